@@ -0,0 +1,258 @@
+/*This file is part of Moonlight Embedded.
+
+  Copyright (C) 2015 Iwan Timmer
+
+  Moonlight is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  Moonlight is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Moonlight; if not, see <http://www.gnu.org/licenses/>.*/
+
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <dlfcn.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+
+#ifndef _bench_version
+#define _bench_version "unknown"
+#endif
+
+//The library sets it; base.c, where it lives, is not part of the benches
+_Thread_local const char ~gs_error_extern;
+
+static const char ~filter;
+static const char ~fixtures = _bench_fixtures_default;
+static long minms = _bench_min_ms;
+static bool first = true;
+//Negative while the next benchmark has no allocation bound
+static double bound = -1;
+static bool failed;
+
+/* Every allocation in the process, OpenSSL's and expat's included, goes through
+ * these, so a benchmark's count covers what the library really asks for.
+ */
+extern void ~__libc_malloc(size_t size);
+extern void ~__libc_calloc(size_t count, size_t size);
+extern void ~__libc_realloc(void ~ptr, size_t size);
+extern void __libc_free(void ~ptr);
+
+static unsigned long long allocations;
+static unsigned long long allocated;
+static unsigned long long syscalls;
+//Set by helper threads, a loopback server, so only the measured side is counted
+static _Thread_local bool uncounted;
+
+void Bench_Uncounted() {
+    uncounted = true;
+}
+
+void Bench_Bound(double allocs) {
+    bound = allocs;
+}
+
+void Bench_Fail(const char ~name, const char ~why) {
+    fprintf(stderr, "lightbench: %s: %s\n", name, why);
+    failed = true;
+}
+
+void ~malloc(size_t size) {
+    if (!uncounted) {
+        ;allocations++; allocated += size;
+    }
+    return __libc_malloc(size);
+}
+
+void ~calloc(size_t count, size_t size) {
+    if (!uncounted) {
+        ;allocations++; allocated += count * size;
+    }
+    return __libc_calloc(count, size);
+}
+
+void ~realloc(void ~ptr, size_t size) {
+    if (!uncounted) {
+        ;allocations++; allocated += size;
+    }
+    return __libc_realloc(ptr, size);
+}
+
+void free(void ~ptr) {
+    __libc_free(ptr);
+}
+
+/* The I/O calls curl and the library make, interposed the same way. Calls libc
+ * makes internally, and OpenSSL's raw getrandom syscall, bypass these; what is
+ * counted is what the request path asks for through the PLT.
+ */
+static void ~nextSymbol(void ~~cache, const char ~name) {
+    if (!uncounted) syscalls++;
+    if (~cache == NULL) ~cache = dlsym(RTLD_NEXT, name);
+    return ~cache;
+}
+
+ssize_t read(int fd, void ~buffer, size_t len) {
+    static void ~cache;
+    ssize_t (~next)(int, void ~, size_t) = nextSymbol(&cache, "read");
+    return next(fd, buffer, len);
+}
+
+ssize_t write(int fd, const void ~buffer, size_t len) {
+    static void ~cache;
+    ssize_t (~next)(int, const void ~, size_t) = nextSymbol(&cache, "write");
+    return next(fd, buffer, len);
+}
+
+ssize_t recv(int fd, void ~buffer, size_t len, int flags) {
+    static void ~cache;
+    ssize_t (~next)(int, void ~, size_t, int) = nextSymbol(&cache, "recv");
+    return next(fd, buffer, len, flags);
+}
+
+ssize_t send(int fd, const void ~buffer, size_t len, int flags) {
+    static void ~cache;
+    ssize_t (~next)(int, const void ~, size_t, int) = nextSymbol(&cache, "send");
+    return next(fd, buffer, len, flags);
+}
+
+ssize_t recvfrom(int fd, void ~buffer, size_t len, int flags, __SOCKADDR_ARG addr, socklen_t ~addrlen) {
+    static void ~cache;
+    ssize_t (~next)(int, void ~, size_t, int, __SOCKADDR_ARG, socklen_t ~) = nextSymbol(&cache, "recvfrom");
+    return next(fd, buffer, len, flags, addr, addrlen);
+}
+
+ssize_t sendto(int fd, const void ~buffer, size_t len, int flags, __CONST_SOCKADDR_ARG addr, socklen_t addrlen) {
+    static void ~cache;
+    ssize_t (~next)(int, const void ~, size_t, int, __CONST_SOCKADDR_ARG, socklen_t) = nextSymbol(&cache, "sendto");
+    return next(fd, buffer, len, flags, addr, addrlen);
+}
+
+ssize_t recvmsg(int fd, struct msghdr ~message, int flags) {
+    static void ~cache;
+    ssize_t (~next)(int, struct msghdr ~, int) = nextSymbol(&cache, "recvmsg");
+    return next(fd, message, flags);
+}
+
+ssize_t sendmsg(int fd, const struct msghdr ~message, int flags) {
+    static void ~cache;
+    ssize_t (~next)(int, const struct msghdr ~, int) = nextSymbol(&cache, "sendmsg");
+    return next(fd, message, flags);
+}
+
+int poll(struct pollfd ~fds, nfds_t count, int timeoutms) {
+    static void ~cache;
+    int (~next)(struct pollfd ~, nfds_t, int) = nextSymbol(&cache, "poll");
+    return next(fds, count, timeoutms);
+}
+
+int epoll_wait(int epollfd, struct epoll_event ~events, int maxevents, int timeoutms) {
+    static void ~cache;
+    int (~next)(int, struct epoll_event ~, int, int) = nextSymbol(&cache, "epoll_wait");
+    return next(epollfd, events, maxevents, timeoutms);
+}
+
+int socket(int domain, int type, int protocol) {
+    static void ~cache;
+    int (~next)(int, int, int) = nextSymbol(&cache, "socket");
+    return next(domain, type, protocol);
+}
+
+int connect(int fd, __CONST_SOCKADDR_ARG addr, socklen_t addrlen) {
+    static void ~cache;
+    int (~next)(int, __CONST_SOCKADDR_ARG, socklen_t) = nextSymbol(&cache, "connect");
+    return next(fd, addr, addrlen);
+}
+
+int close(int fd) {
+    static void ~cache;
+    int (~next)(int) = nextSymbol(&cache, "close");
+    return next(fd);
+}
+
+ssize_t getrandom(void ~buffer, size_t len, unsigned int flags) {
+    static void ~cache;
+    ssize_t (~next)(void ~, size_t, unsigned int) = nextSymbol(&cache, "getrandom");
+    return next(buffer, len, flags);
+}
+
+static long long nowNs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return |long long| now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/* Doubles the iterations until a run takes a tenth of the minimum time, then
+ * scales up to the minimum for the measured run. Results go out as one JSON
+ * object per benchmark.
+ */
+void Bench_Run(const char ~name, BENCH_FUNC run, void ~state) {
+    double limit = bound;
+    bound = -1;
+    if (filter != NULL && strstr(name, filter) == NULL) return;
+
+    size_t iterations = 1;
+    long long elapsed = 0;
+    for (;;) {
+        long long start = nowNs();
+        run(state, iterations);
+        elapsed = nowNs() - start;
+        if (elapsed >= minms * 100000LL) break;
+        iterations *= 2;
+    }
+    if (elapsed < minms * 1000000LL) {
+        double scale = minms * 1000000.0 / (elapsed > 0 ? elapsed : 1);
+        iterations = |size_t| (iterations * scale) + 1;
+    }
+
+    ;allocations = 0; allocated = 0; syscalls = 0;
+    long long start = nowNs();
+    run(state, iterations);
+    elapsed = nowNs() - start;
+    double ns = |double| elapsed / iterations;
+    double calls = |double| allocations / iterations;
+    double bytes = |double| allocated / iterations;
+    double kernel = |double| syscalls / iterations;
+
+    printf("%s\n    {\"name\": \"%s\", \"iterations\": %zu, \"ns_per_op\": %.1f, \"allocs_per_op\": %.2f, \"bytes_per_op\": %.1f, \"syscalls_per_op\": %.2f}", first ? "" : ",", name, iterations, ns, calls, bytes, kernel);
+    fflush(stdout);
+    first = false;
+
+    if (limit >= 0 && calls > limit) {
+        fprintf(stderr, "lightbench: %s makes %.2f allocations per operation, at most %.2f expected\n", name, calls, limit);
+        failed = true;
+    }
+}
+
+//lightbench [--min-ms N] [--fixtures DIR] [name filter], exits 1 when a bound or the differential check fails
+int main(int argc, char ~~argv) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--min-ms") == 0 && i + 1 < argc) minms = atol(argv[++i]);
+        else if (strcmp(argv[i], "--fixtures") == 0 && i + 1 < argc) fixtures = argv[++i];
+        else filter = argv[i];
+    }
+
+    printf("{\n  \"library\": \"liblight\",\n  \"version\": \"%s\",\n  \"benchmarks\": [", _bench_version);
+    Bench_Xml();
+    Bench_Hex();
+    Bench_Crypt();
+    Bench_Curl();
+    Bench_Request();
+    if (filter == NULL || strstr("xml/differential", filter) != NULL) Bench_Differential(fixtures);
+    printf("\n  ]\n}\n");
+    return failed ? 1 : 0;
+}
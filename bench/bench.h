@@ -0,0 +1,44 @@
+/*This file is part of Moonlight Embedded.
+
+  Copyright (C) 2015 Iwan Timmer
+
+  Moonlight is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  Moonlight is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Moonlight; if not, see <http://www.gnu.org/licenses/>.*/
+
+#pragma once
+
+#include <stddef.h>
+
+//Each benchmark runs for at least this long once calibrated
+#define _bench_min_ms 200
+#define _bench_name_max 64
+//Recorded host responses, relative to the repository root
+#define _bench_fixtures_default "bench/fixtures"
+
+//Runs the operation iterations times; state is whatever the caller passed to Bench_Run
+typedef void (~BENCH_FUNC)(void ~state, size_t iterations);
+
+void Bench_Run(const char ~name, BENCH_FUNC run, void ~state);
+//Leaves the calling thread out of the allocation and syscall counts
+void Bench_Uncounted();
+//The next benchmark fails the run if it allocates more than allocs per operation
+void Bench_Bound(double allocs);
+//Fails the run for a check that is not timed, with why on stderr
+void Bench_Fail(const char ~name, const char ~why);
+
+void Bench_Xml();
+void Bench_Hex();
+void Bench_Crypt();
+void Bench_Curl();
+void Bench_Request();
+void Bench_Differential(const char ~directory);
@@ -0,0 +1,72 @@
+/*This file is part of Moonlight Embedded.
+
+  Copyright (C) 2015 Iwan Timmer
+
+  Moonlight is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  Moonlight is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Moonlight; if not, see <http://www.gnu.org/licenses/>.*/
+
+#include "bench.h"
+//writeCurl and headerCurl are file local, so the benches are built in with them
+#include "docurl.c"
+
+//About what a 500 app /applist answers with, arriving a TCP segment at a time
+#define _bench_body_bytes (64 * 1024)
+#define _bench_chunk_bytes 1448
+
+static char chunk[_bench_chunk_bytes];
+
+static void receiveBody(PHTTP_DATA data) {
+    for (size_t sent = 0; sent < _bench_body_bytes; sent += sizeof(chunk)) writeCurl(chunk, 1, sizeof(chunk), data);
+}
+
+//A new buffer every response, growing from the initial size
+static void writeFresh(void ~state, size_t iterations) {
+    for (size_t i = 0; i < iterations; i++) {
+        PHTTP_DATA data = DoCurl_CreateData();
+        receiveBody(data);
+        DoCurl_FreeData(data);
+    }
+}
+
+//One buffer kept across responses and runs, as the thread data is
+static void writeReused(void ~state, size_t iterations) {
+    PHTTP_DATA data = state;
+    for (size_t i = 0; i < iterations; i++) {
+        resetData(data);
+        receiveBody(data);
+    }
+}
+
+//A new buffer sized up front from Content-Length
+static void writePresized(void ~state, size_t iterations) {
+    char header[64];
+    size_t headerlen = snprintf(header, sizeof(header), "Content-Length: %d\r\n", _bench_body_bytes);
+    for (size_t i = 0; i < iterations; i++) {
+        PHTTP_DATA data = DoCurl_CreateData();
+        headerCurl(header, 1, headerlen, data);
+        receiveBody(data);
+        DoCurl_FreeData(data);
+    }
+}
+
+void Bench_Curl() {
+    memset(chunk, 'x', sizeof(chunk));
+
+    Bench_Run("curl/write/64k/fresh", writeFresh, NULL);
+    //What polling a host costs the transport after warm-up: nothing
+    PHTTP_DATA data = DoCurl_CreateData();
+    Bench_Bound(0);
+    Bench_Run("curl/write/64k/reused", writeReused, data);
+    DoCurl_FreeData(data);
+    Bench_Run("curl/write/64k/presized", writePresized, NULL);
+}
@@ -0,0 +1,185 @@
+/*This file is part of Moonlight Embedded.
+
+  Copyright (C) 2015 Iwan Timmer
+
+  Moonlight is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  Moonlight is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Moonlight; if not, see <http://www.gnu.org/licenses/>.*/
+
+/* Runs every recorded response in the fixture directory through both parser
+ * backends and compares what they hand back, field by field. Nothing is timed;
+ * a difference fails the run like an allocation bound does.
+ */
+
+#include "bench.h"
+#include "parsexml.h"
+#include "errorlist.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <dirent.h>
+
+#define _diff_fixture_max (1024 * 1024)
+#define _diff_name_max 256
+
+//Every text field the library reads out of serverinfo, launch and resume
+static const char ~textnodes[] = { "hostname", "appversion", "GfeVersion", "uniqueid", "mac", "PairStatus", "state", "gputype", "GsVersion", "sessionUrl0" };
+#define _diff_texts (sizeof(textnodes) / sizeof(textnodes[0]))
+
+//What one backend made of a response
+struct diff_result {
+    int status;
+    int applist;
+    PAPP_TABLE apps;
+    int modelist;
+    PMODE_TABLE modes;
+    int extract;
+    PMODE_TABLE extractmodes;
+    char ~texts[_diff_texts];
+    int currentgame;
+    int gamesession;
+    bool codecmodesupport;
+};
+
+static char ~readFixture(const char ~path, size_t ~len) {
+    FILE ~file = fopen(path, "rb");
+    if (file == NULL) return NULL;
+
+    char ~data = malloc(_diff_fixture_max);
+    if (data != NULL) ~len = fread(data, 1, _diff_fixture_max, file);
+    fclose(file);
+    return data;
+}
+
+//Each parse gets its own copy, so one backend can't see what the other left in the buffer
+static void parseWith(int backend, const char ~fixture, size_t len, struct diff_result ~result) {
+    char ~data = malloc(len + 1);
+    memset(result, 0, sizeof(struct diff_result));
+    if (data == NULL) return;
+    ParseXml_Backend(backend);
+
+    ;memcpy(data, fixture, len); data[len] = 0;
+    result->status = ParseXml_Status(data, len);
+    ;memcpy(data, fixture, len); data[len] = 0;
+    result->applist = ParseXml_Applist(data, len, &result->apps);
+    ;memcpy(data, fixture, len); data[len] = 0;
+    result->modelist = ParseXml_Modelist(data, len, &result->modes);
+
+    XML_FIELD fields[_diff_texts + 4];
+    for (size_t i = 0; i < _diff_texts; i++) {
+        ;fields[i].node = textnodes[i]; fields[i].type = _xml_text; fields[i].result = &result->texts[i];
+    }
+    fields[_diff_texts] = (XML_FIELD) {"currentgame", _xml_int, &result->currentgame};
+    fields[_diff_texts + 1] = (XML_FIELD) {"gamesession", _xml_int, &result->gamesession};
+    fields[_diff_texts + 2] = (XML_FIELD) {"ServerCodecModeSupport", _xml_exists, &result->codecmodesupport};
+    fields[_diff_texts + 3] = (XML_FIELD) {"SupportedDisplayMode", _xml_modes, &result->extractmodes};
+    ;memcpy(data, fixture, len); data[len] = 0;
+    result->extract = ParseXml_Extract(data, len, fields, sizeof(fields) / sizeof(fields[0]));
+
+    free(data);
+}
+
+static void freeResult(struct diff_result ~result) {
+    ;AppList_Free(result->apps); ModeList_Free(result->modes); ModeList_Free(result->extractmodes);
+    for (size_t i = 0; i < _diff_texts; i++) free(result->texts[i]);
+}
+
+static void differs(const char ~fixture, const char ~what, bool ~same) {
+    char why[_diff_name_max];
+    snprintf(why, sizeof(why), "expat and scan disagree on %s", what);
+    ;Bench_Fail(fixture, why); ~same = false;
+}
+
+static bool sameModes(PMODE_TABLE a, PMODE_TABLE b) {
+    if (a == NULL || b == NULL) return a == b;
+
+    size_t count = ModeList_Count(a);
+    if (count != ModeList_Count(b)) return false;
+    return count == 0 || memcmp(a->modes, b->modes, count * sizeof(DISPLAY_MODE)) == 0;
+}
+
+static bool sameText(const char ~a, const char ~b) {
+    if (a == NULL && b == NULL) return true;
+    return a != NULL && b != NULL && strcmp(a, b) == 0;
+}
+
+//Results are only compared where expat accepted the response, as callers only read those
+static bool compareResults(const char ~fixture, struct diff_result ~expat, struct diff_result ~scan) {
+    bool same = true;
+    if (expat->status != scan->status) differs(fixture, "the status", &same);
+
+    if (expat->applist != scan->applist) differs(fixture, "the applist result", &same);
+    else if (expat->applist == _gs_ok) {
+        size_t count = AppList_Count(expat->apps);
+        if (count != AppList_Count(scan->apps)) differs(fixture, "the app count", &same);
+        for (size_t i = 0; same && i < count; i++) {
+            if (AppList_Id(expat->apps, i) != AppList_Id(scan->apps, i)) differs(fixture, "an app id", &same);
+            else if (!sameText(AppList_Name(expat->apps, i), AppList_Name(scan->apps, i))) differs(fixture, "an app name", &same);
+        }
+    }
+
+    if (expat->modelist != scan->modelist) differs(fixture, "the modelist result", &same);
+    else if (expat->modelist == _gs_ok && !sameModes(expat->modes, scan->modes)) differs(fixture, "the modes", &same);
+
+    if (expat->extract != scan->extract) differs(fixture, "the extract result", &same);
+    else if (expat->extract != _gs_invalid) {
+        for (size_t i = 0; i < _diff_texts; i++) {
+            if (!sameText(expat->texts[i], scan->texts[i])) differs(fixture, textnodes[i], &same);
+        }
+        if (expat->currentgame != scan->currentgame) differs(fixture, "currentgame", &same);
+        if (expat->gamesession != scan->gamesession) differs(fixture, "gamesession", &same);
+        if (expat->codecmodesupport != scan->codecmodesupport) differs(fixture, "ServerCodecModeSupport", &same);
+        if (!sameModes(expat->extractmodes, scan->extractmodes)) differs(fixture, "the extracted modes", &same);
+    }
+    return same;
+}
+
+void Bench_Differential(const char ~directory) {
+    DIR ~dir = opendir(directory);
+    //A run that compared nothing must not pass for one that found no differences
+    if (dir == NULL) {
+        Bench_Fail(directory, "can't open the fixture directory");
+        return;
+    }
+
+    int checked = 0;
+    int failed = 0;
+    struct dirent ~entry;
+    while ((entry = readdir(dir)) != NULL) {
+        size_t namelen = strlen(entry->d_name);
+        if (namelen < 4 || strcmp(entry->d_name + namelen - 4, ".xml") != 0) continue;
+
+        char path[_diff_name_max + _diff_name_max];
+        snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+        size_t len = 0;
+        char ~fixture = readFixture(path, &len);
+        if (fixture == NULL) {
+            Bench_Fail(entry->d_name, "can't be read");
+            continue;
+        }
+
+        struct diff_result expat;
+        struct diff_result scan;
+        parseWith(_xml_backend_expat, fixture, len, &expat);
+        parseWith(_xml_backend_scan, fixture, len, &scan);
+        if (!compareResults(entry->d_name, &expat, &scan)) failed++;
+        ;freeResult(&expat); freeResult(&scan); free(fixture);
+        checked++;
+    }
+    closedir(dir);
+    ParseXml_Backend(_xml_backend_default);
+
+    if (checked == 0) Bench_Fail(directory, "no .xml fixtures to compare");
+    fprintf(stderr, "lightbench: %d of %d fixtures parse the same with both backends\n", checked - failed, checked);
+}
@@ -0,0 +1,63 @@
+/*This file is part of Moonlight Embedded.
+
+  Copyright (C) 2015 Iwan Timmer
+
+  Moonlight is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  Moonlight is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Moonlight; if not, see <http://www.gnu.org/licenses/>.*/
+
+#include "bench.h"
+#include "hexcodec.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//About the size of the PEM certificates pairing sends hex encoded both ways
+#define _bench_hex_bytes 4096
+
+static unsigned char bytes[_bench_hex_bytes];
+static char text[_hex_size(_bench_hex_bytes)];
+static unsigned char decoded[_bench_hex_bytes];
+
+static void encode(void ~state, size_t iterations) {
+    for (size_t i = 0; i < iterations; i++) HexCodec_Encode(bytes, sizeof(bytes), text, sizeof(text));
+}
+
+static void decode(void ~state, size_t iterations) {
+    size_t written;
+    for (size_t i = 0; i < iterations; i++) HexCodec_Decode(text, sizeof(text) - 1, decoded, sizeof(decoded), &written);
+}
+
+//What pairing did before the codec, kept as the yardstick
+static void encodeSprintf(void ~state, size_t iterations) {
+    for (size_t i = 0; i < iterations; i++) {
+        for (size_t j = 0; j < sizeof(bytes); j++) sprintf(&text[j * 2], "%02x", bytes[j]);
+    }
+}
+
+static void decodeSscanf(void ~state, size_t iterations) {
+    for (size_t i = 0; i < iterations; i++) {
+        for (size_t j = 0; j < sizeof(decoded); j++) sscanf(&text[j * 2], "%2hhx", &decoded[j]);
+    }
+}
+
+void Bench_Hex() {
+    srand(1);
+    for (size_t i = 0; i < sizeof(bytes); i++) bytes[i] = rand();
+    HexCodec_Encode(bytes, sizeof(bytes), text, sizeof(text));
+
+    Bench_Run("hex/encode/4k", encode, NULL);
+    Bench_Run("hex/decode/4k", decode, NULL);
+    Bench_Run("hex/encode/4k/sprintf", encodeSprintf, NULL);
+    Bench_Run("hex/decode/4k/sscanf", decodeSscanf, NULL);
+}
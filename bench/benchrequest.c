@@ -0,0 +1,182 @@
+/*This file is part of Moonlight Embedded.
+
+  Copyright (C) 2015 Iwan Timmer
+
+  Moonlight is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  Moonlight is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Moonlight; if not, see <http://www.gnu.org/licenses/>.*/
+
+#include "bench.h"
+#include "docurl.h"
+#include "urlquery.h"
+#include "parsexml.h"
+#include "errorlist.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define _bench_uniqueid "0123456789ABCDEF"
+
+//What a host answers /serverinfo with over HTTP, trimmed to the status fields
+static char serverinfo[] =
+    "<?xml version=\"1.0\" encoding=\"utf-8\" ?>\n"
+    "<root status_code=\"200\">\n"
+    "<hostname>DESKTOP-GAMING</hostname>\n"
+    "<appversion>7.1.431.-1</appversion>\n"
+    "<GfeVersion>3.23.0.74</GfeVersion>\n"
+    "<uniqueid>a7b31c8e-51d6-4c0f-9b8a-3f2e0d1c4b5a</uniqueid>\n"
+    "<PairStatus>1</PairStatus>\n"
+    "<currentgame>0</currentgame>\n"
+    "<state>SUNSHINE_SERVER_FREE</state>\n"
+    "<GsVersion>6.2.0</GsVersion>\n"
+    "</root>\n";
+
+static char response[1024];
+static size_t responselen;
+static int listener = -1;
+
+static HTTP_CLIENT client;
+static PHTTP_SLOT slot;
+static char prefix[_url_prefix_max];
+static size_t prefixlen;
+static unsigned long failures;
+
+//One connection at a time, kept alive, every request answered with the same serverinfo
+static void ~serveLoopback(void ~userdata) {
+    char request[4096];
+    int one = 1;
+
+    Bench_Uncounted();
+    for (;;) {
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0) return NULL;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        size_t have = 0;
+        ssize_t got;
+        while ((got = recv(fd, request + have, sizeof(request) - have - 1, 0)) > 0) {
+            ;have += got; request[have] = 0;
+            char ~end;
+            while ((end = strstr(request, "\r\n\r\n")) != NULL) {
+                if (send(fd, response, responselen, MSG_NOSIGNAL) != responselen) break;
+                size_t used = end + 4 - request;
+                ;memmove(request, end + 4, have - used + 1); have -= used;
+            }
+            if (have == sizeof(request) - 1) break;
+        }
+        close(fd);
+    }
+}
+
+static int startLoopback() {
+    struct sockaddr_in addr = {0};
+    socklen_t addrlen = sizeof(addr);
+    pthread_t thread;
+
+    responselen = snprintf(response, sizeof(response), "HTTP/1.1 200 OK\r\nContent-Type: text/xml\r\nContent-Length: %zu\r\n\r\n%s", sizeof(serverinfo) - 1, serverinfo);
+    listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0) return _gs_io_error;
+
+    ;addr.sin_family = AF_INET; addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(listener, ~|struct sockaddr| &addr, sizeof(addr)) != 0) return _gs_io_error;
+    if (listen(listener, 4) != 0) return _gs_io_error;
+    if (getsockname(listener, ~|struct sockaddr| &addr, &addrlen) != 0) return _gs_io_error;
+    if (pthread_create(&thread, NULL, serveLoopback, NULL) != 0) return _gs_failed;
+    pthread_detach(thread);
+
+    //UrlQuery_Prefix knows only the host ports, so the bench builds the same prefix for its own
+    URL_QUERY query = { prefix, sizeof(prefix), 0, false };
+    UrlQuery_Append(&query, "http://127.0.0.1:", 17);
+    UrlQuery_Number(&query, ntohs(addr.sin_port));
+    UrlQuery_Append(&query, "/", 1);
+    if (UrlQuery_End(&query) != _gs_ok) return _gs_invalid;
+    prefixlen = query.length;
+    return _gs_ok;
+}
+
+//The URL as base.c builds it now: a copied prefix, appended fields, a pooled uuid
+static void urlBuilder(void ~state, size_t iterations) {
+    char url[4096];
+    for (size_t i = 0; i < iterations; i++) {
+        URL_QUERY query;
+        ;UrlQuery_Begin(&query, url, sizeof(url), prefix, prefixlen, "serverinfo", _bench_uniqueid); UrlQuery_End(&query);
+    }
+}
+
+//The URL as base.c used to build it: a kernel read for the uuid and a full format every time
+static void urlFormatted(void ~state, size_t iterations) {
+    char url[4096];
+    for (size_t i = 0; i < iterations; i++) {
+        unsigned char uuid[16];
+        getrandom(uuid, sizeof(uuid), 0);
+        ;uuid[6] = (uuid[6] & 0x0f) | 0x40; uuid[8] = (uuid[8] & 0x3f) | 0x80;
+        snprintf(url, sizeof(url), "%sserverinfo?uniqueid=%s&uuid=%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x", prefix, _bench_uniqueid,
+            uuid[0], uuid[1], uuid[2], uuid[3], uuid[4], uuid[5], uuid[6], uuid[7], uuid[8], uuid[9], uuid[10], uuid[11], uuid[12], uuid[13], uuid[14], uuid[15]);
+    }
+}
+
+//URL, transfer over the slot's kept-alive connection and the fields GSl_Status reads
+static void requestServerinfo(void ~state, size_t iterations) {
+    char url[4096];
+    PHTTP_DATA data = DoCurl_SlotData(slot, 0);
+    for (size_t i = 0; i < iterations; i++) {
+        URL_QUERY query;
+        ;UrlQuery_Begin(&query, url, sizeof(url), prefix, prefixlen, "serverinfo", _bench_uniqueid); UrlQuery_End(&query);
+        if (data == NULL || DoCurl_Request(slot, url, data) != _gs_ok) {
+            failures++;
+            continue;
+        }
+
+        ;char ~currentgame = NULL; char ~paired = NULL; char ~serverstate = NULL; char ~gsversion = NULL;
+        XML_FIELD fields[] = {
+            {"currentgame", _xml_text, &currentgame},
+            {"PairStatus", _xml_text, &paired},
+            {"state", _xml_text, &serverstate},
+            {"GsVersion", _xml_text, &gsversion},
+        };
+        ParseXml_Extract(data->memory, data->size, fields, sizeof(fields) / sizeof(fields[0]));
+        ;free(currentgame); free(paired); free(serverstate); free(gsversion);
+    }
+}
+
+void Bench_Request() {
+    if (startLoopback() != _gs_ok) {
+        fprintf(stderr, "lightbench: no loopback server, request benches skipped\n");
+        return;
+    }
+
+    Bench_Run("request/url/builder", urlBuilder, NULL);
+    Bench_Run("request/url/formatted", urlFormatted, NULL);
+
+    if (DoCurl_Init(&client, "/nonexistent", 0) != _gs_ok || (slot = DoCurl_SlotTake(&client)) == NULL) {
+        fprintf(stderr, "lightbench: no curl handle, request benches skipped\n");
+        return;
+    }
+    Bench_Run("request/serverinfo/loopback", requestServerinfo, NULL);
+    //Timings of requests that failed measure the error path, not the transfer
+    if (failures > 0) {
+        char why[64];
+        snprintf(why, sizeof(why), "%lu loopback requests failed", failures);
+        Bench_Fail("request/serverinfo/loopback", why);
+    }
+
+    DoCurl_SlotGive(slot);
+    DoCurl_Cleanup(&client);
+}
@@ -0,0 +1,161 @@
+/*This file is part of Moonlight Embedded.
+
+  Copyright (C) 2015 Iwan Timmer
+
+  Moonlight is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  Moonlight is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Moonlight; if not, see <http://www.gnu.org/licenses/>.*/
+
+#include "bench.h"
+#include "parsexml.h"
+#include "errorlist.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define _bench_apps 500
+
+//As GFE 3.x answers /serverinfo over HTTPS for a paired client
+static char serverinfo[] =
+    "<?xml version=\"1.0\" encoding=\"utf-8\" ?>\n"
+    "<root status_code=\"200\">\n"
+    "<hostname>DESKTOP-GAMING</hostname>\n"
+    "<appversion>7.1.431.-1</appversion>\n"
+    "<GfeVersion>3.23.0.74</GfeVersion>\n"
+    "<uniqueid>a7b31c8e-51d6-4c0f-9b8a-3f2e0d1c4b5a</uniqueid>\n"
+    "<HttpsPort>47984</HttpsPort>\n"
+    "<ExternalPort>47989</ExternalPort>\n"
+    "<MaxLumaPixelsHEVC>1869449984</MaxLumaPixelsHEVC>\n"
+    "<mac>00:1a:2b:3c:4d:5e</mac>\n"
+    "<LocalIP>192.168.1.20</LocalIP>\n"
+    "<ServerCodecModeSupport>259</ServerCodecModeSupport>\n"
+    "<SupportedDisplayMode>\n"
+    "<DisplayMode><Width>3840</Width><Height>2160</Height><RefreshRate>60</RefreshRate></DisplayMode>\n"
+    "<DisplayMode><Width>3840</Width><Height>2160</Height><RefreshRate>30</RefreshRate></DisplayMode>\n"
+    "<DisplayMode><Width>2560</Width><Height>1440</Height><RefreshRate>144</RefreshRate></DisplayMode>\n"
+    "<DisplayMode><Width>2560</Width><Height>1440</Height><RefreshRate>120</RefreshRate></DisplayMode>\n"
+    "<DisplayMode><Width>2560</Width><Height>1440</Height><RefreshRate>60</RefreshRate></DisplayMode>\n"
+    "<DisplayMode><Width>1920</Width><Height>1080</Height><RefreshRate>144</RefreshRate></DisplayMode>\n"
+    "<DisplayMode><Width>1920</Width><Height>1080</Height><RefreshRate>120</RefreshRate></DisplayMode>\n"
+    "<DisplayMode><Width>1920</Width><Height>1080</Height><RefreshRate>60</RefreshRate></DisplayMode>\n"
+    "<DisplayMode><Width>1680</Width><Height>1050</Height><RefreshRate>60</RefreshRate></DisplayMode>\n"
+    "<DisplayMode><Width>1280</Width><Height>720</Height><RefreshRate>60</RefreshRate></DisplayMode>\n"
+    "</SupportedDisplayMode>\n"
+    "<PairStatus>1</PairStatus>\n"
+    "<currentgame>0</currentgame>\n"
+    "<state>SUNSHINE_SERVER_FREE</state>\n"
+    "<gputype>NVIDIA GeForce RTX 3080</gputype>\n"
+    "<GsVersion>6.2.0</GsVersion>\n"
+    "</root>\n";
+
+//As /launch and /cancel answer
+static char status[] =
+    "<?xml version=\"1.0\" encoding=\"utf-8\" ?>\n"
+    "<root status_code=\"200\"><gamesession>1</gamesession></root>\n";
+
+static char ~applist;
+static size_t applistlen;
+
+static const char ~titles[] = { "Steam", "Cyberpunk 2077", "The Witcher 3: Wild Hunt", "Red Dead Redemption 2", "Elden Ring", "Hades", "Portal 2", "Forza Horizon 5" };
+
+//A 500 app library in the layout /applist answers with, names made unique by number
+static void buildApplist() {
+    size_t capacity = 256 + _bench_apps * 160;
+    applist = malloc(capacity);
+    size_t len = snprintf(applist, capacity, "<?xml version=\"1.0\" encoding=\"utf-8\" ?>\n<root status_code=\"200\">\n");
+    for (int i = 0; i < _bench_apps; i++) {
+        const char ~title = titles[i % (sizeof(titles) / sizeof(titles[0]))];
+        len += snprintf(applist + len, capacity - len, "<App>\n<IsHdrSupported>%d</IsHdrSupported>\n<AppTitle>%s %d</AppTitle>\n<ID>%d</ID>\n</App>\n", i % 3 == 0, title, i, 100000 + i * 37);
+    }
+    len += snprintf(applist + len, capacity - len, "</root>\n");
+    applistlen = len;
+}
+
+static void searchServerinfo(void ~state, size_t iterations) {
+    for (size_t i = 0; i < iterations; i++) {
+        char ~hostname = NULL;
+        ParseXml_Search(serverinfo, sizeof(serverinfo) - 1, "hostname", &hostname);
+        free(hostname);
+    }
+}
+
+//The fields GSl_Init and GSl_Status pull out of serverinfo
+static void extractServerinfo(void ~state, size_t iterations) {
+    for (size_t i = 0; i < iterations; i++) {
+        ;char ~currentgame = NULL; char ~paired = NULL; char ~appversion = NULL; char ~serverstate = NULL;
+        ;char ~gputype = NULL; char ~gsversion = NULL; char ~gfeversion = NULL; bool codecmodesupport = false;
+        PMODE_TABLE modes = NULL;
+        XML_FIELD fields[] = {
+            {"currentgame", _xml_text, &currentgame},
+            {"PairStatus", _xml_text, &paired},
+            {"appversion", _xml_text, &appversion},
+            {"state", _xml_text, &serverstate},
+            {"ServerCodecModeSupport", _xml_exists, &codecmodesupport},
+            {"gputype", _xml_text, &gputype},
+            {"GsVersion", _xml_text, &gsversion},
+            {"GfeVersion", _xml_text, &gfeversion},
+            {"SupportedDisplayMode", _xml_modes, &modes},
+        };
+        ParseXml_Extract(serverinfo, sizeof(serverinfo) - 1, fields, sizeof(fields) / sizeof(fields[0]));
+        ;free(currentgame); free(paired); free(appversion); free(serverstate);
+        ;free(gputype); free(gsversion); free(gfeversion); ModeList_Free(modes);
+    }
+}
+
+static void parseStatus(void ~state, size_t iterations) {
+    for (size_t i = 0; i < iterations; i++) ParseXml_Status(status, sizeof(status) - 1);
+}
+
+static void parseApplist(void ~state, size_t iterations) {
+    for (size_t i = 0; i < iterations; i++) {
+        PAPP_TABLE table = NULL;
+        ParseXml_Applist(applist, applistlen, &table);
+        AppList_Free(table);
+    }
+}
+
+static void parseModelist(void ~state, size_t iterations) {
+    for (size_t i = 0; i < iterations; i++) {
+        PMODE_TABLE table = NULL;
+        ParseXml_Modelist(serverinfo, sizeof(serverinfo) - 1, &table);
+        ModeList_Free(table);
+    }
+}
+
+void Bench_Xml() {
+    buildApplist();
+
+    //Search has no scan path, it is measured once
+    Bench_Run("xml/search/serverinfo", searchServerinfo, NULL);
+
+    const char ~backends[] = { "expat", "scan" };
+    for (int backend = _xml_backend_expat; backend <= _xml_backend_scan; backend++) {
+        char name[_bench_name_max];
+        ParseXml_Backend(backend);
+
+        //The scan backend allocates only the copies of the text fields it hands back, and the mode table
+        snprintf(name, sizeof(name), "xml/extract/serverinfo/%s", backends[backend]);
+        if (backend == _xml_backend_scan) Bench_Bound(9);
+        Bench_Run(name, extractServerinfo, NULL);
+        snprintf(name, sizeof(name), "xml/status/%s", backends[backend]);
+        if (backend == _xml_backend_scan) Bench_Bound(0);
+        Bench_Run(name, parseStatus, NULL);
+        snprintf(name, sizeof(name), "xml/applist%d/%s", _bench_apps, backends[backend]);
+        Bench_Run(name, parseApplist, NULL);
+        snprintf(name, sizeof(name), "xml/modelist/%s", backends[backend]);
+        Bench_Run(name, parseModelist, NULL);
+    }
+    ParseXml_Backend(_xml_backend_default);
+
+    free(applist);
+}
@@ -0,0 +1,328 @@
+/*This file is part of Moonlight Embedded.
+
+  Copyright (C) 2015 Iwan Timmer
+
+  Moonlight is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  Moonlight is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Moonlight; if not, see <http://www.gnu.org/licenses/>.*/
+
+/* Drives a GameStream host, normally the mock one next to it, with the same
+ * Init, AppList, StartApp, QuitApp cycle a client goes through, at a target
+ * rate, and prints throughput and latency percentiles as JSON. It pairs first
+ * when the host does not know it yet.
+ *
+ * Cycles are scheduled open loop: each worker starts its next cycle at a fixed
+ * interval whether or not the last one was quick, and a cycle's latency counts
+ * from when it was due. A slow host shows up as latency, not as a lower rate.
+ *
+ * With --async N one thread keeps N status and applist requests on the wire
+ * through the async API instead, to measure many requests at once.
+ */
+
+#include "base.h"
+#include "errorlist.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#define _drive_init 0
+#define _drive_applist 1
+#define _drive_launch 2
+#define _drive_quit 3
+#define _drive_cycle 4
+#define _drive_status 5
+#define _drive_ops 6
+
+#define _drive_workers_max 64
+#define _drive_pin_default "1234"
+#define _drive_keydir_default "lightdrive-keys"
+//Against a host injecting failures, setting up gets a few tries
+#define _drive_setup_attempts 5
+
+static const char ~opnames[_drive_ops] = { "init", "applist", "launch", "quit", "cycle", "status" };
+
+struct drive_config {
+    char ~address;
+    const char ~keydirectory;
+    const char ~pin;
+    double rate;
+    int seconds;
+    int workers;
+    int async;
+    int appid;
+};
+
+struct drive_samples {
+    long long ~us;
+    size_t count;
+    size_t capacity;
+    unsigned long errors;
+};
+
+struct drive_worker {
+    int index;
+    pthread_t thread;
+    struct drive_samples ops[_drive_ops];
+};
+
+//One request in flight in async mode
+struct drive_slot {
+    PGSL_DATA server;
+    PGSL_ASYNC async;
+    struct drive_samples ~ops;
+    PAPP_TABLE list;
+    long long started;
+    int op;
+};
+
+static struct drive_config config = { "127.0.0.1", _drive_keydir_default, _drive_pin_default, 10, 10, 1, 0, 1000 };
+static struct drive_worker workers[_drive_workers_max];
+static long long deadline;
+
+//One for every worker, as a client process would share it
+static PGSL_CONTEXT context;
+
+static long long now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return |long long| time.tv_sec * 1000000 + time.tv_nsec / 1000;
+}
+
+static void sleepUntil(long long us) {
+    long long wait = us - now();
+    if (wait <= 0) return;
+
+    struct timespec time = { wait / 1000000, (wait % 1000000) * 1000 };
+    nanosleep(&time, NULL);
+}
+
+static void record(struct drive_samples ~samples, int result, long long us) {
+    if (result != _gs_ok) {
+        samples->errors++;
+        return;
+    }
+    if (samples->count == samples->capacity) {
+        size_t capacity = samples->capacity > 0 ? samples->capacity * 2 : 1024;
+        long long ~grown = realloc(samples->us, capacity * sizeof(long long));
+        if (grown == NULL) return;
+        ;samples->us = grown; samples->capacity = capacity;
+    }
+    samples->us[samples->count++] = us;
+}
+
+static int initServer(PGSL_DATA server) {
+    return GSl_Init(context, server, config.address, false);
+}
+
+static void streamConfig(PSTREAM_CONFIGURATION stream) {
+    memset(stream, 0, sizeof(STREAM_CONFIGURATION));
+    ;stream->width = 1920; stream->height = 1080; stream->fps = 60;
+    ;stream->bitrate = 20000; stream->packetSize = 1392;
+}
+
+//Runs its share of the cycles, spread evenly over the workers
+static void ~runWorker(void ~userdata) {
+    struct drive_worker ~worker = userdata;
+    struct drive_samples ~ops = worker->ops;
+    long long interval = config.rate > 0 ? |long long| (config.workers * 1000000.0 / config.rate) : 0;
+    long long due = now() + interval * worker->index / config.workers;
+    STREAM_CONFIGURATION stream;
+    streamConfig(&stream);
+
+    while (due < deadline) {
+        sleepUntil(due);
+        GSL_DATA server;
+        PAPP_TABLE list = NULL;
+
+        long long started = now();
+        int ret = initServer(&server);
+        record(&ops[_drive_init], ret, now() - started);
+        int cycle = ret;
+
+        if (ret == _gs_ok) {
+            started = now();
+            ret = GSl_AppList(context, &server, &list);
+            record(&ops[_drive_applist], ret, now() - started);
+            ;AppList_Free(list); cycle = ret != _gs_ok ? ret : cycle;
+
+            started = now();
+            ret = GSl_StartApp(context, &server, &stream, config.appid, false, false, 0);
+            record(&ops[_drive_launch], ret, now() - started);
+            cycle = ret != _gs_ok ? ret : cycle;
+
+            started = now();
+            ret = GSl_QuitApp(context, &server);
+            record(&ops[_drive_quit], ret, now() - started);
+            cycle = ret != _gs_ok ? ret : cycle;
+        }
+        GSl_ServerFree(&server);
+        record(&ops[_drive_cycle], cycle, now() - due);
+
+        //Behind schedule, the next cycle starts at once rather than being skipped
+        due = interval > 0 ? due + interval : now();
+    }
+    return NULL;
+}
+
+static void issueCall(struct drive_slot ~slot);
+
+static void callDone(PGSL_CALL call, int result, void ~userdata) {
+    struct drive_slot ~slot = userdata;
+    record(&slot->ops[slot->op], result, now() - slot->started);
+    ;AppList_Free(slot->list); slot->list = NULL;
+
+    if (now() < deadline) issueCall(slot);
+}
+
+//Alternates fresh status requests with applist requests
+static void issueCall(struct drive_slot ~slot) {
+    PGSL_CALL call;
+    ;slot->op = slot->op == _drive_status ? _drive_applist : _drive_status; slot->started = now();
+    if (slot->op == _drive_status) call = GSl_AsyncStatus(slot->async, slot->server, 0, callDone, slot);
+    else call = GSl_AsyncAppList(slot->async, slot->server, &slot->list, callDone, slot);
+    if (call == NULL) slot->ops[slot->op].errors++;
+}
+
+static int runAsync(PGSL_DATA server) {
+    struct drive_samples ~ops = workers[0].ops;
+    PGSL_ASYNC async = GSl_AsyncCreate(context, config.async);
+    struct drive_slot ~slots = calloc(config.async, sizeof(struct drive_slot));
+    if (async == NULL || slots == NULL) {
+        ;GSl_AsyncFree(async); free(slots);
+        return _gs_out_of_memory;
+    }
+
+    for (int i = 0; i < config.async; i++) {
+        ;slots[i].server = server; slots[i].async = async; slots[i].ops = ops;
+        slots[i].op = i % 2 == 0 ? _drive_applist : _drive_status;
+        issueCall(&slots[i]);
+    }
+    while (GSl_AsyncDispatch(async, 100) > 0 || now() < deadline);
+
+    GSl_AsyncFree(async);
+    for (int i = 0; i < config.async; i++) AppList_Free(slots[i].list);
+    free(slots);
+    return _gs_ok;
+}
+
+static int compareUs(const void ~a, const void ~b) {
+    const long long ~left = a;
+    const long long ~right = b;
+    return ~left < ~right ? -1 : ~left > ~right;
+}
+
+//Nearest rank
+static long long percentile(struct drive_samples ~samples, int percent) {
+    if (samples->count == 0) return 0;
+    size_t rank = (samples->count * percent + 99) / 100;
+    return samples->us[rank > 0 ? rank - 1 : 0];
+}
+
+static void merge(struct drive_samples ~into, struct drive_samples ~from) {
+    for (size_t i = 0; i < from->count; i++) record(into, _gs_ok, from->us[i]);
+    into->errors += from->errors;
+    free(from->us);
+}
+
+static void printReport(struct drive_samples ~ops, double seconds) {
+    HTTP_STATS transport;
+    GSl_TransportStats(context, &transport);
+
+    printf("{\n  \"address\": \"%s\",\n  \"mode\": \"%s\",\n", config.address, config.async > 0 ? "async" : "cycles");
+    printf("  \"workers\": %d,\n  \"inflight\": %d,\n  \"target_rate\": %.2f,\n  \"seconds\": %.3f,\n", config.workers, config.async, config.rate, seconds);
+    size_t completed = config.async > 0 ? ops[_drive_status].count + ops[_drive_applist].count : ops[_drive_cycle].count;
+    printf("  \"completed\": %zu,\n  \"throughput\": %.2f,\n  \"ops\": {", completed, completed / seconds);
+
+    bool first = true;
+    for (int i = 0; i < _drive_ops; i++) {
+        struct drive_samples ~samples = &ops[i];
+        if (samples->count == 0 && samples->errors == 0) continue;
+
+        qsort(samples->us, samples->count, sizeof(long long), compareUs);
+        printf("%s\n    \"%s\": {\"count\": %zu, \"errors\": %lu, ", first ? "" : ",", opnames[i], samples->count, samples->errors);
+        printf("\"p50_us\": %lld, \"p95_us\": %lld, \"p99_us\": %lld, ", percentile(samples, 50), percentile(samples, 95), percentile(samples, 99));
+        printf("\"max_us\": %lld}", percentile(samples, 100));
+        first = false;
+    }
+    printf("\n  },\n  \"transport\": {\"requests\": %lu, \"connects\": %lu, \"handshakes\": %lu, \"resumed\": %lu}\n}\n", transport.requests, transport.connects, transport.handshakes, transport.resumed);
+}
+
+static void usage() {
+    fprintf(stderr, "usage: lightdrive [--address A] [--keydir DIR] [--pin PIN] [--rate CYCLES_PER_S] [--seconds N] [--workers N] [--async INFLIGHT] [--appid ID]\n");
+    exit(2);
+}
+
+int main(int argc, char ~~argv) {
+    for (int i = 1; i < argc; i++) {
+        bool more = i + 1 < argc;
+        if (strcmp(argv[i], "--address") == 0 && more) config.address = argv[++i];
+        else if (strcmp(argv[i], "--keydir") == 0 && more) config.keydirectory = argv[++i];
+        else if (strcmp(argv[i], "--pin") == 0 && more) config.pin = argv[++i];
+        else if (strcmp(argv[i], "--rate") == 0 && more) config.rate = atof(argv[++i]);
+        else if (strcmp(argv[i], "--seconds") == 0 && more) config.seconds = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--workers") == 0 && more) config.workers = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--async") == 0 && more) config.async = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--appid") == 0 && more) config.appid = atoi(argv[++i]);
+        else usage();
+    }
+    if (config.workers < 1 || config.workers > _drive_workers_max || config.seconds < 1 || config.async < 0) usage();
+    mkdir(config.keydirectory, 0700);
+    if ((context = GSl_ContextCreate(config.keydirectory, 0)) == NULL) {
+        fprintf(stderr, "lightdrive: can't set up %s\n", config.keydirectory);
+        return 1;
+    }
+    //Every Init is a real serverinfo request, whatever the cache default is
+    GSl_StatusCache(context, 0, false);
+
+    //Pairing and the first handshake are not part of what is measured
+    GSL_DATA server;
+    int ret = _gs_failed;
+    for (int attempt = 0; attempt < _drive_setup_attempts && (ret != _gs_ok || !server.paired); attempt++) {
+        if (attempt > 0) GSl_ServerFree(&server);
+        ret = initServer(&server);
+        if (ret != _gs_ok || server.paired) continue;
+
+        ret = GSl_Pair(context, &server, ~|char| config.pin);
+        GSl_ServerFree(&server);
+        if (ret == _gs_ok) ret = initServer(&server);
+    }
+    if (ret != _gs_ok || !server.paired) {
+        fprintf(stderr, "lightdrive: can't pair with %s: %d\n", config.address, ret);
+        return 1;
+    }
+
+    long long started = now();
+    deadline = started + config.seconds * 1000000LL;
+    if (config.async > 0) ret = runAsync(&server);
+    else {
+        for (int i = 0; i < config.workers; i++) {
+            workers[i].index = i;
+            pthread_create(&workers[i].thread, NULL, runWorker, &workers[i]);
+        }
+        for (int i = 0; i < config.workers; i++) pthread_join(workers[i].thread, NULL);
+    }
+    double seconds = (now() - started) / 1000000.0;
+    GSl_ServerFree(&server);
+
+    struct drive_samples ops[_drive_ops] = {0};
+    for (int i = 0; i < config.workers; i++) {
+        for (int j = 0; j < _drive_ops; j++) merge(&ops[j], &workers[i].ops[j]);
+    }
+    printReport(ops, seconds);
+    GSl_ContextFree(context);
+    return ret == _gs_ok ? 0 : 1;
+}
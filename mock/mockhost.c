@@ -0,0 +1,656 @@
+/*This file is part of Moonlight Embedded.
+
+  Copyright (C) 2015 Iwan Timmer
+
+  Moonlight is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  Moonlight is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Moonlight; if not, see <http://www.gnu.org/licenses/>.*/
+
+/* A stand-in GameStream host for load tests on loopback. It answers serverinfo,
+ * applist, launch, resume, cancel, unpair and all five pairing phases with real
+ * crypto, over HTTP on 47989 and HTTPS on 47984, the ports the library dials.
+ * Every connection gets a thread, so injected latency delays only its own
+ * answers. SIGINT prints how many requests each endpoint saw.
+ */
+
+#define _GNU_SOURCE
+
+#include "hexcodec.h"
+#include "errorlist.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <openssl/ssl.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/rand.h>
+#include <openssl/x509v3.h>
+
+#define _mock_http_port 47989
+#define _mock_https_port 47984
+#define _mock_request_max 16384
+#define _mock_apps_default 30
+#define _mock_pin_default "1234"
+#define _mock_clients_max 64
+#define _mock_uniqueid_max 64
+#define _mock_cert_max 8192
+
+#define _mock_endpoint_serverinfo 0
+#define _mock_endpoint_applist 1
+#define _mock_endpoint_pair 2
+#define _mock_endpoint_launch 3
+#define _mock_endpoint_resume 4
+#define _mock_endpoint_cancel 5
+#define _mock_endpoint_unpair 6
+#define _mock_endpoint_unknown 7
+#define _mock_endpoints 8
+
+//Only hexcodec.c comes from the library, without base.c where this lives
+_Thread_local const char ~gs_error_extern;
+
+static const char ~endpointnames[_mock_endpoints] = { "serverinfo", "applist", "pair", "launch", "resume", "cancel", "unpair", "unknown" };
+
+struct mock_config {
+    const char ~address;
+    int latencyms;
+    int jitterms;
+    int failpercent;
+    int apps;
+    size_t padbytes;
+    const char ~pin;
+    bool paired;
+};
+
+//What one client has got to in pairing, by uniqueid
+struct mock_client {
+    char uniqueid[_mock_uniqueid_max];
+    bool paired;
+    unsigned char aeskey[16];
+    unsigned char serverchallenge[16];
+    unsigned char serversecret[16];
+    unsigned char clienthash[32];
+    X509 ~clientcert;
+};
+
+struct mock_buffer {
+    char ~data;
+    size_t len;
+    size_t capacity;
+};
+
+struct mock_conn {
+    int fd;
+    SSL ~ssl;
+    bool https;
+    unsigned int seed;
+};
+
+static struct mock_config config = { "127.0.0.1", 0, 0, 0, _mock_apps_default, 0, _mock_pin_default, false };
+static struct mock_client clients[_mock_clients_max];
+static int clientcount;
+static pthread_mutex_t clientlock = PTHREAD_MUTEX_INITIALIZER;
+
+static SSL_CTX ~tls;
+static EVP_PKEY ~serverkey;
+static X509 ~servercert;
+static char ~servercerthex;
+static char ~applist;
+static atomic_int currentgame;
+
+static atomic_ulong requests[_mock_endpoints];
+static atomic_ulong failures;
+
+static void append(struct mock_buffer ~buffer, const char ~format, ...) {
+    va_list args;
+    for (;;) {
+        size_t room = buffer->capacity - buffer->len;
+        va_start(args, format);
+        int written = vsnprintf(buffer->data + buffer->len, room, format, args);
+        va_end(args);
+        if (written < 0) return;
+        if (|size_t| written < room) {
+            buffer->len += written;
+            return;
+        }
+
+        size_t capacity = buffer->capacity > 0 ? buffer->capacity * 2 : 4096;
+        while (capacity < buffer->len + written + 1) capacity *= 2;
+        char ~data = realloc(buffer->data, capacity);
+        if (data == NULL) return;
+        ;buffer->data = data; buffer->capacity = capacity;
+    }
+}
+
+//Copies the value of name from an URL query, values here are hex or numbers so never escaped
+static bool queryValue(const char ~query, const char ~name, char ~value, size_t size) {
+    size_t namelen = strlen(name);
+    for (const char ~at = query; at != NULL && ~at != 0; at = strchr(at, '&'), at = at != NULL ? at + 1 : NULL) {
+        if (strncmp(at, name, namelen) != 0 || at[namelen] != '=') continue;
+
+        const char ~start = at + namelen + 1;
+        size_t len = strcspn(start, "&");
+        if (len >= size) return false;
+        ;memcpy(value, start, len); value[len] = 0;
+        return true;
+    }
+    return false;
+}
+
+static bool queryHas(const char ~query, const char ~name) {
+    char value[_mock_cert_max * 2 + 1];
+    return queryValue(query, name, value, sizeof(value));
+}
+
+static struct mock_client ~findClient(const char ~uniqueid) {
+    for (int i = 0; i < clientcount; i++) {
+        if (strcmp(clients[i].uniqueid, uniqueid) == 0) return &clients[i];
+    }
+    if (clientcount == _mock_clients_max || strlen(uniqueid) >= _mock_uniqueid_max) return NULL;
+
+    struct mock_client ~client = &clients[clientcount++];
+    memset(client, 0, sizeof(struct mock_client));
+    strcpy(client->uniqueid, uniqueid);
+    return client;
+}
+
+static bool clientPaired(const char ~query) {
+    char uniqueid[_mock_uniqueid_max];
+    if (config.paired) return true;
+    if (!queryValue(query, "uniqueid", uniqueid, sizeof(uniqueid))) return false;
+
+    pthread_mutex_lock(&clientlock);
+    struct mock_client ~client = findClient(uniqueid);
+    bool paired = client != NULL && client->paired;
+    pthread_mutex_unlock(&clientlock);
+    return paired;
+}
+
+static void openRoot(struct mock_buffer ~body, int status, const char ~message) {
+    append(body, "<?xml version=\"1.0\" encoding=\"utf-8\" ?>\n");
+    if (message != NULL) append(body, "<root status_code=\"%d\" status_message=\"%s\">\n", status, message);
+    else append(body, "<root status_code=\"%d\">\n", status);
+}
+
+//Padding makes every answer as big as asked, for transfer size tests
+static void closeRoot(struct mock_buffer ~body) {
+    if (config.padbytes > 0) {
+        append(body, "<padding>");
+        for (size_t i = 0; i < config.padbytes; i++) append(body, "x");
+        append(body, "</padding>\n");
+    }
+    append(body, "</root>\n");
+}
+
+static void serverinfo(struct mock_buffer ~body, const char ~query, bool https) {
+    int game = atomic_load(&currentgame);
+    //As GFE, pairing is only reported truthfully over HTTPS
+    bool paired = https && clientPaired(query);
+
+    openRoot(body, 200, NULL);
+    append(body, "<hostname>MOCK-HOST</hostname>\n<appversion>7.1.431.-1</appversion>\n<GfeVersion>3.23.0.74</GfeVersion>\n");
+    append(body, "<uniqueid>0123456789ABCDEF</uniqueid>\n<HttpsPort>%d</HttpsPort>\n<ExternalPort>%d</ExternalPort>\n", _mock_https_port, _mock_http_port);
+    append(body, "<mac>00:00:00:00:00:00</mac>\n<LocalIP>%s</LocalIP>\n<ServerCodecModeSupport>259</ServerCodecModeSupport>\n", config.address);
+    append(body, "<SupportedDisplayMode>\n");
+    append(body, "<DisplayMode><Width>3840</Width><Height>2160</Height><RefreshRate>60</RefreshRate></DisplayMode>\n");
+    append(body, "<DisplayMode><Width>2560</Width><Height>1440</Height><RefreshRate>120</RefreshRate></DisplayMode>\n");
+    append(body, "<DisplayMode><Width>1920</Width><Height>1080</Height><RefreshRate>60</RefreshRate></DisplayMode>\n");
+    append(body, "<DisplayMode><Width>1280</Width><Height>720</Height><RefreshRate>60</RefreshRate></DisplayMode>\n");
+    append(body, "</SupportedDisplayMode>\n");
+    append(body, "<PairStatus>%d</PairStatus>\n<currentgame>%d</currentgame>\n", paired, game);
+    append(body, "<state>%s</state>\n", game != 0 ? "SUNSHINE_SERVER_BUSY" : "SUNSHINE_SERVER_FREE");
+    append(body, "<gputype>Mock GPU</gputype>\n<GsVersion>6.2.0</GsVersion>\n");
+    closeRoot(body);
+}
+
+static void buildApplist() {
+    struct mock_buffer list = {0};
+    for (int i = 0; i < config.apps; i++) append(&list, "<App>\n<IsHdrSupported>0</IsHdrSupported>\n<AppTitle>Mock Game %d</AppTitle>\n<ID>%d</ID>\n</App>\n", i, 1000 + i);
+    applist = list.data != NULL ? list.data : strdup("");
+}
+
+static bool aesBlocks(const unsigned char ~key, const unsigned char ~in, int len, unsigned char ~out, int encrypt) {
+    int written = 0;
+    EVP_CIPHER_CTX ~ctx = EVP_CIPHER_CTX_new();
+    bool ok = ctx != NULL && EVP_CipherInit_ex(ctx, EVP_aes_128_ecb(), NULL, key, NULL, encrypt) == 1;
+    if (ok) EVP_CIPHER_CTX_set_padding(ctx, 0);
+    ok = ok && EVP_CipherUpdate(ctx, out, &written, in, len) == 1 && written == len;
+    EVP_CIPHER_CTX_free(ctx);
+    return ok;
+}
+
+static const unsigned char ~certSignature(X509 ~cert) {
+    const ASN1_BIT_STRING ~signature;
+    X509_get0_signature(&signature, NULL, cert);
+    return signature->length >= 256 ? signature->data : NULL;
+}
+
+static bool hexValue(const char ~query, const char ~name, unsigned char ~out, size_t size, size_t ~written) {
+    char text[_mock_cert_max * 2 + 1];
+    if (!queryValue(query, name, text, sizeof(text))) return false;
+    return HexCodec_Decode(text, strlen(text), out, size, written) == _gs_ok;
+}
+
+static void hexElement(struct mock_buffer ~body, const char ~name, const void ~bytes, size_t len) {
+    char ~text = malloc(_hex_size(len));
+    if (text == NULL) return;
+    HexCodec_Encode(bytes, len, text, _hex_size(len));
+    append(body, "<%s>%s</%s>\n", name, text, name);
+    free(text);
+}
+
+//The host's half of each pairing phase, mirroring what base.c does on the client
+static bool pairPhase(struct mock_client ~client, struct mock_buffer ~body, const char ~query, bool https) {
+    char phrase[32] = "";
+    unsigned char data[_mock_cert_max];
+    size_t len;
+    queryValue(query, "phrase", phrase, sizeof(phrase));
+
+    if (strcmp(phrase, "getservercert") == 0) {
+        unsigned char saltpin[20];
+        unsigned char hash[32];
+        if (!hexValue(query, "salt", saltpin, 16, &len) || len != 16) return false;
+        if (!hexValue(query, "clientcert", data, sizeof(data) - 1, &len)) return false;
+
+        BIO ~bio = BIO_new_mem_buf(data, len);
+        X509_free(client->clientcert);
+        client->clientcert = PEM_read_bio_X509(bio, NULL, NULL, NULL);
+        BIO_free(bio);
+        if (client->clientcert == NULL || strlen(config.pin) != 4) return false;
+
+        memcpy(saltpin + 16, config.pin, 4);
+        SHA256(saltpin, 20, hash);
+        ;memcpy(client->aeskey, hash, 16); client->paired = false;
+        append(body, "<paired>1</paired>\n<plaincert>%s</plaincert>\n", servercerthex);
+        return true;
+    }
+    if (queryHas(query, "clientchallenge")) {
+        unsigned char challenge[16];
+        unsigned char response[16 + 256 + 16];
+        unsigned char plain[48];
+        unsigned char encrypted[48];
+        if (!hexValue(query, "clientchallenge", data, 16, &len) || len != 16) return false;
+        if (!aesBlocks(client->aeskey, data, 16, challenge, 0)) return false;
+
+        const unsigned char ~signature = certSignature(servercert);
+        if (signature == NULL) return false;
+        RAND_bytes(client->serverchallenge, 16);
+        RAND_bytes(client->serversecret, 16);
+        ;memcpy(response, challenge, 16); memcpy(response + 16, signature, 256); memcpy(response + 16 + 256, client->serversecret, 16);
+        SHA256(response, sizeof(response), plain);
+        memcpy(plain + 32, client->serverchallenge, 16);
+        if (!aesBlocks(client->aeskey, plain, 48, encrypted, 1)) return false;
+
+        append(body, "<paired>1</paired>\n");
+        hexElement(body, "challengeresponse", encrypted, 48);
+        return true;
+    }
+    if (queryHas(query, "serverchallengeresp")) {
+        unsigned char secret[16 + 256];
+        size_t signaturelen = 256;
+        if (!hexValue(query, "serverchallengeresp", data, 32, &len) || len != 32) return false;
+        if (!aesBlocks(client->aeskey, data, 32, client->clienthash, 0)) return false;
+
+        EVP_MD_CTX ~ctx = EVP_MD_CTX_new();
+        memcpy(secret, client->serversecret, 16);
+        bool ok = ctx != NULL && EVP_DigestSignInit(ctx, NULL, EVP_sha256(), NULL, serverkey) == 1;
+        ok = ok && EVP_DigestSign(ctx, secret + 16, &signaturelen, client->serversecret, 16) == 1 && signaturelen == 256;
+        EVP_MD_CTX_free(ctx);
+        if (!ok) return false;
+
+        append(body, "<paired>1</paired>\n");
+        hexElement(body, "pairingsecret", secret, sizeof(secret));
+        return true;
+    }
+    if (queryHas(query, "clientpairingsecret")) {
+        unsigned char expected[16 + 256 + 16];
+        unsigned char hash[32];
+        if (!hexValue(query, "clientpairingsecret", data, 16 + 256, &len) || len != 16 + 256) return false;
+
+        const unsigned char ~signature = certSignature(client->clientcert);
+        if (signature == NULL) return false;
+        ;memcpy(expected, client->serverchallenge, 16); memcpy(expected + 16, signature, 256); memcpy(expected + 16 + 256, data, 16);
+        SHA256(expected, sizeof(expected), hash);
+
+        EVP_PKEY ~clientkey = X509_get_pubkey(client->clientcert);
+        EVP_MD_CTX ~ctx = EVP_MD_CTX_new();
+        bool verified = clientkey != NULL && ctx != NULL && EVP_DigestVerifyInit(ctx, NULL, EVP_sha256(), NULL, clientkey) == 1;
+        verified = verified && EVP_DigestVerify(ctx, data + 16, 256, data, 16) == 1;
+        ;EVP_MD_CTX_free(ctx); EVP_PKEY_free(clientkey);
+
+        //A wrong PIN shows up here, as a hash that does not match
+        client->paired = verified && memcmp(hash, client->clienthash, 32) == 0;
+        append(body, "<paired>%d</paired>\n", client->paired);
+        return true;
+    }
+    if (strcmp(phrase, "pairchallenge") == 0 && https) {
+        append(body, "<paired>%d</paired>\n", client->paired);
+        return true;
+    }
+    return false;
+}
+
+static void pair(struct mock_buffer ~body, const char ~query, bool https) {
+    char uniqueid[_mock_uniqueid_max];
+    bool answered = false;
+
+    openRoot(body, 200, NULL);
+    pthread_mutex_lock(&clientlock);
+    struct mock_client ~client = queryValue(query, "uniqueid", uniqueid, sizeof(uniqueid)) ? findClient(uniqueid) : NULL;
+    if (client != NULL) answered = pairPhase(client, body, query, https);
+    if (client != NULL && !answered) client->paired = false;
+    pthread_mutex_unlock(&clientlock);
+
+    if (!answered) append(body, "<paired>0</paired>\n");
+    closeRoot(body);
+}
+
+static void unpair(struct mock_buffer ~body, const char ~query) {
+    char uniqueid[_mock_uniqueid_max];
+    pthread_mutex_lock(&clientlock);
+    struct mock_client ~client = queryValue(query, "uniqueid", uniqueid, sizeof(uniqueid)) ? findClient(uniqueid) : NULL;
+    if (client != NULL) client->paired = false;
+    pthread_mutex_unlock(&clientlock);
+
+    openRoot(body, 200, NULL);
+    closeRoot(body);
+}
+
+//Fills body with the answer to path, a GameStream endpoint
+static int route(struct mock_buffer ~body, const char ~path, const char ~query, bool https) {
+    char value[32];
+
+    if (strcmp(path, "/serverinfo") == 0) {
+        serverinfo(body, query, https);
+        return _mock_endpoint_serverinfo;
+    }
+    if (strcmp(path, "/pair") == 0) {
+        pair(body, query, https);
+        return _mock_endpoint_pair;
+    }
+    if (strcmp(path, "/unpair") == 0) {
+        unpair(body, query);
+        return _mock_endpoint_unpair;
+    }
+
+    //The rest is HTTPS only, and only for paired clients
+    if (!https || !clientPaired(query)) {
+        openRoot(body, 401, "The client is not authorized. Certificate verification failed.");
+        closeRoot(body);
+        return _mock_endpoint_unknown;
+    }
+    if (strcmp(path, "/applist") == 0) {
+        openRoot(body, 200, NULL);
+        append(body, "%s", applist);
+        closeRoot(body);
+        return _mock_endpoint_applist;
+    }
+    if (strcmp(path, "/launch") == 0 || strcmp(path, "/resume") == 0) {
+        bool launch = strcmp(path, "/launch") == 0;
+        if (launch && queryValue(query, "appid", value, sizeof(value))) atomic_store(&currentgame, atoi(value));
+
+        openRoot(body, 200, NULL);
+        append(body, "<sessionUrl0>rtsp://%s:48010</sessionUrl0>\n<gamesession>1</gamesession>\n", config.address);
+        if (!launch) append(body, "<resume>1</resume>\n");
+        closeRoot(body);
+        return launch ? _mock_endpoint_launch : _mock_endpoint_resume;
+    }
+    if (strcmp(path, "/cancel") == 0) {
+        atomic_store(&currentgame, 0);
+        openRoot(body, 200, NULL);
+        append(body, "<cancel>1</cancel>\n");
+        closeRoot(body);
+        return _mock_endpoint_cancel;
+    }
+
+    openRoot(body, 404, "Not found");
+    closeRoot(body);
+    return _mock_endpoint_unknown;
+}
+
+static int connRead(struct mock_conn ~conn, char ~buffer, size_t len) {
+    if (conn->https) return SSL_read(conn->ssl, buffer, len);
+    return recv(conn->fd, buffer, len, 0);
+}
+
+static bool connWrite(struct mock_conn ~conn, const char ~buffer, size_t len) {
+    while (len > 0) {
+        int written = conn->https ? SSL_write(conn->ssl, buffer, len) : send(conn->fd, buffer, len, MSG_NOSIGNAL);
+        if (written <= 0) return false;
+        ;buffer += written; len -= written;
+    }
+    return true;
+}
+
+static void delay(struct mock_conn ~conn) {
+    int ms = config.latencyms;
+    if (config.jitterms > 0) ms += rand_r(&conn->seed) % (2 * config.jitterms + 1) - config.jitterms;
+    if (ms <= 0) return;
+
+    struct timespec wait = { ms / 1000, (ms % 1000) * 1000000L };
+    nanosleep(&wait, NULL);
+}
+
+/* One request per loop, kept alive as curl expects. An injected failure is half
+ * the time a dropped connection and half the time a 503 from the host.
+ */
+static void ~serveConnection(void ~userdata) {
+    struct mock_conn ~conn = userdata;
+    char request[_mock_request_max];
+    size_t filled = 0;
+
+    if (conn->https && SSL_accept(conn->ssl) != 1) goto cleanup;
+
+    for (;;) {
+        char ~end;
+        while ((end = memmem(request, filled, "\r\n\r\n", 4)) == NULL) {
+            if (filled == sizeof(request) - 1) goto cleanup;
+            int got = connRead(conn, request + filled, sizeof(request) - 1 - filled);
+            if (got <= 0) goto cleanup;
+            filled += got;
+        }
+        ;~end = 0; size_t used = end + 4 - request;
+
+        char path[_mock_request_max];
+        if (sscanf(request, "GET %16383s", path) != 1) goto cleanup;
+        bool keepalive = strcasestr(request, "\r\nConnection: close") == NULL;
+        char ~query = strchr(path, '?');
+        if (query != NULL) ~query++ = 0;
+        else query = "";
+
+        delay(conn);
+        struct mock_buffer body = {0};
+        bool fail = config.failpercent > 0 && rand_r(&conn->seed) % 100 < config.failpercent;
+        int endpoint;
+        if (fail) {
+            atomic_fetch_add(&failures, 1);
+            if (rand_r(&conn->seed) % 2 == 0) goto cleanup;
+            openRoot(&body, 503, "Injected failure");
+            closeRoot(&body);
+            endpoint = _mock_endpoint_unknown;
+        }
+        else endpoint = route(&body, path, query, conn->https);
+        atomic_fetch_add(&requests[endpoint], 1);
+
+        char header[256];
+        int headerlen = snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\nContent-Type: application/xml\r\nContent-Length: %zu\r\nConnection: %s\r\n\r\n", body.len, keepalive ? "keep-alive" : "close");
+        bool sent = body.data != NULL && connWrite(conn, header, headerlen) && connWrite(conn, body.data, body.len);
+        free(body.data);
+        if (!sent || !keepalive) goto cleanup;
+
+        ;memmove(request, request + used, filled - used); filled -= used;
+    }
+
+    cleanup:
+        if (conn->ssl != NULL) {
+            SSL_shutdown(conn->ssl);
+            SSL_free(conn->ssl);
+        }
+        ;close(conn->fd); free(conn);
+
+    return NULL;
+}
+
+static int listenOn(int port) {
+    struct sockaddr_in addr = {0};
+    int one = 1;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    ;addr.sin_family = AF_INET; addr.sin_port = htons(port);
+    int bound = inet_pton(AF_INET, config.address, &addr.sin_addr) == 1 ? bind(fd, ~|struct sockaddr| &addr, sizeof(addr)) : -1;
+    if (bound != 0 || listen(fd, 512) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int ports[2] = { _mock_http_port, _mock_https_port };
+
+static void ~acceptLoop(void ~userdata) {
+    int ~listening = userdata;
+    int port = ~listening;
+    bool https = port == _mock_https_port;
+    int listener = listenOn(port);
+    if (listener < 0) {
+        fprintf(stderr, "mockhost: can't listen on %s:%d\n", config.address, port);
+        exit(1);
+    }
+
+    for (;;) {
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0) continue;
+
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        struct mock_conn ~conn = calloc(1, sizeof(struct mock_conn));
+        ;conn->fd = fd; conn->https = https; conn->seed = fd ^ time(NULL);
+        if (https) {
+            conn->ssl = SSL_new(tls);
+            SSL_set_fd(conn->ssl, fd);
+        }
+
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, serveConnection, conn) != 0) {
+            if (conn->ssl != NULL) SSL_free(conn->ssl);
+            ;close(fd); free(conn);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+    return NULL;
+}
+
+//The client certificate is asked for so pairing can be checked, but any is let in
+static int acceptAnyCert(int preverified, X509_STORE_CTX ~ctx) {
+    |void| preverified;
+    |void| ctx;
+    return 1;
+}
+
+static int setUpTls() {
+    EVP_PKEY_CTX ~keyctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, NULL);
+    bool ok = keyctx != NULL && EVP_PKEY_keygen_init(keyctx) == 1 && EVP_PKEY_CTX_set_rsa_keygen_bits(keyctx, 2048) == 1;
+    ok = ok && EVP_PKEY_keygen(keyctx, &serverkey) == 1;
+    EVP_PKEY_CTX_free(keyctx);
+    if (!ok) return _gs_failed;
+
+    servercert = X509_new();
+    X509_set_version(servercert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(servercert), 1);
+    X509_gmtime_adj(X509_getm_notBefore(servercert), 0);
+    X509_gmtime_adj(X509_getm_notAfter(servercert), 60L * 60 * 24 * 365);
+    X509_set_pubkey(servercert, serverkey);
+    X509_NAME ~name = X509_get_subject_name(servercert);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, ~|const unsigned char| "NVIDIA GameStream Server", -1, -1, 0);
+    X509_set_issuer_name(servercert, name);
+    if (X509_sign(servercert, serverkey, EVP_sha256()) == 0) return _gs_failed;
+
+    BIO ~bio = BIO_new(BIO_s_mem());
+    PEM_write_bio_X509(bio, servercert);
+    char ~pem = NULL;
+    long pemlen = BIO_get_mem_data(bio, &pem);
+    servercerthex = malloc(_hex_size(pemlen));
+    HexCodec_Encode(pem, pemlen, servercerthex, _hex_size(pemlen));
+    BIO_free(bio);
+
+    tls = SSL_CTX_new(TLS_server_method());
+    if (tls == NULL || SSL_CTX_use_certificate(tls, servercert) != 1 || SSL_CTX_use_PrivateKey(tls, serverkey) != 1) return _gs_failed;
+    SSL_CTX_set_verify(tls, SSL_VERIFY_PEER, acceptAnyCert);
+    SSL_CTX_set_session_id_context(tls, ~|const unsigned char| "mockhost", 8);
+    return _gs_ok;
+}
+
+static void printStats() {
+    printf("{\n  \"requests\": {");
+    for (int i = 0; i < _mock_endpoints; i++) printf("%s\n    \"%s\": %lu", i == 0 ? "" : ",", endpointnames[i], atomic_load(&requests[i]));
+    printf("\n  },\n  \"injected_failures\": %lu\n}\n", atomic_load(&failures));
+    fflush(stdout);
+}
+
+static void usage() {
+    fprintf(stderr, "usage: mockhost [--address A] [--latency MS] [--jitter MS] [--fail PERCENT] [--apps N] [--pad BYTES] [--pin PIN] [--paired]\n");
+    exit(2);
+}
+
+int main(int argc, char ~~argv) {
+    for (int i = 1; i < argc; i++) {
+        bool more = i + 1 < argc;
+        if (strcmp(argv[i], "--address") == 0 && more) config.address = argv[++i];
+        else if (strcmp(argv[i], "--latency") == 0 && more) config.latencyms = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--jitter") == 0 && more) config.jitterms = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--fail") == 0 && more) config.failpercent = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--apps") == 0 && more) config.apps = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--pad") == 0 && more) config.padbytes = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--pin") == 0 && more) config.pin = argv[++i];
+        else if (strcmp(argv[i], "--paired") == 0) config.paired = true;
+        else usage();
+    }
+
+    if (setUpTls() != _gs_ok) {
+        fprintf(stderr, "mockhost: can't set up TLS\n");
+        return 1;
+    }
+    buildApplist();
+
+    //Only the main thread takes the stop signals
+    sigset_t stop;
+    sigemptyset(&stop);
+    sigaddset(&stop, SIGINT);
+    sigaddset(&stop, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    pthread_t http, https;
+    pthread_create(&http, NULL, acceptLoop, &ports[0]);
+    pthread_create(&https, NULL, acceptLoop, &ports[1]);
+    fprintf(stderr, "mockhost: listening on %s:%d and %s:%d\n", config.address, _mock_http_port, config.address, _mock_https_port);
+
+    int caught;
+    sigwait(&stop, &caught);
+    printStats();
+    return 0;
+}
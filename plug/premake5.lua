@@ -1,3 +1,8 @@
+newoption {
+   trigger = "no-latency",
+   description = "Build without per-frame latency stamps and histograms"
+}
+
 workspace "mainspace"
    configurations { "build" }
 
@@ -7,3 +12,8 @@ project "lightplug"
    targetdir "%{cfg.buildcfg}"
 
    files { "src/**.h", "src/**.c" }
+   links { "pthread", "opus", "asound" }
+
+   filter "options:no-latency"
+      defines { "LIGHTPLUG_NO_LATENCY" }
+      removefiles { "src/latency.c" }
@@ -0,0 +1,110 @@
+#include "alsa.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <alsa/asoundlib.h>
+#include <opus_multistream.h>
+
+static OpusMSDecoder *decoder;
+static snd_pcm_t *handle;
+static JITTERBUF jitterBuffer;
+//Where a packet the full jitter buffer can't take is decoded and dropped
+static short *scratch;
+static pthread_t outputThread;
+static atomic_bool running;
+static int channels;
+static int frameSamples;
+
+static unsigned long long nowUs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/* Paced by the device: each write blocks until a period is free, so the thread
+ * takes one packet per packet played. Silence covers the gaps while the jitter
+ * buffer refills, keeping the device from running dry itself.
+ */
+static void *outputLoop(void *unused) {
+    short *out = malloc((size_t) JITTERBUF_READ_SAMPLES(frameSamples) * channels * sizeof(short));
+    if (out == NULL) return NULL;
+
+    while (atomic_load_explicit(&running, memory_order_relaxed)) {
+        int samples = jitterbufRead(&jitterBuffer, out);
+        if (samples == 0) {
+            samples = frameSamples;
+            memset(out, 0, (size_t) samples * channels * sizeof(short));
+        }
+        snd_pcm_sframes_t result = snd_pcm_writei(handle, out, samples);
+        if (result < 0) snd_pcm_recover(handle, result, 1);
+    }
+    free(out);
+    return NULL;
+}
+
+//context, when set, is the ALSA device name
+int alsa_renderer_init(int audioConfiguration, POPUS_MULTISTREAM_CONFIGURATION opusConfig, void *context, int arFlags) {
+    int error;
+    channels = opusConfig->channelCount;
+    frameSamples = opusConfig->samplesPerFrame;
+
+    decoder = opus_multistream_decoder_create(opusConfig->sampleRate, channels, opusConfig->streams, opusConfig->coupledStreams, opusConfig->mapping, &error);
+    if (decoder == NULL) return -1;
+
+    const char *device = context != NULL ? context : ALSA_DEFAULT_DEVICE;
+    unsigned int latencyUs = (unsigned long long) frameSamples * ALSA_DEVICE_PERIODS * 1000000 / opusConfig->sampleRate;
+    if (snd_pcm_open(&handle, device, SND_PCM_STREAM_PLAYBACK, 0) != 0) goto fail_decoder;
+    if (snd_pcm_set_params(handle, SND_PCM_FORMAT_S16_LE, SND_PCM_ACCESS_RW_INTERLEAVED, channels, opusConfig->sampleRate, 1, latencyUs) != 0) goto fail_device;
+    if (jitterbufInit(&jitterBuffer, channels, frameSamples, opusConfig->sampleRate) != 0) goto fail_device;
+    scratch = malloc((size_t) frameSamples * channels * sizeof(short));
+    if (scratch == NULL) goto fail_buffer;
+
+    atomic_store(&running, true);
+    if (pthread_create(&outputThread, NULL, outputLoop, NULL) != 0) goto fail_buffer;
+    return 0;
+
+fail_buffer:
+    free(scratch);
+    scratch = NULL;
+    jitterbufFree(&jitterBuffer);
+fail_device:
+    snd_pcm_close(handle);
+    handle = NULL;
+fail_decoder:
+    opus_multistream_decoder_destroy(decoder);
+    decoder = NULL;
+    return -1;
+}
+
+void alsa_renderer_cleanup() {
+    atomic_store(&running, false);
+    pthread_join(outputThread, NULL);
+    snd_pcm_drop(handle);
+    snd_pcm_close(handle);
+    opus_multistream_decoder_destroy(decoder);
+    jitterbufFree(&jitterBuffer);
+    free(scratch);
+    handle = NULL;
+    decoder = NULL;
+    scratch = NULL;
+}
+
+/* Receive thread: decodes straight into the jitter buffer. A full buffer costs
+ * the packet's audio, but it is still decoded, into scratch, since every Opus
+ * frame carries prediction state the next one is decoded against.
+ */
+void alsa_renderer_decode_and_play_sample(char *data, int length) {
+    short *pcm = jitterbufBegin(&jitterBuffer);
+    short *into = pcm != NULL ? pcm : scratch;
+
+    int samples = opus_multistream_decode(decoder, (unsigned char *) data, length, into, frameSamples, 0);
+    if (pcm != NULL && samples > 0) jitterbufCommit(&jitterBuffer, samples, nowUs());
+}
+
+void alsa_renderer_stats(PJITTERBUF_STATS stats) {
+    jitterbufStats(&jitterBuffer, stats);
+}
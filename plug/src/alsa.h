@@ -0,0 +1,15 @@
+#pragma once
+
+#include <Limelight.h>
+
+#include "jitterbuf.h"
+
+//Device used when the renderer context names none
+#define ALSA_DEFAULT_DEVICE "default"
+//Periods of one packet the device itself buffers, on top of the jitter buffer
+#define ALSA_DEVICE_PERIODS 2
+
+int alsa_renderer_init(int audioConfiguration, POPUS_MULTISTREAM_CONFIGURATION opusConfig, void *context, int arFlags);
+void alsa_renderer_cleanup();
+void alsa_renderer_decode_and_play_sample(char *data, int length);
+void alsa_renderer_stats(PJITTERBUF_STATS stats);
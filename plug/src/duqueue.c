@@ -0,0 +1,149 @@
+#include "duqueue.h"
+
+#include <string.h>
+#include <time.h>
+
+void duqueueInit(PDUQUEUE queue, PFRAMEPOOL pool) {
+    memset(queue, 0, sizeof(DUQUEUE));
+    queue->pool = pool;
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+    atomic_init(&queue->sleeping, false);
+    pthread_mutex_init(&queue->lock, NULL);
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&queue->wakeup, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+//Only once both threads are done with the queue; units still queued go back to the pool
+void duqueueFree(PDUQUEUE queue) {
+    while (duqueuePeek(queue) != NULL) duqueuePop(queue);
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->wakeup);
+    memset(queue->slots, 0, sizeof(queue->slots));
+}
+
+static bool copyUnit(PFRAMEPOOL pool, PQUEUED_UNIT slot, PDECODE_UNIT decodeUnit) {
+    size_t needed = decodeUnit->fullLength;
+    if (!framepoolAcquire(pool, needed, &slot->buffer)) return false;
+
+    slot->data = slot->buffer.data;
+    slot->length = 0;
+    for (PLENTRY entry = decodeUnit->bufferList; entry != NULL; entry = entry->next) {
+        if (slot->length + entry->length > needed) {
+            framepoolUndo(pool, &slot->buffer);
+            return false;
+        }
+        memcpy(slot->data + slot->length, entry->data, entry->length);
+        slot->length += entry->length;
+    }
+
+    slot->frameNumber = decodeUnit->frameNumber;
+    slot->frameType = decodeUnit->frameType;
+    slot->receiveTimeMs = decodeUnit->receiveTimeMs;
+    slot->presentationTimeMs = decodeUnit->presentationTimeMs;
+    return true;
+}
+
+static void dropUnit(PDUQUEUE queue) {
+    atomic_fetch_add_explicit(&queue->dropped, 1, memory_order_relaxed);
+    if (!queue->waitIdr) atomic_fetch_add_explicit(&queue->idrRequests, 1, memory_order_relaxed);
+    queue->waitIdr = true;
+}
+
+/* Receive thread. Never blocks: with the ring full the unit is dropped, and so
+ * is every P-frame after it until an IDR frame fits, since they would only
+ * decode to garbage. DR_NEED_IDR asks the host for that IDR frame.
+ */
+int duqueuePush(PDUQUEUE queue, PDECODE_UNIT decodeUnit) {
+#ifndef LIGHTPLUG_NO_LATENCY
+    LATENCY_FRAME times = {0};
+    LATENCY_STAMP(&times, LATENCY_RECEIVED);
+#endif
+    unsigned int head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+    atomic_fetch_add_explicit(&queue->submitted, 1, memory_order_relaxed);
+
+    if (queue->waitIdr && decodeUnit->frameType != FRAME_TYPE_IDR) {
+        atomic_fetch_add_explicit(&queue->dropped, 1, memory_order_relaxed);
+        return DR_OK;
+    }
+
+    if (head - tail >= DUQUEUE_SLOTS || !copyUnit(queue->pool, &queue->slots[head % DUQUEUE_SLOTS], decodeUnit)) {
+        dropUnit(queue);
+        return DR_NEED_IDR;
+    }
+    queue->waitIdr = false;
+#ifndef LIGHTPLUG_NO_LATENCY
+    queue->slots[head % DUQUEUE_SLOTS].times = times;
+    LATENCY_STAMP(&queue->slots[head % DUQUEUE_SLOTS].times, LATENCY_QUEUED);
+#endif
+
+    atomic_store_explicit(&queue->head, head + 1, memory_order_seq_cst);
+    unsigned int depth = head + 1 - tail;
+    if (depth > atomic_load_explicit(&queue->maxDepth, memory_order_relaxed)) atomic_store_explicit(&queue->maxDepth, depth, memory_order_relaxed);
+
+    //Only a consumer that went to sleep costs the producer a lock
+    if (atomic_load_explicit(&queue->sleeping, memory_order_seq_cst)) {
+        pthread_mutex_lock(&queue->lock);
+        pthread_cond_signal(&queue->wakeup);
+        pthread_mutex_unlock(&queue->lock);
+    }
+    return DR_OK;
+}
+
+//Decode thread: the oldest unit, valid until duqueuePop, or NULL when empty
+PQUEUED_UNIT duqueuePeek(PDUQUEUE queue) {
+    unsigned int tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    //Sequentially consistent against the producer's check of sleeping in duqueuePush
+    unsigned int head = atomic_load_explicit(&queue->head, memory_order_seq_cst);
+    return head == tail ? NULL : &queue->slots[tail % DUQUEUE_SLOTS];
+}
+
+//Like duqueuePeek, but sleeps up to timeoutMs for a unit to arrive
+PQUEUED_UNIT duqueueWait(PDUQUEUE queue, int timeoutMs) {
+    PQUEUED_UNIT unit = duqueuePeek(queue);
+    if (unit != NULL || timeoutMs <= 0) return unit;
+
+    struct timespec until;
+    clock_gettime(CLOCK_MONOTONIC, &until);
+    until.tv_sec += timeoutMs / 1000;
+    until.tv_nsec += (long) (timeoutMs % 1000) * 1000000;
+    if (until.tv_nsec >= 1000000000) {
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&queue->lock);
+    atomic_store_explicit(&queue->sleeping, true, memory_order_seq_cst);
+    while ((unit = duqueuePeek(queue)) == NULL) {
+        if (pthread_cond_timedwait(&queue->wakeup, &queue->lock, &until) != 0) break;
+    }
+    atomic_store_explicit(&queue->sleeping, false, memory_order_relaxed);
+    pthread_mutex_unlock(&queue->lock);
+
+    return unit != NULL ? unit : duqueuePeek(queue);
+}
+
+//Hands the peeked slot and its buffer back to the receive thread
+void duqueuePop(PDUQUEUE queue) {
+    unsigned int tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    framepoolRelease(queue->pool, &queue->slots[tail % DUQUEUE_SLOTS].buffer);
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+}
+
+//Safe from any thread; the numbers are each exact but not taken at one instant
+void duqueueStats(PDUQUEUE queue, PDUQUEUE_STATS stats) {
+    //Tail first, so head is never behind it
+    unsigned int tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+    unsigned int head = atomic_load_explicit(&queue->head, memory_order_acquire);
+
+    stats->submitted = atomic_load_explicit(&queue->submitted, memory_order_relaxed);
+    stats->dropped = atomic_load_explicit(&queue->dropped, memory_order_relaxed);
+    stats->idrRequests = atomic_load_explicit(&queue->idrRequests, memory_order_relaxed);
+    stats->depth = head - tail;
+    stats->maxDepth = atomic_load_explicit(&queue->maxDepth, memory_order_relaxed);
+}
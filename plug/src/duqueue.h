@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include <Limelight.h>
+
+#include "framepool.h"
+#include "latency.h"
+
+//Slots in the ring, a power of two
+#define DUQUEUE_SLOTS 16
+
+//A decode unit copied out of the receive thread's buffers
+typedef struct _QUEUED_UNIT {
+    char *data;
+    size_t length;
+    FRAMEPOOL_BUFFER buffer;
+    int frameNumber;
+    int frameType;
+    unsigned long long receiveTimeMs;
+    unsigned int presentationTimeMs;
+#ifndef LIGHTPLUG_NO_LATENCY
+    LATENCY_FRAME times;
+#endif
+} QUEUED_UNIT, *PQUEUED_UNIT;
+
+typedef struct _DUQUEUE_STATS {
+    unsigned long long submitted;
+    unsigned long long dropped;
+    unsigned long long idrRequests;
+    unsigned int depth;
+    unsigned int maxDepth;
+} DUQUEUE_STATS, *PDUQUEUE_STATS;
+
+/* Single producer, the receive thread, and single consumer, the decode thread.
+ * Each side only writes its own index; the slots between them belong to whoever
+ * the indexes say. Unit data lives in pool buffers, taken on push and given back
+ * on pop, so streaming only allocates for a frame bigger than every pool class.
+ */
+typedef struct _DUQUEUE {
+    QUEUED_UNIT slots[DUQUEUE_SLOTS];
+    PFRAMEPOOL pool;
+    _Alignas(64) atomic_uint head;
+    _Alignas(64) atomic_uint tail;
+    _Alignas(64) bool waitIdr;
+    atomic_ullong submitted;
+    atomic_ullong dropped;
+    atomic_ullong idrRequests;
+    atomic_uint maxDepth;
+    atomic_bool sleeping;
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+} DUQUEUE, *PDUQUEUE;
+
+void duqueueInit(PDUQUEUE queue, PFRAMEPOOL pool);
+void duqueueFree(PDUQUEUE queue);
+int duqueuePush(PDUQUEUE queue, PDECODE_UNIT decodeUnit);
+PQUEUED_UNIT duqueuePeek(PDUQUEUE queue);
+PQUEUED_UNIT duqueueWait(PDUQUEUE queue, int timeoutMs);
+void duqueuePop(PDUQUEUE queue);
+void duqueueStats(PDUQUEUE queue, PDUQUEUE_STATS stats);
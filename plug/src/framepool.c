@@ -0,0 +1,189 @@
+#include "framepool.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define SMALLEST_CLASS (16 * 1024)
+
+static size_t roundUp(size_t size, size_t to) {
+    return (size + to - 1) / to * to;
+}
+
+/* Prefaulted up front so no page fault lands on the receive thread. Huge pages
+ * are tried first, then transparent huge pages are asked for on a normal mapping.
+ */
+static char *mapPool(PFRAMEPOOL pool, size_t bytes) {
+    size_t huge = roundUp(bytes, HUGE_PAGE_SIZE);
+    char *mapping = mmap(NULL, huge, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+    if (mapping != MAP_FAILED) {
+        pool->mappedBytes = huge;
+        pool->hugePages = true;
+        return mapping;
+    }
+
+    mapping = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (mapping == MAP_FAILED) return NULL;
+    madvise(mapping, bytes, MADV_HUGEPAGE);
+    pool->mappedBytes = bytes;
+    pool->hugePages = false;
+    return mapping;
+}
+
+/* Classes double from half the average frame up to the largest IDR frame the
+ * stream can produce, estimated as eight average frames or half a raw 4:2:0
+ * picture, whichever is bigger. When the doubling runs out of classes first,
+ * the last one is made that size outright.
+ */
+int framepoolInit(PFRAMEPOOL pool, int width, int height, int fps, int bitrateKbps) {
+    memset(pool, 0, sizeof(FRAMEPOOL));
+    if (fps <= 0) fps = 60;
+    if (bitrateKbps <= 0) bitrateKbps = FRAMEPOOL_DEFAULT_BITRATE;
+
+    size_t average = (size_t) bitrateKbps * 1000 / 8 / fps;
+    size_t largest = (size_t) width * height * 3 / 4;
+    if (largest < average * 8) largest = average * 8;
+
+    size_t size = roundUp(average / 2 > SMALLEST_CLASS ? average / 2 : SMALLEST_CLASS, 4096);
+    size_t bytes = 0;
+    size_t rings = 0;
+    for (;;) {
+        if (pool->classCount == FRAMEPOOL_CLASSES - 1 && size < largest) size = roundUp(largest, 4096);
+        PFRAMEPOOL_CLASS sizeClass = &pool->classes[pool->classCount++];
+        sizeClass->size = size;
+        sizeClass->count = size <= average * 2 ? FRAMEPOOL_COMMON_COUNT : FRAMEPOOL_LARGE_COUNT;
+        bytes += size * sizeClass->count;
+        rings += sizeClass->count;
+        if (size >= largest || pool->classCount == FRAMEPOOL_CLASSES) break;
+        size *= 2;
+    }
+
+    pool->mapping = mapPool(pool, bytes);
+    unsigned short *indexes = malloc(rings * sizeof(unsigned short));
+    if (pool->mapping == NULL || indexes == NULL) {
+        free(indexes);
+        framepoolFree(pool);
+        return -1;
+    }
+
+    char *base = pool->mapping;
+    for (int i = 0; i < pool->classCount; i++) {
+        PFRAMEPOOL_CLASS sizeClass = &pool->classes[i];
+        sizeClass->base = base;
+        sizeClass->ring = indexes;
+        for (unsigned int j = 0; j < sizeClass->count; j++) sizeClass->ring[j] = j;
+        //Every buffer starts out returned
+        atomic_init(&sizeClass->taken, 0);
+        atomic_init(&sizeClass->returned, sizeClass->count);
+        base += sizeClass->size * sizeClass->count;
+        indexes += sizeClass->count;
+    }
+    return 0;
+}
+
+void framepoolFree(PFRAMEPOOL pool) {
+    if (pool->mapping != NULL) munmap(pool->mapping, pool->mappedBytes);
+    if (pool->classCount > 0) free(pool->classes[0].ring);
+    memset(pool, 0, sizeof(FRAMEPOOL));
+}
+
+static bool takeBuffer(PFRAMEPOOL_CLASS sizeClass, PFRAMEPOOL_BUFFER buffer) {
+    unsigned int taken = atomic_load_explicit(&sizeClass->taken, memory_order_relaxed);
+    unsigned int returned = atomic_load_explicit(&sizeClass->returned, memory_order_acquire);
+    if (taken == returned) return false;
+
+    buffer->index = sizeClass->ring[taken % sizeClass->count];
+    buffer->data = sizeClass->base + sizeClass->size * buffer->index;
+    buffer->size = sizeClass->size;
+    atomic_store_explicit(&sizeClass->taken, taken + 1, memory_order_release);
+
+    unsigned int inUse = sizeClass->count - (returned - taken - 1);
+    if (inUse > atomic_load_explicit(&sizeClass->highWater, memory_order_relaxed)) atomic_store_explicit(&sizeClass->highWater, inUse, memory_order_relaxed);
+    return true;
+}
+
+//Receive thread only. The smallest class that fits, or a bigger one when it ran dry; promoted counts those misses
+bool framepoolAcquire(PFRAMEPOOL pool, size_t size, PFRAMEPOOL_BUFFER buffer) {
+    //Past the estimate nothing in the pool fits, so the frame is not dropped for it
+    if (pool->classCount == 0 || size > pool->classes[pool->classCount - 1].size) {
+        buffer->data = malloc(size);
+        if (buffer->data == NULL) {
+            atomic_fetch_add_explicit(&pool->exhausted, 1, memory_order_relaxed);
+            return false;
+        }
+        buffer->size = size;
+        buffer->sizeClass = -1;
+        buffer->index = 0;
+        atomic_fetch_add_explicit(&pool->oversize, 1, memory_order_relaxed);
+        return true;
+    }
+
+    for (int i = 0; i < pool->classCount; i++) {
+        if (pool->classes[i].size < size) continue;
+        if (!takeBuffer(&pool->classes[i], buffer)) {
+            atomic_fetch_add_explicit(&pool->promoted, 1, memory_order_relaxed);
+            continue;
+        }
+        buffer->sizeClass = i;
+        return true;
+    }
+    atomic_fetch_add_explicit(&pool->exhausted, 1, memory_order_relaxed);
+    return false;
+}
+
+//Decode thread only
+void framepoolRelease(PFRAMEPOOL pool, PFRAMEPOOL_BUFFER buffer) {
+    if (buffer->data == NULL) return;
+    if (buffer->sizeClass < 0) {
+        free(buffer->data);
+        buffer->data = NULL;
+        return;
+    }
+
+    PFRAMEPOOL_CLASS sizeClass = &pool->classes[buffer->sizeClass];
+    unsigned int returned = atomic_load_explicit(&sizeClass->returned, memory_order_relaxed);
+    sizeClass->ring[returned % sizeClass->count] = buffer->index;
+    atomic_store_explicit(&sizeClass->returned, returned + 1, memory_order_release);
+    buffer->data = NULL;
+}
+
+/* Receive thread only, for the buffer it acquired last: taken steps back instead of
+ * the buffer going through returned, which belongs to the decode thread. The ring
+ * entry still holds the index, the decode thread can't reach that position while
+ * the buffer is out.
+ */
+void framepoolUndo(PFRAMEPOOL pool, PFRAMEPOOL_BUFFER buffer) {
+    if (buffer->data == NULL) return;
+    if (buffer->sizeClass < 0) {
+        free(buffer->data);
+        buffer->data = NULL;
+        return;
+    }
+
+    PFRAMEPOOL_CLASS sizeClass = &pool->classes[buffer->sizeClass];
+    unsigned int taken = atomic_load_explicit(&sizeClass->taken, memory_order_relaxed);
+    atomic_store_explicit(&sizeClass->taken, taken - 1, memory_order_release);
+    buffer->data = NULL;
+}
+
+//Safe from any thread, each number read on its own
+void framepoolStats(PFRAMEPOOL pool, PFRAMEPOOL_STATS stats) {
+    memset(stats, 0, sizeof(FRAMEPOOL_STATS));
+    stats->classes = pool->classCount;
+    for (int i = 0; i < pool->classCount; i++) {
+        PFRAMEPOOL_CLASS sizeClass = &pool->classes[i];
+        unsigned int taken = atomic_load_explicit(&sizeClass->taken, memory_order_acquire);
+        unsigned int returned = atomic_load_explicit(&sizeClass->returned, memory_order_acquire);
+        unsigned int available = returned - taken;
+        stats->size[i] = sizeClass->size;
+        stats->count[i] = sizeClass->count;
+        stats->inUse[i] = available < sizeClass->count ? sizeClass->count - available : 0;
+        stats->highWater[i] = atomic_load_explicit(&sizeClass->highWater, memory_order_relaxed);
+    }
+    stats->mappedBytes = pool->mappedBytes;
+    stats->hugePages = pool->hugePages;
+    stats->promoted = atomic_load_explicit(&pool->promoted, memory_order_relaxed);
+    stats->exhausted = atomic_load_explicit(&pool->exhausted, memory_order_relaxed);
+    stats->oversize = atomic_load_explicit(&pool->oversize, memory_order_relaxed);
+}
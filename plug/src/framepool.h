@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <Limelight.h>
+
+//Enough for 4K at 20 Mbps to double all the way up to its largest frame
+#define FRAMEPOOL_CLASSES 10
+//Buffers in the classes an ordinary frame lands in: a full decode queue plus the unit being decoded and one spare
+#define FRAMEPOOL_COMMON_COUNT 18
+//Buffers in the classes only IDR frames reach
+#define FRAMEPOOL_LARGE_COUNT 4
+//Kilobits per second assumed when the stream configuration is not known
+#define FRAMEPOOL_DEFAULT_BITRATE 20000
+
+/* One size class: its buffers are carved out of the pool's mapping and handed
+ * around by index through a ring. The receive thread takes from the ring and the
+ * decode thread gives back to it, so each index moves single producer, single
+ * consumer and no lock is needed.
+ */
+typedef struct _FRAMEPOOL_CLASS {
+    size_t size;
+    unsigned int count;
+    char *base;
+    unsigned short *ring;
+    _Alignas(64) atomic_uint taken;
+    _Alignas(64) atomic_uint returned;
+    atomic_uint highWater;
+} FRAMEPOOL_CLASS, *PFRAMEPOOL_CLASS;
+
+//sizeClass is -1 for a frame bigger than every class, which gets a heap buffer of its own
+typedef struct _FRAMEPOOL_BUFFER {
+    char *data;
+    size_t size;
+    int sizeClass;
+    unsigned short index;
+} FRAMEPOOL_BUFFER, *PFRAMEPOOL_BUFFER;
+
+typedef struct _FRAMEPOOL_STATS {
+    int classes;
+    size_t size[FRAMEPOOL_CLASSES];
+    unsigned int count[FRAMEPOOL_CLASSES];
+    unsigned int inUse[FRAMEPOOL_CLASSES];
+    unsigned int highWater[FRAMEPOOL_CLASSES];
+    size_t mappedBytes;
+    bool hugePages;
+    unsigned long long promoted;
+    unsigned long long exhausted;
+    unsigned long long oversize;
+} FRAMEPOOL_STATS, *PFRAMEPOOL_STATS;
+
+typedef struct _FRAMEPOOL {
+    FRAMEPOOL_CLASS classes[FRAMEPOOL_CLASSES];
+    int classCount;
+    char *mapping;
+    size_t mappedBytes;
+    bool hugePages;
+    atomic_ullong promoted;
+    atomic_ullong exhausted;
+    atomic_ullong oversize;
+} FRAMEPOOL, *PFRAMEPOOL;
+
+int framepoolInit(PFRAMEPOOL pool, int width, int height, int fps, int bitrateKbps);
+void framepoolFree(PFRAMEPOOL pool);
+bool framepoolAcquire(PFRAMEPOOL pool, size_t size, PFRAMEPOOL_BUFFER buffer);
+void framepoolRelease(PFRAMEPOOL pool, PFRAMEPOOL_BUFFER buffer);
+void framepoolUndo(PFRAMEPOOL pool, PFRAMEPOOL_BUFFER buffer);
+void framepoolStats(PFRAMEPOOL pool, PFRAMEPOOL_STATS stats);
@@ -0,0 +1,141 @@
+#include "jitterbuf.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+int jitterbufInit(PJITTERBUF buffer, int channels, int frameSamples, int sampleRate) {
+    memset(buffer, 0, sizeof(JITTERBUF));
+    buffer->pcm = malloc((size_t) JITTERBUF_SLOTS * frameSamples * channels * sizeof(short));
+    if (buffer->pcm == NULL) return -1;
+
+    buffer->channels = channels;
+    buffer->frameSamples = frameSamples;
+    buffer->frameUs = (unsigned long long) frameSamples * 1000000 / sampleRate;
+    buffer->buffering = true;
+    buffer->smoothedDepth = JITTERBUF_MIN_TARGET * 16;
+    atomic_init(&buffer->head, 0);
+    atomic_init(&buffer->tail, 0);
+    atomic_init(&buffer->target, JITTERBUF_MIN_TARGET);
+    atomic_init(&buffer->underrun, false);
+    return 0;
+}
+
+void jitterbufFree(PJITTERBUF buffer) {
+    free(buffer->pcm);
+    buffer->pcm = NULL;
+}
+
+//Receive thread: room for one packet of samples, or NULL when full and the packet has to go
+short *jitterbufBegin(PJITTERBUF buffer) {
+    unsigned int head = atomic_load_explicit(&buffer->head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&buffer->tail, memory_order_acquire);
+    if (head - tail >= JITTERBUF_SLOTS) {
+        atomic_fetch_add_explicit(&buffer->overflows, 1, memory_order_relaxed);
+        return NULL;
+    }
+    return buffer->pcm + (size_t) (head % JITTERBUF_SLOTS) * buffer->frameSamples * buffer->channels;
+}
+
+/* Receive thread: publishes the packet filled since jitterbufBegin. Jitter is the
+ * running mean deviation of the gap between arrivals from one packet's duration,
+ * as RTP receivers estimate it, kept in sixteenths of a microsecond.
+ */
+void jitterbufCommit(PJITTERBUF buffer, int samples, unsigned long long arrivalUs) {
+    unsigned int head = atomic_load_explicit(&buffer->head, memory_order_relaxed);
+    buffer->lengths[head % JITTERBUF_SLOTS] = samples;
+    atomic_store_explicit(&buffer->head, head + 1, memory_order_release);
+    atomic_fetch_add_explicit(&buffer->packets, 1, memory_order_relaxed);
+
+    //The output side ran dry waiting for this one
+    if (atomic_exchange_explicit(&buffer->underrun, false, memory_order_relaxed))
+        atomic_fetch_add_explicit(&buffer->late, 1, memory_order_relaxed);
+
+    if (buffer->lastArrivalUs != 0) {
+        long long gap = (long long) (arrivalUs - buffer->lastArrivalUs) - buffer->frameUs;
+        unsigned int deviation = gap < 0 ? -gap : gap;
+        buffer->jitter += deviation - ((buffer->jitter + 8) >> 4);
+    }
+    buffer->lastArrivalUs = arrivalUs;
+
+    unsigned int jitterUs = buffer->jitter >> 4;
+    unsigned int target = JITTERBUF_MIN_TARGET + (jitterUs * JITTERBUF_JITTER_MARGIN + buffer->frameUs - 1) / buffer->frameUs;
+    if (target > JITTERBUF_SLOTS / 2) target = JITTERBUF_SLOTS / 2;
+    atomic_store_explicit(&buffer->jitterUs, jitterUs, memory_order_relaxed);
+    atomic_store_explicit(&buffer->target, target, memory_order_relaxed);
+}
+
+/* Output thread: the next packet into out, which holds JITTERBUF_READ_SAMPLES.
+ * Returns the sample frames written, zero while refilling after an underrun,
+ * when the caller plays silence instead.
+ */
+int jitterbufRead(PJITTERBUF buffer, short *out) {
+    unsigned int tail = atomic_load_explicit(&buffer->tail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&buffer->head, memory_order_acquire);
+    unsigned int target = atomic_load_explicit(&buffer->target, memory_order_relaxed);
+    unsigned int depth = head - tail;
+
+    if (depth == 0) {
+        if (!buffer->buffering) {
+            atomic_fetch_add_explicit(&buffer->underruns, 1, memory_order_relaxed);
+            atomic_store_explicit(&buffer->underrun, true, memory_order_relaxed);
+        }
+        buffer->buffering = true;
+        return 0;
+    }
+    if (buffer->buffering) {
+        if (depth < target) return 0;
+        buffer->buffering = false;
+        buffer->smoothedDepth = depth * 16;
+    }
+
+    //Depth averaged over about sixteen packets, in sixteenths, so one burst does not trigger a correction
+    buffer->smoothedDepth += depth - (buffer->smoothedDepth >> 4);
+    //Packets off target past a one packet dead band; the further off, the faster the catch up
+    int adjust = 0;
+    int smoothed = buffer->smoothedDepth >> 4;
+    if (smoothed > (int) target + 1) adjust = -(smoothed - (int) target);
+    else if (smoothed + 1 < (int) target) adjust = (int) target - smoothed;
+    if (adjust > JITTERBUF_MAX_ADJUST) adjust = JITTERBUF_MAX_ADJUST;
+    if (adjust < -JITTERBUF_MAX_ADJUST) adjust = -JITTERBUF_MAX_ADJUST;
+
+    int channels = buffer->channels;
+    int samples = buffer->lengths[tail % JITTERBUF_SLOTS];
+    short *pcm = buffer->pcm + (size_t) (tail % JITTERBUF_SLOTS) * buffer->frameSamples * channels;
+    int corrections = (samples / JITTERBUF_ADJUST_RATIO + 1) * (adjust < 0 ? -adjust : adjust);
+    int spacing = samples / (corrections + 1);
+    if (spacing == 0) corrections = 0;
+
+    //Drop or repeat the sample frames at every spacing, spread out to stay inaudible
+    int written = 0;
+    int next = spacing;
+    for (int i = 0; i < samples; i++) {
+        if (corrections > 0 && i == next) {
+            corrections--;
+            next += spacing;
+            if (adjust < 0) continue;
+            memcpy(out + (size_t) written++ * channels, pcm + (size_t) i * channels, channels * sizeof(short));
+        }
+        memcpy(out + (size_t) written++ * channels, pcm + (size_t) i * channels, channels * sizeof(short));
+    }
+    atomic_store_explicit(&buffer->tail, tail + 1, memory_order_release);
+
+    if (written < samples) atomic_fetch_add_explicit(&buffer->samplesDropped, samples - written, memory_order_relaxed);
+    if (written > samples) atomic_fetch_add_explicit(&buffer->samplesRepeated, written - samples, memory_order_relaxed);
+    return written;
+}
+
+//Safe from any thread; the numbers are each exact but not taken at one instant
+void jitterbufStats(PJITTERBUF buffer, PJITTERBUF_STATS stats) {
+    unsigned int tail = atomic_load_explicit(&buffer->tail, memory_order_acquire);
+    unsigned int head = atomic_load_explicit(&buffer->head, memory_order_acquire);
+
+    stats->depth = head - tail;
+    stats->target = atomic_load_explicit(&buffer->target, memory_order_relaxed);
+    stats->jitterUs = atomic_load_explicit(&buffer->jitterUs, memory_order_relaxed);
+    stats->packets = atomic_load_explicit(&buffer->packets, memory_order_relaxed);
+    stats->underruns = atomic_load_explicit(&buffer->underruns, memory_order_relaxed);
+    stats->late = atomic_load_explicit(&buffer->late, memory_order_relaxed);
+    stats->overflows = atomic_load_explicit(&buffer->overflows, memory_order_relaxed);
+    stats->samplesDropped = atomic_load_explicit(&buffer->samplesDropped, memory_order_relaxed);
+    stats->samplesRepeated = atomic_load_explicit(&buffer->samplesRepeated, memory_order_relaxed);
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+//Slots in the ring, a power of two; 32 packets is 160ms at the usual 5ms Opus frame
+#define JITTERBUF_SLOTS 32
+//Fewest packets the buffer aims to hold, even on a perfectly steady network
+#define JITTERBUF_MIN_TARGET 2
+//Arrival jitter multiples kept in the buffer, enough to ride out most spikes
+#define JITTERBUF_JITTER_MARGIN 3
+//One sample frame in this many is dropped or repeated per packet off target, about 1% speed
+#define JITTERBUF_ADJUST_RATIO 96
+//Packets off target the catch up speed stops growing at
+#define JITTERBUF_MAX_ADJUST 4
+//Sample frames jitterbufRead may write for a packet of frameSamples
+#define JITTERBUF_READ_SAMPLES(frameSamples) ((frameSamples) + ((frameSamples) / JITTERBUF_ADJUST_RATIO + 1) * JITTERBUF_MAX_ADJUST)
+
+typedef struct _JITTERBUF_STATS {
+    unsigned int depth;
+    unsigned int target;
+    unsigned int jitterUs;
+    unsigned long long packets;
+    unsigned long long underruns;
+    unsigned long long late;
+    unsigned long long overflows;
+    unsigned long long samplesDropped;
+    unsigned long long samplesRepeated;
+} JITTERBUF_STATS, *PJITTERBUF_STATS;
+
+/* Decoded PCM between the receive thread, which decodes straight into the slot
+ * at the head, and the output thread, which drains from the tail at the device's
+ * pace. Each side only writes its own index, so neither ever waits on the other.
+ *
+ * The target depth follows the measured arrival jitter. The output side holds the
+ * buffer near it by dropping or repeating single sample frames spread through a
+ * packet, which shifts latency by well under a millisecond per packet instead of
+ * the audible skips of dropping whole packets.
+ */
+typedef struct _JITTERBUF {
+    short *pcm;
+    int channels;
+    int frameSamples;
+    unsigned int frameUs;
+    unsigned int lengths[JITTERBUF_SLOTS];
+    _Alignas(64) atomic_uint head;
+    unsigned long long lastArrivalUs;
+    unsigned int jitter;
+    _Alignas(64) atomic_uint tail;
+    unsigned int smoothedDepth;
+    bool buffering;
+    atomic_uint target;
+    atomic_uint jitterUs;
+    atomic_ullong packets;
+    atomic_ullong underruns;
+    atomic_ullong late;
+    atomic_ullong overflows;
+    atomic_ullong samplesDropped;
+    atomic_ullong samplesRepeated;
+    atomic_bool underrun;
+} JITTERBUF, *PJITTERBUF;
+
+int jitterbufInit(PJITTERBUF buffer, int channels, int frameSamples, int sampleRate);
+void jitterbufFree(PJITTERBUF buffer);
+short *jitterbufBegin(PJITTERBUF buffer);
+void jitterbufCommit(PJITTERBUF buffer, int samples, unsigned long long arrivalUs);
+int jitterbufRead(PJITTERBUF buffer, short *out);
+void jitterbufStats(PJITTERBUF buffer, PJITTERBUF_STATS stats);
@@ -0,0 +1,75 @@
+#include "latency.h"
+
+#include <string.h>
+#include <time.h>
+
+const char *latencyStageNames[LATENCY_STAGES] = { "queue", "wait", "decode", "present", "total" };
+
+void latencyStamp(PLATENCY_FRAME frame, int point) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    frame->times[point] = (unsigned long long) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static int bucketOf(unsigned long long value) {
+    if (value < LATENCY_SUB_COUNT) return value;
+
+    int magnitude = 63 - __builtin_clzll(value);
+    if (magnitude >= LATENCY_MAX_BITS) return LATENCY_BUCKETS - 1;
+    int shift = magnitude - LATENCY_SUB_BITS;
+    return (shift + 1) * LATENCY_SUB_COUNT + (value >> shift) - LATENCY_SUB_COUNT;
+}
+
+//The highest value a bucket holds, so percentiles never read low
+static unsigned long long bucketTop(int bucket) {
+    if (bucket < LATENCY_SUB_COUNT) return bucket;
+
+    int shift = bucket / LATENCY_SUB_COUNT - 1;
+    unsigned long long base = (unsigned long long) (bucket % LATENCY_SUB_COUNT + LATENCY_SUB_COUNT) << shift;
+    return base + (1ULL << shift) - 1;
+}
+
+static void recordValue(PLATENCY_HISTOGRAM histogram, unsigned long long value) {
+    atomic_fetch_add_explicit(&histogram->buckets[bucketOf(value)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->count, 1, memory_order_relaxed);
+
+    unsigned long long max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+    while (value > max && !atomic_compare_exchange_weak_explicit(&histogram->max, &max, value, memory_order_relaxed, memory_order_relaxed));
+}
+
+//Points never stamped, zero, leave their stages out
+void latencyRecord(PLATENCY latency, PLATENCY_FRAME frame) {
+    for (int stage = 0; stage < LATENCY_STAGE_TOTAL; stage++) {
+        if (frame->times[stage] == 0 || frame->times[stage + 1] < frame->times[stage]) continue;
+        recordValue(&latency->stages[stage], frame->times[stage + 1] - frame->times[stage]);
+    }
+    unsigned long long received = frame->times[LATENCY_RECEIVED];
+    unsigned long long presented = frame->times[LATENCY_PRESENTED];
+    if (received != 0 && presented >= received) recordValue(&latency->stages[LATENCY_STAGE_TOTAL], presented - received);
+}
+
+//Microseconds. Safe while frames are being recorded; a frame in flight may be counted in one bucket and not yet the total
+void latencyStats(PLATENCY latency, int stage, PLATENCY_STATS stats) {
+    PLATENCY_HISTOGRAM histogram = &latency->stages[stage];
+    unsigned long long counts[LATENCY_BUCKETS];
+    unsigned long long total = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        counts[i] = atomic_load_explicit(&histogram->buckets[i], memory_order_relaxed);
+        total += counts[i];
+    }
+
+    memset(stats, 0, sizeof(LATENCY_STATS));
+    stats->count = total;
+    stats->max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+    if (total == 0) return;
+
+    unsigned long long wanted[3] = { (total * 50 + 99) / 100, (total * 95 + 99) / 100, (total * 99 + 99) / 100 };
+    unsigned long long *results[3] = { &stats->p50, &stats->p95, &stats->p99 };
+    unsigned long long seen = 0;
+    int next = 0;
+    for (int i = 0; i < LATENCY_BUCKETS && next < 3; i++) {
+        seen += counts[i];
+        while (next < 3 && seen >= wanted[next]) *results[next++] = bucketTop(i);
+    }
+    for (int i = 0; i < 3; i++) if (*results[i] > stats->max) *results[i] = stats->max;
+}
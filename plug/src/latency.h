@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdatomic.h>
+
+//Points a frame is stamped at on its way through the plugin
+#define LATENCY_RECEIVED 0
+#define LATENCY_QUEUED 1
+#define LATENCY_DECODING 2
+#define LATENCY_DECODED 3
+#define LATENCY_PRESENTED 4
+#define LATENCY_POINTS 5
+
+//Stages histogrammed: one between each pair of points, then received to presented
+#define LATENCY_STAGE_TOTAL (LATENCY_POINTS - 1)
+#define LATENCY_STAGES LATENCY_POINTS
+
+//Buckets per power of two, so each bucket is within 1/32 of its value
+#define LATENCY_SUB_BITS 5
+#define LATENCY_SUB_COUNT (1 << LATENCY_SUB_BITS)
+//Microseconds up to 2^26, about a minute; anything longer lands in the last bucket
+#define LATENCY_MAX_BITS 26
+#define LATENCY_BUCKETS ((LATENCY_MAX_BITS - LATENCY_SUB_BITS + 1) * LATENCY_SUB_COUNT)
+
+typedef struct _LATENCY_FRAME {
+    unsigned long long times[LATENCY_POINTS];
+} LATENCY_FRAME, *PLATENCY_FRAME;
+
+/* Log-linear buckets as HDR histograms lay them out: exact below 32us, then 32
+ * per power of two. Recording is one relaxed increment, and readers walk the
+ * buckets without stopping the writer.
+ */
+typedef struct _LATENCY_HISTOGRAM {
+    atomic_ullong buckets[LATENCY_BUCKETS];
+    atomic_ullong count;
+    atomic_ullong max;
+} LATENCY_HISTOGRAM, *PLATENCY_HISTOGRAM;
+
+typedef struct _LATENCY {
+    LATENCY_HISTOGRAM stages[LATENCY_STAGES];
+} LATENCY, *PLATENCY;
+
+typedef struct _LATENCY_STATS {
+    unsigned long long count;
+    unsigned long long p50;
+    unsigned long long p95;
+    unsigned long long p99;
+    unsigned long long max;
+} LATENCY_STATS, *PLATENCY_STATS;
+
+extern const char *latencyStageNames[LATENCY_STAGES];
+
+void latencyStamp(PLATENCY_FRAME frame, int point);
+void latencyRecord(PLATENCY latency, PLATENCY_FRAME frame);
+void latencyStats(PLATENCY latency, int stage, PLATENCY_STATS stats);
+
+//Building with LIGHTPLUG_NO_LATENCY takes the stamps out altogether
+#ifdef LIGHTPLUG_NO_LATENCY
+#define LATENCY_STAMP(frame, point)
+#define LATENCY_RECORD(latency, frame)
+#else
+#define LATENCY_STAMP(frame, point) latencyStamp(frame, point)
+#define LATENCY_RECORD(latency, frame) latencyRecord(latency, frame)
+#endif
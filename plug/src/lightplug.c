@@ -9,6 +9,9 @@
 #include <gsl/base.h>
 #include <Limelight.h>
 
+#include "alsa.h"
+#include "duqueue.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -18,12 +21,107 @@ bool startsWith(const char *a, const char *b) {
     return 0;
 }
 
-static int mpv_renderer_setup(int videoFormat, int width, int height, int redrawRate, void *context, int drFlags) {};
+//Filled by the receive thread, drained by the decode thread
+static DUQUEUE decodeQueue;
+static FRAMEPOOL framePool;
+#ifndef LIGHTPLUG_NO_LATENCY
+static LATENCY latency;
+#endif
+
+//How often the latency properties are refreshed
+#define LATENCY_PUBLISH_SECONDS 1.0
 
-void mpv_cleanup() {
+//context is the STREAM_CONFIGURATION given to LiStartConnection, for the bitrate
+static int mpv_renderer_setup(int videoFormat, int width, int height, int redrawRate, void *context, int drFlags) {
+    PSTREAM_CONFIGURATION stream = context;
+    if (framepoolInit(&framePool, width, height, redrawRate, stream != NULL ? stream->bitrate : 0) != 0) return -1;
+
+    duqueueInit(&decodeQueue, &framePool);
+    return 0;
 }
 
-int mpv_submit_decode_unit(PDECODE_UNIT decodeUnit) {}
+void mpv_renderer_cleanup() {
+    duqueueFree(&decodeQueue);
+    framepoolFree(&framePool);
+}
+
+//Runs on the receive thread: copies the unit and returns, a slow decoder costs frames, not packets
+int mpv_submit_decode_unit(PDECODE_UNIT decodeUnit) {
+    return duqueuePush(&decodeQueue, decodeUnit);
+}
+
+//Decode thread: the next unit for the decoder, or NULL after timeoutMs
+PQUEUED_UNIT mpv_next_decode_unit(int timeoutMs) {
+    PQUEUED_UNIT unit = duqueueWait(&decodeQueue, timeoutMs);
+    if (unit != NULL) LATENCY_STAMP(&unit->times, LATENCY_DECODING);
+    return unit;
+}
+
+//Decode thread: gives the unit back once decoded; times travel on with the picture to mpv_frame_presented
+void mpv_decode_unit_done(PQUEUED_UNIT unit, PLATENCY_FRAME times) {
+#ifndef LIGHTPLUG_NO_LATENCY
+    LATENCY_STAMP(&unit->times, LATENCY_DECODED);
+    *times = unit->times;
+#endif
+    duqueuePop(&decodeQueue);
+}
+
+void mpv_frame_presented(PLATENCY_FRAME times) {
+    LATENCY_STAMP(times, LATENCY_PRESENTED);
+    LATENCY_RECORD(&latency, times);
+}
+
+//All zero when built without latency tracking
+void mpv_latency_stats(int stage, PLATENCY_STATS stats) {
+#ifdef LIGHTPLUG_NO_LATENCY
+    memset(stats, 0, sizeof(LATENCY_STATS));
+#else
+    latencyStats(&latency, stage, stats);
+#endif
+}
+
+void mpv_decode_queue_stats(PDUQUEUE_STATS stats) {
+    duqueueStats(&decodeQueue, stats);
+}
+
+void mpv_frame_pool_stats(PFRAMEPOOL_STATS stats) {
+    framepoolStats(&framePool, stats);
+}
+
+void mpv_audio_buffer_stats(PJITTERBUF_STATS stats) {
+    alsa_renderer_stats(stats);
+}
+
+#ifndef LIGHTPLUG_NO_LATENCY
+/* Published as user-data/lightplug/latency/<stage>/{count,p50,p95,p99,max} in
+ * microseconds, for the OSD or scripts to read.
+ */
+static void publishLatency(mpv_handle *handle) {
+    mpv_node stages[LATENCY_STAGES];
+    mpv_node_list stageLists[LATENCY_STAGES];
+    mpv_node values[LATENCY_STAGES][5];
+    char *valueNames[5] = { "count", "p50", "p95", "p99", "max" };
+    char *stageNames[LATENCY_STAGES];
+
+    for (int stage = 0; stage < LATENCY_STAGES; stage++) {
+        LATENCY_STATS stats;
+        latencyStats(&latency, stage, &stats);
+        unsigned long long numbers[5] = { stats.count, stats.p50, stats.p95, stats.p99, stats.max };
+        for (int i = 0; i < 5; i++) {
+            values[stage][i].format = MPV_FORMAT_INT64;
+            values[stage][i].u.int64 = numbers[i];
+        }
+        stageLists[stage] = (mpv_node_list) { .num = 5, .values = values[stage], .keys = valueNames };
+        stages[stage].format = MPV_FORMAT_NODE_MAP;
+        stages[stage].u.list = &stageLists[stage];
+        stageNames[stage] = (char *) latencyStageNames[stage];
+    }
+
+    mpv_node_list list = { .num = LATENCY_STAGES, .values = stages, .keys = stageNames };
+    mpv_node root = { .format = MPV_FORMAT_NODE_MAP, .u.list = &list };
+    mpv_set_property_async(handle, 0, "user-data/lightplug/latency", MPV_FORMAT_NODE, &root);
+}
+#endif
 
 int mpv_open_cplugin(mpv_handle *handle) {
     PGSL_DATA server;
@@ -32,9 +130,16 @@ int mpv_open_cplugin(mpv_handle *handle) {
     //GSl_Applist()
     //GSl_StartApp()
     
-    //LiStartConnection(&server->serverinfo, &config->stream, &connection_callbacks, (DECODER_RENDERER_CALLBACKS)decoder_callbacks_mpv, platform_get_audio(system, config->audio_device), NULL, drFlags, config->audio_device, 0);
+    //LiStartConnection(&server->serverinfo, &config->stream, &connection_callbacks, (DECODER_RENDERER_CALLBACKS)decoder_callbacks_mpv, platform_get_audio(system, config->audio_device), &config->stream, drFlags, config->audio_device, 0);
     while (1) {
-        mpv_event *event = mpv_wait_event(handle, -1);
+        mpv_event *event = mpv_wait_event(handle, LATENCY_PUBLISH_SECONDS);
+        //Timed out with nothing to handle
+        if (event->event_id == MPV_EVENT_NONE) {
+#ifndef LIGHTPLUG_NO_LATENCY
+            publishLatency(handle);
+#endif
+            continue;
+        }
         char *result = NULL;
         mpv_get_property(handle, "stream-open-filename", 1, &result);
         printf("%s\n", result);
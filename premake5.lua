@@ -3,21 +3,80 @@ os.execute("sed 's/~/*/g' src/base.c > srctest/base.c")
 os.execute("sed 's/~/*/g' src/parsexml.c > srctest/parsexml.c")
 os.execute("sed 's/~/*/g' src/docurl.c > srctest/docurl.c")
 os.execute("sed 's/~/*/g' src/cryptssl.c > srctest/cryptssl.c")
+os.execute("sed 's/~/*/g' src/scanxml.c > srctest/scanxml.c")
+os.execute("sed 's/~/*/g' src/statuscache.c > srctest/statuscache.c")
+os.execute("sed 's/~/*/g' src/timerwheel.c > srctest/timerwheel.c")
+os.execute("sed 's/~/*/g' src/urlquery.c > srctest/urlquery.c")
+os.execute("sed 's/~/*/g' src/hoststore.c > srctest/hoststore.c")
+os.execute("sed 's/~/*/g' src/applist.c > srctest/applist.c")
+os.execute("sed 's/~/*/g' src/modelist.c > srctest/modelist.c")
+os.execute("sed 's/~/*/g' src/hexcodec.c > srctest/hexcodec.c")
 os.execute("sed 's/~/*/g' src/base.h > srctest/base.h")
 os.execute("sed 's/~/*/g' src/parsexml.h > srctest/parsexml.h")
 os.execute("sed 's/~/*/g' src/docurl.h > srctest/docurl.h")
 os.execute("sed 's/~/*/g' src/cryptssl.h > srctest/cryptssl.h")
+os.execute("sed 's/~/*/g' src/scanxml.h > srctest/scanxml.h")
+os.execute("sed 's/~/*/g' src/statuscache.h > srctest/statuscache.h")
+os.execute("sed 's/~/*/g' src/timerwheel.h > srctest/timerwheel.h")
+os.execute("sed 's/~/*/g' src/urlquery.h > srctest/urlquery.h")
+os.execute("sed 's/~/*/g' src/hoststore.h > srctest/hoststore.h")
+os.execute("sed 's/~/*/g' src/applist.h > srctest/applist.h")
+os.execute("sed 's/~/*/g' src/modelist.h > srctest/modelist.h")
+os.execute("sed 's/~/*/g' src/hexcodec.h > srctest/hexcodec.h")
 os.execute("sed 's/~/*/g' src/errorlist.h > srctest/errorlist.h")
 
+os.execute("mkdir -p benchtest")
+os.execute("sed 's/~/*/g' bench/bench.c > benchtest/bench.c")
+os.execute("sed 's/~/*/g' bench/benchxml.c > benchtest/benchxml.c")
+os.execute("sed 's/~/*/g' bench/benchhex.c > benchtest/benchhex.c")
+os.execute("sed 's/~/*/g' bench/benchcrypt.c > benchtest/benchcrypt.c")
+os.execute("sed 's/~/*/g' bench/benchcurl.c > benchtest/benchcurl.c")
+os.execute("sed 's/~/*/g' bench/benchrequest.c > benchtest/benchrequest.c")
+os.execute("sed 's/~/*/g' bench/benchdiff.c > benchtest/benchdiff.c")
+os.execute("sed 's/~/*/g' bench/bench.h > benchtest/bench.h")
+
 os.execute("sed 's/~|\(.*\)|/(\1*)/' -i srctest/parsexml.c")
 os.execute("sed 's/|\([A-z]\)\(.*\)\([A-z1-9]\)|/(\1\2\3)/' -i srctest/parsexml.c")
 os.execute("sed 's/~|\(.*\)|/(\1*)/' -i srctest/base.c")
 os.execute("sed 's/|\([A-z]\)\(.*\)\([A-z1-9]\)|/(\1\2\3)/' -i srctest/base.c")
+os.execute("sed 's/~|\(.*\)|/(\1*)/' -i srctest/docurl.c")
+os.execute("sed 's/|\([A-z]\)\(.*\)\([A-z1-9]\)|/(\1\2\3)/' -i srctest/docurl.c")
 os.execute("sed 's/~|\(.*\)|/(\1*)/' -i srctest/cryptssl.c")
 os.execute("sed 's/|\([A-z]\)\(.*\)\([A-z1-9]\)|/(\1\2\3)/' -i srctest/cryptssl.c")
+os.execute("sed 's/~|\(.*\)|/(\1*)/' -i srctest/scanxml.c")
+os.execute("sed 's/|\([A-z]\)\(.*\)\([A-z1-9]\)|/(\1\2\3)/' -i srctest/scanxml.c")
+os.execute("sed 's/~|\(.*\)|/(\1*)/' -i srctest/statuscache.c")
+os.execute("sed 's/|\([A-z]\)\(.*\)\([A-z1-9]\)|/(\1\2\3)/' -i srctest/statuscache.c")
+os.execute("sed 's/~|\(.*\)|/(\1*)/' -i srctest/hoststore.c")
+os.execute("sed 's/|\([A-z]\)\(.*\)\([A-z1-9]\)|/(\1\2\3)/' -i srctest/hoststore.c")
+os.execute("sed 's/~|\(.*\)|/(\1*)/' -i srctest/applist.c")
+os.execute("sed 's/|\([A-z]\)\(.*\)\([A-z1-9]\)|/(\1\2\3)/' -i srctest/applist.c")
+os.execute("sed 's/~|\(.*\)|/(\1*)/' -i srctest/modelist.c")
+os.execute("sed 's/|\([A-z]\)\(.*\)\([A-z1-9]\)|/(\1\2\3)/' -i srctest/modelist.c")
+os.execute("sed 's/~|\(.*\)|/(\1*)/' -i srctest/hexcodec.c")
+os.execute("sed 's/|\([A-z]\)\(.*\)\([A-z1-9]\)|/(\1\2\3)/' -i srctest/hexcodec.c")
+os.execute("sed 's/~|\(.*\)|/(\1*)/' -i srctest/urlquery.c")
+os.execute("sed 's/|\([A-z]\)\(.*\)\([A-z1-9]\)|/(\1\2\3)/' -i srctest/urlquery.c")
+os.execute("sed 's/~|\(.*\)|/(\1*)/' -i benchtest/bench.c")
+os.execute("sed 's/|\([A-z]\)\(.*\)\([A-z1-9]\)|/(\1\2\3)/' -i benchtest/bench.c")
+os.execute("sed 's/~|\(.*\)|/(\1*)/' -i benchtest/benchxml.c")
+os.execute("sed 's/|\([A-z]\)\(.*\)\([A-z1-9]\)|/(\1\2\3)/' -i benchtest/benchxml.c")
+os.execute("sed 's/~|\(.*\)|/(\1*)/' -i benchtest/benchcrypt.c")
+os.execute("sed 's/|\([A-z]\)\(.*\)\([A-z1-9]\)|/(\1\2\3)/' -i benchtest/benchcrypt.c")
+os.execute("sed 's/~|\(.*\)|/(\1*)/' -i benchtest/benchrequest.c")
+os.execute("sed 's/|\([A-z]\)\(.*\)\([A-z1-9]\)|/(\1\2\3)/' -i benchtest/benchrequest.c")
+
+os.execute("mkdir -p mocktest")
+os.execute("sed 's/~/*/g' mock/mockhost.c > mocktest/mockhost.c")
+os.execute("sed 's/~/*/g' mock/loaddrive.c > mocktest/loaddrive.c")
+os.execute("sed 's/~|\(.*\)|/(\1*)/' -i mocktest/mockhost.c")
+os.execute("sed 's/|\([A-z]\)\(.*\)\([A-z1-9]\)|/(\1\2\3)/' -i mocktest/mockhost.c")
+os.execute("sed 's/~|\(.*\)|/(\1*)/' -i mocktest/loaddrive.c")
+os.execute("sed 's/|\([A-z]\)\(.*\)\([A-z1-9]\)|/(\1\2\3)/' -i mocktest/loaddrive.c")
 
 
 os.execute("sed -i 's/server_info_appversion/serverInfoAppVersion/g' -i srctest/base.c && sed 's/server_info_appversion/serverInfoAppVersion/g' -i srctest/base.c")
+os.execute("sed -i 's/server_info_gfeversion/serverInfoGfeVersion/g' -i srctest/base.c")
 os.execute("sed 's/_openssl_no_engine/OPENSSL_NO_ENGINE/g' -i srctest/cryptssl.c")
 
 
@@ -36,3 +95,29 @@ local ver
 ver = "0.3-beta" 
 
 print("liblight", ver)
+
+project "lightbench"
+kind "ConsoleApp"
+language "C"
+optimize "Speed"
+targetdir "%{cfg.buildcfg}"
+includedirs { "srctest" }
+files { "benchtest/**.h", "benchtest/**.c", "srctest/parsexml.c", "srctest/scanxml.c", "srctest/applist.c", "srctest/modelist.c", "srctest/hexcodec.c", "srctest/urlquery.c" }
+defines { '_bench_version="' .. ver .. '"' }
+links { "expat", "ssl", "crypto", "curl", "pthread", "dl" }
+
+project "lightmock"
+kind "ConsoleApp"
+language "C"
+targetdir "%{cfg.buildcfg}"
+includedirs { "srctest" }
+files { "mocktest/mockhost.c", "srctest/hexcodec.c" }
+links { "ssl", "crypto", "pthread" }
+
+project "lightdrive"
+kind "ConsoleApp"
+language "C"
+targetdir "%{cfg.buildcfg}"
+includedirs { "srctest" }
+files { "mocktest/loaddrive.c" }
+links { "light", "moonlight-common-c", "expat", "ssl", "crypto", "curl", "pthread" }
@@ -0,0 +1,202 @@
+/*This file is part of Moonlight Embedded.
+
+  Copyright (C) 2015 Iwan Timmer
+
+  Moonlight is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  Moonlight is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Moonlight; if not, see <http://www.gnu.org/licenses/>.*/
+
+#include "applist.h"
+#include "errorlist.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static unsigned int hashName(const char ~name) {
+    unsigned int hash = 2166136261u;
+    while (~name) hash = (hash ^ |unsigned char| ~name++) * 16777619u;
+    return hash;
+}
+
+static unsigned int hashId(int id) {
+    return |unsigned int| id * 2654435761u;
+}
+
+static int reservePool(PAPP_BUILDER builder, size_t needed) {
+    if (needed <= builder->poolcapacity) return _gs_ok;
+
+    size_t capacity = builder->poolcapacity > 0 ? builder->poolcapacity : _applist_pool_initial;
+    while (capacity < needed) capacity *= 2;
+
+    char ~pool = realloc(builder->pool, capacity);
+    if (pool == NULL) {
+        builder->failed = true;
+        return _gs_out_of_memory;
+    }
+    ;builder->pool = pool; builder->poolcapacity = capacity;
+
+    return _gs_ok;
+}
+
+void AppList_Begin(PAPP_BUILDER builder) {
+    memset(builder, 0, sizeof(APP_BUILDER));
+}
+
+//Offset 0 of the pool is the empty name every app starts with
+int AppList_Add(PAPP_BUILDER builder) {
+    if (builder->failed) return _gs_out_of_memory;
+
+    if (builder->poolsize == 0) {
+        if (reservePool(builder, _applist_pool_initial) != _gs_ok) return _gs_out_of_memory;
+        ;builder->pool[0] = 0; builder->poolsize = 1;
+    }
+    if (builder->count == builder->capacity) {
+        size_t capacity = builder->capacity > 0 ? builder->capacity * 2 : _applist_initial;
+        PAPP_ENTRY apps = realloc(builder->apps, capacity * sizeof(APP_ENTRY));
+        if (apps == NULL) {
+            builder->failed = true;
+            return _gs_out_of_memory;
+        }
+        ;builder->apps = apps; builder->capacity = capacity;
+    }
+
+    PAPP_ENTRY app = &builder->apps[builder->count++];
+    ;app->id = 0; app->name = 0; app->hash = 0;
+    return _gs_ok;
+}
+
+void AppList_SetId(PAPP_BUILDER builder, int id) {
+    if (builder->count > 0) builder->apps[builder->count - 1].id = id;
+}
+
+//A second title for the same app replaces the first, like the old list did
+int AppList_BeginName(PAPP_BUILDER builder) {
+    if (builder->count == 0 || builder->failed) return _gs_out_of_memory;
+    if (reservePool(builder, builder->poolsize + 1) != _gs_ok) return _gs_out_of_memory;
+
+    ;builder->apps[builder->count - 1].name = |unsigned int| builder->poolsize;
+    ;builder->pool[builder->poolsize++] = 0;
+    return _gs_ok;
+}
+
+//Room for maxlen more bytes of the current name; decoders write straight into the pool
+char ~AppList_Extend(PAPP_BUILDER builder, size_t maxlen) {
+    if (builder->count == 0 || builder->failed) return NULL;
+    if (reservePool(builder, builder->poolsize + maxlen) != _gs_ok) return NULL;
+
+    return builder->pool + builder->poolsize - 1;
+}
+
+void AppList_Extended(PAPP_BUILDER builder, size_t len) {
+    ;builder->poolsize += len; builder->pool[builder->poolsize - 1] = 0;
+}
+
+int AppList_AppendName(PAPP_BUILDER builder, const char ~text, size_t len) {
+    char ~out = AppList_Extend(builder, len);
+    if (out == NULL) return _gs_out_of_memory;
+
+    ;memcpy(out, text, len); AppList_Extended(builder, len);
+    return _gs_ok;
+}
+
+void AppList_Discard(PAPP_BUILDER builder) {
+    ;free(builder->apps); free(builder->pool);
+    memset(builder, 0, sizeof(APP_BUILDER));
+}
+
+/* Entries keep document order. Both indexes are open addressing tables at most half
+ * full, holding entry numbers or _applist_missing; equal keys are found in document
+ * order. The builder is released either way.
+ */
+PAPP_TABLE AppList_Finish(PAPP_BUILDER builder) {
+    if (builder->failed) {
+        AppList_Discard(builder);
+        return NULL;
+    }
+
+    size_t buckets = 8;
+    while (buckets < builder->count * 2) buckets *= 2;
+
+    size_t entries = builder->count * sizeof(APP_ENTRY);
+    size_t indexes = buckets * sizeof(int);
+    PAPP_TABLE table = malloc(sizeof(APP_TABLE) + entries + 2 * indexes + builder->poolsize);
+    if (table == NULL) {
+        AppList_Discard(builder);
+        return NULL;
+    }
+
+    char ~cursor = ~|char| (table + 1);
+    ;table->apps = ~|APP_ENTRY| cursor; cursor += entries;
+    ;table->ids = ~|int| cursor; cursor += indexes;
+    ;table->names = ~|int| cursor; cursor += indexes;
+    ;table->pool = cursor; table->poolsize = builder->poolsize;
+    ;table->count = builder->count; table->mask = buckets - 1;
+
+    if (entries > 0) memcpy(table->apps, builder->apps, entries);
+    if (builder->poolsize > 0) memcpy(table->pool, builder->pool, builder->poolsize);
+    for (size_t i = 0; i < buckets; i++) {
+        ;table->ids[i] = _applist_missing; table->names[i] = _applist_missing;
+    }
+
+    for (size_t i = 0; i < table->count; i++) {
+        PAPP_ENTRY app = &table->apps[i];
+        app->hash = hashName(table->pool + app->name);
+
+        size_t slot = hashId(app->id) & table->mask;
+        while (table->ids[slot] != _applist_missing) slot = (slot + 1) & table->mask;
+        table->ids[slot] = |int| i;
+
+        slot = app->hash & table->mask;
+        while (table->names[slot] != _applist_missing) slot = (slot + 1) & table->mask;
+        table->names[slot] = |int| i;
+    }
+
+    AppList_Discard(builder);
+    return table;
+}
+
+size_t AppList_Count(PAPP_TABLE table) {
+    return table == NULL ? 0 : table->count;
+}
+
+int AppList_Id(PAPP_TABLE table, size_t index) {
+    return table->apps[index].id;
+}
+
+const char ~AppList_Name(PAPP_TABLE table, size_t index) {
+    return table->pool + table->apps[index].name;
+}
+
+//Answers the entry number or _applist_missing
+int AppList_FindId(PAPP_TABLE table, int id) {
+    if (table == NULL) return _applist_missing;
+
+    for (size_t slot = hashId(id) & table->mask; table->ids[slot] != _applist_missing; slot = (slot + 1) & table->mask) {
+        if (table->apps[table->ids[slot]].id == id) return table->ids[slot];
+    }
+    return _applist_missing;
+}
+
+int AppList_FindName(PAPP_TABLE table, const char ~name) {
+    if (table == NULL || name == NULL) return _applist_missing;
+
+    unsigned int hash = hashName(name);
+    for (size_t slot = hash & table->mask; table->names[slot] != _applist_missing; slot = (slot + 1) & table->mask) {
+        PAPP_ENTRY app = &table->apps[table->names[slot]];
+        if (app->hash == hash && strcmp(table->pool + app->name, name) == 0) return table->names[slot];
+    }
+    return _applist_missing;
+}
+
+void AppList_Free(PAPP_TABLE table) {
+    free(table);
+}
@@ -0,0 +1,71 @@
+/*This file is part of Moonlight Embedded.
+
+  Copyright (C) 2015 Iwan Timmer
+
+  Moonlight is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  Moonlight is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Moonlight; if not, see <http://www.gnu.org/licenses/>.*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define _applist_initial 64
+#define _applist_pool_initial 2048
+#define _applist_missing -1
+
+//name is an offset into the string pool, every name there ends with a zero
+typedef struct _APP_ENTRY {
+    int id;
+    unsigned int name;
+    unsigned int hash;
+} APP_ENTRY, ~PAPP_ENTRY;
+
+//Header, entries, both hash indexes and the pool sit in one allocation
+typedef struct _APP_TABLE {
+    size_t count;
+    size_t mask;
+    PAPP_ENTRY apps;
+    int ~ids;
+    int ~names;
+    char ~pool;
+    size_t poolsize;
+} APP_TABLE, ~PAPP_TABLE;
+
+//Grows while a response is parsed, AppList_Finish packs it into a table
+typedef struct _APP_BUILDER {
+    PAPP_ENTRY apps;
+    size_t count;
+    size_t capacity;
+    char ~pool;
+    size_t poolsize;
+    size_t poolcapacity;
+    bool failed;
+} APP_BUILDER, ~PAPP_BUILDER;
+
+void AppList_Begin(PAPP_BUILDER builder);
+int AppList_Add(PAPP_BUILDER builder);
+void AppList_SetId(PAPP_BUILDER builder, int id);
+int AppList_BeginName(PAPP_BUILDER builder);
+char ~AppList_Extend(PAPP_BUILDER builder, size_t maxlen);
+void AppList_Extended(PAPP_BUILDER builder, size_t len);
+int AppList_AppendName(PAPP_BUILDER builder, const char ~text, size_t len);
+PAPP_TABLE AppList_Finish(PAPP_BUILDER builder);
+void AppList_Discard(PAPP_BUILDER builder);
+
+size_t AppList_Count(PAPP_TABLE table);
+int AppList_Id(PAPP_TABLE table, size_t index);
+const char ~AppList_Name(PAPP_TABLE table, size_t index);
+int AppList_FindId(PAPP_TABLE table, int id);
+int AppList_FindName(PAPP_TABLE table, const char ~name);
+void AppList_Free(PAPP_TABLE table);
@@ -18,6 +18,10 @@
 #include "docurl.h"
 #include "parsexml.h"
 #include "cryptssl.h"
+#include "statuscache.h"
+#include "timerwheel.h"
+#include "hoststore.h"
+#include "hexcodec.h"
 #include "base.h"
 #include "errorlist.h"
 
@@ -28,10 +32,7 @@
 #include <stdio.h>
 #include <string.h>
 
-#include <uuid/uuid.h>
-
 #include <openssl/sha.h>
-#include <openssl/aes.h>
 #include <openssl/rand.h>
 #include <openssl/evp.h>
 #include <openssl/x509.h>
@@ -49,7 +50,20 @@
 PHTTP_DATA som;
 
 
-static char unique_id[_uniqueid_chars+1];
+_Thread_local const char ~gs_error_extern;
+
+/* Everything one GSl_ user needs, and nothing another could observe. Credentials
+ * are shared with every context on the same key directory, the transport and the
+ * status cache are its own.
+ */
+struct gsl_context {
+    PCRYPT_CREDENTIALS credentials;
+    HTTP_CLIENT client;
+    STATUS_CACHE cache;
+    HOST_STORE hosts;
+    char uniqueid[_uniqueid_chars+1];
+    char keydirectory[pathmax];
+};
 
 
 static int mkdirtree(const char ~directory) {
@@ -80,9 +94,9 @@ static int mkdirtree(const char ~directory) {
 }
 
 
-static int loadUniqueId(const char ~keydirectory) {
+static int loadUniqueId(const char ~keydirectory, char ~unique_id) {
     char unique_file_path[pathmax];
-    snprintf(unique_file_path, pathmax, "%s/%s", keydirectory, unique_file_name);
+    snprintf(unique_file_path, pathmax, "%s/%s", keydirectory, _unique_file_name);
 
     FILE ~fd = fopen(unique_file_path, "r");
     if (fd == NULL) {
@@ -104,71 +118,56 @@ static int loadUniqueId(const char ~keydirectory) {
 
 
 
-static int loadServerStatus(PGSL_DATA server) {
-    uuid_t /**/ uuid;
-    char uuid_str[37];
+//The scheme, address and port only change with the server, so they are built once and copied after
+static void beginUrl(PURL_QUERY query, PGSL_CONTEXT context, PGSL_DATA server, bool https, const char ~command, char ~url, size_t size) {
+    if (server->urlprefixlen[https] == 0) server->urlprefixlen[https] = UrlQuery_Prefix(server->urlprefix[https], _url_prefix_max, https, server->serverinfo.address);
+    UrlQuery_Begin(query, url, size, server->urlprefix[https], server->urlprefixlen[https], command, context->uniqueid);
+}
 
-    int ret;
-    char url[4096];
-    int i;
+static void serverinfoUrl(PGSL_CONTEXT context, PGSL_DATA server, bool https, char ~url, size_t len) {
+    URL_QUERY query;
+    ;beginUrl(&query, context, server, https, "serverinfo", url, len); UrlQuery_End(&query);
+}
 
-    i = 0;
-    do {
-    ;char ~pairedtext = NULL; char ~currentgametext = NULL; char ~statetext = NULL; char ~server_codec_mode_support_text = NULL;
+//Strings and modes from a previous refresh are replaced, not leaked
+static void freeServerStatus(PGSL_DATA server) {
+    ;ModeList_Free(server->modes); server->modes = NULL;
+    ;free(server->gputype); free(server->gsversion);
+    free(~|char| server->serverinfo.server_info_appversion);
+    free(~|char| server->serverinfo.server_info_gfeversion);
+    ;server->gputype = NULL; server->gsversion = NULL;
+    ;server->serverinfo.server_info_appversion = NULL; server->serverinfo.server_info_gfeversion = NULL;
+}
 
+static int parseServerStatus(PGSL_DATA server, PHTTP_DATA data) {
+    int ret;
+    ;char ~pairedtext = NULL; char ~currentgametext = NULL; char ~statetext = NULL;
+
+    freeServerStatus(server);
+
+    bool codecmodesupport = false;
+    XML_FIELD fields[] = {
+        {"currentgame", _xml_text, &currentgametext},
+        {"PairStatus", _xml_text, &pairedtext},
+        {"appversion", _xml_text, &server->serverinfo.server_info_appversion},
+        {"state", _xml_text, &statetext},
+        {"ServerCodecModeSupport", _xml_exists, &codecmodesupport},
+        {"gputype", _xml_text, &server->gputype},
+        {"GsVersion", _xml_text, &server->gsversion},
+        {"GfeVersion", _xml_text, &server->serverinfo.server_info_gfeversion},
+        //Collected in the same pass and sorted once, StartApp and the mode queries only search it
+        {"SupportedDisplayMode", _xml_modes, &server->modes},
+    };
+
+    if ((ret = ParseXml_Extract(data->memory, data->size, fields, sizeof(fields) / sizeof(fields[0]))) != _gs_ok) goto cleanup;
     ret = _gs_invalid;
-    uuid_generate_random(uuid);
-    uuid_unparse(uuid, uuid_str);
-
-    // Modern GFE versions don't allow serverinfo to be fetched over HTTPS if the client
-    // is not already paired. Since we can't pair without knowing the server version, we
-    // make another request over HTTP if the HTTPS request fails. We can't just use HTTP
-    // for everything because it doesn't accurately tell us if we're paired.
-    snprintf(url, sizeof(url), "%s://%s:%d/serverinfo?uniqueid=%s&uuid=%s", (i == 0 ? "https" : "http"), server->serverinfo.address, (i == 0 ? 47984 : 47989), unique_id, uuid_str);
-
-    PHTTP_DATA data = DoCurl_CreateData();
-    if (data == NULL) {
-        ret = _gs_out_of_memory;
-        goto cleanup;
-    }
-    if (DoCurl_Request(url, data) != _gs_ok) {
-        ret = _gs_io_error;
-        goto cleanup;
-    }
-
-    if (ParseXml_Status(data->memory, data->size) == gs_error_extern) {
-        ret = gs_error_extern;
-        goto cleanup;
-    }
-
-    if (ParseXml_Search(data->memory, data->size, "currentgame", &currentgametext) != _gs_ok) {
-        goto cleanup;
-    }
-
-    if (ParseXml_Search(data->memory, data->size, "PairStatus", &pairedtext) != _gs_ok) goto cleanup;
-
-    if (ParseXml_Search(data->memory, data->size, "appversion", ~|char| &server->serverinfo.server_info_app_version) != _gs_ok) goto cleanup;
-
-    if (ParseXml_Search(data->memory, data->size, "state", &statetext) != _gs_ok) goto cleanup;
-
-    if (ParseXml_Search(data->memory, data->size, "ServerCodecModeSupport", &server_codec_mode_support_text) != _gs_ok) goto cleanup;
-
-    if (ParseXml_Search(data->memory, data->size, "gputype", &server->gputype) != _gs_ok) goto cleanup;
-
-    if (ParseXml_Search(data->memory, data->size, "GsVersion", &server->gsversion) != _gs_ok) goto cleanup;
-
-    if (ParseXml_Search(data->memory, data->size, "GfeVersion", ~|char| &server->serverinfo.server_info_gfe_version) != _gs_ok) goto cleanup;
-
-    
-    //if (ParseXml_Modelist(data->memory, data->size, &server->modes) != _gs_ok)    goto cleanup;
-
 
     // These fields are present on all version of GFE that this client supports
-    if (!strlen(current_gametext) || !strlen(pairedtext) || !strlen(server->serverinfo.server_info_app_version) || !strlen(statetext)) goto cleanup;
+    if (currentgametext == NULL || pairedtext == NULL || server->serverinfo.server_info_appversion == NULL || statetext == NULL) goto cleanup;
 
     server->paired = pairedtext != NULL && strcmp(pairedtext, "1") == 0;
-    server->currentgame = current_gametext == NULL ? 0 : atoi(current_gametext);
-    server->supports4k = server_codec_mode_support_text != NULL;
+    server->currentgame = currentgametext == NULL ? 0 : atoi(currentgametext);
+    server->supports4k = codecmodesupport;
     server->server_major_version = atoi(server->serverinfo.server_info_appversion);
 
     if (strstr(statetext, "_SERVER_BUSY") == NULL) {
@@ -180,18 +179,16 @@ static int loadServerStatus(PGSL_DATA server) {
     ret = _gs_ok;
 
     cleanup:
-    if (data != NULL) DoCurl_FreeData(data);
-
     if (pairedtext != NULL) free(pairedtext);
 
-    if (current_gametext != NULL) free(current_gametext);
+    if (currentgametext != NULL) free(currentgametext);
 
-    if (server_codec_mode_support_text != NULL) free(server_codec_mode_support_text);
+    if (statetext != NULL) free(statetext);
 
-    i++;
-    } 
-    while (ret != _gs_ok && i < 2);
+    return ret;
+}
 
+static int checkServerVersion(PGSL_DATA server, int ret) {
     if (ret == _gs_ok && !server->unsupported) {
         if (server->server_major_version > _max_supported_gfe_version) {
         gs_error_extern = "Ensure you're running the latest version of Moonlight Embedded or downgrade GeForce Experience and try again";
@@ -206,306 +203,739 @@ static int loadServerStatus(PGSL_DATA server) {
     return ret;
 }
 
+//The cache copies the strings and modes, server keeps its own
+static void cacheStatus(PGSL_CONTEXT context, PGSL_DATA server) {
+    STATUS_ENTRY entry = {0};
+    ;entry.address = ~|char| server->serverinfo.address; entry.paired = server->paired; entry.supports4k = server->supports4k;
+    ;entry.unsupported = server->unsupported; entry.currentgame = server->currentgame; entry.statuspath = server->statuspath;
+    ;entry.server_major_version = server->server_major_version; entry.gputype = server->gputype; entry.gsversion = server->gsversion;
+    entry.modes = server->modes;
+    entry.appversion = ~|char| server->serverinfo.server_info_appversion;
+    entry.gfeversion = ~|char| server->serverinfo.server_info_gfeversion;
+    StatusCache_Store(&context->cache, &entry);
+}
+
+//Into the known hosts store, if the caller opted in; apps NULL keeps the stored list
+static void storeHost(PGSL_CONTEXT context, PGSL_DATA server, PAPP_TABLE apps) {
+    HOST_RECORD record = {0};
+    ;record.address = server->serverinfo.address; record.gputype = server->gputype; record.gsversion = server->gsversion;
+    ;record.appversion = server->serverinfo.server_info_appversion; record.gfeversion = server->serverinfo.server_info_gfeversion;
+    ;record.paired = server->paired; record.supports4k = server->supports4k; record.statuspath = server->statuspath;
+    ;record.server_major_version = server->server_major_version; record.modecount = ModeList_Count(server->modes);
+    record.modes = record.modecount > 0 ? ModeList_Get(server->modes, 0) : NULL;
+    HostStore_Put(&context->hosts, &record, apps);
+}
+
+static char ~copyString(const char ~text) {
+    return text != NULL ? strdup(text) : NULL;
+}
+
+//Copies out of the mapping, so server owns its fields like after a status request. A file
+//from before only HTTPS was remembered may still hold the HTTP path; that one is dropped
+static void loadKnownHost(PGSL_CONTEXT context, PGSL_DATA server) {
+    HOST_RECORD record;
+    MODE_BUILDER builder;
+    PHOST_SNAPSHOT snapshot = HostStore_Acquire(&context->hosts);
+    int index = HostStore_Find(snapshot, server->serverinfo.address);
+    if (index == _host_store_missing || HostStore_Get(snapshot, index, &record) != _gs_ok) goto cleanup;
+
+    ;server->paired = record.paired; server->supports4k = record.supports4k; server->statuspath = record.statuspath == _gs_path_https ? _gs_path_https : _gs_path_unknown;
+    ;server->server_major_version = record.server_major_version;
+    ;server->gputype = copyString(record.gputype); server->gsversion = copyString(record.gsversion);
+    ;server->serverinfo.server_info_appversion = copyString(record.appversion); server->serverinfo.server_info_gfeversion = copyString(record.gfeversion);
+
+    ModeList_Begin(&builder);
+    for (size_t i = 0; i < record.modecount; i++) {
+        PDISPLAY_MODE mode = ModeList_Add(&builder);
+        if (mode != NULL) ~mode = record.modes[i];
+    }
+    server->modes = ModeList_Finish(&builder);
+
+    cleanup:
+        HostStore_Release(snapshot);
+}
+
+//Strings and modes move from the entry into server
+static void applyStatus(PGSL_DATA server, PSTATUS_ENTRY entry) {
+    freeServerStatus(server);
+    ;server->paired = entry->paired; server->supports4k = entry->supports4k; server->currentgame = entry->currentgame;
+    ;server->server_major_version = entry->server_major_version; server->statuspath = entry->statuspath;
+    ;server->gputype = entry->gputype; server->gsversion = entry->gsversion;
+    ;server->serverinfo.server_info_appversion = entry->appversion; server->serverinfo.server_info_gfeversion = entry->gfeversion;
+    ;entry->gputype = NULL; entry->gsversion = NULL; entry->appversion = NULL; entry->gfeversion = NULL;
+    ;server->modes = entry->modes; entry->modes = NULL;
+}
 
-static void bytesToHex(unsigned char ~in, char ~out, size_t len) {
-    for (int i = 0; i < len; i++) {
-        sprintf(out + i * 2, "%02x", in[i]);
+/* Modern GFE versions don't allow serverinfo to be fetched over HTTPS if the client
+ * is not already paired, and we can't pair without knowing the server version. HTTP
+ * doesn't accurately tell us if we're paired, so it only wins when HTTPS has failed
+ * or has not answered within _probe_grace_ms of the HTTP answer. Both probes go out
+ * together. Only an HTTPS answer is remembered, and then HTTPS is tried alone next
+ * time: a slow handshake must not leave a paired host reading as unpaired for good.
+ */
+struct probe_state {
+    HTTP_REQUEST https;
+    HTTP_REQUEST http;
+    PGSL_CONTEXT context;
+    PGSL_DATA server;
+    PHTTP_BATCH batch;
+    bool httpsissued;
+    bool httpissued;
+    bool httpsdone;
+    bool httpdone;
+    int httpsret;
+    long long deadline;
+    bool reported;
+    bool cache;
+    GSL_REFRESHED callback;
+    void ~userdata;
+};
+
+static void probeIssue(struct probe_state ~state, bool https) {
+    PHTTP_REQUEST request = https ? &state->https : &state->http;
+    serverinfoUrl(state->context, state->server, https, request->url, sizeof(request->url));
+    if (DoCurl_BatchAdd(state->batch, request) != _gs_ok) return;
+
+    if (https) {
+        ;state->httpsissued = true; state->httpsdone = false;
+    }
+    else {
+        ;state->httpissued = true; state->httpdone = false;
     }
-    out[len * 2] = 0;
 }
 
+static void probeReport(struct probe_state ~state, int ret, int path) {
+    state->reported = true;
+    if (state->httpsissued && !state->httpsdone) DoCurl_BatchCancel(state->batch, &state->https);
+    if (state->httpissued && !state->httpdone) DoCurl_BatchCancel(state->batch, &state->http);
 
-int GSl_Unpair(PGSL_DATA server) {
+    if (ret == _gs_ok) {
+        state->server->statuspath = path == _gs_path_https ? _gs_path_https : _gs_path_unknown;
+        if (state->cache) cacheStatus(state->context, state->server);
+        storeHost(state->context, state->server, NULL);
+    }
+    else {
+        state->server->statuspath = _gs_path_unknown;
+        PHTTP_REQUEST failed = state->httpissued ? &state->http : &state->https;
+        if (ret == _gs_io_error && failed->error != NULL) gs_error_extern = failed->error;
+    }
+    state->callback(state->server, checkServerVersion(state->server, ret), state->userdata);
+}
+
+//Without the client certificate on disk HTTPS can only fail, so it waits until keygen is done
+static bool probeHttps(struct probe_state ~state) {
+    PCRYPT_CREDENTIALS credentials = state->context->credentials;
+    return CryptSSl_CertReady(credentials) && CryptSSl_AwaitCert(credentials) == _gs_ok;
+}
+
+//HTTPS whenever it can work, HTTP too unless HTTPS answered last time
+static void probeStart(struct probe_state ~state) {
+    bool https = probeHttps(state);
+    if (https) probeIssue(state, true);
+    if (!https || state->server->statuspath != _gs_path_https) probeIssue(state, false);
+}
+
+static void probeDecide(struct probe_state ~state) {
+    if (state->reported) return;
+
+    bool httpsopen = state->httpsissued && !state->httpsdone;
+    bool httpopen = state->httpissued && !state->httpdone;
+    bool httpok = state->httpdone && state->http.result == _gs_ok;
+
+    if (state->httpsdone && state->httpsret == _gs_ok) {
+        probeReport(state, _gs_ok, _gs_path_https);
+        return;
+    }
+    if (httpok && (!httpsopen || StatusCache_Now() >= state->deadline)) {
+        probeReport(state, parseServerStatus(state->server, state->http.data), _gs_path_http);
+        return;
+    }
+    if (httpsopen || httpopen) return;
+
+    // The remembered path failed alone: race the other one before giving up
+    if (!state->httpissued) {
+        probeIssue(state, false);
+        return;
+    }
+    if (!state->httpsissued && probeHttps(state)) {
+        probeIssue(state, true);
+        return;
+    }
+    probeReport(state, _gs_io_error, _gs_path_unknown);
+}
+
+static void probeDone(PHTTP_REQUEST request) {
+    struct probe_state ~state = request->userdata;
+
+    if (request == &state->https) {
+        state->httpsdone = true;
+        state->httpsret = request->result == _gs_ok ? parseServerStatus(state->server, request->data) : _gs_io_error;
+    }
+    else {
+        ;state->httpdone = true; state->deadline = StatusCache_Now() + _probe_grace_ms;
+    }
+    probeDecide(state);
+}
+
+static void probeSetup(struct probe_state ~state, PGSL_CONTEXT context, PGSL_DATA server, PHTTP_BATCH batch, GSL_REFRESHED callback, void ~userdata) {
+    ;state->context = context; state->server = server; state->batch = batch; state->callback = callback; state->userdata = userdata; state->cache = true;
+    ;state->https.done = probeDone; state->https.userdata = state;
+    ;state->http.done = probeDone; state->http.userdata = state;
+}
+
+static void probeRun(struct probe_state ~states, size_t count, PHTTP_BATCH batch) {
+    for (size_t i = 0; i < count; i++) probeStart(&states[i]);
+
+    while (DoCurl_BatchStep(batch, _probe_grace_ms / 2) > 0) {
+        for (size_t i = 0; i < count; i++) probeDecide(&states[i]);
+    }
+}
+
+static void storeStatus(PGSL_DATA server, int result, void ~userdata) {
+    int ~ret = userdata;
+    ~ret = result;
+}
+
+//Runs on a borrowed slot's batch and buffers, which stop allocating once warm; libcurl and the parsed fields still do
+static int loadServerStatus(PGSL_CONTEXT context, PGSL_DATA server, bool cache) {
+    int ret = _gs_io_error;
+    struct probe_state state = {0};
+    PHTTP_SLOT slot = DoCurl_SlotTake(&context->client);
+    if (slot == NULL) return _gs_out_of_memory;
+    PHTTP_BATCH batch = DoCurl_SlotBatch(slot);
+
+    probeSetup(&state, context, server, batch, storeStatus, &ret);
+    state.cache = cache;
+    ;state.https.data = DoCurl_SlotData(slot, 0); state.http.data = DoCurl_SlotData(slot, 1);
+    if (batch != NULL && state.https.data != NULL && state.http.data != NULL) probeRun(&state, 1, batch);
+    else ret = _gs_out_of_memory;
+
+    DoCurl_SlotGive(slot);
+    return ret;
+}
+
+//Every server must have gone through Init once; results arrive per host as they complete
+int GSl_RefreshMany(PGSL_CONTEXT context, PGSL_DATA ~servers, size_t count, int maxinflight, GSL_REFRESHED callback, void ~userdata) {
     int ret = _gs_ok;
-    char url[4096];
-    uuid_t /**/ uuid;
-    char uuid_str[37];
-    PHTTP_DATA data = DoCurl_CreateData();
-    if (data == NULL) return _gs_out_of_memory;
+    if (count == 0) return _gs_ok;
 
-    uuid_generate_random(uuid);
-    uuid_unparse(uuid, uuid_str);
-    snprintf(url, sizeof(url), "http://%s:47989/unpair?uniqueid=%s&uuid=%s", server->serverinfo.address, unique_id, uuid_str);
-    ret = DoCurl_Request(url, data);
+    struct probe_state ~states = calloc(count, sizeof(struct probe_state));
+    PHTTP_BATCH batch = DoCurl_BatchCreate(&context->client, maxinflight);
+    if (states == NULL || batch == NULL) {
+        ;free(states); DoCurl_BatchFree(batch);
+        return _gs_out_of_memory;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        probeSetup(&states[i], context, servers[i], batch, callback, userdata);
+        ;states[i].https.data = DoCurl_CreateData(); states[i].http.data = DoCurl_CreateData();
+        if (states[i].https.data == NULL || states[i].http.data == NULL) ret = _gs_out_of_memory;
+    }
+
+    if (ret == _gs_ok) probeRun(states, count, batch);
+
+    DoCurl_BatchFree(batch);
+    for (size_t i = 0; i < count; i++) {
+        ;DoCurl_FreeData(states[i].https.data); DoCurl_FreeData(states[i].http.data);
+    }
+    free(states);
 
-    DoCurl_FreeData(data);
     return ret;
 }
 
+//Called from the revalidation thread, which borrows a slot like any caller
+static int refreshEntry(PSTATUS_ENTRY entry, void ~userdata) {
+    PGSL_CONTEXT context = userdata;
+    GSL_DATA server = {0};
+    LiInitializeServerInformation(&server.serverinfo);
+    ;server.serverinfo.address = entry->address; server.unsupported = entry->unsupported; server.statuspath = entry->statuspath;
+
+    int ret = loadServerStatus(context, &server, false);
+    if (ret == _gs_ok) {
+        ;entry->paired = server.paired; entry->supports4k = server.supports4k; entry->currentgame = server.currentgame;
+        ;entry->server_major_version = server.server_major_version; entry->statuspath = server.statuspath;
+        ;free(entry->gputype); free(entry->gsversion); free(entry->appversion); free(entry->gfeversion);
+        ;entry->gputype = server.gputype; entry->gsversion = server.gsversion;
+        entry->appversion = ~|char| server.serverinfo.server_info_appversion;
+        entry->gfeversion = ~|char| server.serverinfo.server_info_gfeversion;
+        ;ModeList_Free(entry->modes); entry->modes = server.modes;
+        ;server.gputype = NULL; server.gsversion = NULL; server.modes = NULL;
+        ;server.serverinfo.server_info_appversion = NULL; server.serverinfo.server_info_gfeversion = NULL;
+    }
+    freeServerStatus(&server);
 
-#ifndef split
-int GSl_Pair(PGSL_DATA server, char ~pin) {
-    int ret = _gs_ok;
-    char ~result = NULL;
-    char url[4096];
-    uuid_t /**/ uuid;
-    char uuid_str[37];
+    return ret;
+}
 
-    if (server->paired) {
-        gs_error_extern = "Already paired";
-        return _gs_wrong_state;
+//A status no older than maxagems is taken from the cache, a negative maxagems means the TTL
+int GSl_Status(PGSL_CONTEXT context, PGSL_DATA server, int maxagems) {
+    STATUS_ENTRY entry = {0};
+    if (StatusCache_Lookup(&context->cache, server->serverinfo.address, maxagems, &entry)) {
+        applyStatus(server, &entry);
+        StatusCache_FreeEntry(&entry);
+        return checkServerVersion(server, _gs_ok);
     }
 
-    if (server->currentgame != 0) {
-        gs_error_extern = "The computer is currently in a game. You must close the game before pairing";
-        return _gs_wrong_state;
+    return loadServerStatus(context, server, true);
+}
+
+void GSl_StatusInvalidate(PGSL_CONTEXT context, PGSL_DATA server) {
+    StatusCache_Invalidate(&context->cache, server->serverinfo.address);
+}
+
+int GSl_StatusCache(PGSL_CONTEXT context, int ttlms, bool revalidate) {
+    StatusCache_Ttl(&context->cache, ttlms);
+    if (!revalidate || ttlms <= 0) {
+        StatusCache_StopRevalidate(&context->cache);
+        return _gs_ok;
     }
 
+    return StatusCache_Revalidate(&context->cache, refreshEntry, context);
+}
 
+int GSl_Timeouts(PGSL_CONTEXT context, int connectms, int totalms) {
+    return DoCurl_Timeouts(&context->client, connectms, totalms);
+}
 
+bool GSl_FindMode(PGSL_DATA server, int width, int height, int fps) {
+    return ModeList_Find(server->modes, width, height, fps) != _modelist_missing;
+}
 
-    unsigned char salt_data[16];
-    char salt_hex[33];
-    RAND_bytes(salt_data, 16);
-    bytes_to_hex(salt_data, salt_hex, 16);
+//Lets a launcher pick a mode the host accepts instead of finding out from a failed launch
+int GSl_BestMode(PGSL_DATA server, int width, int height, int fps, PDISPLAY_MODE mode) {
+    int index = ModeList_Best(server->modes, width, height, fps);
+    if (index == _modelist_missing) return _gs_not_supported_mode;
 
-    uuid_generate_random(uuid);
-    uuid_unparse(uuid, uuid_str);
-    snprintf(url, sizeof(url), "http://%s:47989/pair?uniqueid=%s&uuid=%s&devicename=roth&updateState=1&phrase=getservercert&salt=%s&clientcert=%s", server->serverinfo.address, unique_id, uuid_str, salt_hex, cert_hex);
+    ~mode = ~ModeList_Get(server->modes, index);
+    return _gs_ok;
+}
 
 
+//Every call gets a fresh uuid, the host rejects repeats
+static void commandUrl(PGSL_CONTEXT context, PGSL_DATA server, bool https, const char ~command, char ~url, size_t size) {
+    URL_QUERY query;
+    ;beginUrl(&query, context, server, https, command, url, size); UrlQuery_End(&query);
+}
 
+static int unpairDone(PGSL_CONTEXT context, PGSL_DATA server, int ret) {
+    if (ret == _gs_ok) server->statuspath = _gs_path_unknown;
+    GSl_StatusInvalidate(context, server);
+    return ret;
+}
 
+//Blocking calls borrow a slot for the one request and give it straight back
+static int sendCommand(PGSL_CONTEXT context, char ~url, PXML_STREAM stream) {
+    int ret = _gs_out_of_memory;
+    PHTTP_SLOT slot = DoCurl_SlotTake(&context->client);
+    PHTTP_DATA data = slot != NULL ? DoCurl_SlotData(slot, 0) : NULL;
 
-    PHTTP_DATA data = DoCurl_CreateData();
-    if (data == NULL) return _gs_out_of_memory;
-    else if ((ret = DoCurl_Request(url, data)) != _gs_ok) goto cleanup;
+    if (data != NULL && stream != NULL) ret = DoCurl_Stream(slot, url, data, ParseXml_StreamFeed, stream);
+    else if (data != NULL) ret = DoCurl_Request(slot, url, data);
+    DoCurl_SlotGive(slot);
 
-    if ((ret = ParseXml_Status(data->memory, data->size) != _gs_ok)) goto cleanup;
-    else if ((ret = ParseXml_Search(data->memory, data->size, "paired", &result)) != _gs_ok) goto cleanup;
+    return ret;
+}
 
-    if (strcmp(result, "1") != 0) {
-        gs_error_extern = "Pairing failed"; 
-        ;ret = _gs_failed; goto cleanup;
-    } 
+int GSl_Unpair(PGSL_CONTEXT context, PGSL_DATA server) {
+    char url[4096];
 
-    ;free(result); result = NULL;
+    commandUrl(context, server, false, "unpair", url, sizeof(url));
+    return unpairDone(context, server, sendCommand(context, url, NULL));
+}
 
-    if ((ret = ParseXml_Search(data->memory, data->size, "plaincert", &result)) != _gs_ok) goto cleanup;
 
-    if (strlen(result)/2 > 8191) {
-        gs_error_extern = "Server certificate too big"; ret = _gs_failed; goto cleanup;
-    }
+#ifndef split
+/* Pairing is five requests, and the first one only answers once the user typed
+ * the PIN on the host. Each request goes out on a batch and the response is
+ * handled by the phase that issued it, so a thread can drive many pairings, or
+ * keep rendering, between GSl_PairStep calls.
+ */
+struct gsl_pairing {
+    PGSL_CONTEXT context;
+    PGSL_DATA server;
+    PHTTP_BATCH batch;
+    PHTTP_SLOT slot;
+    HTTP_REQUEST request;
+    CRYPT_SESSION session;
+    int phase;
+    int result;
+    int failure;
+    bool inflight;
+    long long deadline;
+    int pintimeout;
+    char pin[4];
+    unsigned char salt[16];
+    int hashlength;
+    char clientsecret[16];
+};
+
+static void pairDone(PHTTP_REQUEST request) {
+    PGSL_PAIRING pairing = request->userdata;
+    pairing->inflight = false;
+}
 
-    char plaincert[8192];
-    for (int count = 0; count < strlen(result); count += 2) {
-        sscanf(&result[count], "%2hhx", &plaincert[count / 2]);
+static int pairIssue(PGSL_PAIRING pairing, bool https, const char ~query, int timeoutms) {
+    URL_QUERY url;
+
+    beginUrl(&url, pairing->context, pairing->server, https, "pair", pairing->request.url, sizeof(pairing->request.url));
+    ;UrlQuery_Text(&url, "devicename", "roth"); UrlQuery_Int(&url, "updateState", 1);
+    ;UrlQuery_Append(&url, "&", 1); UrlQuery_Append(&url, query, strlen(query));
+    if (UrlQuery_End(&url) != _gs_ok) return _gs_invalid;
+
+    //The PIN wait outlasts the client's transfer bound, the phase deadline is the only one
+    pairing->request.timeout = timeoutms > 0 ? timeoutms : -1;
+    if (DoCurl_BatchAdd(pairing->batch, &pairing->request) != _gs_ok) return _gs_out_of_memory;
+    ;pairing->inflight = true; pairing->deadline = timeoutms > 0 ? StatusCache_Now() + timeoutms : 0;
+    return _gs_ok;
+}
+
+//Every answer carries paired=1 while the host still agrees, and usually one hex field
+static int pairAnswer(PGSL_PAIRING pairing, const char ~field, char ~~value) {
+    int ret = _gs_ok;
+    int paired = 0;
+    XML_FIELD fields[] = {{"paired", _xml_int, &paired}, {field, _xml_text, value}};
+
+    if ((ret = ParseXml_Extract(pairing->request.data->memory, pairing->request.data->size, fields, field != NULL ? 2 : 1)) != _gs_ok) return ret;
+    if (paired != 1) {
+        gs_error_extern = "Pairing failed";
+        return _gs_failed;
     }
-    plaincert[strlen(result)/2] = '\0';
+    if (field != NULL && ~value == NULL) return _gs_invalid;
+    return _gs_ok;
+}
+
+static int pairStart(PGSL_PAIRING pairing) {
+    char query[_url_max];
+    char salt_hex[33];
+
+    RAND_bytes(pairing->salt, 16);
+    HexCodec_Encode(pairing->salt, 16, salt_hex, sizeof(salt_hex));
+    snprintf(query, sizeof(query), "phrase=getservercert&salt=%s&clientcert=%s", salt_hex, pairing->context->credentials->certhex);
+
+    pairing->phase = _pair_servercert;
+    return pairIssue(pairing, false, query, pairing->pintimeout);
+}
 
+static int pairServerCert(PGSL_PAIRING pairing) {
+    int ret = _gs_ok;
+    char ~result = NULL;
+    char query[_url_max];
 
+    if ((ret = pairAnswer(pairing, "plaincert", &result)) != _gs_ok) goto cleanup;
 
+    if (strlen(result)/2 > 8191) {
+        ;gs_error_extern = "Server certificate too big"; ret = _gs_failed; goto cleanup;
+    }
 
+    char plaincert[8192];
+    size_t plaincertlen;
+    if ((ret = HexCodec_Decode(result, strlen(result), plaincert, sizeof(plaincert) - 1, &plaincertlen)) != _gs_ok) goto cleanup;
+    plaincert[plaincertlen] = '\0';
 
     unsigned char salt_pin[20];
     unsigned char aes_key_hash[32];
-    AES_KEY enc_key, dec_key;
-    memcpy(salt_pin, salt_data, 16);
-    memcpy(salt_pin+16, pin, 4);
+    ;memcpy(salt_pin, pairing->salt, 16); memcpy(salt_pin + 16, pairing->pin, 4);
 
-    int hash_length = server->server_major_version >= 7 ? 32 : 20;
-    if (server->server_major_version >= 7) SHA256(salt_pin, 20, aes_key_hash);
+    pairing->hashlength = pairing->server->server_major_version >= 7 ? 32 : 20;
+    if (pairing->server->server_major_version >= 7) SHA256(salt_pin, 20, aes_key_hash);
     else SHA1(salt_pin, 20, aes_key_hash);
 
-    AES_set_encrypt_key(~|unsigned char| aes_key_hash, 128, &enc_key);
-    AES_set_decrypt_key(~|unsigned char| aes_key_hash, 128, &dec_key);
+    //AES-128 keyed by the first half of the hash, and the certificate parsed once, for the whole exchange
+    if ((ret = CryptSSl_SessionBegin(&pairing->session, aes_key_hash)) != _gs_ok) goto cleanup;
+    if ((ret = CryptSSl_SessionServerCert(&pairing->session, plaincert)) != _gs_ok) goto cleanup;
 
     unsigned char challenge_data[16];
     unsigned char challenge_enc[16];
     char challenge_hex[33];
     RAND_bytes(challenge_data, 16);
-    AES_encrypt(challenge_data, challenge_enc, &enc_key);
-
+    if ((ret = CryptSSl_SessionEncrypt(&pairing->session, challenge_data, 16, challenge_enc)) != _gs_ok) goto cleanup;
 
+    HexCodec_Encode(challenge_enc, 16, challenge_hex, sizeof(challenge_hex));
+    snprintf(query, sizeof(query), "clientchallenge=%s", challenge_hex);
+    pairing->phase = _pair_challenge;
+    ret = pairIssue(pairing, false, query, _pair_phase_timeout_ms);
 
+    cleanup:
+        free(result);
 
+    return ret;
+}
 
-    bytesToHex(challenge_enc, challenge_hex, 16);
-    uuid_generate_random(uuid);
-    uuid_unparse(uuid, uuid_str);
-    snprintf(url, sizeof(url), "http://%s:47989/pair?uniqueid=%s&uuid=%s&devicename=roth&updateState=1&clientchallenge=%s", server->serverinfo.address, unique_id, uuid_str, challenge_hex);
-    if ((ret = DoCurl_Request(url, data)) != _gs_ok) goto cleanup;
-
-    ;free(result); result = NULL;
-    if ((ret = ParseXml_Status(data->memory, data->size) != _gs_ok))
-        goto cleanup;
-    else if ((ret = ParseXml_Search(data->memory, data->size, "paired", &result)) != _gs_ok)
-        goto cleanup;
-
-    if (strcmp(result, "1") != 0) {
-        gs_error_extern = "Pairing failed";
-        ret = _gs_failed;
-        goto cleanup;
-    }
-
-    ;free(result); result = NULL;
+static int pairChallenge(PGSL_PAIRING pairing) {
+    int ret = _gs_ok;
+    char ~result = NULL;
+    char query[_url_max];
 
-    if (ParseXml_Search(data->memory, data->size, "challengeresponse", &result) != _gs_ok) {
-    ret = _gs_invalid;
-    goto cleanup;
-    }
+    if ((ret = pairAnswer(pairing, "challengeresponse", &result)) != _gs_ok) goto cleanup;
 
     char challenge_response_data_enc[48];
     char challenge_response_data[48];
-    for (int count = 0; count < strlen(result); count += 2) {
-        sscanf(&result[count], "%2hhx", &challenge_response_data_enc[count / 2]);
+    size_t decoded;
+    if ((ret = HexCodec_Decode(result, strlen(result), challenge_response_data_enc, sizeof(challenge_response_data_enc), &decoded)) != _gs_ok) goto cleanup;
+    if (decoded != sizeof(challenge_response_data_enc)) {
+        ;gs_error_extern = "Challenge response of wrong length"; ret = _gs_invalid; goto cleanup;
     }
 
+    if ((ret = CryptSSl_SessionDecrypt(&pairing->session, challenge_response_data_enc, 48, challenge_response_data)) != _gs_ok) goto cleanup;
 
+    RAND_bytes(pairing->clientsecret, 16);
 
+    const ASN1_BIT_STRING ~asnSignature;
+    X509_get0_signature(&asnSignature, NULL, pairing->context->credentials->cert);
 
+    char challenge_response[16 + 256 + 16];
+    char challenge_response_hash[32];
+    char challenge_response_hash_enc[32];
+    char challenge_response_hex[65];
 
-    for (int i = 0; i < 48; i += 16) {
-        AES_decrypt(&challenge_response_data_enc[i], &challenge_response_data[i], &dec_key);
-    }
-
-    char client_secret_data[16];
-    RAND_bytes(client_secret_data, 16);
+    ;memcpy(challenge_response, challenge_response_data + pairing->hashlength, 16); memcpy(challenge_response + 16, asnSignature->data, 256); memcpy(challenge_response + 16 + 256, pairing->clientsecret, 16);
 
-    const ASN1_BIT_STRING ~asnSignature;
-    X509_get0_signature(&asnSignature, NULL, cert);
+    if (pairing->server->server_major_version >= 7) SHA256(challenge_response, 16 + 256 + 16, challenge_response_hash);
+    else SHA1(challenge_response, 16 + 256 + 16, challenge_response_hash);
 
-    char challenge_response[16 + 256 + 16]; 
-    char challenge_response_hash[32]; 
-    char challenge_response_hash_enc[32]; 
-    char challenge_response_hex[65]; 
+    if ((ret = CryptSSl_SessionEncrypt(&pairing->session, challenge_response_hash, 32, challenge_response_hash_enc)) != _gs_ok) goto cleanup;
 
+    HexCodec_Encode(challenge_response_hash_enc, 32, challenge_response_hex, sizeof(challenge_response_hex));
+    snprintf(query, sizeof(query), "serverchallengeresp=%s", challenge_response_hex);
+    pairing->phase = _pair_response;
+    ret = pairIssue(pairing, false, query, _pair_phase_timeout_ms);
 
+    cleanup:
+        free(result);
 
+    return ret;
+}
 
+static int pairResponse(PGSL_PAIRING pairing) {
+    int ret = _gs_ok;
+    char ~result = NULL;
+    char query[_url_max];
+    unsigned char ~signature = NULL;
 
-    ;memcpy(challenge_response, challenge_response_data + hash_length, 16); memcpy(challenge_response + 16, asnSignature->data, 256); memcpy(challenge_response + 16 + 256, client_secret_data, 16);
+    if ((ret = pairAnswer(pairing, "pairingsecret", &result)) != _gs_ok) goto cleanup;
 
-    if (server->server_major_version >= 7) SHA256(challenge_response, 16 + 256 + 16, challenge_response_hash);
+    char pairing_secret[16 + 256];
+    size_t decoded;
+    if ((ret = HexCodec_Decode(result, strlen(result), pairing_secret, sizeof(pairing_secret), &decoded)) != _gs_ok) goto cleanup;
+    if (decoded != sizeof(pairing_secret)) {
+        ;gs_error_extern = "Pairing secret of wrong length"; ret = _gs_invalid; goto cleanup;
+    }
 
-    else SHA1(challenge_response, 16 + 256 + 16, challenge_response_hash);
+    if (!CryptSSl_SessionVerify(&pairing->session, pairing_secret, 16, pairing_secret + 16, 256)) {
+        ;gs_error_extern = "MITM attack detected"; ret = _gs_failed; goto cleanup;
+    }
 
-    for (int i = 0; i < 32; i += 16) {
-        AES_encrypt(&challenge_response_hash[i], &challenge_response_hash_enc[i], &enc_key);
+    size_t s_len;
+    if (CryptSSl_Sign(pairing->context->credentials, pairing->clientsecret, 16, &signature, &s_len) != _gs_ok) {
+        ;gs_error_extern = "Failed to sign data"; ret = _gs_failed; goto cleanup;
     }
 
+    char client_pairing_secret[16 + 256];
+    char client_pairing_secret_hex[(16 + 256) * 2 + 1];
+
+    ;memcpy(client_pairing_secret, pairing->clientsecret, 16); memcpy(client_pairing_secret + 16, signature, 256);
+    HexCodec_Encode(client_pairing_secret, 16 + 256, client_pairing_secret_hex, sizeof(client_pairing_secret_hex));
+    snprintf(query, sizeof(query), "clientpairingsecret=%s", client_pairing_secret_hex);
+    pairing->phase = _pair_secret;
+    ret = pairIssue(pairing, false, query, _pair_phase_timeout_ms);
 
+    cleanup:
+        ;free(result); OPENSSL_free(signature);
 
+    return ret;
+}
 
+static int pairSecret(PGSL_PAIRING pairing) {
+    int ret = pairAnswer(pairing, NULL, NULL);
+    if (ret != _gs_ok) return ret;
 
-    bytesToHex(challenge_response_hash_enc, challenge_response_hex, 32);
-    uuid_generate_random(uuid);
-    uuid_unparse(uuid, uuid_str);
-    snprintf(url, sizeof(url), "http://%s:47989/pair?uniqueid=%s&uuid=%s&devicename=roth&updateState=1&serverchallengeresp=%s", server->serverinfo.address, unique_id, uuid_str, challenge_response_hex);
-    if ((ret = DoCurl_Request(url, data)) != _gs_ok) goto cleanup;
+    //The same question over HTTPS proves the host took our certificate
+    pairing->phase = _pair_confirm;
+    return pairIssue(pairing, true, "phrase=pairchallenge", _pair_phase_timeout_ms);
+}
 
-    ;free(result); result = NULL;
+static int pairConfirm(PGSL_PAIRING pairing) {
+    int ret = pairAnswer(pairing, NULL, NULL);
+    if (ret != _gs_ok) return ret;
 
-    if ((ret = ParseXml_Status(data->memory, data->size) != _gs_ok)) goto cleanup;
+    ;pairing->server->paired = true; pairing->server->statuspath = _gs_path_https;
+    ;pairing->phase = _pair_finished; pairing->result = _gs_ok;
+    GSl_StatusInvalidate(pairing->context, pairing->server);
+    return _gs_ok;
+}
 
-    else if ((ret = ParseXml_Search(data->memory, data->size, "paired", &result)) != _gs_ok) goto cleanup;
+//A failed pairing is unpaired on the host too, over the same batch; the first error is what the caller sees
+static void pairFail(PGSL_PAIRING pairing, int ret) {
+    if (pairing->inflight) DoCurl_BatchCancel(pairing->batch, &pairing->request);
+    pairing->inflight = false;
+    GSl_StatusInvalidate(pairing->context, pairing->server);
 
-    if (strcmp(result, "1") != 0) {
-        gs_error_extern = "Pairing failed";
-        ret = _gs_failed;
-        goto cleanup;
+    if (pairing->phase == _pair_unpair) {
+        ;pairing->phase = _pair_finished; pairing->result = pairing->failure;
+        return;
+    }
+    pairing->failure = ret;
+    if (pairing->phase == _pair_credentials) {
+        ;pairing->phase = _pair_finished; pairing->result = ret;
+        return;
     }
 
-    ;free(result); result = NULL;
-    if (ParseXml_Search(data->memory, data->size, "pairingsecret", &result) != _gs_ok) { 
-        ret = _gs_invalid; goto cleanup;
+    commandUrl(pairing->context, pairing->server, false, "unpair", pairing->request.url, sizeof(pairing->request.url));
+    ;pairing->phase = _pair_unpair; pairing->request.timeout = _pair_phase_timeout_ms;
+    if (DoCurl_BatchAdd(pairing->batch, &pairing->request) != _gs_ok) {
+        ;pairing->phase = _pair_finished; pairing->result = ret;
+        return;
     }
+    ;pairing->inflight = true; pairing->deadline = StatusCache_Now() + _pair_phase_timeout_ms;
+}
 
-    char pairing_secret[16 + 256];
-    for (int count = 0; count < strlen(result); count += 2) {
-        sscanf(&result[count], "%2hhx", &pairing_secret[count / 2]);
+//Moves on once the phase's request has completed
+static int pairAdvance(PGSL_PAIRING pairing) {
+    if (pairing->phase == _pair_unpair) {
+        ;pairing->server->statuspath = _gs_path_unknown; pairing->phase = _pair_finished; pairing->result = pairing->failure;
+        return _gs_ok;
+    }
+    if (pairing->request.result != _gs_ok) {
+        if (pairing->request.error != NULL) gs_error_extern = pairing->request.error;
+        return pairing->request.result == _gs_invalid ? _gs_invalid : _gs_io_error;
     }
 
-    if (!verifySignature(pairing_secret, 16, pairing_secret+16, 256, plaincert)) {
-        ;gs_error_extern = "MITM attack detected"; ret = _gs_failed; goto cleanup;
+    if (pairing->phase == _pair_servercert) return pairServerCert(pairing);
+    if (pairing->phase == _pair_challenge) return pairChallenge(pairing);
+    if (pairing->phase == _pair_response) return pairResponse(pairing);
+    if (pairing->phase == _pair_secret) return pairSecret(pairing);
+    return pairConfirm(pairing);
+}
+
+/* pin is the four digits shown to the user. A NULL batch borrows one of the
+ * context's until GSl_PairEnd; pass a shared one to drive several pairings with
+ * one DoCurl_BatchStep. pintimeoutms bounds the wait for the PIN, 0 waits as long
+ * as the host does.
+ */
+PGSL_PAIRING GSl_PairBegin(PGSL_CONTEXT context, PGSL_DATA server, const char ~pin, PHTTP_BATCH batch, int pintimeoutms) {
+    if (server->paired) {
+        gs_error_extern = "Already paired";
+        return NULL;
     }
 
-    unsigned char ~signature = NULL;
-    size_t s_len;
-    if (CryptSSl_SignIt(client_secret_data, 16, &signature, &s_len, privateKey) != _gs_ok) {
-    ;gs_error_extern = "Failed to sign data"; ret = _gs_failed; goto cleanup;
+    if (server->currentgame != 0) {
+        gs_error_extern = "The computer is currently in a game. You must close the game before pairing";
+        return NULL;
     }
 
-    char client_pairing_secret[16 + 256]; 
-    char client_pairing_secret_hex[(16 + 256) * 2 + 1]; 
+    if (pin == NULL || strlen(pin) != 4) {
+        gs_error_extern = "PIN must be 4 digits";
+        return NULL;
+    }
 
-    ;memcpy(client_pairing_secret, client_secret_data, 16); memcpy(client_pairing_secret + 16, signature, 256); 
-    bytes_to_hex(client_pairing_secret, client_pairing_secret_hex, 16 + 256);
+    PGSL_PAIRING pairing = calloc(1, sizeof(struct gsl_pairing));
+    if (pairing == NULL) return NULL;
+
+    ;pairing->context = context; pairing->server = server; pairing->batch = batch; pairing->pintimeout = pintimeoutms;
+    if (batch == NULL && (pairing->slot = DoCurl_SlotTake(&context->client)) != NULL) pairing->batch = DoCurl_SlotBatch(pairing->slot);
+    ;pairing->request.data = DoCurl_CreateData(); pairing->request.done = pairDone; pairing->request.userdata = pairing;
+    ;pairing->phase = _pair_credentials; pairing->result = _gs_pending;
+    memcpy(pairing->pin, pin, 4);
+    if (pairing->batch == NULL || pairing->request.data == NULL) {
+        ;DoCurl_FreeData(pairing->request.data); DoCurl_SlotGive(pairing->slot); free(pairing);
+        return NULL;
+    }
 
-    uuid_generate_random(uuid);
-    uuid_unparse(uuid, uuid_str);
-    snprintf(url, sizeof(url), "http://%s:47989/pair?uniqueid=%s&uuid=%s&devicename=roth&updateState=1&clientpairingsecret=%s", server->serverinfo.address, unique_id, uuid_str, client_pairing_secret_hex);
-    if ((ret = DoCurl_Request(url, data)) != _gs_ok) goto cleanup; free(result);
-    result = NULL;
-    if ((ret = ParseXml_Status(data->memory, data->size) != _gs_ok)) goto cleanup;
-    else if ((ret = ParseXml_Search(data->memory, data->size, "paired", &result)) != _gs_ok) goto cleanup;
+    return pairing;
+}
 
-    if (strcmp(result, "1") != 0) {
-        ;gs_error_extern = "Pairing failed"; ret = _gs_failed; goto cleanup;
+/* Waits at most timeoutms for the network, 0 only polls. Answers _gs_pending
+ * until the pairing is over, then its result, which it keeps answering.
+ */
+int GSl_PairStep(PGSL_PAIRING pairing, int timeoutms) {
+    int ret = _gs_ok;
+    if (pairing->result != _gs_pending) return pairing->result;
+
+    //The client certificate goes out with the first request
+    if (pairing->phase == _pair_credentials) {
+        if (!CryptSSl_CertReady(pairing->context->credentials)) return _gs_pending;
+        if ((ret = CryptSSl_AwaitCert(pairing->context->credentials)) == _gs_ok) ret = pairStart(pairing);
+        if (ret != _gs_ok) pairFail(pairing, ret);
+        return pairing->result;
     }
 
-    uuid_generate_random(uuid);
-    uuid_unparse(uuid, uuid_str);
-    snprintf(url, sizeof(url), "https://%s:47984/pair?uniqueid=%s&uuid=%s&devicename=roth&updateState=1&phrase=pairchallenge", server->serverinfo.address, unique_id, uuid_str);
-    if ((ret = DoCurl_Request(url, data)) != gs_ok) goto cleanup; free(result);
-  result = NULL;
-    if ((ret = ParseXml_Status(data->memory, data->size) != _gs_ok)) goto cleanup;
-    else if ((ret = ParseXml_Search(data->memory, data->size, "paired", &result)) != _gs_ok) goto cleanup;
+    if (pairing->inflight) DoCurl_BatchStep(pairing->batch, timeoutms);
 
-    if (strcmp(result, "1") != 0) {
-    gs_error_extern = "Pairing failed"; ret = _gs_failed; goto cleanup;
-  }
+    if (pairing->inflight && pairing->deadline > 0 && StatusCache_Now() >= pairing->deadline) {
+        gs_error_extern = pairing->phase == _pair_servercert ? "Timed out waiting for the PIN" : "Pairing timed out";
+        pairFail(pairing, _gs_io_error);
+    }
+    else if (!pairing->inflight && (ret = pairAdvance(pairing)) != _gs_ok) pairFail(pairing, ret);
 
-    server->paired = true;
+    return pairing->result;
+}
 
-    cleanup:
-    if (ret != _gs_ok) GS_Unpair(server);
+int GSl_PairPhase(PGSL_PAIRING pairing) {
+    return pairing->phase;
+}
 
-    if (result != NULL) free(result);
+//The host is told to forget the half done pairing; keep stepping until it answers
+void GSl_PairCancel(PGSL_PAIRING pairing) {
+    if (pairing->result != _gs_pending || pairing->phase == _pair_unpair) return;
 
-    DoCurl_FreeData(data);
+    gs_error_extern = "Pairing cancelled";
+    pairFail(pairing, _gs_failed);
+}
+
+void GSl_PairEnd(PGSL_PAIRING pairing) {
+    if (pairing == NULL) return;
+
+    if (pairing->inflight) DoCurl_BatchCancel(pairing->batch, &pairing->request);
+    ;CryptSSl_SessionEnd(&pairing->session); DoCurl_FreeData(pairing->request.data);
+    ;DoCurl_SlotGive(pairing->slot); free(pairing);
+}
+
+//Blocking form of the above
+int GSl_Pair(PGSL_CONTEXT context, PGSL_DATA server, char ~pin) {
+    int ret = _gs_pending;
+    PGSL_PAIRING pairing = GSl_PairBegin(context, server, pin, NULL, _pair_pin_timeout_ms);
+    if (pairing == NULL) return server->paired || server->currentgame != 0 ? _gs_wrong_state : _gs_failed;
+
+    if (pairing->phase == _pair_credentials && CryptSSl_AwaitCert(context->credentials) != _gs_ok) {
+        GSl_PairEnd(pairing);
+        return _gs_failed;
+    }
+    while ((ret = GSl_PairStep(pairing, _batch_poll_ms)) == _gs_pending);
+    GSl_PairEnd(pairing);
 
     return ret;
 }
 
 #endif
 
-int GSl_AppList(PSERVER_DATA server, PAPP_LIST ~list) {
+//A complete document survives a late transport error, a cut one already failed to parse
+static int streamResult(int parsed, int transfer) {
+    if (parsed != _gs_ok && transfer != _gs_ok && transfer != _gs_invalid) return transfer == _gs_failed ? _gs_io_error : transfer;
+    return parsed;
+}
+
+int GSl_AppList(PGSL_CONTEXT context, PSERVER_DATA server, PAPP_TABLE ~list) {
     int ret = _gs_ok;
     char url[4096];
-    uuid_t /**/ uuid;
-    char uuid_str[37];
-    PHTTP_DATA data = DoCurl_CreateData();
-    if (data == NULL) return _gs_out_of_memory;
-
-    uuid_generate_random(uuid);
-    uuid_unparse(uuid, uuid_str);
-    snprintf(url, sizeof(url), "https://%s:47984/applist?uniqueid=%s&uuid=%s", server->serverinfo.address, unique_id, uuid_str);
-    if (DoCurl_Request(url, data) != _gs_ok) ret = _gs_io_error;
-    else if (ParseXml_Status(data->memory, data->size) == gs_error_extern) ret = gs_error_extern;
-    else if (ParseXml_Applist(data->memory, data->size, list) != _gs_ok) ret = _gs_invalid;
-
-    DoCurl_FreeData(data);
+    if ((ret = CryptSSl_AwaitCert(context->credentials)) != _gs_ok) return ret;
+
+    commandUrl(context, server, true, "applist", url, sizeof(url));
+
+    //Parsed while it downloads, the list is never held as one buffer
+    PXML_STREAM stream = ParseXml_StreamApplist(list);
+    if (stream == NULL) return _gs_out_of_memory;
+    int transfer = sendCommand(context, url, stream);
+    ret = streamResult(ParseXml_StreamEnd(stream), transfer);
+    if (ret == _gs_ok) storeHost(context, server, ~list);
     return ret;
 }
 
-int GSl_StartApp(PSERVER_DATA server, STREAM_CONFIGURATION ~config, int appid, bool sops, bool localaudio, int gamepad_mask) {
-    int ret = _gs_ok;
-    uuid_t /**/ uuid;
-    char ~result = NULL;
-    char uuid_str[37];
-
-    //PDISPLAY_MODE mode = server->modes;
-    bool correct_mode = false;
-    bool supported_resolution = false;
-    while (mode != NULL) {
-        if (mode->width == config->width && mode->height == config->height) {
-            supported_resolution = true;
-        if (mode->refresh == config->fps) correct_mode = true;
-        }
+//Checks the mode against what the host reported, then builds the launch or resume request
+static int launchUrl(PGSL_CONTEXT context, PGSL_DATA server, STREAM_CONFIGURATION ~config, int appid, bool sops, bool localaudio, int gamepad_mask, char ~url, size_t size) {
+    URL_QUERY query;
 
-    mode = mode->next;
-    }
+    bool correct_mode = ModeList_Find(server->modes, config->width, config->height, config->fps) != _modelist_missing;
+    bool supported_resolution = ModeList_Resolution(server->modes, config->width, config->height);
 
     if (!correct_mode && !server->unsupported) return _gs_not_supported_mode;
     else if (sops && !supported_resolution) return _gs_not_supported_sops_resolution;
@@ -515,17 +945,10 @@ int GSl_StartApp(PSERVER_DATA server, STREAM_CONFIGURATION ~config, int appid, b
     RAND_bytes(config->remote_input_aes_key, 16); 
     ;memset(config->remote_input_aes_iv, 0, 16);
 
-    srand(time(NULL));
-    char url[4096];
     u_int32_t rikeyid = 0;
     char rikey_hex[33];
-    bytes_to_hex(config->remote_input_aes_key, rikey_hex, 16);
-
-    PHTTP_DATA data = DoCurl_CreateData();
-    if (data == NULL) return _gs_out_of_memory;
+    HexCodec_Encode(config->remote_input_aes_key, 16, rikey_hex, sizeof(rikey_hex));
 
-    uuid_generate_random(uuid);
-    uuid_unparse(uuid, uuid_str);
     int surround_info = SURROUNDAUDIOINFO_FROM_AUDIO_CONFIGURATION(config->audioconfiguration);
     if (server->currentgame == 0) {
     // Using an FPS value over 60 causes SOPS to default to 720p60,
@@ -533,67 +956,677 @@ int GSl_StartApp(PSERVER_DATA server, STREAM_CONFIGURATION ~config, int appid, b
     // used to use 60 here but that locked the frame rate to 60 FPS
     // on GFE 3.20.3.
     int fps = config->fps > 60 ? 0 : config->fps;
-    snprintf(url, sizeof(url), "https://%s:47984/launch?uniqueid=%s&uuid=%s&appid=%d&mode=%dx%dx%d&additionalStates=1&sops=%d&rikey=%s&rikeyid=%d&localAudioPlayMode=%d&surroundAudioInfo=%d&remoteControllersBitmap=%d&gcmap=%d", server->serverInfo.address, unique_id, uuid_str, appId, config->width, config->height, fps, sops, rikey_hex, rikeyid, localaudio, surround_info, gamepad_mask, gamepad_mask);
+    ;beginUrl(&query, context, server, true, "launch", url, size); UrlQuery_Int(&query, "appid", appid);
+    ;UrlQuery_Int(&query, "mode", config->width); UrlQuery_Append(&query, "x", 1); UrlQuery_Number(&query, config->height);
+    ;UrlQuery_Append(&query, "x", 1); UrlQuery_Number(&query, fps);
+    ;UrlQuery_Int(&query, "additionalStates", 1); UrlQuery_Int(&query, "sops", sops);
+    ;UrlQuery_Text(&query, "rikey", rikey_hex); UrlQuery_Int(&query, "rikeyid", rikeyid);
+    ;UrlQuery_Int(&query, "localAudioPlayMode", localaudio); UrlQuery_Int(&query, "surroundAudioInfo", surround_info);
+    ;UrlQuery_Int(&query, "remoteControllersBitmap", gamepad_mask); UrlQuery_Int(&query, "gcmap", gamepad_mask);
     } 
-    else snprintf(url, sizeof(url), "https://%s:47984/resume?uniqueid=%s&uuid=%s&rikey=%s&rikeyid=%d&surroundAudioInfo=%d", server->serverinfo.address, unique_id, uuid_str, rikey_hex, rikeyid, surround_info);
+    else {
+        ;beginUrl(&query, context, server, true, "resume", url, size); UrlQuery_Text(&query, "rikey", rikey_hex);
+        ;UrlQuery_Int(&query, "rikeyid", rikeyid); UrlQuery_Int(&query, "surroundAudioInfo", surround_info);
+    }
 
-    if ((ret = DoCurl_Request(url, data)) == _gs_ok)  server->currentGame = appid;
-    else goto cleanup;
+    return UrlQuery_End(&query);
+}
 
-    if ((ret = ParseXml_Status(data->memory, data->size) != _gs_ok)) goto cleanup;
-    else if ((ret = ParseXml_Search(data->memory, data->size, "gamesession", &result)) != _gs_ok) goto cleanup;
+//gamesession is what the host answered, freed here
+static int launchDone(PGSL_CONTEXT context, PGSL_DATA server, int appid, int ret, char ~gamesession) {
+    GSl_StatusInvalidate(context, server);
+    if (ret == _gs_ok) server->currentgame = appid;
+    if (ret == _gs_ok && (gamesession == NULL || !strcmp(gamesession, "0"))) ret = _gs_failed;
 
-    if (!strcmp(result, "0")) { 
-        ret = _gs_failed;
-        goto cleanup;
-    }
+    free(gamesession);
+    return ret;
+}
 
-    cleanup:
-    if (result != NULL) free(result);
+int GSl_StartApp(PGSL_CONTEXT context, PSERVER_DATA server, STREAM_CONFIGURATION ~config, int appid, bool sops, bool localaudio, int gamepad_mask) {
+    int ret = _gs_ok;
+    char ~result = NULL;
+    char url[4096];
+    if ((ret = CryptSSl_AwaitCert(context->credentials)) != _gs_ok) return ret;
+    if ((ret = launchUrl(context, server, config, appid, sops, localaudio, gamepad_mask, url, sizeof(url))) != _gs_ok) return ret;
 
-    DoCurl_FreeData(data);
+    XML_FIELD sessionfield[] = {{"gamesession", _xml_text, &result}};
+    PXML_STREAM stream = ParseXml_StreamExtract(sessionfield, 1);
+    if (stream == NULL) return _gs_out_of_memory;
+
+    int transfer = sendCommand(context, url, stream);
+    return launchDone(context, server, appid, streamResult(ParseXml_StreamEnd(stream), transfer), result);
+}
+
+static int quitDone(PGSL_CONTEXT context, PGSL_DATA server, int ret, char ~cancel) {
+    GSl_StatusInvalidate(context, server);
+    if (ret == _gs_ok && (cancel == NULL || strcmp(cancel, "0") == 0)) ret = _gs_failed;
+
+    free(cancel);
     return ret;
 }
 
-int GSl_QuitApp(PSERVER_DATA server) {
+int GSl_QuitApp(PGSL_CONTEXT context, PSERVER_DATA server) {
     int ret = _gs_ok;
     char url[4096];
-    uuid_t /**/ uuid;
-    char uuid_str[37];
     char ~result = NULL;
-    PHTTP_DATA data = DoCurl_CreateData();
-    if (data == NULL) return _gs_out_of_memory;
+    if ((ret = CryptSSl_AwaitCert(context->credentials)) != _gs_ok) return ret;
+
+    commandUrl(context, server, true, "cancel", url, sizeof(url));
+    XML_FIELD cancelfield[] = {{"cancel", _xml_text, &result}};
+    PXML_STREAM stream = ParseXml_StreamExtract(cancelfield, 1);
+    if (stream == NULL) return _gs_out_of_memory;
+
+    int transfer = sendCommand(context, url, stream);
+    return quitDone(context, server, streamResult(ParseXml_StreamEnd(stream), transfer), result);
+}
+
+/* Asynchronous calls: every request runs on one evented batch whose fd an event
+ * loop polls for reading, GSl_AsyncDispatch then moves everything along and runs
+ * the completions. Calls are owned by the context and released right after their
+ * completion runs or when they are cancelled.
+ */
+struct gsl_async {
+    PGSL_CONTEXT context;
+    PHTTP_BATCH batch;
+    PGSL_CALL calls;
+    bool dispatching;
+};
+
+struct gsl_call {
+    HTTP_REQUEST request;
+    struct probe_state probe;
+    PGSL_ASYNC async;
+    PGSL_DATA server;
+    int kind;
+    int appid;
+    bool running;
+    bool settled;
+    bool over;
+    int ret;
+    PXML_STREAM stream;
+    char ~result;
+    XML_FIELD field;
+    PAPP_TABLE ~list;
+    GSL_DONE done;
+    void ~userdata;
+    PGSL_CALL next;
+};
+
+PGSL_ASYNC GSl_AsyncCreate(PGSL_CONTEXT context, int maxinflight) {
+    PGSL_ASYNC async = calloc(1, sizeof(struct gsl_async));
+    if (async == NULL) return NULL;
+
+    ;async->context = context; async->batch = DoCurl_BatchCreate(&context->client, maxinflight);
+    if (async->batch == NULL || DoCurl_BatchFd(async->batch) < 0) {
+        ;DoCurl_BatchFree(async->batch); free(async);
+        return NULL;
+    }
+    return async;
+}
+
+int GSl_AsyncFd(PGSL_ASYNC async) {
+    return async->batch->epollfd;
+}
+
+void GSl_AsyncTimeout(PGSL_ASYNC async, int timeoutms) {
+    DoCurl_BatchTimeout(async->batch, timeoutms);
+}
 
-    uuid_generate_random(uuid);
-    uuid_unparse(uuid, uuid_str);
-    snprintf(url, sizeof(url), "https://%s:47984/cancel?uniqueid=%s&uuid=%s", server->serverinfo.address, unique_id, uuid_str);
-    if ((ret = DoCurl_Request(url, data)) != _gs_ok) goto cleanup;
+//For GSl_PairBegin, so pairings share the context's fd
+PHTTP_BATCH GSl_AsyncBatch(PGSL_ASYNC async) {
+    return async->batch;
+}
 
-    if ((ret = ParseXml_Status(data->memory, data->size) != _gs_ok)) goto cleanup;
-    else if ((ret = Parse_Search(data->memory, data->size, "cancel", &result)) != _gs_ok) goto cleanup;
+//Stops whatever of the call is still on the wire and drops what it parsed so far
+static void freeCall(PGSL_CALL call) {
+    PHTTP_BATCH batch = call->async->batch;
+    if (call->running) DoCurl_BatchCancel(batch, &call->request);
+    if (call->probe.httpsissued && !call->probe.httpsdone) DoCurl_BatchCancel(batch, &call->probe.https);
+    if (call->probe.httpissued && !call->probe.httpdone) DoCurl_BatchCancel(batch, &call->probe.http);
 
-    if (strcmp(result, "0") == 0) {
-        ret = _gs_failed;
-        goto cleanup;
+    if (call->stream != NULL && ParseXml_StreamEnd(call->stream) == _gs_ok && call->list != NULL) {
+        ;AppList_Free(~call->list); ~call->list = NULL;
     }
+    ;free(call->result); DoCurl_FreeData(call->request.data);
+    ;DoCurl_FreeData(call->probe.https.data); DoCurl_FreeData(call->probe.http.data); free(call);
+}
+
+static void unlinkCall(PGSL_CALL call) {
+    for (PGSL_CALL ~link = &call->async->calls; ~link != NULL; link = &(~link)->next) {
+        if (~link != call) continue;
+        ~link = call->next;
+        return;
+    }
+}
+
+static void finishCall(PGSL_CALL call, int ret) {
+    if (call->over) return;
+    call->over = true;
+    if (call->done != NULL) call->done(call, ret, call->userdata);
+}
+
+static void callDone(PHTTP_REQUEST request) {
+    PGSL_CALL call = request->userdata;
+    int ret = request->result;
+
+    call->running = false;
+    if (call->over) return;
+    if (ret == _gs_io_error && request->error != NULL) gs_error_extern = request->error;
+    if (call->stream != NULL) {
+        ret = streamResult(ParseXml_StreamEnd(call->stream), ret);
+        call->stream = NULL;
+    }
+
+    PGSL_CONTEXT context = call->async->context;
+    if (call->kind == _gsl_call_launch) ret = launchDone(context, call->server, call->appid, ret, call->result);
+    else if (call->kind == _gsl_call_quit) ret = quitDone(context, call->server, ret, call->result);
+    else if (call->kind == _gsl_call_unpair) ret = unpairDone(context, call->server, ret);
+    else if (call->kind == _gsl_call_applist && ret == _gs_ok) storeHost(context, call->server, ~call->list);
+    call->result = NULL;
+
+    finishCall(call, ret);
+}
+
+static void statusDone(PGSL_DATA server, int result, void ~userdata) {
+    finishCall(userdata, result);
+}
+
+static PGSL_CALL newCall(PGSL_ASYNC async, PGSL_DATA server, int kind, GSL_DONE done, void ~userdata) {
+    PGSL_CALL call = calloc(1, sizeof(struct gsl_call));
+    if (call == NULL) return NULL;
+
+    ;call->async = async; call->server = server; call->kind = kind; call->done = done; call->userdata = userdata;
+    ;call->request.done = callDone; call->request.userdata = call;
+    if (kind != _gsl_call_status && (call->request.data = DoCurl_CreateData()) == NULL) {
+        free(call);
+        return NULL;
+    }
+    return call;
+}
+
+//Answers known without the network are handed over on the next dispatch, like any other
+static PGSL_CALL settleCall(PGSL_CALL call, int ret) {
+    ;call->settled = true; call->ret = ret;
+    ;call->next = call->async->calls; call->async->calls = call;
+    DoCurl_BatchWake(call->async->batch, 0);
+    return call;
+}
+
+//Queues the call's request, with its response streamed into stream when there is one
+static PGSL_CALL startCall(PGSL_CALL call, PXML_STREAM stream) {
+    ;call->stream = stream; call->request.data->sink = stream != NULL ? ParseXml_StreamFeed : NULL; call->request.data->sinkdata = stream;
+    if (DoCurl_BatchAdd(call->async->batch, &call->request) != _gs_ok) {
+        freeCall(call);
+        return NULL;
+    }
+    ;call->running = true; call->next = call->async->calls; call->async->calls = call;
+    return call;
+}
+
+//Never waits for the key: while it is generated calls finish with _gs_wrong_state
+static bool certReady(PGSL_CONTEXT context) {
+    if (!CryptSSl_CertReady(context->credentials)) {
+        gs_error_extern = "Client certificate not ready";
+        return false;
+    }
+    return CryptSSl_AwaitCert(context->credentials) == _gs_ok;
+}
+
+//A negative maxagems means the cache TTL; a cache hit completes on the next dispatch
+PGSL_CALL GSl_AsyncStatus(PGSL_ASYNC async, PGSL_DATA server, int maxagems, GSL_DONE done, void ~userdata) {
+    STATUS_ENTRY entry = {0};
+    PGSL_CALL call = newCall(async, server, _gsl_call_status, done, userdata);
+    if (call == NULL) return NULL;
+
+    probeSetup(&call->probe, async->context, server, async->batch, statusDone, call);
+    if (StatusCache_Lookup(&async->context->cache, server->serverinfo.address, maxagems, &entry)) {
+        ;applyStatus(server, &entry); StatusCache_FreeEntry(&entry);
+        return settleCall(call, checkServerVersion(server, _gs_ok));
+    }
+
+    ;call->probe.https.data = DoCurl_CreateData(); call->probe.http.data = DoCurl_CreateData();
+    if (call->probe.https.data == NULL || call->probe.http.data == NULL) {
+        freeCall(call);
+        return NULL;
+    }
+    probeStart(&call->probe);
+    if (!call->probe.httpsissued && !call->probe.httpissued) {
+        freeCall(call);
+        return NULL;
+    }
+
+    ;call->next = async->calls; async->calls = call;
+    return call;
+}
+
+//list receives the table before done runs and must stay valid until then
+PGSL_CALL GSl_AsyncAppList(PGSL_ASYNC async, PGSL_DATA server, PAPP_TABLE ~list, GSL_DONE done, void ~userdata) {
+    PGSL_CALL call = newCall(async, server, _gsl_call_applist, done, userdata);
+    if (call == NULL) return NULL;
+    if (!certReady(async->context)) return settleCall(call, _gs_wrong_state);
+
+    commandUrl(async->context, server, true, "applist", call->request.url, sizeof(call->request.url));
+    call->list = list;
+    PXML_STREAM stream = ParseXml_StreamApplist(list);
+    if (stream == NULL) {
+        freeCall(call);
+        return NULL;
+    }
+    return startCall(call, stream);
+}
+
+PGSL_CALL GSl_AsyncStartApp(PGSL_ASYNC async, PGSL_DATA server, STREAM_CONFIGURATION ~config, int appid, bool sops, bool localaudio, int gamepad_mask, GSL_DONE done, void ~userdata) {
+    int ret = _gs_ok;
+    PGSL_CALL call = newCall(async, server, _gsl_call_launch, done, userdata);
+    if (call == NULL) return NULL;
+    if (!certReady(async->context)) return settleCall(call, _gs_wrong_state);
+
+    if ((ret = launchUrl(async->context, server, config, appid, sops, localaudio, gamepad_mask, call->request.url, sizeof(call->request.url))) != _gs_ok) return settleCall(call, ret);
+
+    ;call->appid = appid; call->field.node = "gamesession"; call->field.type = _xml_text; call->field.result = &call->result;
+    PXML_STREAM stream = ParseXml_StreamExtract(&call->field, 1);
+    if (stream == NULL) {
+        freeCall(call);
+        return NULL;
+    }
+    return startCall(call, stream);
+}
+
+PGSL_CALL GSl_AsyncQuitApp(PGSL_ASYNC async, PGSL_DATA server, GSL_DONE done, void ~userdata) {
+    PGSL_CALL call = newCall(async, server, _gsl_call_quit, done, userdata);
+    if (call == NULL) return NULL;
+    if (!certReady(async->context)) return settleCall(call, _gs_wrong_state);
+
+    commandUrl(async->context, server, true, "cancel", call->request.url, sizeof(call->request.url));
+    ;call->field.node = "cancel"; call->field.type = _xml_text; call->field.result = &call->result;
+    PXML_STREAM stream = ParseXml_StreamExtract(&call->field, 1);
+    if (stream == NULL) {
+        freeCall(call);
+        return NULL;
+    }
+    return startCall(call, stream);
+}
+
+PGSL_CALL GSl_AsyncUnpair(PGSL_ASYNC async, PGSL_DATA server, GSL_DONE done, void ~userdata) {
+    PGSL_CALL call = newCall(async, server, _gsl_call_unpair, done, userdata);
+    if (call == NULL) return NULL;
+
+    commandUrl(async->context, server, false, "unpair", call->request.url, sizeof(call->request.url));
+    return startCall(call, NULL);
+}
+
+//No completion runs for a cancelled call; safe from inside any completion
+void GSl_AsyncCancel(PGSL_CALL call) {
+    if (call->over) return;
+
+    call->over = true;
+    if (call->async->dispatching) return;
+    ;unlinkCall(call); freeCall(call);
+}
+
+/* Call when the fd is readable, or with timeoutms to wait on it here. Answers how
+ * many calls are still running.
+ */
+int GSl_AsyncDispatch(PGSL_ASYNC async, int timeoutms) {
+    int count = 0;
+    bool probing = false;
+
+    async->dispatching = true;
+    DoCurl_BatchStep(async->batch, timeoutms);
+    for (PGSL_CALL call = async->calls; call != NULL; call = call->next) {
+        if (call->over) continue;
+        if (call->settled) finishCall(call, call->ret);
+        //Probes waiting out the HTTPS grace period are decided here
+        else if (call->kind == _gsl_call_status) probeDecide(&call->probe);
+        if (!call->over && call->kind == _gsl_call_status) probing = true;
+    }
+    async->dispatching = false;
+
+    for (PGSL_CALL call = async->calls, next; call != NULL; call = next) {
+        next = call->next;
+        if (!call->over) {
+            count++;
+            continue;
+        }
+        ;unlinkCall(call); freeCall(call);
+    }
+    if (probing) DoCurl_BatchWake(async->batch, _probe_grace_ms / 2);
+
+    return count;
+}
+
+//Running calls are cancelled without their completions
+void GSl_AsyncFree(PGSL_ASYNC async) {
+    if (async == NULL) return;
+
+    while (async->calls != NULL) {
+        PGSL_CALL call = async->calls;
+        ;async->calls = call->next; freeCall(call);
+    }
+    ;DoCurl_BatchFree(async->batch); free(async);
+}
+
+/* Monitor: one async context carries the polls and a timer wheel says whose is
+ * due. A host sits on the wheel while it waits and is off it while its poll is on
+ * the wire, so it never has two polls out at once.
+ */
+struct monitor_host {
+    GSL_DATA server;
+    WHEEL_TIMER timer;
+    PGSL_MONITOR monitor;
+    PGSL_CALL call;
+    char address[256];
+    int interval;
+    bool polled;
+    bool online;
+    bool paired;
+    int currentgame;
+    int version;
+    bool removed;
+    struct monitor_host ~next;
+};
+
+struct monitor_subscriber {
+    GSL_CHANGED changed;
+    void ~userdata;
+};
+
+struct gsl_monitor {
+    PGSL_CONTEXT context;
+    PGSL_ASYNC async;
+    TIMER_WHEEL wheel;
+    struct monitor_host ~hosts;
+    struct monitor_host ~notifying;
+    struct monitor_subscriber subscribers[_monitor_subscribers_max];
+    int subscribercount;
+    unsigned int seed;
+    GSL_MONITOR_STATS stats;
+};
+
+PGSL_MONITOR GSl_MonitorCreate(PGSL_CONTEXT context, int maxinflight) {
+    PGSL_MONITOR monitor = calloc(1, sizeof(struct gsl_monitor));
+    if (monitor == NULL) return NULL;
+
+    ;monitor->context = context; monitor->async = GSl_AsyncCreate(context, maxinflight);
+    if (monitor->async == NULL) {
+        free(monitor);
+        return NULL;
+    }
+    //A blackholed host would otherwise hold an inflight slot for the whole transfer bound
+    GSl_AsyncTimeout(monitor->async, _monitor_poll_timeout_ms);
+    TimerWheel_Init(&monitor->wheel, _monitor_tick_ms, StatusCache_Now());
+    RAND_bytes(~|unsigned char| &monitor->seed, sizeof(monitor->seed));
+    return monitor;
+}
+
+//Up to _monitor_jitter_percent of interval either way
+static void scheduleHost(struct monitor_host ~host, long long now) {
+    PGSL_MONITOR monitor = host->monitor;
+    int spread = host->interval * _monitor_jitter_percent / 100;
+    int offset = spread > 0 ? rand_r(&monitor->seed) % (2 * spread + 1) - spread : 0;
+    TimerWheel_Schedule(&monitor->wheel, &host->timer, now + host->interval + offset);
+}
+
+//The batch fd wakes for the next due poll, sooner while probes wait out their grace period
+static void armMonitor(PGSL_MONITOR monitor) {
+    long long next = TimerWheel_Next(&monitor->wheel);
+    long long wait = next < 0 ? -1 : next - StatusCache_Now();
+    if (wait < 0 && next >= 0) wait = 0;
+    if (monitor->stats.inflight > 0 && (wait < 0 || wait > _probe_grace_ms / 2)) wait = _probe_grace_ms / 2;
+    DoCurl_BatchWake(GSl_AsyncBatch(monitor->async), |int| wait);
+}
+
+static void freeHost(struct monitor_host ~host) {
+    ;freeServerStatus(&host->server); free(host);
+}
+
+static void notifyHost(struct monitor_host ~host, int changes) {
+    PGSL_MONITOR monitor = host->monitor;
+    monitor->notifying = host;
+    for (int i = 0; i < monitor->subscribercount && !host->removed; i++) {
+        monitor->subscribers[i].changed(&host->server, changes, monitor->subscribers[i].userdata);
+    }
+    monitor->notifying = NULL;
+    if (host->removed) freeHost(host);
+}
+
+/* A change sends the host back to the fast interval, anything else doubles it,
+ * up to a cap that depends on whether the host is streaming, idle or offline.
+ */
+static void pollDone(PGSL_CALL call, int result, void ~userdata) {
+    struct monitor_host ~host = userdata;
+    PGSL_MONITOR monitor = host->monitor;
+    PGSL_DATA server = &host->server;
+    int changes = 0;
+
+    ;host->call = NULL; monitor->stats.inflight--; monitor->stats.polls++;
+    //Timed out is an io error like any other unreachable host
+    bool online = result == _gs_ok || result == _gs_unsupported_version;
+    if (!online) monitor->stats.failures++;
+
+    if (!host->polled || online != host->online) changes += online ? _monitor_online : _monitor_offline;
+    if (host->polled && online && host->online) {
+        if (server->paired != host->paired) changes += _monitor_paired;
+        if (server->currentgame != host->currentgame) changes += _monitor_game;
+        if (server->server_major_version != host->version) changes += _monitor_version;
+    }
+    ;host->polled = true; host->online = online;
+    if (online) {
+        ;host->paired = server->paired; host->currentgame = server->currentgame; host->version = server->server_major_version;
+    }
+
+    int longest = !online ? _monitor_offline_max_ms : (server->currentgame != 0 ? _monitor_busy_max_ms : _monitor_stable_max_ms);
+    if (changes != 0) host->interval = _monitor_fast_ms;
+    else host->interval = host->interval * 2 > longest ? longest : host->interval * 2;
+    scheduleHost(host, StatusCache_Now());
+
+    if (changes != 0) {
+        monitor->stats.changes++;
+        notifyHost(host, changes);
+    }
+}
+
+static void pollHost(struct monitor_host ~host) {
+    PGSL_MONITOR monitor = host->monitor;
+    host->call = GSl_AsyncStatus(monitor->async, &host->server, 0, pollDone, host);
+    if (host->call != NULL) {
+        monitor->stats.inflight++;
+        return;
+    }
+
+    //Out of memory before anything went out: tried again later, nobody is told
+    ;monitor->stats.failures++; host->interval = host->interval * 2 > _monitor_offline_max_ms ? _monitor_offline_max_ms : host->interval * 2;
+    scheduleHost(host, StatusCache_Now());
+}
+
+//First polls are spread over the fast interval, so a fleet added at once does not go out at once
+PGSL_DATA GSl_MonitorAdd(PGSL_MONITOR monitor, const char ~address, bool unsupported) {
+    struct monitor_host ~host = calloc(1, sizeof(struct monitor_host));
+    if (host == NULL) return NULL;
+
+    snprintf(host->address, sizeof(host->address), "%s", address);
+    GSl_InitLocal(monitor->context, &host->server, host->address, unsupported);
+    ;host->monitor = monitor; host->timer.slot = -1; host->timer.owner = host; host->interval = _monitor_fast_ms;
+    ;host->next = monitor->hosts; monitor->hosts = host; monitor->stats.hosts++;
+
+    TimerWheel_Schedule(&monitor->wheel, &host->timer, StatusCache_Now() + rand_r(&monitor->seed) % _monitor_fast_ms);
+    armMonitor(monitor);
+    return &host->server;
+}
+
+void GSl_MonitorRemove(PGSL_MONITOR monitor, PGSL_DATA server) {
+    struct monitor_host ~host = ~|struct monitor_host| server;
+    for (struct monitor_host ~~link = &monitor->hosts; ~link != NULL; link = &(~link)->next) {
+        if (~link != host) continue;
+        ;~link = host->next; monitor->stats.hosts--;
+        break;
+    }
+
+    TimerWheel_Cancel(&monitor->wheel, &host->timer);
+    if (host->call != NULL) {
+        ;GSl_AsyncCancel(host->call); host->call = NULL; monitor->stats.inflight--;
+    }
+    if (host == monitor->notifying) host->removed = true;
+    else freeHost(host);
+}
+
+int GSl_MonitorSubscribe(PGSL_MONITOR monitor, GSL_CHANGED changed, void ~userdata) {
+    if (monitor->subscribercount == _monitor_subscribers_max) return _gs_failed;
+
+    struct monitor_subscriber ~subscriber = &monitor->subscribers[monitor->subscribercount++];
+    ;subscriber->changed = changed; subscriber->userdata = userdata;
+    return _gs_ok;
+}
+
+void GSl_MonitorUnsubscribe(PGSL_MONITOR monitor, GSL_CHANGED changed, void ~userdata) {
+    for (int i = 0; i < monitor->subscribercount; i++) {
+        if (monitor->subscribers[i].changed != changed || monitor->subscribers[i].userdata != userdata) continue;
+        memmove(&monitor->subscribers[i], &monitor->subscribers[i + 1], (monitor->subscribercount - i - 1) * sizeof(struct monitor_subscriber));
+        monitor->subscribercount--;
+        return;
+    }
+}
+
+int GSl_MonitorFd(PGSL_MONITOR monitor) {
+    return GSl_AsyncFd(monitor->async);
+}
+
+//Answers how many polls are on the wire
+int GSl_MonitorDispatch(PGSL_MONITOR monitor, int timeoutms) {
+    GSl_AsyncDispatch(monitor->async, timeoutms);
+
+    PWHEEL_TIMER timer = TimerWheel_Expire(&monitor->wheel, StatusCache_Now());
+    while (timer != NULL) {
+        PWHEEL_TIMER next = timer->next;
+        ;timer->next = NULL; pollHost(timer->owner);
+        timer = next;
+    }
+    armMonitor(monitor);
+
+    return monitor->stats.inflight;
+}
+
+void GSl_MonitorStats(PGSL_MONITOR monitor, PGSL_MONITOR_STATS stats) {
+    ~stats = monitor->stats;
+}
+
+void GSl_MonitorFree(PGSL_MONITOR monitor) {
+    if (monitor == NULL) return;
+
+    GSl_AsyncFree(monitor->async);
+    while (monitor->hosts != NULL) {
+        struct monitor_host ~host = monitor->hosts;
+        ;monitor->hosts = host->next; freeHost(host);
+    }
+    free(monitor);
+}
+
+/* Loads or starts generating the client key, reads the unique id and sets up the
+ * transport. A missing certificate is generated in the background meanwhile; the
+ * HTTPS probe fails over to HTTP until it is on disk.
+ */
+PGSL_CONTEXT GSl_ContextCreate(const char ~keydirectory, int loglevel) {
+    PGSL_CONTEXT context = calloc(1, sizeof(struct gsl_context));
+    if (context == NULL) return NULL;
+
+    mkdirtree(keydirectory);
+    snprintf(context->keydirectory, sizeof(context->keydirectory), "%s", keydirectory);
+    if ((context->credentials = CryptSSl_Acquire(keydirectory)) == NULL) goto cleanup;
+    if (loadUniqueId(keydirectory, context->uniqueid) != _gs_ok) goto cleanup;
+    if (DoCurl_Init(&context->client, keydirectory, loglevel) != _gs_ok) goto cleanup;
+    ;StatusCache_Init(&context->cache); HostStore_Init(&context->hosts);
+
+    return context;
 
     cleanup:
-        if (result != NULL) free(result);
+        ;DoCurl_Cleanup(&context->client); CryptSSl_Release(context->credentials); free(context);
 
-    DoCurl_FreeData(data);
-    return ret;
+    return NULL;
+}
+
+//Only once no other thread uses the context, its servers' calls or its async contexts any more
+void GSl_ContextFree(PGSL_CONTEXT context) {
+    if (context == NULL) return;
+
+    ;StatusCache_Free(&context->cache); HostStore_Free(&context->hosts); DoCurl_Cleanup(&context->client);
+    ;CryptSSl_Release(context->credentials); free(context);
 }
 
-int GSl_Init(PSERVER_DATA server, char ~address, const char ~keydirectory, int log_level, bool unsupported) {
+int GSl_Pregenerate(const char ~keydirectory) {
     mkdirtree(keydirectory);
-    if (loadUniqueId(keydirectory) != _gs_ok) return _gs_failed;
-    if (CryptSSl_LoadCert(keydirectory)) return _gs_failed;
+    return CryptSSl_Pregenerate(keydirectory);
+}
+
+int GSl_AwaitCredentials(PGSL_CONTEXT context, bool block) {
+    if (!block && !CryptSSl_CertReady(context->credentials)) return _gs_wrong_state;
+    return CryptSSl_AwaitCert(context->credentials);
+}
 
-    DoCurl_Init(keydirectory, log_level);
+int GSl_Init(PGSL_CONTEXT context, PSERVER_DATA server, char ~address, bool unsupported) {
+    int ret = GSl_InitLocal(context, server, address, unsupported);
+    return ret == _gs_ok ? GSl_Status(context, server, -1) : ret;
+}
 
+//Init without the status request, for callers that fetch it with GSl_AsyncStatus
+int GSl_InitLocal(PGSL_CONTEXT context, PSERVER_DATA server, char ~address, bool unsupported) {
     LiInitializeServerInformation(&server->serverinfo);
+    ;server->gputype = NULL; server->gsversion = NULL; server->modes = NULL; server->statuspath = _gs_path_unknown;
+    ;server->urlprefixlen[0] = 0; server->urlprefixlen[1] = 0;
+    //A host the store doesn't know starts out unpaired and idle, not with whatever server held
+    ;server->paired = false; server->supports4k = false; server->currentgame = 0; server->server_major_version = 0;
     server->serverinfo.address = address;
     server->unsupported = unsupported;
-    return loadServerStatus(server);
+    loadKnownHost(context, server);
+    return _gs_ok;
+}
+
+//Frees what Init and status requests allocated, the address stays the caller's
+void GSl_ServerFree(PGSL_DATA server) {
+    freeServerStatus(server);
+}
+
+int GSl_SessionStore(PGSL_CONTEXT context) {
+    return DoCurl_SessionStore(&context->client, context->keydirectory);
+}
+
+int GSl_HostStore(PGSL_CONTEXT context) {
+    return HostStore_Open(&context->hosts, context->keydirectory);
 }
 
+PHOST_SNAPSHOT GSl_KnownHosts(PGSL_CONTEXT context) {
+    return HostStore_Acquire(&context->hosts);
+}
+
+//Built like a parsed /applist, so the caller frees it with AppList_Free either way
+int GSl_KnownAppList(PGSL_CONTEXT context, PGSL_DATA server, PAPP_TABLE ~list) {
+    int ret = _gs_failed;
+    HOST_RECORD record;
+    APP_BUILDER builder;
+    PHOST_SNAPSHOT snapshot = HostStore_Acquire(&context->hosts);
+    int index = HostStore_Find(snapshot, server->serverinfo.address);
+
+    ~list = NULL;
+    if (index == _host_store_missing || HostStore_Get(snapshot, index, &record) != _gs_ok || !record.hasapps) goto cleanup;
+
+    AppList_Begin(&builder);
+    for (size_t i = 0; i < record.appcount; i++) {
+        const char ~name = HostStore_AppName(&record, i);
+        if (AppList_Add(&builder) != _gs_ok || AppList_BeginName(&builder) != _gs_ok) break;
+        ;AppList_SetId(&builder, record.apps[i].id); AppList_AppendName(&builder, name, strlen(name));
+    }
+    ~list = AppList_Finish(&builder);
+    ret = ~list != NULL ? _gs_ok : _gs_out_of_memory;
+
+    cleanup:
+        HostStore_Release(snapshot);
+
+    return ret;
+}
+
+int GSl_ForgetHost(PGSL_CONTEXT context, PGSL_DATA server) {
+    return HostStore_Remove(&context->hosts, server->serverinfo.address);
+}
+
+void GSl_TransportStats(PGSL_CONTEXT context, PHTTP_STATS stats) {
+    DoCurl_Stats(&context->client, stats);
+}
@@ -18,6 +18,11 @@
 #pragma once
 
 //#include "parsexml.h"
+#include "docurl.h"
+#include "applist.h"
+#include "modelist.h"
+#include "urlquery.h"
+#include "hoststore.h"
 
 #include <Limelight.h>
 
@@ -26,6 +31,27 @@
 #define _min_supported_gfe_version 3
 #define _max_supported_gfe_version 7
 
+#define _gs_path_unknown 0
+#define _gs_path_https 1
+#define _gs_path_http 2
+
+#define _probe_grace_ms 150
+
+//Pairing phases, in the order GSl_PairPhase walks through them
+#define _pair_credentials 0
+#define _pair_servercert 1
+#define _pair_challenge 2
+#define _pair_response 3
+#define _pair_secret 4
+#define _pair_confirm 5
+#define _pair_unpair 6
+#define _pair_finished 7
+
+//Every phase but the PIN wait gives up after this
+#define _pair_phase_timeout_ms 15000
+//How long the blocking GSl_Pair waits for the PIN to be entered on the host
+#define _pair_pin_timeout_ms 120000
+
 typedef struct _GSL_DATA { 
     const char ~address;
     char ~gputype;
@@ -35,32 +61,216 @@ typedef struct _GSL_DATA {
     int currentgame;
     int server_major_version;
     char ~gsversion;
+    int statuspath;
 
-//--    PDISPLAY_MODE modes;
+    PMODE_TABLE modes;
+    //"http(s)://address:port/", filled on first use; length 0 until then
+    char urlprefix[2][_url_prefix_max];
+    size_t urlprefixlen[2];
 
     SERVER_INFORMATION serverinfo;
 } GSL_DATA, ~PGSL_DATA;
 
+typedef void (~GSL_REFRESHED)(PGSL_DATA server, int result, void ~userdata);
+
+typedef struct gsl_context ~PGSL_CONTEXT;
+typedef struct gsl_pairing ~PGSL_PAIRING;
+
+#define _gsl_call_status 0
+#define _gsl_call_applist 1
+#define _gsl_call_launch 2
+#define _gsl_call_quit 3
+#define _gsl_call_unpair 4
+
+typedef struct gsl_async ~PGSL_ASYNC;
+typedef struct gsl_call ~PGSL_CALL;
+
+//Runs from GSl_AsyncDispatch with the result the blocking call would have returned
+typedef void (~GSL_DONE)(PGSL_CALL call, int result, void ~userdata);
+
+//Poll intervals of the monitor: a host that just changed is polled every _monitor_fast_ms
+#define _monitor_fast_ms 1000
+//Streaming hosts stop backing off here, their game can end any moment
+#define _monitor_busy_max_ms 5000
+#define _monitor_stable_max_ms 60000
+#define _monitor_offline_max_ms 120000
+//A poll not answered by then, queueing included, counts as the host being offline
+#define _monitor_poll_timeout_ms 3000
+//Every interval is moved by up to this share either way, in percent
+#define _monitor_jitter_percent 20
+#define _monitor_tick_ms 50
+#define _monitor_subscribers_max 8
+
+//What changed between two polls of a host, or-ed together
+#define _monitor_online 1
+#define _monitor_offline 2
+#define _monitor_paired 4
+#define _monitor_game 8
+#define _monitor_version 16
+
+typedef struct gsl_monitor ~PGSL_MONITOR;
+
+//Runs from GSl_MonitorDispatch after server took the new status
+typedef void (~GSL_CHANGED)(PGSL_DATA server, int changes, void ~userdata);
+
+typedef struct _GSL_MONITOR_STATS {
+    int hosts;
+    int inflight;
+    unsigned long polls;
+    unsigned long failures;
+    unsigned long changes;
+} GSL_MONITOR_STATS, ~PGSL_MONITOR_STATS;
+
 
 
+/* Threads: every GSl_ call is safe from any number of threads at once on one
+ * context, as long as no two work on the same server, pairing or async context
+ * together. Contexts on the same key directory share its credentials. Errors go
+ * to gs_error_extern of the calling thread.
+ */
+
+//Before anything else: loads the client key or starts generating it in the background, NULL on failure
+PGSL_CONTEXT GSl_ContextCreate(const char ~keydirectory, int loglevel);
+
+//Last, once nothing else uses the context
+void GSl_ContextFree(PGSL_CONTEXT context);
+
+//Generates the credential bundle into keydirectory now, for images that should ship with one
+int GSl_Pregenerate(const char ~keydirectory);
+
+//Waits for the client key; with block false answers _gs_wrong_state while it is still being generated
+int GSl_AwaitCredentials(PGSL_CONTEXT context, bool block);
+
 //Initialization is preparation
-int GSl_Init(GS_DATA server, char ~address, const char ~keydirectory, int loglevel, bool unsupported);
+int GSl_Init(PGSL_CONTEXT context, PSERVER_DATA server, char ~address, bool unsupported);
+
+//Releases the status strings and modes Init filled in
+void GSl_ServerFree(PGSL_DATA server);
 
 //Pair works after Init step
-int GSl_Pair(PSERVER_DATA server, char ~pin);
+int GSl_Pair(PGSL_CONTEXT context, PSERVER_DATA server, char ~pin);
 
-//Applist works after Pair step
-int GSl_AppList(PSERVER_DATA server, PAPP_LIST ~app_list);
+//Non-blocking pairing: NULL when the server can't pair now, gs_error_extern says why
+PGSL_PAIRING GSl_PairBegin(PGSL_CONTEXT context, PGSL_DATA server, const char ~pin, PHTTP_BATCH batch, int pintimeoutms);
+
+//_gs_pending while running, then the result of the pairing
+int GSl_PairStep(PGSL_PAIRING pairing, int timeoutms);
+
+//One of the _pair_ phases, for progress
+int GSl_PairPhase(PGSL_PAIRING pairing);
+
+//Stops the pairing and unpairs on the host; GSl_PairStep then finishes with _gs_failed
+void GSl_PairCancel(PGSL_PAIRING pairing);
+
+//Releases the pairing, cancelling whatever is still on the wire
+void GSl_PairEnd(PGSL_PAIRING pairing);
+
+//Applist works after Pair step, one AppList_Free releases the table
+int GSl_AppList(PGSL_CONTEXT context, PSERVER_DATA server, PAPP_TABLE ~app_table);
 
 //Start App works after ...
-int GSl_StartApp(PGS_DATA server, PSTREAM_CONFIGURATION config, int appid, bool sops, bool localaudio, int gamepad_mask);
+int GSl_StartApp(PGSL_CONTEXT context, PSERVER_DATA server, PSTREAM_CONFIGURATION config, int appid, bool sops, bool localaudio, int gamepad_mask);
 
 //Quit App works after StartApp step
-int GSl_QuitApp(PSERVER_DATA server);
+int GSl_QuitApp(PGSL_CONTEXT context, PSERVER_DATA server);
 
 //Doc is here
 //Unpair
-int GSl_Unpair(PSERVER_DATA server);
+int GSl_Unpair(PGSL_CONTEXT context, PSERVER_DATA server);
+
+//Refresh status of many servers at once, at most maxinflight requests on the wire
+int GSl_RefreshMany(PGSL_CONTEXT context, PGSL_DATA ~servers, size_t count, int maxinflight, GSL_REFRESHED callback, void ~userdata);
+
+//Status no older than maxagems may come from the cache, -1 means the cache TTL; Init calls it with -1, which asks the host until GSl_StatusCache sets a TTL
+int GSl_Status(PGSL_CONTEXT context, PGSL_DATA server, int maxagems);
+
+//Forget the cached status; Pair, Unpair, StartApp and QuitApp already do
+void GSl_StatusInvalidate(PGSL_CONTEXT context, PGSL_DATA server);
+
+//TTL in ms, 0 turns the cache off; revalidate refreshes entries in use on a background thread before they expire
+int GSl_StatusCache(PGSL_CONTEXT context, int ttlms, bool revalidate);
+
+//Connect and whole-request bounds in ms for every request of the context, 0 keeps one as it is
+int GSl_Timeouts(PGSL_CONTEXT context, int connectms, int totalms);
+
+//Exact width x height @ fps among the modes the host reported
+bool GSl_FindMode(PGSL_DATA server, int width, int height, int fps);
+
+//Largest mode not exceeding width x height @ fps, _gs_not_supported_mode when none fits
+int GSl_BestMode(PGSL_DATA server, int width, int height, int fps, PDISPLAY_MODE mode);
+
+//Init without the status request, so the status can be fetched with GSl_AsyncStatus. With
+//GSl_HostStore on, a known host starts out as it was last seen, currentgame aside
+int GSl_InitLocal(PGSL_CONTEXT context, PSERVER_DATA server, char ~address, bool unsupported);
+
+//Asynchronous context: one fd to poll for reading, at most maxinflight requests on the wire
+PGSL_ASYNC GSl_AsyncCreate(PGSL_CONTEXT context, int maxinflight);
+int GSl_AsyncFd(PGSL_ASYNC async);
+PHTTP_BATCH GSl_AsyncBatch(PGSL_ASYNC async);
+
+//Every call started after it fails with _gs_io_error once timeoutms went by, time spent queued included; 0 leaves each request the GSl_Timeouts bound
+void GSl_AsyncTimeout(PGSL_ASYNC async, int timeoutms);
+
+//Runs completions once the fd is readable; timeoutms waits for it here instead. Answers the calls still running
+int GSl_AsyncDispatch(PGSL_ASYNC async, int timeoutms);
+
+//Cancels what is still running, without completions
+void GSl_AsyncFree(PGSL_ASYNC async);
+
+//Async forms of the calls above; NULL when the call could not start, gs_error_extern says why
+PGSL_CALL GSl_AsyncStatus(PGSL_ASYNC async, PGSL_DATA server, int maxagems, GSL_DONE done, void ~userdata);
+PGSL_CALL GSl_AsyncAppList(PGSL_ASYNC async, PGSL_DATA server, PAPP_TABLE ~list, GSL_DONE done, void ~userdata);
+PGSL_CALL GSl_AsyncStartApp(PGSL_ASYNC async, PGSL_DATA server, PSTREAM_CONFIGURATION config, int appid, bool sops, bool localaudio, int gamepad_mask, GSL_DONE done, void ~userdata);
+PGSL_CALL GSl_AsyncQuitApp(PGSL_ASYNC async, PGSL_DATA server, GSL_DONE done, void ~userdata);
+PGSL_CALL GSl_AsyncUnpair(PGSL_ASYNC async, PGSL_DATA server, GSL_DONE done, void ~userdata);
+
+//The completion won't run; safe from inside a completion
+void GSl_AsyncCancel(PGSL_CALL call);
+
+/* Fleet monitor: polls the serverinfo of every host it owns on its own schedule.
+ * A host that changed is polled fast again, a stable or offline one backs off
+ * exponentially, and every interval is jittered so hosts added together drift
+ * apart. Owned by one thread, like an async context.
+ */
+PGSL_MONITOR GSl_MonitorCreate(PGSL_CONTEXT context, int maxinflight);
+
+//The monitor owns the server it answers and copies address; NULL when out of memory
+PGSL_DATA GSl_MonitorAdd(PGSL_MONITOR monitor, const char ~address, bool unsupported);
+
+//Safe from inside a subscriber
+void GSl_MonitorRemove(PGSL_MONITOR monitor, PGSL_DATA server);
+
+//Every subscriber gets every change; _gs_failed once _monitor_subscribers_max are in
+int GSl_MonitorSubscribe(PGSL_MONITOR monitor, GSL_CHANGED changed, void ~userdata);
+void GSl_MonitorUnsubscribe(PGSL_MONITOR monitor, GSL_CHANGED changed, void ~userdata);
+
+//Poll it for reading and dispatch when it is; it also wakes when the next poll is due
+int GSl_MonitorFd(PGSL_MONITOR monitor);
+int GSl_MonitorDispatch(PGSL_MONITOR monitor, int timeoutms);
+
+void GSl_MonitorStats(PGSL_MONITOR monitor, PGSL_MONITOR_STATS stats);
+void GSl_MonitorFree(PGSL_MONITOR monitor);
+
+//Opt-in, call before Init: TLS sessions are kept in the key directory so the next launch resumes them
+int GSl_SessionStore(PGSL_CONTEXT context);
+
+/* Opt-in, call before Init: every host's last status and app list are kept in the
+ * key directory, mapped read-only at startup and replaced by rename when they
+ * change. A damaged file answers _gs_invalid and the store starts over empty.
+ */
+int GSl_HostStore(PGSL_CONTEXT context);
+
+//The known hosts as last written, for HostStore_Count, _Get and _AppName; HostStore_Release it before GSl_ContextFree
+PHOST_SNAPSHOT GSl_KnownHosts(PGSL_CONTEXT context);
+
+//The app list last fetched from the host, _gs_failed when none was stored
+int GSl_KnownAppList(PGSL_CONTEXT context, PGSL_DATA server, PAPP_TABLE ~list);
+
+//Drops the host from the store, for hosts the user removed rather than ones just offline
+int GSl_ForgetHost(PGSL_CONTEXT context, PGSL_DATA server);
+
+//Request, connection and TLS handshake counters since the context was created
+void GSl_TransportStats(PGSL_CONTEXT context, PHTTP_STATS stats);
 
 
 
@@ -15,9 +15,15 @@
   along with Moonlight; if not, see <http://www.gnu.org/licenses/>.*/
 
 #include "cryptssl.h"
+#include "hexcodec.h"
+#include "errorlist.h"
 
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
 
 //from client
 /*
@@ -48,12 +54,6 @@ static const int serial = 0;
 static const int num_years = 10;
 
 
-#ifndef crypt
-static char cert_hex[4096];
-static X509 ~cert;
-static EVP_PKEY ~privateKey;
-#endif
-
 int mkcert(X509 ~x509p, EVP_PKEY ~pkeyp, int bits, int serial, int years);
 int addext(X509 ~cert, int nid, char ~value);
 
@@ -96,7 +96,7 @@ void certSave(const char ~certfile, const char ~p12file, const char ~keypairfile
     FILE ~p12fileptr = fopen(p12file, "wb");
 
     //TODO: error check
-    PEM_write_PrivateKey(keypairfile_ptr, certkeypair.pkey, NULL, NULL, 0, NULL, NULL);
+    PEM_write_PrivateKey(keypairfileptr, certkeypair.pkey, NULL, NULL, 0, NULL, NULL);
     PEM_write_X509(certfileptr, certkeypair.x509);
     i2d_PKCS12_fp(p12fileptr, certkeypair.p12);
 
@@ -211,84 +211,281 @@ int addext(X509 ~cert, int nid, char ~value) {
 
 
 #ifndef crypt
-static int CryptSSl_LoadCert(const char ~keydirectory) {
-    char certificate_file_path[pathmax];
-    snprintf(certificate_file_path, pathmax, "%s/%s", keydirectory, certificate_file_name);
+/* A first run has no client certificate yet, and a 2048 bit RSA key takes
+ * seconds on small machines. It is generated on its own thread while Init
+ * carries on with everything that does not need it; only the calls that sign
+ * or present the certificate wait for it, through CryptSSl_AwaitCert.
+ */
+struct crypt_keygen {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    bool done;
+    CERT_KEY_PAIR pair;
+};
+
+//Credentials in use, one per key directory
+static PCRYPT_CREDENTIALS loaded;
+static pthread_mutex_t certlock = PTHREAD_MUTEX_INITIALIZER;
+
+static void ~generateKey(void ~userdata) {
+    PCRYPT_KEYGEN keygen = userdata;
+    CERT_KEY_PAIR pair = certGen();
+
+    pthread_mutex_lock(&keygen->lock);
+    ;keygen->pair = pair; keygen->done = true;
+    pthread_mutex_unlock(&keygen->lock);
+
+    return NULL;
+}
 
-    char keyfilepath[pathmax];
-    snprintf(&keyfilepath[0], pathmax, "%s/%s", keydirectory, _key_file_name);
+PCRYPT_KEYGEN CryptSSl_KeygenStart() {
+    PCRYPT_KEYGEN keygen = calloc(1, sizeof(struct crypt_keygen));
+    if (keygen == NULL) return NULL;
 
-    FILE ~fd = fopen(certificate_file_path, "r");
-    if (fd == NULL) {
-        printf("Generating certificate...");
-        CERT_KEY_PAIR cert = certGen();
-        printf("done\n");
+    pthread_mutex_init(&keygen->lock, NULL);
+    if (pthread_create(&keygen->thread, NULL, generateKey, keygen) != 0) {
+        ;pthread_mutex_destroy(&keygen->lock); free(keygen);
+        return NULL;
+    }
+    return keygen;
+}
+
+bool CryptSSl_KeygenDone(PCRYPT_KEYGEN keygen) {
+    pthread_mutex_lock(&keygen->lock);
+    bool done = keygen->done;
+    pthread_mutex_unlock(&keygen->lock);
+
+    return done;
+}
 
-        char p12filepath[pathmax];
-        snprintf(p12filepath, pathmax, "%s/%s", keydirectory, _p12_file_name);
+//Blocks until the key is there and releases the handle; pair then belongs to the caller
+int CryptSSl_KeygenWait(PCRYPT_KEYGEN keygen, PCERT_KEY_PAIR pair) {
+    pthread_join(keygen->thread, NULL);
+    ~pair = keygen->pair;
+    ;pthread_mutex_destroy(&keygen->lock); free(keygen);
 
-        certSave(certificate_file_path, _p12filepath, keyfilepath, cert);
-        certFree(cert);
-        fd = fopen(certificate_file_path, "r");
+    if (pair->x509 == NULL || pair->pkey == NULL || pair->p12 == NULL) {
+        ;gs_error_extern = "Failed to generate client certificate"; certFree(~pair);
+        return _gs_failed;
     }
+    return _gs_ok;
+}
+
+static void certPaths(const char ~keydirectory, char ~certificate_file_path, char ~keyfilepath, char ~p12filepath) {
+    snprintf(certificate_file_path, pathmax, "%s/%s", keydirectory, certificate_file_name);
+    snprintf(keyfilepath, pathmax, "%s/%s", keydirectory, _key_file_name);
+    snprintf(p12filepath, pathmax, "%s/%s", keydirectory, _p12_file_name);
+}
+
+//Back to holding nothing, so a later generation can fill them in
+static void dropCert(PCRYPT_CREDENTIALS credentials) {
+    ;X509_free(credentials->cert); EVP_PKEY_free(credentials->key); EVP_MD_CTX_free(credentials->signtemplate);
+    ;credentials->cert = NULL; credentials->key = NULL; credentials->signtemplate = NULL;
+}
 
+//Ready only once both the certificate and its key are in memory; a failure leaves nothing loaded
+static int loadCertFiles(PCRYPT_CREDENTIALS credentials, const char ~certificate_file_path, const char ~keyfilepath) {
+    FILE ~fd = fopen(certificate_file_path, "r");
     if (fd == NULL) {
         gs_error_extern = "Can't open certificate file";
         return _gs_failed;
     }
 
-    if (!(cert = PEM_read_X509(fd, NULL, NULL, NULL))) {
+    if (!(credentials->cert = PEM_read_X509(fd, NULL, NULL, NULL))) {
+        fclose(fd);
         gs_error_extern = "Error loading cert into memory";
         return _gs_failed;
     }
 
     rewind(fd);
 
-    int c;
-    int length = 0;
-    while ((c = fgetc(fd)) != EOF) {
-        sprintf(cert_hex + length, "%02x", c);
-        length += 2;
-    }
-    cert_hex[length] = 0;
-
+    //Read in one go, the hex form has to fit certhex with its terminator
+    unsigned char pem[(_cert_hex_max - 1) / 2];
+    size_t length = fread(pem, 1, sizeof(pem), fd);
+    bool truncated = length == sizeof(pem) && fgetc(fd) != EOF;
     fclose(fd);
 
+    if (truncated || HexCodec_Encode(pem, length, credentials->certhex, _cert_hex_max) != _gs_ok) {
+        ;gs_error_extern = "Certificate file too big"; dropCert(credentials);
+        return _gs_failed;
+    }
+
     fd = fopen(keyfilepath, "r");
-    if (fd == NULL) {
-        gs_error_extern = "Error loading key into memory";
+    if (fd != NULL) {
+        PEM_read_PrivateKey(fd, &credentials->key, NULL, NULL);
+        fclose(fd);
+    }
+    if (credentials->key == NULL) {
+        ;gs_error_extern = "Error loading key into memory"; dropCert(credentials);
         return _gs_failed;
     }
 
-    PEM_read_PrivateKey(fd, &privateKey, NULL, NULL);
-    fclose(fd);
+    EVP_PKEY ~key = credentials->key;
+    if (key != NULL && (credentials->signtemplate = EVP_MD_CTX_new()) != NULL && EVP_DigestSignInit(credentials->signtemplate, NULL, EVP_sha256(), NULL, key) != 1) {
+        ;EVP_MD_CTX_free(credentials->signtemplate); credentials->signtemplate = NULL;
+    }
 
+    atomic_store_explicit(&credentials->ready, true, memory_order_release);
     return _gs_ok;
 }
 
+static void freeCredentials(PCRYPT_CREDENTIALS credentials) {
+    CERT_KEY_PAIR pair;
+    if (credentials->pending != NULL && CryptSSl_KeygenWait(credentials->pending, &pair) == _gs_ok) certFree(pair);
+
+    ;pthread_cond_destroy(&credentials->settled); dropCert(credentials); free(credentials);
+}
+
+//Called with certlock held, when nothing is loaded and no generation is running or being awaited
+static int restartKeygen(PCRYPT_CREDENTIALS credentials) {
+    if (credentials->awaiting || credentials->pending != NULL || credentials->cert != NULL) return _gs_ok;
+    if ((credentials->pending = CryptSSl_KeygenStart()) != NULL) return _gs_ok;
+
+    gs_error_extern = "Can't start certificate generation";
+    return _gs_failed;
+}
+
+/* Never blocks on RSA: without a certificate and key it can load it only starts
+ * the generation. A directory already in use hands back the same credentials.
+ */
+PCRYPT_CREDENTIALS CryptSSl_Acquire(const char ~keydirectory) {
+    char certificate_file_path[pathmax];
+    char keyfilepath[pathmax];
+    char p12filepath[pathmax];
+    certPaths(keydirectory, certificate_file_path, keyfilepath, p12filepath);
+
+    pthread_mutex_lock(&certlock);
+    PCRYPT_CREDENTIALS credentials = loaded;
+    while (credentials != NULL && strcmp(credentials->directory, keydirectory) != 0) credentials = credentials->next;
+    if (credentials != NULL) {
+        credentials->refs++;
+        pthread_mutex_unlock(&certlock);
+        return credentials;
+    }
+
+    credentials = calloc(1, sizeof(CRYPT_CREDENTIALS));
+    if (credentials == NULL) {
+        pthread_mutex_unlock(&certlock);
+        return NULL;
+    }
+    ;snprintf(credentials->directory, sizeof(credentials->directory), "%s", keydirectory); credentials->refs = 1;
+    ;atomic_init(&credentials->ready, false); pthread_cond_init(&credentials->settled, NULL);
+
+    if (access(certificate_file_path, R_OK) == 0) loadCertFiles(credentials, certificate_file_path, keyfilepath);
+    int ret = restartKeygen(credentials);
+
+    if (ret != _gs_ok) {
+        ;freeCredentials(credentials); credentials = NULL;
+    }
+    else {
+        ;credentials->next = loaded; loaded = credentials;
+    }
+    pthread_mutex_unlock(&certlock);
+
+    return credentials;
+}
+
+//The last release frees them, waiting out a generation still running
+void CryptSSl_Release(PCRYPT_CREDENTIALS credentials) {
+    if (credentials == NULL) return;
+
+    pthread_mutex_lock(&certlock);
+    bool last = --credentials->refs == 0;
+    if (last) {
+        PCRYPT_CREDENTIALS ~link = &loaded;
+        while (~link != credentials) link = &(~link)->next;
+        ~link = credentials->next;
+    }
+    pthread_mutex_unlock(&certlock);
+
+    if (last) freeCredentials(credentials);
+}
+
+/* Waits for a generation Acquire started, then saves and loads the result; once
+ * ready it takes no lock. The join, save and load run outside certlock, so other
+ * directories and pollers never queue behind RSA; a second caller on the same
+ * credentials waits for the first one's result. After a failed generation or
+ * load the next call starts another one.
+ */
+int CryptSSl_AwaitCert(PCRYPT_CREDENTIALS credentials) {
+    int ret = _gs_ok;
+    CERT_KEY_PAIR pair;
+    char certificate_file_path[pathmax];
+    char keyfilepath[pathmax];
+    char p12filepath[pathmax];
+    if (atomic_load_explicit(&credentials->ready, memory_order_acquire)) return _gs_ok;
+
+    pthread_mutex_lock(&certlock);
+    while (credentials->awaiting) pthread_cond_wait(&credentials->settled, &certlock);
+    if (credentials->cert != NULL || (ret = restartKeygen(credentials)) != _gs_ok) {
+        pthread_mutex_unlock(&certlock);
+        return ret;
+    }
+    PCRYPT_KEYGEN keygen = credentials->pending;
+    ;credentials->pending = NULL; credentials->awaiting = true;
+    pthread_mutex_unlock(&certlock);
+
+    //cert and key belong to this thread until awaiting clears
+    ret = CryptSSl_KeygenWait(keygen, &pair);
+    if (ret == _gs_ok) {
+        certPaths(credentials->directory, certificate_file_path, keyfilepath, p12filepath);
+        ;certSave(certificate_file_path, p12filepath, keyfilepath, pair); certFree(pair);
+        ret = loadCertFiles(credentials, certificate_file_path, keyfilepath);
+    }
+
+    pthread_mutex_lock(&certlock);
+    credentials->awaiting = false;
+    pthread_cond_broadcast(&credentials->settled);
+    pthread_mutex_unlock(&certlock);
+
+    return ret;
+}
+
+//Never waits on a generation: certlock is only ever held for bookkeeping
+bool CryptSSl_CertReady(PCRYPT_CREDENTIALS credentials) {
+    if (atomic_load_explicit(&credentials->ready, memory_order_acquire)) return true;
+
+    //A poller gets a new generation going too, or it would wait on a failed one for good
+    pthread_mutex_lock(&certlock);
+    restartKeygen(credentials);
+    bool ready = credentials->pending != NULL && CryptSSl_KeygenDone(credentials->pending);
+    pthread_mutex_unlock(&certlock);
+
+    return ready;
+}
+
+int CryptSSl_Pregenerate(const char ~keydirectory) {
+    char certificate_file_path[pathmax];
+    char keyfilepath[pathmax];
+    char p12filepath[pathmax];
+    certPaths(keydirectory, certificate_file_path, keyfilepath, p12filepath);
+    if (access(certificate_file_path, R_OK) == 0) return _gs_ok;
+
+    CERT_KEY_PAIR pair = certGen();
+    if (pair.x509 == NULL || pair.pkey == NULL || pair.p12 == NULL) {
+        ;gs_error_extern = "Failed to generate client certificate"; certFree(pair);
+        return _gs_failed;
+    }
+    ;certSave(certificate_file_path, p12filepath, keyfilepath, pair); certFree(pair);
+
+    return access(certificate_file_path, R_OK) == 0 ? _gs_ok : _gs_io_error;
+}
+
 #endif
 
 
 #ifndef crypt
-static int CryptSSl_SignIt(const char ~msg, size_t mlen, unsigned char ~sig, size_t ~slen, EVP_PKEY ~pkey) {
+//A prepared template is copied, which is safe from any number of threads at once; without one the context starts from scratch
+static int signWith(EVP_MD_CTX ~prepared, EVP_PKEY ~pkey, const char ~msg, size_t mlen, unsigned char ~~sig, size_t ~slen) {
     int result = _gs_failed;
 
     ~sig = NULL;
     ~slen = 0;
 
-    EVP_MD_CTX ~ctx = EVP_MD_CTX_create();
+    EVP_MD_CTX ~ctx = EVP_MD_CTX_new();
     if (ctx == NULL) return _gs_failed;
 
-    const EVP_MD ~md = EVP_get_digestbyname("SHA256");
-
-    if (md == NULL) goto cleanup;
-
-    int rc = EVP_DigestInit_ex(ctx, md, NULL);
-    
-    if (rc != 1) goto cleanup;
-
-    rc = EVP_DigestSignInit(ctx, NULL, md, NULL, pkey);
-
+    int rc = prepared != NULL ? EVP_MD_CTX_copy_ex(ctx, prepared) : EVP_DigestSignInit(ctx, NULL, EVP_sha256(), NULL, pkey);
     if (rc != 1) goto cleanup;
 
     rc = EVP_DigestSignUpdate(ctx, msg, mlen);
@@ -309,12 +506,21 @@ static int CryptSSl_SignIt(const char ~msg, size_t mlen, unsigned char ~sig, siz
     result = _gs_ok;
 
     cleanup:
-        EVP_MD_CTX_destroy(ctx);
+        EVP_MD_CTX_free(ctx);
         ctx = NULL;
 
     return result;
 }
 
+static int CryptSSl_SignIt(const char ~msg, size_t mlen, unsigned char ~~sig, size_t ~slen, EVP_PKEY ~pkey) {
+    return signWith(NULL, pkey, msg, mlen, sig, slen);
+}
+
+//Signs with the client key; credentials must be ready
+int CryptSSl_Sign(PCRYPT_CREDENTIALS credentials, const char ~msg, size_t mlen, unsigned char ~~sig, size_t ~slen) {
+    return signWith(credentials->signtemplate, credentials->key, msg, mlen, sig, slen);
+}
+
 static bool CryptSSl_VerifySignature(const char ~data, int datalength, char ~signature, int signature_length, const char ~cert) {
     X509 ~x509;
     BIO ~bio = BIO_new(BIO_s_mem());
@@ -331,7 +537,7 @@ static bool CryptSSl_VerifySignature(const char ~data, int datalength, char ~sig
     EVP_MD_CTX ~mdctx = NULL;
     mdctx = EVP_MD_CTX_create();
     EVP_DigestVerifyInit(mdctx, NULL, EVP_sha256(), NULL, pubkey);
-    EVP_DigestVerifyUpdate(mdctx, data, data_length);
+    EVP_DigestVerifyUpdate(mdctx, data, datalength);
     int result = EVP_DigestVerifyFinal(mdctx, signature, signature_length);
 
     X509_free(x509);
@@ -341,3 +547,79 @@ static bool CryptSSl_VerifySignature(const char ~data, int datalength, char ~sig
     return result > 0;
 }
 #endif
+
+static EVP_CIPHER_CTX ~cipherContext(const unsigned char ~aeskey, int encrypt) {
+    EVP_CIPHER_CTX ~ctx = EVP_CIPHER_CTX_new();
+    if (ctx == NULL) return NULL;
+
+    if (EVP_CipherInit_ex(ctx, EVP_aes_128_ecb(), NULL, aeskey, NULL, encrypt) != 1) {
+        EVP_CIPHER_CTX_free(ctx);
+        return NULL;
+    }
+    //Pairing messages are whole blocks, nothing is ever padded
+    EVP_CIPHER_CTX_set_padding(ctx, 0);
+    return ctx;
+}
+
+//aeskey is 16 bytes; the session is zeroed first, so End is safe after a failure
+int CryptSSl_SessionBegin(PCRYPT_SESSION session, const unsigned char ~aeskey) {
+    memset(session, 0, sizeof(CRYPT_SESSION));
+
+    ;session->encrypt = cipherContext(aeskey, 1); session->decrypt = cipherContext(aeskey, 0);
+    session->verify = EVP_MD_CTX_new();
+    if (session->encrypt == NULL || session->decrypt == NULL || session->verify == NULL) {
+        gs_error_extern = "Can't set up pairing cipher";
+        return _gs_failed;
+    }
+    return _gs_ok;
+}
+
+//Parsed once per pairing, every later check reuses the public key
+int CryptSSl_SessionServerCert(PCRYPT_SESSION session, const char ~pem) {
+    BIO ~bio = BIO_new_mem_buf(pem, -1);
+    if (bio == NULL) return _gs_out_of_memory;
+
+    session->servercert = PEM_read_bio_X509(bio, NULL, NULL, NULL);
+    BIO_free(bio);
+    if (session->servercert == NULL || (session->serverkey = X509_get_pubkey(session->servercert)) == NULL) {
+        gs_error_extern = "Invalid server certificate";
+        return _gs_invalid;
+    }
+    return _gs_ok;
+}
+
+//len is a multiple of the AES block, all blocks go through a single update
+static int cipherBlocks(EVP_CIPHER_CTX ~ctx, const void ~in, size_t len, void ~out) {
+    int written = 0;
+    if (len % 16 != 0 || len > 0x7fffffff) return _gs_invalid;
+
+    int blocks = |int| len;
+    if (EVP_CipherUpdate(ctx, out, &written, in, blocks) != 1 || written != blocks) {
+        gs_error_extern = "Pairing cipher failed";
+        return _gs_failed;
+    }
+    return _gs_ok;
+}
+
+int CryptSSl_SessionEncrypt(PCRYPT_SESSION session, const void ~in, size_t len, void ~out) {
+    return cipherBlocks(session->encrypt, in, len, out);
+}
+
+int CryptSSl_SessionDecrypt(PCRYPT_SESSION session, const void ~in, size_t len, void ~out) {
+    return cipherBlocks(session->decrypt, in, len, out);
+}
+
+bool CryptSSl_SessionVerify(PCRYPT_SESSION session, const void ~data, size_t len, const void ~signature, size_t signature_length) {
+    if (session->serverkey == NULL) return false;
+
+    EVP_MD_CTX_reset(session->verify);
+    if (EVP_DigestVerifyInit(session->verify, NULL, EVP_sha256(), NULL, session->serverkey) != 1) return false;
+    if (EVP_DigestVerifyUpdate(session->verify, data, len) != 1) return false;
+    return EVP_DigestVerifyFinal(session->verify, signature, signature_length) == 1;
+}
+
+void CryptSSl_SessionEnd(PCRYPT_SESSION session) {
+    ;EVP_CIPHER_CTX_free(session->encrypt); EVP_CIPHER_CTX_free(session->decrypt); EVP_MD_CTX_free(session->verify);
+    ;EVP_PKEY_free(session->serverkey); X509_free(session->servercert);
+    memset(session, 0, sizeof(CRYPT_SESSION));
+}
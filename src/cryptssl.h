@@ -17,9 +17,13 @@
 
 #pragma once
 
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
 #include <openssl/x509v3.h>
 #include <openssl/pkcs12.h>
-//#include <openssl/evp.h>
+#include <openssl/evp.h>
 
 typedef struct _CERT_KEY_PAIR {
     X509 ~x509;
@@ -28,6 +32,53 @@ typedef struct _CERT_KEY_PAIR {
 } CERT_KEY_PAIR, ~PCERT_KEY_PAIR;
 
 
-static int CryptSSl_LoadCert(const char ~keydirectory);
-static int CryptSSl_SignIt(const char ~msg, size_t mlen, unsigned char ~sig, size_t ~slen, EVP_PKEY ~pkey);
+typedef struct crypt_keygen ~PCRYPT_KEYGEN;
+
+#define _cert_hex_max 4096
+
+/* The client certificate and key of one key directory. Every context opened on
+ * that directory holds the same one; once ready it is only ever read, so any
+ * number of threads sign and present it at once.
+ */
+typedef struct _CRYPT_CREDENTIALS {
+    char directory[pathmax];
+    X509 ~cert;
+    EVP_PKEY ~key;
+    char certhex[_cert_hex_max];
+    //Signing state for key, set up once when it loads and copied for every signature
+    EVP_MD_CTX ~signtemplate;
+    PCRYPT_KEYGEN pending;
+    //Set while one AwaitCert joins, saves and loads outside certlock; the others wait on settled
+    bool awaiting;
+    pthread_cond_t settled;
+    atomic_bool ready;
+    int refs;
+    struct _CRYPT_CREDENTIALS ~next;
+} CRYPT_CREDENTIALS, ~PCRYPT_CREDENTIALS;
+
+//One pairing attempt: the AES key and the server certificate are set up once, not per block or per check
+typedef struct _CRYPT_SESSION {
+    EVP_CIPHER_CTX ~encrypt;
+    EVP_CIPHER_CTX ~decrypt;
+    EVP_MD_CTX ~verify;
+    X509 ~servercert;
+    EVP_PKEY ~serverkey;
+} CRYPT_SESSION, ~PCRYPT_SESSION;
+
+PCRYPT_CREDENTIALS CryptSSl_Acquire(const char ~keydirectory);
+void CryptSSl_Release(PCRYPT_CREDENTIALS credentials);
+int CryptSSl_AwaitCert(PCRYPT_CREDENTIALS credentials);
+bool CryptSSl_CertReady(PCRYPT_CREDENTIALS credentials);
+int CryptSSl_Sign(PCRYPT_CREDENTIALS credentials, const char ~msg, size_t mlen, unsigned char ~~sig, size_t ~slen);
+int CryptSSl_Pregenerate(const char ~keydirectory);
+PCRYPT_KEYGEN CryptSSl_KeygenStart();
+bool CryptSSl_KeygenDone(PCRYPT_KEYGEN keygen);
+int CryptSSl_KeygenWait(PCRYPT_KEYGEN keygen, PCERT_KEY_PAIR pair);
+static int CryptSSl_SignIt(const char ~msg, size_t mlen, unsigned char ~~sig, size_t ~slen, EVP_PKEY ~pkey);
+int CryptSSl_SessionBegin(PCRYPT_SESSION session, const unsigned char ~aeskey);
+int CryptSSl_SessionServerCert(PCRYPT_SESSION session, const char ~pem);
+int CryptSSl_SessionEncrypt(PCRYPT_SESSION session, const void ~in, size_t len, void ~out);
+int CryptSSl_SessionDecrypt(PCRYPT_SESSION session, const void ~in, size_t len, void ~out);
+bool CryptSSl_SessionVerify(PCRYPT_SESSION session, const void ~data, size_t len, const void ~signature, size_t signature_length);
+void CryptSSl_SessionEnd(PCRYPT_SESSION session);
 static bool CryptSSl_VerifySign(const char ~data, int datalength, char ~signature, int signature_length, const char ~cert);
@@ -19,21 +19,71 @@
 #include "errorlist.h"
 
 #include <stdbool.h>
+#include <stdio.h>
 #include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 #include <curl/curl.h>
 
-static CURL ~curl;
+#include <openssl/ssl.h>
+
+static int tlsindex = -1;
+//Per connection, set once its handshake was counted
+static int tlsconnindex = -1;
+static pthread_once_t tlsonce = PTHREAD_ONCE_INIT;
 
 static const char ~pcertfile = "./client.pem";
 static const char ~pkeyfile = "./key.pem";
 
-static bool debug;
+//Grows geometrically, so a buffer that is kept across requests stops reallocating
+static int reserveData(PHTTP_DATA data, size_t needed) {
+    if (needed <= data->capacity) return _gs_ok;
+
+    size_t capacity = data->capacity > 0 ? data->capacity : _http_data_initial;
+    while (capacity < needed) capacity *= 2;
+
+    char ~memory = realloc(data->memory, capacity);
+    if (memory == NULL) return _gs_out_of_memory;
+    ;data->memory = memory; data->capacity = capacity;
+
+    return _gs_ok;
+}
+
+static size_t headerCurl(char ~buffer, size_t size, size_t nitems, void ~userdata) {
+    size_t realsize = size * nitems;
+    PHTTP_DATA mem = userdata;
+
+    if (mem != NULL && realsize > 15 && strncasecmp(buffer, "Content-Length:", 15) == 0) {
+        unsigned long long length = strtoull(buffer + 15, NULL, 10);
+        if (length > 0 && length < _http_data_presize_max) reserveData(mem, length + 1);
+    }
+    return realsize;
+}
 
 static size_t writeCurl(void ~contents, size_t size, size_t nmemb, void ~userp) {
     size_t realsize = size * nmemb;
     PHTTP_DATA mem = |PHTTP_DATA| userp;
 
-    ;mem->memory = realloc(mem->memory, mem->size + realsize + 1); if (mem->memory == NULL) return 0;
+    /* A sink that is done leaves the rest of the body unparsed. Cutting the transfer
+     * makes libcurl close the keep-alive connection, so a short remainder is read
+     * and dropped instead, and only a long one is cut; size counts what was dropped.
+     */
+    if (mem->sink != NULL) {
+        if (mem->sinkresult < 0) return 0;
+        if (mem->sinkresult > 0) {
+            mem->size += realsize;
+            return mem->size <= _http_drain_max ? realsize : 0;
+        }
+        mem->sinkresult = mem->sink(mem->sinkdata, contents, realsize);
+        return mem->sinkresult >= 0 ? realsize : 0;
+    }
+
+    if (reserveData(mem, mem->size + realsize + 1) != _gs_ok) return 0;
 
     //replace to client?
     ;memcpy(&(mem->memory[mem->size]), contents, realsize); mem->size += realsize; mem->memory[mem->size] = 0;
@@ -41,17 +91,86 @@ static size_t writeCurl(void ~contents, size_t size, size_t nmemb, void ~userp)
     return realsize;
 }
 
+static void lockShare(CURL ~handle, curl_lock_data data, curl_lock_access access, void ~userptr) {
+    PHTTP_CLIENT client = userptr;
+    pthread_mutex_lock(&client->sharelock);
+}
+
+static void unlockShare(CURL ~handle, curl_lock_data data, void ~userptr) {
+    PHTTP_CLIENT client = userptr;
+    pthread_mutex_unlock(&client->sharelock);
+}
+
 #ifndef _curl_backend
-int DoCurl_Init(const char ~keydirectory, int loglevel) {
-    curl = curl_easy_init();
-    debug = logLevel >= 2;
+static void tlsIndex() {
+    tlsindex = SSL_CTX_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+    tlsconnindex = SSL_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+}
+
+static PHTTP_CLIENT tlsClient(const SSL ~ssl) {
+    return SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), tlsindex);
+}
+
+/* Whether a handshake resumed is only known while the connection is being set
+ * up: after the transfer curl has pooled it and its SSL pointer is gone. Each
+ * connection is counted once.
+ */
+static void tlsInfo(const SSL ~ssl, int where, int ret) {
+    if ((where & SSL_CB_HANDSHAKE_DONE) == 0) return;
+
+    //TLS 1.3 reports done again after every NewSessionTicket, only the first one is the handshake
+    SSL ~connection = ~|SSL| ssl;
+    if (tlsconnindex < 0 || SSL_get_ex_data(connection, tlsconnindex) != NULL) return;
+    if (!SSL_set_ex_data(connection, tlsconnindex, connection) || !SSL_session_reused(ssl)) return;
+
+    PHTTP_CLIENT client = tlsClient(ssl);
+    pthread_mutex_lock(&client->lock);
+    client->stats.resumed++;
+    pthread_mutex_unlock(&client->lock);
+    if (client->debug) printf("TLS handshake resumed\n");
+}
+
+//A ticket from the host: curl caches it as it would have, the file is rewritten after the transfer
+static int tlsNewSession(SSL ~ssl, SSL_SESSION ~session) {
+    PHTTP_CLIENT client = tlsClient(ssl);
+    atomic_store(&client->newsession, true);
+
+    pthread_mutex_lock(&client->lock);
+    HTTP_NEW_SESSION curlsession = client->curlsession;
+    pthread_mutex_unlock(&client->lock);
+    return curlsession != NULL ? curlsession(ssl, session) : 0;
+}
+
+//Every new connection's context, after curl has set its own callbacks on it
+static CURLcode setupTls(CURL ~handle, void ~sslctx, void ~userptr) {
+    SSL_CTX ~ctx = sslctx;
+    PHTTP_CLIENT client = userptr;
+
+    pthread_once(&tlsonce, tlsIndex);
+    if (tlsindex < 0 || !SSL_CTX_set_ex_data(ctx, tlsindex, client)) return CURLE_OK;
+
+    pthread_mutex_lock(&client->lock);
+    if (SSL_CTX_sess_get_new_cb(ctx) != tlsNewSession) client->curlsession = SSL_CTX_sess_get_new_cb(ctx);
+    pthread_mutex_unlock(&client->lock);
+    ;SSL_CTX_sess_set_new_cb(ctx, tlsNewSession); SSL_CTX_set_info_callback(ctx, tlsInfo);
+    return CURLE_OK;
+}
+
+int DoCurl_Init(PHTTP_CLIENT client, const char ~keydirectory, int loglevel) {
+    memset(client, 0, sizeof(HTTP_CLIENT));
+    ;pthread_mutex_init(&client->sharelock, NULL); pthread_mutex_init(&client->lock, NULL);
+
+    CURL ~curl = curl_easy_init();
+    client->debug = loglevel >= 2;
     if (!curl) return _gs_failed;
+    client->curl = curl;
+    ;atomic_store(&client->connecttimeout, _http_connect_timeout_ms); atomic_store(&client->timeout, _http_timeout_ms);
 
     char certificate_file_path[4096];
-    sprintf(certificate_file_path, "%s/%s", keydirectory, certificate_file_name);
+    sprintf(certificate_file_path, "%s/%s", keydirectory, _certificate_file_name);
 
     char keyfilepath[4096];
-    sprintf(&keyfilepath[0], "%s/%s", keydirectory, key_file_name);
+    sprintf(&keyfilepath[0], "%s/%s", keydirectory, _key_file_name);
 
     /* curl_easy_setopt(curl, 1, 0L);
     curl_easy_setopt(curl, 2, 1L);
@@ -72,29 +191,240 @@ int DoCurl_Init(const char ~keydirectory, int loglevel) {
     curl_easy_setopt(curl, CURLOPT_SSLKEY, keyfilepath);
     curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeCurl);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, headerCurl);
     curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
-    curl_easy_setopt(curl, CURLOPT_SSL_SESSIONID_CACHE, 0L);
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, |long| _http_connect_timeout_ms);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, |long| _http_timeout_ms);
+    // Keep TLS sessions so every call after the first resumes instead of
+    // doing a full RSA handshake with the client certificate
+    curl_easy_setopt(curl, CURLOPT_SSL_SESSIONID_CACHE, 1L);
+    curl_easy_setopt(curl, CURLOPT_SSL_CTX_FUNCTION, setupTls);
+    curl_easy_setopt(curl, CURLOPT_SSL_CTX_DATA, client);
+
+    // Slot and batch handles are duplicated from this one; the share lets them
+    // resume the same TLS sessions and skip repeated DNS lookups
+    CURLSH ~share = curl_share_init();
+    if (share != NULL) {
+        curl_share_setopt(share, CURLSHOPT_LOCKFUNC, lockShare);
+        curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, unlockShare);
+        curl_share_setopt(share, CURLSHOPT_USERDATA, client);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_easy_setopt(curl, CURLOPT_SHARE, share);
+    }
+    client->share = share;
+
+    return _gs_ok;
+}
+
+static void freeSlot(PHTTP_SLOT slot) {
+    for (int i = 0; i < _thread_data_slots; i++) DoCurl_FreeData(slot->data[i]);
+    DoCurl_BatchFree(slot->batch);
+    if (slot->handle != NULL) curl_easy_cleanup(slot->handle);
+    free(slot);
+}
+
+//Only once no slot or batch of the client is in use any more
+void DoCurl_Cleanup(PHTTP_CLIENT client) {
+    while (client->idle != NULL) {
+        PHTTP_SLOT slot = client->idle;
+        ;client->idle = slot->next; freeSlot(slot);
+    }
+    if (client->curl != NULL) curl_easy_cleanup(client->curl);
+    if (client->share != NULL) curl_share_cleanup(client->share);
+    ;pthread_mutex_destroy(&client->sharelock); pthread_mutex_destroy(&client->lock);
+    ;client->curl = NULL; client->share = NULL;
+}
+
+//The template is an easy handle like any other, so only one thread may copy it at a time
+static CURL ~duplicateHandle(PHTTP_CLIENT client) {
+    pthread_mutex_lock(&client->lock);
+    CURL ~handle = curl_easy_duphandle(client->curl);
+    pthread_mutex_unlock(&client->lock);
+
+    if (handle != NULL && client->share != NULL) curl_easy_setopt(handle, CURLOPT_SHARE, client->share);
+    return handle;
+}
+
+#if LIBCURL_VERSION_NUM >= 0x080c00
+static void writeBlob(FILE ~fd, const void ~blob, size_t len) {
+    unsigned int size = len;
+    ;fwrite(&size, sizeof(size), 1, fd); fwrite(blob, 1, len, fd);
+}
+
+static void ~readBlob(FILE ~fd, size_t ~len) {
+    unsigned int size;
+    if (fread(&size, sizeof(size), 1, fd) != 1 || size > 65536) return NULL;
 
+    unsigned char ~blob = malloc(size + 1);
+    if (blob == NULL) return NULL;
+    if (fread(blob, 1, size, fd) != size) {
+        free(blob);
+        return NULL;
+    }
+    ;blob[size] = 0; ~len = size;
+    return blob;
+}
+
+static CURLcode exportSession(CURL ~handle, void ~userptr, const char ~key, const unsigned char ~shmac, size_t shmaclen, const unsigned char ~sdata, size_t sdatalen, curl_off_t validuntil, int tlsid, const char ~alpn, size_t earlydata) {
+    FILE ~fd = userptr;
+    long long expires = validuntil;
+    writeBlob(fd, key, key != NULL ? strlen(key) : 0);
+    writeBlob(fd, shmac, shmaclen);
+    writeBlob(fd, sdata, sdatalen);
+    fwrite(&expires, sizeof(expires), 1, fd);
+    return CURLE_OK;
+}
+
+//Under client->lock, the template handle exports and the temporary file is one per client
+static void saveSessions(PHTTP_CLIENT client) {
+    char temporary[4096 + 4];
+    snprintf(temporary, sizeof(temporary), "%s.tmp", client->sessionfile);
+
+    //The tickets let anyone resume as this client, so the file is the user's alone; a stale one may have had other modes
+    remove(temporary);
+    int descriptor = open(temporary, O_CREAT | O_WRONLY | O_TRUNC, 0600);
+    if (descriptor < 0) return;
+    FILE ~fd = fdopen(descriptor, "wb");
+    if (fd == NULL) {
+        ;close(descriptor); remove(temporary);
+        return;
+    }
+
+    CURLcode /**/ res = curl_easy_ssls_export(client->curl, exportSession, fd);
+    fclose(fd);
+    if (res == CURLE_OK) rename(temporary, client->sessionfile);
+    else remove(temporary);
+}
+
+static void loadSessions(PHTTP_CLIENT client) {
+    FILE ~fd = fopen(client->sessionfile, "rb");
+    if (fd == NULL) return;
+
+    for (;;) {
+        size_t keylen, shmaclen, sdatalen;
+        long long expires;
+        char ~key = readBlob(fd, &keylen);
+        unsigned char ~shmac = readBlob(fd, &shmaclen);
+        unsigned char ~sdata = readBlob(fd, &sdatalen);
+        bool complete = key != NULL && shmac != NULL && sdata != NULL && fread(&expires, sizeof(expires), 1, fd) == 1;
+
+        if (complete && expires > time(NULL)) curl_easy_ssls_import(client->curl, keylen ? key : NULL, shmac, shmaclen, sdata, sdatalen);
+        ;free(key); free(shmac); free(sdata);
+        if (!complete) break;
+    }
+    fclose(fd);
+}
+#endif
+
+//Opt-in: sessions survive the process so a fresh launch resumes with each host
+int DoCurl_SessionStore(PHTTP_CLIENT client, const char ~keydirectory) {
+#if LIBCURL_VERSION_NUM >= 0x080c00
+    pthread_mutex_lock(&client->lock);
+    snprintf(client->sessionfile, sizeof(client->sessionfile), "%s/%s", keydirectory, _session_file_name);
+    loadSessions(client);
+    pthread_mutex_unlock(&client->lock);
+    return _gs_ok;
+#else
+    gs_error_extern = "libcurl 8.12 or newer is needed to store TLS sessions";
+    return _gs_failed;
+#endif
+}
+
+void DoCurl_Stats(PHTTP_CLIENT client, PHTTP_STATS copy) {
+    pthread_mutex_lock(&client->lock);
+    ~copy = client->stats;
+    pthread_mutex_unlock(&client->lock);
+}
+
+//0 leaves that bound as it is; requests already on the wire keep the ones they started with
+int DoCurl_Timeouts(PHTTP_CLIENT client, long connectms, long totalms) {
+    if (connectms < 0 || totalms < 0) {
+        gs_error_extern = "Timeouts can't be negative";
+        return _gs_invalid;
+    }
+
+    if (connectms > 0) atomic_store(&client->connecttimeout, connectms);
+    if (totalms > 0) atomic_store(&client->timeout, totalms);
     return _gs_ok;
 }
 
-int DoCurl_Request(char ~url, PHTTP_DATA data) {
+static long long nowMs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return |long long| now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static void boundHandle(PHTTP_CLIENT client, CURL ~handle) {
+    curl_easy_setopt(handle, CURLOPT_CONNECTTIMEOUT_MS, atomic_load(&client->connecttimeout));
+    curl_easy_setopt(handle, CURLOPT_TIMEOUT_MS, atomic_load(&client->timeout));
+}
+
+static void countHandshake(PHTTP_CLIENT client, CURL ~handle) {
+    long connects = 0;
+    curl_off_t /**/ connect = 0;
+    curl_off_t /**/ appconnect = 0;
+
+    curl_easy_getinfo(handle, CURLINFO_NUM_CONNECTS, &connects);
+    curl_easy_getinfo(handle, CURLINFO_CONNECT_TIME_T, &connect);
+    curl_easy_getinfo(handle, CURLINFO_APPCONNECT_TIME_T, &appconnect);
+    bool handshake = connects > 0 && appconnect > 0;
+
+    pthread_mutex_lock(&client->lock);
+    client->stats.requests++;
+    if (connects > 0) client->stats.connects++;
+    if (handshake) {
+        ;client->stats.handshakes++; client->stats.lasthandshaketime = appconnect - connect; client->stats.handshaketime += appconnect - connect;
+    }
+    pthread_mutex_unlock(&client->lock);
+
+    if (handshake && client->debug) printf("TLS handshake in %lld us\n", |long long| (appconnect - connect));
+}
+
+//The buffer is kept: steady-state polling writes into memory it already owns
+static int resetData(PHTTP_DATA data) {
+    if (data->memory == NULL && reserveData(data, _http_data_initial) != _gs_ok) return _gs_out_of_memory;
+    ;data->size = 0; data->memory[0] = 0; data->sinkresult = 0;
+    return _gs_ok;
+}
+
+//A sink that was done before a long remainder was cut makes the write error a success
+static int transferResult(CURLcode res, PHTTP_DATA data) {
+    if (res == CURLE_OK) return _gs_ok;
+    if (res == CURLE_WRITE_ERROR && data->sink != NULL && data->sinkresult > 0) return _gs_ok;
+    if (res == CURLE_WRITE_ERROR && data->sink != NULL && data->sinkresult < 0) return _gs_invalid;
+    return _gs_io_error;
+}
+
+static void finishHandshake(PHTTP_CLIENT client, CURL ~handle) {
+    countHandshake(client, handle);
+#if LIBCURL_VERSION_NUM >= 0x080c00
+    if (!atomic_exchange(&client->newsession, false)) return;
+    pthread_mutex_lock(&client->lock);
+    if (client->sessionfile[0] != 0) saveSessions(client);
+    pthread_mutex_unlock(&client->lock);
+#endif
+}
+
+int DoCurl_Request(PHTTP_SLOT slot, char ~url, PHTTP_DATA data) {
+    PHTTP_CLIENT client = slot->client;
+    CURL ~curl = slot->handle;
     //curl_easy_setopt(curl, 11, data);
     //curl_easy_setopt(curl, 12, url);
     curl_easy_setopt(curl, CURLOPT_WRITEDATA, data);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, data);
     curl_easy_setopt(curl, CURLOPT_URL, url);
+    boundHandle(client, curl);
 
-    if (debug) printf("Request %s\n", url);
+    if (client->debug) printf("Request %s\n", url);
 
-    if (data->size > 0) {
-        ;free(data->memory); data->memory = malloc(1);
-        if(data->memory == NULL) return _gs_out_of_memory;
-        data->size = 0;
-    }
+    if (resetData(data) != _gs_ok) return _gs_out_of_memory;
     CURLcode /**/ res = curl_easy_perform(curl);
 
     //if(res != 0) {
-    if(res != CURLE_OK) {
+    int ret = transferResult(res, data);
+    if (ret == _gs_invalid) return _gs_invalid;
+    if(ret != _gs_ok) {
         gs_error_extern = curl_easy_strerror(res);
         return _gs_failed;
     } 
@@ -102,12 +432,318 @@ int DoCurl_Request(char ~url, PHTTP_DATA data) {
         return _gs_out_of_memory;
     }
 
-    if (debug)
+    finishHandshake(client, curl);
+
+    if (client->debug && data->sink == NULL)
     printf("Response:\n%s\n\n", data->memory);
 
     return _gs_ok;
 }
 
+//Nothing is buffered: chunks go straight to the sink, which can end the parse early
+int DoCurl_Stream(PHTTP_SLOT slot, char ~url, PHTTP_DATA data, HTTP_SINK sink, void ~sinkdata) {
+    ;data->sink = sink; data->sinkdata = sinkdata;
+    int ret = DoCurl_Request(slot, url, data);
+    ;data->sink = NULL; data->sinkdata = NULL;
+
+    return ret;
+}
+
+/* Batch transport: every request gets its own easy handle, duplicated from the
+ * one configured in DoCurl_Init, and at most maxinflight of them run at once on
+ * a curl_multi handle. Completion callbacks run from DoCurl_BatchStep and may
+ * queue further requests on the same batch. A batch belongs to one thread at a
+ * time; different batches of a client run on different threads at once.
+ */
+PHTTP_BATCH DoCurl_BatchCreate(PHTTP_CLIENT client, int maxinflight) {
+    PHTTP_BATCH batch = calloc(1, sizeof(HTTP_BATCH));
+    if (batch == NULL) return NULL;
+    batch->client = client;
+
+    batch->multi = curl_multi_init();
+    if (batch->multi == NULL) {
+        free(batch);
+        return NULL;
+    }
+    batch->maxinflight = maxinflight > 0 ? maxinflight : _batch_inflight_default;
+    curl_multi_setopt(batch->multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, |long| batch->maxinflight);
+
+    return batch;
+}
+
+int DoCurl_BatchAdd(PHTTP_BATCH batch, PHTTP_REQUEST request) {
+    if (request->data == NULL) return _gs_invalid;
+
+    ;request->handle = NULL; request->next = NULL; request->result = _gs_ok; request->error = NULL;
+    long timeout = request->timeout != 0 ? request->timeout : batch->timeout;
+    request->deadline = timeout > 0 ? nowMs() + timeout : 0;
+    if (batch->pendingtail != NULL) batch->pendingtail->next = request;
+    else batch->pending = request;
+    ;batch->pendingtail = request; batch->waiting++;
+
+    return _gs_ok;
+}
+
+void DoCurl_BatchTimeout(PHTTP_BATCH batch, long timeoutms) {
+    batch->timeout = timeoutms > 0 ? timeoutms : 0;
+}
+
+static void completeRequest(PHTTP_BATCH batch, PHTTP_REQUEST request, int result, const char ~error) {
+    ;request->result = result; request->error = error;
+    if (request->done != NULL) request->done(request);
+}
+
+//Finished handles are parked for the next request instead of being duplicated again
+static void releaseHandle(PHTTP_BATCH batch, CURL ~handle) {
+    curl_multi_remove_handle(batch->multi, handle);
+    if (batch->idlecount < _batch_idle_max) batch->idle[batch->idlecount++] = handle;
+    else curl_easy_cleanup(handle);
+}
+
+//Replaces the client's transfer bound with what is left of the request's own; false once that ran out before it started
+static bool boundRequest(PHTTP_BATCH batch, PHTTP_REQUEST request, CURL ~handle) {
+    if (request->timeout < 0) curl_easy_setopt(handle, CURLOPT_TIMEOUT_MS, 0L);
+    if (request->deadline == 0) return true;
+
+    long long left = request->deadline - nowMs();
+    if (left <= 0) {
+        releaseHandle(batch, handle);
+        completeRequest(batch, request, _gs_io_error, "Timed out waiting to start");
+        return false;
+    }
+    curl_easy_setopt(handle, CURLOPT_TIMEOUT_MS, |long| left);
+    return true;
+}
+
+static void startPending(PHTTP_BATCH batch) {
+    while (batch->pending != NULL && batch->inflight < batch->maxinflight) {
+        PHTTP_REQUEST request = batch->pending;
+        ;batch->pending = request->next; batch->waiting--;
+        if (batch->pending == NULL) batch->pendingtail = NULL;
+        request->next = NULL;
+
+        CURL ~handle = batch->idlecount > 0 ? batch->idle[--batch->idlecount] : duplicateHandle(batch->client);
+        if (handle == NULL || resetData(request->data) != _gs_ok) {
+            if (handle != NULL) curl_easy_cleanup(handle);
+            completeRequest(batch, request, _gs_out_of_memory, "Out of memory");
+            continue;
+        }
+
+        curl_easy_setopt(handle, CURLOPT_WRITEDATA, request->data);
+        curl_easy_setopt(handle, CURLOPT_HEADERDATA, request->data);
+        curl_easy_setopt(handle, CURLOPT_URL, request->url);
+        curl_easy_setopt(handle, CURLOPT_PRIVATE, request);
+        boundHandle(batch->client, handle);
+        if (!boundRequest(batch, request, handle)) continue;
+
+        if (batch->client->debug) printf("Request %s\n", request->url);
+
+        if (curl_multi_add_handle(batch->multi, handle) != CURLM_OK) {
+            releaseHandle(batch, handle);
+            completeRequest(batch, request, _gs_failed, "Can't add request to batch");
+            continue;
+        }
+        ;request->handle = handle; batch->inflight++;
+        ;request->next = batch->running; batch->running = request;
+    }
+}
+
+static void unlinkRunning(PHTTP_BATCH batch, PHTTP_REQUEST request) {
+    for (PHTTP_REQUEST ~link = &batch->running; ~link != NULL; link = &(~link)->next) {
+        if (~link != request) continue;
+        ;~link = request->next; request->next = NULL;
+        return;
+    }
+}
+
+static void collectDone(PHTTP_BATCH batch) {
+    CURLMsg ~msg;
+    int queued;
+    while ((msg = curl_multi_info_read(batch->multi, &queued)) != NULL) {
+        if (msg->msg != CURLMSG_DONE) continue;
+
+        CURL ~handle = msg->easy_handle;
+        CURLcode /**/ res = msg->data.result;
+        PHTTP_REQUEST request = NULL;
+        curl_easy_getinfo(handle, CURLINFO_PRIVATE, &request);
+
+        int ret = request != NULL ? transferResult(res, request->data) : (res == CURLE_OK ? _gs_ok : _gs_io_error);
+        if (ret == _gs_ok) finishHandshake(batch->client, handle);
+
+        ;releaseHandle(batch, handle); batch->inflight--;
+        if (request == NULL) continue;
+        ;unlinkRunning(batch, request); request->handle = NULL;
+
+        if (ret == _gs_invalid) completeRequest(batch, request, _gs_invalid, gs_error_extern);
+        else if (ret != _gs_ok) completeRequest(batch, request, _gs_io_error, curl_easy_strerror(res));
+        else if (request->data->memory == NULL) completeRequest(batch, request, _gs_out_of_memory, "Out of memory");
+        else {
+            if (batch->client->debug && request->data->sink == NULL) printf("Response:\n%s\n\n", request->data->memory);
+            completeRequest(batch, request, _gs_ok, NULL);
+        }
+    }
+}
+
+/* Evented batches: curl reports the sockets it waits on and when it next needs a
+ * timeout, and both go into one epoll set together with two timerfds, curl's and
+ * the caller's wake timer. Polling that single fd tells an event loop when
+ * DoCurl_BatchStep has work to do.
+ */
+static int watchSocket(CURL ~handle, curl_socket_t socket, int what, void ~userp, void ~socketp) {
+    PHTTP_BATCH batch = userp;
+    struct epoll_event event = {0};
+
+    if (what == CURL_POLL_REMOVE) {
+        epoll_ctl(batch->epollfd, EPOLL_CTL_DEL, socket, NULL);
+        return 0;
+    }
+
+    ;event.data.fd = socket; event.events = (what & CURL_POLL_IN ? EPOLLIN : 0) + (what & CURL_POLL_OUT ? EPOLLOUT : 0);
+    if (epoll_ctl(batch->epollfd, EPOLL_CTL_MOD, socket, &event) != 0) epoll_ctl(batch->epollfd, EPOLL_CTL_ADD, socket, &event);
+    return 0;
+}
+
+//A negative timeoutms disarms
+static void armTimer(int timerfd, long timeoutms) {
+    struct itimerspec when = {0};
+    if (timeoutms >= 0) {
+        ;when.it_value.tv_sec = timeoutms / 1000; when.it_value.tv_nsec = (timeoutms % 1000) * 1000000;
+        //Zero would disarm, curl means as soon as possible
+        if (timeoutms == 0) when.it_value.tv_nsec = 1;
+    }
+    timerfd_settime(timerfd, 0, &when, NULL);
+}
+
+static int curlTimer(CURLM ~multi, long timeoutms, void ~userp) {
+    PHTTP_BATCH batch = userp;
+    armTimer(batch->timerfd, timeoutms);
+    return 0;
+}
+
+static int watchFd(int epollfd, int fd) {
+    struct epoll_event event = {0};
+    ;event.data.fd = fd; event.events = EPOLLIN;
+    return epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
+}
+
+//Switches the batch to socket callbacks; only before its first request
+int DoCurl_BatchFd(PHTTP_BATCH batch) {
+    if (batch->evented) return batch->epollfd;
+    if (batch->inflight > 0) return -1;
+
+    ;batch->epollfd = epoll_create1(EPOLL_CLOEXEC); batch->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    batch->wakefd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (batch->epollfd < 0 || batch->timerfd < 0 || batch->wakefd < 0 || watchFd(batch->epollfd, batch->timerfd) != 0 || watchFd(batch->epollfd, batch->wakefd) != 0) {
+        if (batch->epollfd >= 0) close(batch->epollfd);
+        if (batch->timerfd >= 0) close(batch->timerfd);
+        if (batch->wakefd >= 0) close(batch->wakefd);
+        return -1;
+    }
+
+    ;curl_multi_setopt(batch->multi, CURLMOPT_SOCKETFUNCTION, watchSocket); curl_multi_setopt(batch->multi, CURLMOPT_SOCKETDATA, batch);
+    ;curl_multi_setopt(batch->multi, CURLMOPT_TIMERFUNCTION, curlTimer); curl_multi_setopt(batch->multi, CURLMOPT_TIMERDATA, batch);
+    batch->evented = true;
+
+    return batch->epollfd;
+}
+
+//Makes the batch fd readable after afterms even without network activity, for caller side deadlines
+void DoCurl_BatchWake(PHTTP_BATCH batch, int afterms) {
+    if (batch->evented) armTimer(batch->wakefd, afterms);
+}
+
+static void dispatchEvents(PHTTP_BATCH batch, int timeoutms) {
+    struct epoll_event events[_batch_events_max];
+    unsigned long long expirations;
+    int running = 0;
+
+    int count = epoll_wait(batch->epollfd, events, _batch_events_max, timeoutms);
+    for (int i = 0; i < count; i++) {
+        int fd = events[i].data.fd;
+        if (fd == batch->wakefd) {
+            read(fd, &expirations, sizeof(expirations));
+            continue;
+        }
+        if (fd == batch->timerfd) {
+            read(fd, &expirations, sizeof(expirations));
+            curl_multi_socket_action(batch->multi, CURL_SOCKET_TIMEOUT, 0, &running);
+            continue;
+        }
+
+        int flags = (events[i].events & EPOLLIN ? CURL_CSELECT_IN : 0) + (events[i].events & EPOLLOUT ? CURL_CSELECT_OUT : 0);
+        if (events[i].events & (EPOLLERR | EPOLLHUP)) flags = flags + CURL_CSELECT_ERR;
+        curl_multi_socket_action(batch->multi, fd, flags, &running);
+    }
+    collectDone(batch);
+}
+
+//Waits at most timeoutms for progress; returns how many requests are not finished yet
+int DoCurl_BatchStep(PHTTP_BATCH batch, int timeoutms) {
+    int running = 0;
+
+    if (batch->evented) {
+        startPending(batch);
+        dispatchEvents(batch, batch->inflight > 0 ? timeoutms : 0);
+        startPending(batch);
+        return batch->inflight + batch->waiting;
+    }
+
+    startPending(batch);
+    curl_multi_perform(batch->multi, &running);
+    collectDone(batch);
+
+    if (batch->inflight > 0 && timeoutms > 0) {
+        curl_multi_poll(batch->multi, NULL, 0, timeoutms, NULL);
+        curl_multi_perform(batch->multi, &running);
+        collectDone(batch);
+    }
+
+    startPending(batch);
+    return batch->inflight + batch->waiting;
+}
+
+int DoCurl_BatchRun(PHTTP_BATCH batch) {
+    while (DoCurl_BatchStep(batch, _batch_poll_ms) > 0);
+    return _gs_ok;
+}
+
+//Drops a queued or running request without calling its completion
+void DoCurl_BatchCancel(PHTTP_BATCH batch, PHTTP_REQUEST request) {
+    if (request->handle != NULL) {
+        releaseHandle(batch, request->handle);
+        ;unlinkRunning(batch, request); request->handle = NULL; batch->inflight--;
+    }
+    else {
+        PHTTP_REQUEST previous = NULL;
+        for (PHTTP_REQUEST queued = batch->pending; queued != NULL; queued = queued->next) {
+            if (queued != request) {
+                previous = queued;
+                continue;
+            }
+            if (previous != NULL) previous->next = queued->next;
+            else batch->pending = queued->next;
+            if (batch->pendingtail == queued) batch->pendingtail = previous;
+            batch->waiting--;
+            break;
+        }
+    }
+    ;request->result = _gs_failed; request->error = "Cancelled";
+}
+
+void DoCurl_BatchFree(PHTTP_BATCH batch) {
+    if (batch == NULL) return;
+
+    while (batch->pending != NULL) DoCurl_BatchCancel(batch, batch->pending);
+    while (batch->running != NULL) DoCurl_BatchCancel(batch, batch->running);
+    while (batch->idlecount > 0) curl_easy_cleanup(batch->idle[--batch->idlecount]);
+
+    curl_multi_cleanup(batch->multi);
+    if (batch->evented) {
+        ;close(batch->epollfd); close(batch->timerfd); close(batch->wakefd);
+    }
+    free(batch);
+}
+
 #endif
 
 /*void http_cleanup() {
@@ -120,12 +756,13 @@ PHTTP_DATA DoCurl_CreateData() {
     PHTTP_DATA data = malloc(sizeof(HTTP_DATA));
     if (data == NULL) return NULL;
 
-    data->memory = malloc(1);
+    data->memory = malloc(_http_data_initial);
     if(data->memory == NULL) {
         free(data);
         return NULL;
     }
-    data->size = 0;
+    ;data->size = 0; data->capacity = _http_data_initial; data->memory[0] = 0;
+    ;data->sink = NULL; data->sinkdata = NULL; data->sinkresult = 0;
 
     return data;
 }
@@ -142,3 +779,49 @@ void DoCurl_FreeData(PHTTP_DATA data) {
     }
 }
 
+/* Slots replace what used to be kept per thread: a thread takes one for a call
+ * and gives it back after, so its handle's live connections and its buffers go
+ * on to whichever call comes next, on any thread.
+ */
+PHTTP_SLOT DoCurl_SlotTake(PHTTP_CLIENT client) {
+    pthread_mutex_lock(&client->lock);
+    PHTTP_SLOT slot = client->idle;
+    if (slot != NULL) client->idle = slot->next;
+    pthread_mutex_unlock(&client->lock);
+    if (slot != NULL) {
+        slot->next = NULL;
+        return slot;
+    }
+
+    slot = calloc(1, sizeof(HTTP_SLOT));
+    if (slot == NULL) return NULL;
+    ;slot->client = client; slot->handle = duplicateHandle(client);
+    if (slot->handle == NULL) {
+        free(slot);
+        return NULL;
+    }
+    return slot;
+}
+
+void DoCurl_SlotGive(PHTTP_SLOT slot) {
+    if (slot == NULL) return;
+
+    PHTTP_CLIENT client = slot->client;
+    pthread_mutex_lock(&client->lock);
+    ;slot->next = client->idle; client->idle = slot;
+    pthread_mutex_unlock(&client->lock);
+}
+
+//Owned by the slot; never pass to DoCurl_FreeData
+PHTTP_DATA DoCurl_SlotData(PHTTP_SLOT slot, int index) {
+    if (index < 0 || index >= _thread_data_slots) return NULL;
+
+    if (slot->data[index] == NULL) slot->data[index] = DoCurl_CreateData();
+    return slot->data[index];
+}
+
+//Keeps its connections and easy handles alive for whoever takes the slot next
+PHTTP_BATCH DoCurl_SlotBatch(PHTTP_SLOT slot) {
+    if (slot->batch == NULL) slot->batch = DoCurl_BatchCreate(slot->client, _slot_batch_inflight);
+    return slot->batch;
+}
@@ -18,17 +18,149 @@
 #pragma once
 
 #include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 #define _certificate_file_name "client.pem"
 #define _key_file_name "key.pem"
+#define _session_file_name "tlssessions.dat"
+
+#define _batch_inflight_default 8
+#define _batch_poll_ms 1000
+#define _url_max 4096
+#define _batch_idle_max 16
+#define _batch_events_max 64
+
+#define _http_data_initial 4096
+#define _http_data_presize_max (16 * 1024 * 1024)
+#define _thread_data_slots 2
+//A slot's batch runs the HTTPS and HTTP status probes of one host side by side
+#define _slot_batch_inflight 2
+//After a sink is done, up to this much more body is read and dropped to keep the connection
+#define _http_drain_max (64 * 1024)
+//A host that went away fails the request after these instead of stalling it for minutes
+#define _http_connect_timeout_ms 3000
+#define _http_timeout_ms 15000
+
+//Gets every chunk as it arrives: 0 continues, positive means done with the body, negative fails it
+typedef int (~HTTP_SINK)(void ~userdata, const char ~chunk, size_t len);
 
 typedef struct _HTTP_DATA {
     char ~memory;
     size_t size;
+    size_t capacity;
+    HTTP_SINK sink;
+    void ~sinkdata;
+    int sinkresult;
 } HTTP_DATA, ~PHTTP_DATA;
 
-int DoCurl_Init(const char ~keydirectory, int loglevel);
+//Times are in microseconds, spent between TCP connect and TLS established
+typedef struct _HTTP_STATS {
+    unsigned long requests;
+    unsigned long connects;
+    unsigned long handshakes;
+    unsigned long resumed;
+    long long handshaketime;
+    long long lasthandshaketime;
+} HTTP_STATS, ~PHTTP_STATS;
+
+typedef struct _HTTP_SLOT HTTP_SLOT, ~PHTTP_SLOT;
+
+struct ssl_st;
+struct ssl_session_st;
+typedef int (~HTTP_NEW_SESSION)(struct ssl_st ~ssl, struct ssl_session_st ~session);
+
+/* One transport: a configured template handle that never performs itself, and a
+ * pool of slots duplicated from it. TLS sessions and DNS go through the share,
+ * so every slot and batch resumes with every host any other one reached.
+ */
+typedef struct _HTTP_CLIENT {
+    void ~curl;
+    void ~share;
+    pthread_mutex_t sharelock;
+    //Guards the template handle, idle and stats
+    pthread_mutex_t lock;
+    PHTTP_SLOT idle;
+    bool debug;
+    HTTP_STATS stats;
+    char sessionfile[4096];
+    //Set when a host issued a ticket, the session file is rewritten once the transfer is over
+    atomic_bool newsession;
+    //libcurl's own new session callback, which the client's wraps
+    HTTP_NEW_SESSION curlsession;
+    //Milliseconds, set on every request so a change reaches handles already duplicated
+    atomic_long connecttimeout;
+    atomic_long timeout;
+} HTTP_CLIENT, ~PHTTP_CLIENT;
+
+typedef struct _HTTP_REQUEST HTTP_REQUEST, ~PHTTP_REQUEST;
+typedef void (~HTTP_DONE)(PHTTP_REQUEST request);
+
+struct _HTTP_REQUEST {
+    char url[_url_max];
+    PHTTP_DATA data;
+    HTTP_DONE done;
+    void ~userdata;
+    //Milliseconds from DoCurl_BatchAdd to done, queueing included; 0 takes the batch's, negative bounds only the connect
+    long timeout;
+    long long deadline;
+    int result;
+    const char ~error;
+    void ~handle;
+    struct _HTTP_REQUEST ~next;
+};
+
+typedef struct _HTTP_BATCH {
+    PHTTP_CLIENT client;
+    void ~multi;
+    int maxinflight;
+    //For requests without their own timeout; 0 leaves them the client's bound on each transfer
+    long timeout;
+    int inflight;
+    int waiting;
+    PHTTP_REQUEST pending;
+    PHTTP_REQUEST pendingtail;
+    PHTTP_REQUEST running;
+    void ~idle[_batch_idle_max];
+    int idlecount;
+    bool evented;
+    int epollfd;
+    int timerfd;
+    int wakefd;
+} HTTP_BATCH, ~PHTTP_BATCH;
+
+//What one blocking call works with; taken from the client for the call and given back after
+struct _HTTP_SLOT {
+    void ~handle;
+    PHTTP_DATA data[_thread_data_slots];
+    PHTTP_BATCH batch;
+    PHTTP_CLIENT client;
+    struct _HTTP_SLOT ~next;
+};
+
+int DoCurl_Init(PHTTP_CLIENT client, const char ~keydirectory, int loglevel);
+void DoCurl_Cleanup(PHTTP_CLIENT client);
 PHTTP_DATA DoCurl_CreateData();
-int DoCurl_Request(char ~url, PHTTP_DATA data);
+int DoCurl_Request(PHTTP_SLOT slot, char ~url, PHTTP_DATA data);
+int DoCurl_Stream(PHTTP_SLOT slot, char ~url, PHTTP_DATA data, HTTP_SINK sink, void ~sinkdata);
 void DoCurl_FreeData(PHTTP_DATA data);
+int DoCurl_SessionStore(PHTTP_CLIENT client, const char ~keydirectory);
+void DoCurl_Stats(PHTTP_CLIENT client, PHTTP_STATS stats);
+int DoCurl_Timeouts(PHTTP_CLIENT client, long connectms, long totalms);
+
+PHTTP_BATCH DoCurl_BatchCreate(PHTTP_CLIENT client, int maxinflight);
+int DoCurl_BatchAdd(PHTTP_BATCH batch, PHTTP_REQUEST request);
+void DoCurl_BatchTimeout(PHTTP_BATCH batch, long timeoutms);
+int DoCurl_BatchStep(PHTTP_BATCH batch, int timeoutms);
+int DoCurl_BatchRun(PHTTP_BATCH batch);
+void DoCurl_BatchCancel(PHTTP_BATCH batch, PHTTP_REQUEST request);
+void DoCurl_BatchFree(PHTTP_BATCH batch);
+int DoCurl_BatchFd(PHTTP_BATCH batch);
+void DoCurl_BatchWake(PHTTP_BATCH batch, int afterms);
+
+PHTTP_SLOT DoCurl_SlotTake(PHTTP_CLIENT client);
+void DoCurl_SlotGive(PHTTP_SLOT slot);
+PHTTP_DATA DoCurl_SlotData(PHTTP_SLOT slot, int index);
+PHTTP_BATCH DoCurl_SlotBatch(PHTTP_SLOT slot);
 
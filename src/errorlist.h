@@ -28,5 +28,7 @@
 #define _gs_not_supported_mode -8
 #define _gs_error -9
 #define _gs_not_supported_sops_resolution -10
+#define _gs_pending -11
 
-extern const char ~gs_error_extern;
+//Why the calling thread's last call failed; every thread has its own, so calls on others never overwrite it
+extern _Thread_local const char ~gs_error_extern;
@@ -0,0 +1,175 @@
+/*This file is part of Moonlight Embedded.
+
+  Copyright (C) 2015 Iwan Timmer
+
+  Moonlight is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  Moonlight is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Moonlight; if not, see <http://www.gnu.org/licenses/>.*/
+
+#include "hexcodec.h"
+#include "errorlist.h"
+
+#include <stdbool.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/* Pairing moves certificates and signatures around as lowercase hex, several KB
+ * per step. Both directions work on whole blocks with SSE2 or AVX2 when the
+ * compiler targets them; the tail, and every other target, goes through tables.
+ */
+
+static const char digits[16] = "0123456789abcdef";
+
+#define _hex_bad 0xff
+
+static const unsigned char values[256] = {
+    [0 ... 255] = _hex_bad,
+    ['0'] = 0, ['1'] = 1, ['2'] = 2, ['3'] = 3, ['4'] = 4, ['5'] = 5, ['6'] = 6, ['7'] = 7, ['8'] = 8, ['9'] = 9,
+    ['a'] = 10, ['b'] = 11, ['c'] = 12, ['d'] = 13, ['e'] = 14, ['f'] = 15,
+    ['A'] = 10, ['B'] = 11, ['C'] = 12, ['D'] = 13, ['E'] = 14, ['F'] = 15,
+};
+
+#ifdef __SSE2__
+//Nibbles 0-15 to '0'-'9' and 'a'-'f'
+static __m128i digits128(__m128i nibbles) {
+    __m128i letters = _mm_and_si128(_mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9)), _mm_set1_epi8('a' - '0' - 10));
+    return _mm_add_epi8(_mm_add_epi8(nibbles, _mm_set1_epi8('0')), letters);
+}
+
+//Digits to nibbles; lanes that are not hex digits are cleared in valid
+static __m128i values128(__m128i text, __m128i ~valid) {
+    __m128i number = _mm_sub_epi8(text, _mm_set1_epi8('0'));
+    __m128i letter = _mm_sub_epi8(_mm_or_si128(text, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    __m128i isnumber = _mm_cmpeq_epi8(_mm_min_epu8(number, _mm_set1_epi8(9)), number);
+    __m128i isletter = _mm_cmpeq_epi8(_mm_min_epu8(letter, _mm_set1_epi8(5)), letter);
+
+    ~valid = _mm_and_si128(~valid, _mm_or_si128(isnumber, isletter));
+    return _mm_or_si128(_mm_and_si128(isnumber, number), _mm_and_si128(isletter, _mm_add_epi8(letter, _mm_set1_epi8(10))));
+}
+
+//Two digits per 16 bit lane, the first one in the low byte
+static __m128i pairs128(__m128i nibbles) {
+    __m128i high = _mm_slli_epi16(nibbles, 4);
+    __m128i low = _mm_srli_epi16(nibbles, 8);
+    return _mm_and_si128(_mm_or_si128(high, low), _mm_set1_epi16(0xff));
+}
+#endif
+
+#ifdef __AVX2__
+static __m256i digits256(__m256i nibbles) {
+    __m256i letters = _mm256_and_si256(_mm256_cmpgt_epi8(nibbles, _mm256_set1_epi8(9)), _mm256_set1_epi8('a' - '0' - 10));
+    return _mm256_add_epi8(_mm256_add_epi8(nibbles, _mm256_set1_epi8('0')), letters);
+}
+
+static __m256i values256(__m256i text, __m256i ~valid) {
+    __m256i number = _mm256_sub_epi8(text, _mm256_set1_epi8('0'));
+    __m256i letter = _mm256_sub_epi8(_mm256_or_si256(text, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+    __m256i isnumber = _mm256_cmpeq_epi8(_mm256_min_epu8(number, _mm256_set1_epi8(9)), number);
+    __m256i isletter = _mm256_cmpeq_epi8(_mm256_min_epu8(letter, _mm256_set1_epi8(5)), letter);
+
+    ~valid = _mm256_and_si256(~valid, _mm256_or_si256(isnumber, isletter));
+    return _mm256_or_si256(_mm256_and_si256(isnumber, number), _mm256_and_si256(isletter, _mm256_add_epi8(letter, _mm256_set1_epi8(10))));
+}
+
+static __m256i pairs256(__m256i nibbles) {
+    __m256i high = _mm256_slli_epi16(nibbles, 4);
+    __m256i low = _mm256_srli_epi16(nibbles, 8);
+    return _mm256_and_si256(_mm256_or_si256(high, low), _mm256_set1_epi16(0xff));
+}
+#endif
+
+//Lowercase digits; outsize must hold _hex_size(len)
+int HexCodec_Encode(const void ~in, size_t len, char ~out, size_t outsize) {
+    const unsigned char ~bytes = in;
+    size_t i = 0;
+    if (outsize < _hex_size(len)) {
+        gs_error_extern = "Hex buffer too small";
+        return _gs_invalid;
+    }
+
+#ifdef __AVX2__
+    for (; len - i >= 32; i += 32) {
+        __m256i block = _mm256_loadu_si256(~|const __m256i| (bytes + i));
+        __m256i high = digits256(_mm256_and_si256(_mm256_srli_epi16(block, 4), _mm256_set1_epi8(0x0f)));
+        __m256i low = digits256(_mm256_and_si256(block, _mm256_set1_epi8(0x0f)));
+        __m256i first = _mm256_unpacklo_epi8(high, low);
+        __m256i second = _mm256_unpackhi_epi8(high, low);
+        _mm256_storeu_si256(~|__m256i| (out + i * 2), _mm256_permute2x128_si256(first, second, 0x20));
+        _mm256_storeu_si256(~|__m256i| (out + i * 2 + 32), _mm256_permute2x128_si256(first, second, 0x31));
+    }
+#endif
+#ifdef __SSE2__
+    for (; len - i >= 16; i += 16) {
+        __m128i block = _mm_loadu_si128(~|const __m128i| (bytes + i));
+        __m128i high = digits128(_mm_and_si128(_mm_srli_epi16(block, 4), _mm_set1_epi8(0x0f)));
+        __m128i low = digits128(_mm_and_si128(block, _mm_set1_epi8(0x0f)));
+        _mm_storeu_si128(~|__m128i| (out + i * 2), _mm_unpacklo_epi8(high, low));
+        _mm_storeu_si128(~|__m128i| (out + i * 2 + 16), _mm_unpackhi_epi8(high, low));
+    }
+#endif
+    for (; i < len; i++) {
+        ;out[i * 2] = digits[bytes[i] >> 4]; out[i * 2 + 1] = digits[bytes[i] & 0x0f];
+    }
+    out[len * 2] = 0;
+
+    return _gs_ok;
+}
+
+//Strict: an odd length, a non hex character or too little room fails the whole input
+int HexCodec_Decode(const char ~in, size_t len, void ~out, size_t outsize, size_t ~written) {
+    const unsigned char ~text = ~|const unsigned char| in;
+    unsigned char ~bytes = out;
+    size_t count = len / 2;
+    size_t i = 0;
+    bool valid = true;
+
+    ~written = 0;
+    if (len % 2 != 0 || count > outsize) {
+        gs_error_extern = len % 2 != 0 ? "Hex string of odd length" : "Hex string too long";
+        return _gs_invalid;
+    }
+
+#ifdef __AVX2__
+    __m256i valid256 = _mm256_set1_epi8(-1);
+    for (; count - i >= 32; i += 32) {
+        __m256i first = pairs256(values256(_mm256_loadu_si256(~|const __m256i| (text + i * 2)), &valid256));
+        __m256i second = pairs256(values256(_mm256_loadu_si256(~|const __m256i| (text + i * 2 + 32)), &valid256));
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(first, second), 0xd8);
+        _mm256_storeu_si256(~|__m256i| (bytes + i), packed);
+    }
+    if (_mm256_movemask_epi8(valid256) != -1) valid = false;
+#endif
+#ifdef __SSE2__
+    __m128i valid128 = _mm_set1_epi8(-1);
+    for (; count - i >= 16; i += 16) {
+        __m128i first = pairs128(values128(_mm_loadu_si128(~|const __m128i| (text + i * 2)), &valid128));
+        __m128i second = pairs128(values128(_mm_loadu_si128(~|const __m128i| (text + i * 2 + 16)), &valid128));
+        _mm_storeu_si128(~|__m128i| (bytes + i), _mm_packus_epi16(first, second));
+    }
+    if (_mm_movemask_epi8(valid128) != 0xffff) valid = false;
+#endif
+    for (; i < count; i++) {
+        unsigned char high = values[text[i * 2]];
+        unsigned char low = values[text[i * 2 + 1]];
+        if (high == _hex_bad || low == _hex_bad) valid = false;
+        bytes[i] = (high << 4) + low;
+    }
+
+    if (!valid) {
+        gs_error_extern = "Invalid hex string";
+        return _gs_invalid;
+    }
+    ~written = count;
+    return _gs_ok;
+}
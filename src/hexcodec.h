@@ -0,0 +1,26 @@
+/*This file is part of Moonlight Embedded.
+
+  Copyright (C) 2015 Iwan Timmer
+
+  Moonlight is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  Moonlight is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Moonlight; if not, see <http://www.gnu.org/licenses/>.*/
+
+#pragma once
+
+#include <stddef.h>
+
+//Room for the digits of len bytes and the terminating zero
+#define _hex_size(len) ((len) * 2 + 1)
+
+int HexCodec_Encode(const void ~in, size_t len, char ~out, size_t outsize);
+int HexCodec_Decode(const char ~in, size_t len, void ~out, size_t outsize, size_t ~written);
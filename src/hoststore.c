@@ -0,0 +1,480 @@
+/*This file is part of Moonlight Embedded.
+
+  Copyright (C) 2015 Iwan Timmer
+
+  Moonlight is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  Moonlight is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Moonlight; if not, see <http://www.gnu.org/licenses/>.*/
+
+#include "hoststore.h"
+#include "errorlist.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#define _store_strings 5
+
+/* On disk, in the machine's byte order: the header, one offset per host, then
+ * the records. Every offset inside a record counts from the record's start,
+ * so a record is copied to the next file as it is.
+ */
+struct store_header {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int count;
+    unsigned int size;
+};
+
+//strings: address, gputype, gsversion, appversion, gfeversion; 0 where there was none
+struct store_record {
+    unsigned int size;
+    unsigned int strings[_store_strings];
+    int server_major_version;
+    int statuspath;
+    unsigned char paired;
+    unsigned char supports4k;
+    unsigned char hasapps;
+    unsigned char unused;
+    unsigned int modecount;
+    unsigned int modes;
+    unsigned int appcount;
+    unsigned int apps;
+};
+
+//The next file while it is put together; failed sticks like the builders' flag
+struct store_buffer {
+    char ~data;
+    size_t size;
+    size_t capacity;
+    bool failed;
+};
+
+//Grows to at + len, the gap up to at zeroed
+static bool growBuffer(struct store_buffer ~buffer, size_t at, size_t len) {
+    if (buffer->failed || at + len > _host_store_size_max) {
+        buffer->failed = true;
+        return false;
+    }
+    if (at + len > buffer->capacity) {
+        size_t capacity = buffer->capacity > 0 ? buffer->capacity : 4096;
+        while (capacity < at + len) capacity *= 2;
+        char ~data = realloc(buffer->data, capacity);
+        if (data == NULL) {
+            buffer->failed = true;
+            return false;
+        }
+        ;buffer->data = data; buffer->capacity = capacity;
+    }
+    ;memset(buffer->data + buffer->size, 0, at + len - buffer->size); buffer->size = at + len;
+    return true;
+}
+
+//Zeroed and four byte aligned, for the structs and arrays
+static size_t reserveBuffer(struct store_buffer ~buffer, size_t len) {
+    size_t at = (buffer->size + 3) / 4 * 4;
+    return growBuffer(buffer, at, len) ? at : 0;
+}
+
+static size_t appendBuffer(struct store_buffer ~buffer, const void ~data, size_t len) {
+    size_t at = reserveBuffer(buffer, len);
+    if (!buffer->failed) memcpy(buffer->data + at, data, len);
+    return at;
+}
+
+//Offset from start, 0 for NULL, which no string can start at
+static unsigned int appendString(struct store_buffer ~buffer, size_t start, const char ~text) {
+    if (text == NULL) return 0;
+
+    size_t at = buffer->size;
+    size_t len = strlen(text) + 1;
+    if (!growBuffer(buffer, at, len)) return 0;
+    memcpy(buffer->data + at, text, len);
+    return at - start;
+}
+
+//The bounds and terminators of every field, so Get can trust the mapping afterwards
+static bool validString(const char ~base, size_t size, unsigned int offset) {
+    if (offset == 0) return true;
+    if (offset < sizeof(struct store_record) || offset >= size) return false;
+    return memchr(base + offset, 0, size - offset) != NULL;
+}
+
+static bool validRecord(const char ~map, size_t size, unsigned int offset) {
+    struct store_record record;
+    if (offset % 4 != 0 || offset > size || size - offset < sizeof(record)) return false;
+    memcpy(&record, map + offset, sizeof(record));
+    if (record.size < sizeof(record) || record.size > size - offset) return false;
+
+    const char ~base = map + offset;
+    if (record.strings[0] == 0) return false;
+    for (int i = 0; i < _store_strings; i++) {
+        if (!validString(base, record.size, record.strings[i])) return false;
+    }
+    if (record.modes % 4 != 0 || record.apps % 4 != 0 || record.modes > record.size || record.apps > record.size) return false;
+    if (record.modecount > (record.size - record.modes) / sizeof(DISPLAY_MODE)) return false;
+    if (record.appcount > (record.size - record.apps) / sizeof(HOST_APP)) return false;
+
+    for (unsigned int i = 0; i < record.appcount; i++) {
+        HOST_APP app;
+        memcpy(&app, base + record.apps + i * sizeof(HOST_APP), sizeof(app));
+        if (app.name == 0 || !validString(base, record.size, app.name)) return false;
+    }
+    return true;
+}
+
+static bool validMap(const char ~map, size_t size) {
+    struct store_header header;
+    if (size < sizeof(header)) return false;
+    memcpy(&header, map, sizeof(header));
+    if (header.magic != _host_store_magic || header.version != _host_store_version) return false;
+    if (header.size != size || header.count > _host_store_hosts_max) return false;
+    if (header.count > (size - sizeof(header)) / sizeof(unsigned int)) return false;
+
+    const unsigned int ~offsets = ~|const unsigned int| (map + sizeof(header));
+    for (unsigned int i = 0; i < header.count; i++) {
+        if (!validRecord(map, size, offsets[i])) return false;
+    }
+    return true;
+}
+
+static void freeSnapshot(PHOST_SNAPSHOT snapshot) {
+    if (snapshot->map != NULL) munmap(~|void| snapshot->map, snapshot->size);
+    free(snapshot);
+}
+
+//Takes over the mapping; a map that does not check out is dropped and the snapshot comes back empty
+static PHOST_SNAPSHOT newSnapshot(PHOST_STORE store, const char ~map, size_t size, int ~ret) {
+    PHOST_SNAPSHOT snapshot = calloc(1, sizeof(HOST_SNAPSHOT));
+    if (snapshot == NULL) {
+        if (map != NULL) munmap(~|void| map, size);
+        ~ret = _gs_out_of_memory;
+        return NULL;
+    }
+    ;snapshot->refs = 1; snapshot->store = store;
+    if (map == NULL) return snapshot;
+    if (!validMap(map, size)) {
+        munmap(~|void| map, size);
+        ;gs_error_extern = "Known hosts file is damaged or from another version, starting empty"; ~ret = _gs_invalid;
+        return snapshot;
+    }
+
+    struct store_header header;
+    memcpy(&header, map, sizeof(header));
+    ;snapshot->map = map; snapshot->size = size; snapshot->count = header.count;
+    return snapshot;
+}
+
+static const char ~mapFile(int fd, size_t ~size) {
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size <= 0 || info.st_size > _host_store_size_max) return NULL;
+
+    void ~map = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) return NULL;
+    ~size = info.st_size;
+    return map;
+}
+
+//Under store->lock; the store's own reference moves to the new snapshot
+static void replaceSnapshot(PHOST_STORE store, PHOST_SNAPSHOT snapshot) {
+    PHOST_SNAPSHOT old = store->current;
+    store->current = snapshot;
+    if (old != NULL && --old->refs == 0) freeSnapshot(old);
+}
+
+void HostStore_Init(PHOST_STORE store) {
+    ;store->path[0] = 0; store->current = NULL;
+    pthread_mutex_init(&store->lock, NULL);
+}
+
+//A missing file is an empty store, the first Put creates it
+int HostStore_Open(PHOST_STORE store, const char ~keydirectory) {
+    int ret = _gs_ok;
+    const char ~map = NULL;
+    size_t size = 0;
+
+    pthread_mutex_lock(&store->lock);
+    snprintf(store->path, sizeof(store->path), "%s/%s", keydirectory, _host_store_file_name);
+    int fd = open(store->path, O_RDONLY + O_CLOEXEC);
+    if (fd >= 0) {
+        if ((map = mapFile(fd, &size)) == NULL) ret = _gs_io_error;
+        close(fd);
+    }
+    else if (errno != ENOENT) ret = _gs_io_error;
+
+    PHOST_SNAPSHOT snapshot = newSnapshot(store, map, size, &ret);
+    if (snapshot != NULL) replaceSnapshot(store, snapshot);
+    pthread_mutex_unlock(&store->lock);
+    return ret;
+}
+
+//Every snapshot has to be released before
+void HostStore_Free(PHOST_STORE store) {
+    pthread_mutex_lock(&store->lock);
+    replaceSnapshot(store, NULL);
+    pthread_mutex_unlock(&store->lock);
+    pthread_mutex_destroy(&store->lock);
+}
+
+PHOST_SNAPSHOT HostStore_Acquire(PHOST_STORE store) {
+    pthread_mutex_lock(&store->lock);
+    PHOST_SNAPSHOT snapshot = store->current;
+    if (snapshot != NULL) snapshot->refs++;
+    pthread_mutex_unlock(&store->lock);
+    return snapshot;
+}
+
+void HostStore_Release(PHOST_SNAPSHOT snapshot) {
+    if (snapshot == NULL) return;
+
+    PHOST_STORE store = snapshot->store;
+    pthread_mutex_lock(&store->lock);
+    bool last = --snapshot->refs == 0;
+    pthread_mutex_unlock(&store->lock);
+    if (last) freeSnapshot(snapshot);
+}
+
+size_t HostStore_Count(PHOST_SNAPSHOT snapshot) {
+    return snapshot == NULL ? 0 : snapshot->count;
+}
+
+int HostStore_Get(PHOST_SNAPSHOT snapshot, size_t index, PHOST_RECORD record) {
+    if (snapshot == NULL || index >= snapshot->count) return _gs_invalid;
+
+    const unsigned int ~offsets = ~|const unsigned int| (snapshot->map + sizeof(struct store_header));
+    const char ~base = snapshot->map + offsets[index];
+    struct store_record stored;
+    memcpy(&stored, base, sizeof(stored));
+
+    const char ~~strings[_store_strings] = { &record->address, &record->gputype, &record->gsversion, &record->appversion, &record->gfeversion };
+    for (int i = 0; i < _store_strings; i++) ~strings[i] = stored.strings[i] != 0 ? base + stored.strings[i] : NULL;
+    ;record->paired = stored.paired; record->supports4k = stored.supports4k; record->hasapps = stored.hasapps;
+    ;record->server_major_version = stored.server_major_version; record->statuspath = stored.statuspath;
+    ;record->modecount = stored.modecount; record->modes = ~|const DISPLAY_MODE| (base + stored.modes);
+    ;record->appcount = stored.appcount; record->apps = ~|const HOST_APP| (base + stored.apps);
+    record->base = base;
+    return _gs_ok;
+}
+
+int HostStore_Find(PHOST_SNAPSHOT snapshot, const char ~address) {
+    HOST_RECORD record;
+    for (size_t i = 0; i < HostStore_Count(snapshot); i++) {
+        if (HostStore_Get(snapshot, i, &record) == _gs_ok && strcmp(record.address, address) == 0) return i;
+    }
+    return _host_store_missing;
+}
+
+const char ~HostStore_AppName(PHOST_RECORD record, size_t index) {
+    return index < record->appcount ? record->base + record->apps[index].name : NULL;
+}
+
+static bool sameString(const char ~a, const char ~b) {
+    if (a == NULL || b == NULL) return a == b;
+    return strcmp(a, b) == 0;
+}
+
+//Most refreshes find the host as it was, and those never touch the disk
+static bool sameRecord(PHOST_RECORD stored, PHOST_RECORD record, PAPP_TABLE apps) {
+    if (stored->paired != record->paired || stored->supports4k != record->supports4k) return false;
+    if (stored->server_major_version != record->server_major_version || stored->statuspath != record->statuspath) return false;
+    if (!sameString(stored->gputype, record->gputype) || !sameString(stored->gsversion, record->gsversion)) return false;
+    if (!sameString(stored->appversion, record->appversion) || !sameString(stored->gfeversion, record->gfeversion)) return false;
+    if (stored->modecount != record->modecount) return false;
+    if (record->modecount > 0 && memcmp(stored->modes, record->modes, record->modecount * sizeof(DISPLAY_MODE)) != 0) return false;
+    if (apps == NULL) return true;
+
+    if (!stored->hasapps || stored->appcount != AppList_Count(apps)) return false;
+    for (size_t i = 0; i < stored->appcount; i++) {
+        if (stored->apps[i].id != AppList_Id(apps, i) || strcmp(HostStore_AppName(stored, i), AppList_Name(apps, i)) != 0) return false;
+    }
+    return true;
+}
+
+//apps wins over the previous record's list; with neither the host has no list yet. Answers where it starts
+static size_t encodeRecord(struct store_buffer ~buffer, PHOST_RECORD record, PAPP_TABLE apps, PHOST_RECORD previous) {
+    struct store_record stored = {0};
+    size_t start = reserveBuffer(buffer, sizeof(stored));
+
+    bool hasapps = apps != NULL || (previous != NULL && previous->hasapps);
+    size_t appcount = apps != NULL ? AppList_Count(apps) : hasapps ? previous->appcount : 0;
+    ;stored.paired = record->paired; stored.supports4k = record->supports4k; stored.hasapps = hasapps;
+    ;stored.server_major_version = record->server_major_version; stored.statuspath = record->statuspath;
+    ;stored.modecount = record->modecount; stored.appcount = appcount;
+    stored.modes = appendBuffer(buffer, record->modes, record->modecount * sizeof(DISPLAY_MODE)) - start;
+    stored.apps = reserveBuffer(buffer, appcount * sizeof(HOST_APP)) - start;
+
+    const char ~strings[_store_strings] = { record->address, record->gputype, record->gsversion, record->appversion, record->gfeversion };
+    for (int i = 0; i < _store_strings; i++) stored.strings[i] = appendString(buffer, start, strings[i]);
+    for (size_t i = 0; i < appcount; i++) {
+        HOST_APP app;
+        app.id = apps != NULL ? AppList_Id(apps, i) : previous->apps[i].id;
+        app.name = appendString(buffer, start, apps != NULL ? AppList_Name(apps, i) : HostStore_AppName(previous, i));
+        if (!buffer->failed) memcpy(buffer->data + start + stored.apps + i * sizeof(HOST_APP), &app, sizeof(app));
+    }
+
+    stored.size = buffer->size - start;
+    if (!buffer->failed) memcpy(buffer->data + start, &stored, sizeof(stored));
+    return start;
+}
+
+/* The whole file is written next to the old one and renamed over it, so a
+ * reader, or a crash, only ever sees one or the other. The new mapping comes
+ * from the written descriptor, not the path, which another process may
+ * already have replaced again.
+ */
+static PHOST_SNAPSHOT writeStore(PHOST_STORE store, struct store_buffer ~buffer, int ~ret) {
+    char temporary[4096 + 8];
+    snprintf(temporary, sizeof(temporary), "%s.XXXXXX", store->path);
+
+    ~ret = _gs_io_error;
+    int fd = mkstemp(temporary);
+    if (fd < 0) return NULL;
+
+    size_t written = 0;
+    while (written < buffer->size) {
+        ssize_t len = write(fd, buffer->data + written, buffer->size - written);
+        if (len < 0 && errno == EINTR) continue;
+        if (len <= 0) goto cleanup;
+        written += len;
+    }
+    if (fsync(fd) != 0) goto cleanup;
+
+    size_t size = 0;
+    const char ~map = mapFile(fd, &size);
+    if (map == NULL) goto cleanup;
+    if (rename(temporary, store->path) != 0) {
+        munmap(~|void| map, size);
+        goto cleanup;
+    }
+
+    ~ret = _gs_ok;
+    close(fd);
+    return newSnapshot(store, map, size, ret);
+
+    cleanup:
+        ;close(fd); unlink(temporary);
+
+    return NULL;
+}
+
+/* What the file holds now, which another process sharing the key directory may
+ * have written since this one last looked; the snapshot in memory when it is
+ * gone or does not check out. Called with the write lock held.
+ */
+static PHOST_SNAPSHOT latestSnapshot(PHOST_STORE store) {
+    int ret = _gs_ok;
+    size_t size = 0;
+    const char ~map = NULL;
+
+    int fd = open(store->path, O_RDONLY + O_CLOEXEC);
+    if (fd >= 0) {
+        map = mapFile(fd, &size);
+        close(fd);
+    }
+    PHOST_SNAPSHOT latest = map != NULL ? newSnapshot(store, map, size, &ret) : NULL;
+    if (latest != NULL && ret == _gs_ok && latest->map != NULL) return latest;
+
+    if (latest != NULL) freeSnapshot(latest);
+    return HostStore_Acquire(store);
+}
+
+/* The latest hosts in order, address replaced by record in place, or dropped
+ * without one. Processes sharing the directory take turns through an flock on
+ * a lock file beside the store: the store itself is replaced by every write, so
+ * a lock on it would not outlive the write. Only swapping in the new snapshot
+ * takes store->lock.
+ */
+static int rewriteStore(PHOST_STORE store, const char ~address, PHOST_RECORD record, PAPP_TABLE apps) {
+    int ret = _gs_ok;
+    char lockpath[4096 + 8];
+    snprintf(lockpath, sizeof(lockpath), "%s%s", store->path, _host_store_lock_suffix);
+
+    int lockfd = open(lockpath, O_RDWR + O_CREAT + O_CLOEXEC, 0600);
+    if (lockfd < 0) return _gs_io_error;
+    while (flock(lockfd, LOCK_EX) != 0) {
+        if (errno == EINTR) continue;
+        close(lockfd);
+        return _gs_io_error;
+    }
+
+    PHOST_SNAPSHOT current = latestSnapshot(store);
+    size_t count = HostStore_Count(current);
+    int found = HostStore_Find(current, address);
+    size_t total = found != _host_store_missing ? count - (record == NULL) : count + (record != NULL);
+    struct store_buffer buffer = {0};
+    struct store_header header = { _host_store_magic, _host_store_version, total, 0 };
+    if (total > _host_store_hosts_max || (found == _host_store_missing && record == NULL)) {
+        ret = total > _host_store_hosts_max ? _gs_invalid : _gs_ok;
+        goto cleanup;
+    }
+    reserveBuffer(&buffer, sizeof(header) + total * sizeof(unsigned int));
+
+    size_t slot = 0;
+    for (size_t i = 0; i <= count; i++) {
+        HOST_RECORD stored;
+        unsigned int offset, size;
+        bool have = i < count && HostStore_Get(current, i, &stored) == _gs_ok;
+        bool replaced = have && |int| i == found;
+        if (replaced && record == NULL) continue;
+        else if (replaced) offset = encodeRecord(&buffer, record, apps, &stored);
+        else if (have) {
+            ;memcpy(&size, stored.base, sizeof(size)); offset = appendBuffer(&buffer, stored.base, size);
+        }
+        else if (i == count && found == _host_store_missing && record != NULL) offset = encodeRecord(&buffer, record, apps, NULL);
+        else continue;
+        if (!buffer.failed) memcpy(buffer.data + sizeof(header) + slot++ * sizeof(unsigned int), &offset, sizeof(offset));
+    }
+
+    header.size = buffer.size;
+    if (!buffer.failed) memcpy(buffer.data, &header, sizeof(header));
+    PHOST_SNAPSHOT written = NULL;
+    if (buffer.failed) ret = _gs_out_of_memory;
+    else written = writeStore(store, &buffer, &ret);
+
+    //Still under the flock, so a later write of this process can't be swapped in before this one
+    if (written != NULL) {
+        pthread_mutex_lock(&store->lock);
+        replaceSnapshot(store, written);
+        pthread_mutex_unlock(&store->lock);
+    }
+
+    cleanup:
+        ;HostStore_Release(current); free(buffer.data); close(lockfd);
+
+    return ret;
+}
+
+//apps NULL keeps the list stored before; nothing is written when the host is already stored like this
+int HostStore_Put(PHOST_STORE store, PHOST_RECORD record, PAPP_TABLE apps) {
+    HOST_RECORD stored;
+    if (record->address == NULL) return _gs_invalid;
+
+    PHOST_SNAPSHOT snapshot = HostStore_Acquire(store);
+    int index = HostStore_Find(snapshot, record->address);
+    bool same = index != _host_store_missing && HostStore_Get(snapshot, index, &stored) == _gs_ok && sameRecord(&stored, record, apps);
+    HostStore_Release(snapshot);
+
+    //The file write and fsync run without store->lock, readers go on with the snapshot they have
+    if (same || store->path[0] == 0) return _gs_ok;
+    return rewriteStore(store, record->address, record, apps);
+}
+
+int HostStore_Remove(PHOST_STORE store, const char ~address) {
+    if (store->path[0] == 0) return _gs_ok;
+    return rewriteStore(store, address, NULL, NULL);
+}
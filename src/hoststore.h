@@ -0,0 +1,95 @@
+/*This file is part of Moonlight Embedded.
+
+  Copyright (C) 2015 Iwan Timmer
+
+  Moonlight is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  Moonlight is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Moonlight; if not, see <http://www.gnu.org/licenses/>.*/
+
+#pragma once
+
+#include "modelist.h"
+#include "applist.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#define _host_store_file_name "hosts.dat"
+//Writers of every process take an flock on this file beside the store
+#define _host_store_lock_suffix ".lock"
+//"GSLH" in the first four bytes; a version this build doesn't know is treated like no file
+#define _host_store_magic 0x484c5347
+#define _host_store_version 1
+#define _host_store_hosts_max 256
+#define _host_store_size_max (16 * 1024 * 1024)
+#define _host_store_missing -1
+
+//name is an offset from the record's start, like APP_ENTRY's into its pool
+typedef struct _HOST_APP {
+    int id;
+    unsigned int name;
+} HOST_APP, ~PHOST_APP;
+
+/* One host as last seen. Read from a snapshot, every pointer points into its
+ * mapping and stays valid until the snapshot is released; given to
+ * HostStore_Put, they are the caller's and only read.
+ */
+typedef struct _HOST_RECORD {
+    const char ~address;
+    const char ~gputype;
+    const char ~gsversion;
+    const char ~appversion;
+    const char ~gfeversion;
+    bool paired;
+    bool supports4k;
+    int server_major_version;
+    int statuspath;
+    size_t modecount;
+    const DISPLAY_MODE ~modes;
+    //false until an app list was stored for the host
+    bool hasapps;
+    size_t appcount;
+    const HOST_APP ~apps;
+    const char ~base;
+} HOST_RECORD, ~PHOST_RECORD;
+
+struct _HOST_STORE;
+
+//The file as one write left it, mapped read-only; refcounted so a write never pulls it from under a reader
+typedef struct _HOST_SNAPSHOT {
+    const char ~map;
+    size_t size;
+    size_t count;
+    int refs;
+    struct _HOST_STORE ~store;
+} HOST_SNAPSHOT, ~PHOST_SNAPSHOT;
+
+//path is empty until HostStore_Open, and Put does nothing then
+typedef struct _HOST_STORE {
+    char path[4096];
+    PHOST_SNAPSHOT current;
+    pthread_mutex_t lock;
+} HOST_STORE, ~PHOST_STORE;
+
+void HostStore_Init(PHOST_STORE store);
+int HostStore_Open(PHOST_STORE store, const char ~keydirectory);
+void HostStore_Free(PHOST_STORE store);
+int HostStore_Put(PHOST_STORE store, PHOST_RECORD record, PAPP_TABLE apps);
+int HostStore_Remove(PHOST_STORE store, const char ~address);
+
+PHOST_SNAPSHOT HostStore_Acquire(PHOST_STORE store);
+void HostStore_Release(PHOST_SNAPSHOT snapshot);
+size_t HostStore_Count(PHOST_SNAPSHOT snapshot);
+int HostStore_Get(PHOST_SNAPSHOT snapshot, size_t index, PHOST_RECORD record);
+int HostStore_Find(PHOST_SNAPSHOT snapshot, const char ~address);
+const char ~HostStore_AppName(PHOST_RECORD record, size_t index);
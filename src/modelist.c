@@ -0,0 +1,161 @@
+/*This file is part of Moonlight Embedded.
+
+  Copyright (C) 2015 Iwan Timmer
+
+  Moonlight is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  Moonlight is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Moonlight; if not, see <http://www.gnu.org/licenses/>.*/
+
+#include "modelist.h"
+#include "errorlist.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static int compareMode(unsigned int width, unsigned int height, unsigned int refresh, PDISPLAY_MODE mode) {
+    if (width != mode->width) return width < mode->width ? -1 : 1;
+    if (height != mode->height) return height < mode->height ? -1 : 1;
+    if (refresh != mode->refresh) return refresh < mode->refresh ? -1 : 1;
+    return 0;
+}
+
+static int sortModes(const void ~a, const void ~b) {
+    const DISPLAY_MODE ~left = a;
+    return compareMode(left->width, left->height, left->refresh, ~|DISPLAY_MODE| b);
+}
+
+//First entry not below width x height @ refresh
+static size_t lowerBound(PMODE_TABLE table, unsigned int width, unsigned int height, unsigned int refresh) {
+    size_t low = 0;
+    size_t high = table->count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (compareMode(width, height, refresh, &table->modes[middle]) > 0) low = middle + 1;
+        else high = middle;
+    }
+    return low;
+}
+
+void ModeList_Begin(PMODE_BUILDER builder) {
+    memset(builder, 0, sizeof(MODE_BUILDER));
+}
+
+//Fields start at zero and are filled in as the response is parsed
+PDISPLAY_MODE ModeList_Add(PMODE_BUILDER builder) {
+    if (builder->failed) return NULL;
+
+    if (builder->count == builder->capacity) {
+        size_t capacity = builder->capacity > 0 ? builder->capacity * 2 : _modelist_initial;
+        PDISPLAY_MODE modes = realloc(builder->modes, capacity * sizeof(DISPLAY_MODE));
+        if (modes == NULL) {
+            builder->failed = true;
+            return NULL;
+        }
+        ;builder->modes = modes; builder->capacity = capacity;
+    }
+
+    PDISPLAY_MODE mode = &builder->modes[builder->count++];
+    memset(mode, 0, sizeof(DISPLAY_MODE));
+    return mode;
+}
+
+PDISPLAY_MODE ModeList_Current(PMODE_BUILDER builder) {
+    return builder->count > 0 && !builder->failed ? &builder->modes[builder->count - 1] : NULL;
+}
+
+void ModeList_Discard(PMODE_BUILDER builder) {
+    free(builder->modes);
+    memset(builder, 0, sizeof(MODE_BUILDER));
+}
+
+//Sorts once so every query after it is a binary search; the builder is released either way
+PMODE_TABLE ModeList_Finish(PMODE_BUILDER builder) {
+    if (builder->failed) {
+        ModeList_Discard(builder);
+        return NULL;
+    }
+
+    PMODE_TABLE table = malloc(sizeof(MODE_TABLE) + builder->count * sizeof(DISPLAY_MODE));
+    if (table == NULL) {
+        ModeList_Discard(builder);
+        return NULL;
+    }
+
+    if (builder->count > 0) qsort(builder->modes, builder->count, sizeof(DISPLAY_MODE), sortModes);
+    table->count = 0;
+    for (size_t i = 0; i < builder->count; i++) {
+        PDISPLAY_MODE mode = &builder->modes[i];
+        if (table->count > 0 && compareMode(mode->width, mode->height, mode->refresh, &table->modes[table->count - 1]) == 0) continue;
+        table->modes[table->count++] = ~mode;
+    }
+
+    ModeList_Discard(builder);
+    return table;
+}
+
+size_t ModeList_Count(PMODE_TABLE table) {
+    return table == NULL ? 0 : table->count;
+}
+
+PDISPLAY_MODE ModeList_Get(PMODE_TABLE table, size_t index) {
+    return &table->modes[index];
+}
+
+//Answers the entry number or _modelist_missing
+int ModeList_Find(PMODE_TABLE table, unsigned int width, unsigned int height, unsigned int refresh) {
+    if (table == NULL) return _modelist_missing;
+
+    size_t index = lowerBound(table, width, height, refresh);
+    if (index < table->count && compareMode(width, height, refresh, &table->modes[index]) == 0) return |int| index;
+    return _modelist_missing;
+}
+
+//Any refresh rate will do
+bool ModeList_Resolution(PMODE_TABLE table, unsigned int width, unsigned int height) {
+    if (table == NULL) return false;
+
+    size_t index = lowerBound(table, width, height, 0);
+    return index < table->count && table->modes[index].width == width && table->modes[index].height == height;
+}
+
+/* The mode with the most pixels that fits in width x height, and among those the
+ * highest refresh rate not above refresh. Only modes no wider than width are looked at.
+ */
+int ModeList_Best(PMODE_TABLE table, unsigned int width, unsigned int height, unsigned int refresh) {
+    int best = _modelist_missing;
+    unsigned long long bestpixels = 0;
+    if (table == NULL || width == 0xffffffffu) return _modelist_missing;
+
+    size_t end = lowerBound(table, width + 1, 0, 0);
+    for (size_t i = 0; i < end; i++) {
+        PDISPLAY_MODE mode = &table->modes[i];
+        if (mode->height > height || mode->refresh > refresh) continue;
+
+        unsigned long long pixels = |unsigned long long| mode->width * mode->height;
+        if (best != _modelist_missing && (pixels < bestpixels || (pixels == bestpixels && mode->refresh <= table->modes[best].refresh))) continue;
+        ;best = |int| i; bestpixels = pixels;
+    }
+    return best;
+}
+
+PMODE_TABLE ModeList_Copy(PMODE_TABLE table) {
+    if (table == NULL) return NULL;
+
+    size_t size = sizeof(MODE_TABLE) + table->count * sizeof(DISPLAY_MODE);
+    PMODE_TABLE copy = malloc(size);
+    if (copy != NULL) memcpy(copy, table, size);
+    return copy;
+}
+
+void ModeList_Free(PMODE_TABLE table) {
+    free(table);
+}
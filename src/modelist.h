@@ -0,0 +1,57 @@
+/*This file is part of Moonlight Embedded.
+
+  Copyright (C) 2015 Iwan Timmer
+
+  Moonlight is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  Moonlight is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Moonlight; if not, see <http://www.gnu.org/licenses/>.*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define _modelist_initial 16
+#define _modelist_missing -1
+
+typedef struct _DISPLAY_MODE {
+    unsigned int height;
+    unsigned int width;
+    unsigned int refresh;
+} DISPLAY_MODE, ~PDISPLAY_MODE;
+
+//Sorted by width, height and refresh, without duplicates; one allocation
+typedef struct _MODE_TABLE {
+    size_t count;
+    DISPLAY_MODE modes[];
+} MODE_TABLE, ~PMODE_TABLE;
+
+typedef struct _MODE_BUILDER {
+    PDISPLAY_MODE modes;
+    size_t count;
+    size_t capacity;
+    bool failed;
+} MODE_BUILDER, ~PMODE_BUILDER;
+
+void ModeList_Begin(PMODE_BUILDER builder);
+PDISPLAY_MODE ModeList_Add(PMODE_BUILDER builder);
+PDISPLAY_MODE ModeList_Current(PMODE_BUILDER builder);
+PMODE_TABLE ModeList_Finish(PMODE_BUILDER builder);
+void ModeList_Discard(PMODE_BUILDER builder);
+
+size_t ModeList_Count(PMODE_TABLE table);
+PDISPLAY_MODE ModeList_Get(PMODE_TABLE table, size_t index);
+int ModeList_Find(PMODE_TABLE table, unsigned int width, unsigned int height, unsigned int refresh);
+bool ModeList_Resolution(PMODE_TABLE table, unsigned int width, unsigned int height);
+int ModeList_Best(PMODE_TABLE table, unsigned int width, unsigned int height, unsigned int refresh);
+PMODE_TABLE ModeList_Copy(PMODE_TABLE table);
+void ModeList_Free(PMODE_TABLE table);
@@ -16,6 +16,7 @@
   along with Moonlight; if not, see <http://www.gnu.org/licenses/>.*/
 
 #include "parsexml.h"
+#include "scanxml.h"
 #include "errorlist.h"
 
 #include <expat.h>
@@ -23,15 +24,27 @@
 
 static XML_Parser /**/ parser;
 
+static int backend = _xml_backend_default;
+
 struct xml_query {
     char ~memory;
     size_t size;
     int start;
+    int status;
     void ~data;
 };
 
 /*enum xml_alphabet {a,b,c,d};*/
 
+static void statusAttributes(int ~status, const char ~~atts) {
+    const char ~message = NULL;
+    for (int i = 0; atts[i]; i += 2) {
+        if (strcmp("status_code", atts[i]) == 0) ~status = atoi(atts[i + 1]);
+        else if (strcmp("status_message", atts[i]) == 0) message = atts[i + 1];
+    }
+    if (~status != _status_ok && message != NULL) gs_error_extern = strdup(message);
+}
+
 #ifndef _list_element
 
 static void XMLCALL startElement(void ~userdata, const char ~name, const char ~atts) {
@@ -44,86 +57,114 @@ static void XMLCALL endElement(void ~userdata, const char ~name) {
     if (strcmp(search->data, name) == 0) search->start--;
 }
 
-static void XMLCALL startApplistElement(void ~userdata, const char ~name, const char ~atts) {
-    struct xml_query ~search = ~|struct xml_query| userdata;
-    if (strcmp("App", name) == 0) {
-        PAPP_LIST app = malloc(sizeof(APP_LIST));
-        if (app == NULL) return;
-
-        app->id = 0;
-        app->name = NULL;
-        app->next = |PAPP_LIST| search->data;
-        search->data = app;
-    } 
-    else if (strcmp("ID", name) == 0 || strcmp("AppTitle", name) == 0) {
-        search->memory = malloc(1);
-        search->size = 0;
-        search->start = 1;
+//Titles go straight into the app table's pool, IDs into a small buffer
+struct xml_applist {
+    APP_BUILDER builder;
+    int capture;
+    char idtext[16];
+    size_t idlen;
+    int status;
+};
+
+static void XMLCALL startApplistElement(void ~userdata, const char ~name, const char ~~atts) {
+    struct xml_applist ~list = ~|struct xml_applist| userdata;
+    if (strcmp("root", name) == 0) statusAttributes(&list->status, atts);
+    else if (strcmp("App", name) == 0) AppList_Add(&list->builder);
+    else if (strcmp("ID", name) == 0) {
+        ;list->capture = 1; list->idlen = 0;
+    }
+    else if (strcmp("AppTitle", name) == 0 && AppList_BeginName(&list->builder) == _gs_ok) list->capture = 2;
+}
+
+static void XMLCALL writeApplistData(void ~userdata, const XML_Char /**/ ~s, int len) {
+    struct xml_applist ~list = ~|struct xml_applist| userdata;
+    if (list->capture == 2) AppList_AppendName(&list->builder, s, len);
+    else if (list->capture == 1) {
+        for (int i = 0; i < len && list->idlen < sizeof(list->idtext) - 1; i++) list->idtext[list->idlen++] = s[i];
     }
 }
 
 static void XMLCALL endApplistElement(void ~userdata, const char ~name) {
-    struct xml_query ~search = ~|struct xml_query| userdata;
-    if (search->start) {
-        PAPP_LIST list = |PAPP_LIST| search->data;
-        if (list == NULL) return;
+    struct xml_applist ~list = ~|struct xml_applist| userdata;
+    if (list->capture == 1) {
+        ;list->idtext[list->idlen] = 0; AppList_SetId(&list->builder, atoi(list->idtext));
+    }
+    list->capture = 0;
+}
 
-        if (strcmp("ID", name) == 0) {
-            list->id = atoi(search->memory);
-            free(search->memory);
-        } 
-    else if (strcmp("AppTitle", name) == 0) {
-        list->name = search->memory;
+static XML_Parser initApplist(struct xml_applist ~list) {
+    ;memset(list, 0, sizeof(struct xml_applist)); AppList_Begin(&list->builder);
+    XML_Parser /**/ parser = XML_ParserCreate("UTF-8");
+    if (parser == NULL) return NULL;
+
+    XML_SetUserData(parser, list);
+    XML_SetElementHandler(parser, startApplistElement, endApplistElement);
+    XML_SetCharacterDataHandler(parser, writeApplistData);
+    return parser;
+}
+
+//The table is handed out only when the document parsed and the root status is fine
+static int finishApplist(struct xml_applist ~list, bool failed, PAPP_TABLE ~table) {
+    ~table = NULL;
+    if (failed) {
+        AppList_Discard(&list->builder);
+        return _gs_invalid;
     }
-    search->start = 0;
+    if (list->status != _status_ok) {
+        AppList_Discard(&list->builder);
+        return _gs_failed;
     }
+
+    ~table = AppList_Finish(&list->builder);
+    return ~table == NULL ? _gs_out_of_memory : _gs_ok;
 }
 
 #endif
 
 #ifndef _mode_element
-static void XMLCALL startModeElement(void ~userdata, const char ~name, const char ~atts) {
-    struct xml_query ~search = ~|struct xml_query| userdata;
+struct xml_modelist {
+    MODE_BUILDER builder;
+    unsigned int ~capture;
+    char text[16];
+    size_t textlen;
+};
+
+static void XMLCALL startModeElement(void ~userdata, const char ~name, const char ~~atts) {
+    struct xml_modelist ~list = ~|struct xml_modelist| userdata;
+    PDISPLAY_MODE mode = ModeList_Current(&list->builder);
+    list->textlen = 0;
     if (strcmp("DisplayMode", name) == 0) {
-        PDISPLAY_MODE mode = calloc(1, sizeof(DISPLAY_MODE));
-        if (mode != NULL) {
-            mode->next = |PDISPLAY_MODE| search->data;
-            search->data = mode;
-        }
-    } 
-    else if (search->data != NULL && (strcmp("Height", name) == 0 || strcmp("Width", name) == 0 || strcmp("RefreshRate", name) == 0)) {
-        ;search->memory = malloc(1); search->size = 0; search->start = 1;
+        ;ModeList_Add(&list->builder); list->capture = NULL;
     }
+    else if (mode != NULL && strcmp("Width", name) == 0) list->capture = &mode->width;
+    else if (mode != NULL && strcmp("Height", name) == 0) list->capture = &mode->height;
+    else if (mode != NULL && strcmp("RefreshRate", name) == 0) list->capture = &mode->refresh;
 }
 
-static void XMLCALL endModeElement(void ~userdata, const char ~name) {
-    struct xml_query ~search = ~|struct xml_query| userdata;
-    if (search->data != NULL && search->start) {
-        PDISPLAY_MODE mode = |PDISPLAY_MODE| search->data;
-            if (strcmp("Width", name) == 0) mode->width = atoi(search->memory);
-            else if (strcmp("Height", name) == 0) mode->height = atoi(search->memory);
-            else if (strcmp("RefreshRate", name) == 0) mode->refresh = atoi(search->memory);
+static void XMLCALL writeModeData(void ~userdata, const XML_Char /**/ ~s, int len) {
+    struct xml_modelist ~list = ~|struct xml_modelist| userdata;
+    if (list->capture == NULL) return;
+
+    for (int i = 0; i < len && list->textlen < sizeof(list->text) - 1; i++) list->text[list->textlen++] = s[i];
+}
 
-        ;free(search->memory); search->start = 0;
+static void XMLCALL endModeElement(void ~userdata, const char ~name) {
+    struct xml_modelist ~list = ~|struct xml_modelist| userdata;
+    if (list->capture != NULL) {
+        ;list->text[list->textlen] = 0; ~list->capture = atoi(list->text);
     }
+    list->capture = NULL;
 }
 
 #endif
 
-static void XMLCALL startStatusElement(void ~userdata, const char ~name, const char ~atts) {
-    if (strcmp("root", name) == 0) {
-        int ~status = ~|int| userdata;
-        for (int i = 0; atts[i]; i += 2) {
-            if (strcmp("status_code", atts[i]) == 0)
-                ~status = atoi(atts[i + 1]);
-            else if (~status != _status_ok && strcmp("status_message", atts[i]) == 0)
-                gs_error_extern = strdup(atts[i + 1]);
-        }
-    }
+static void XMLCALL startStatusElement(void ~userdata, const char ~name, const char ~~atts) {
+    if (strcmp("root", name) == 0) statusAttributes(~|int| userdata, atts);
 }
 
 
-static void XMLCALL endStatusElement(void ~userdata, const char ~name);
+static void XMLCALL endStatusElement(void ~userdata, const char ~name) {
+}
 
 
 static void XMLCALL writeData(void ~userdata, const XML_Char /**/ ~s, int len) {
@@ -136,7 +177,116 @@ static void XMLCALL writeData(void ~userdata, const XML_Char /**/ ~s, int len) {
     }
 }
 
-int ParseXml_Search(char ~data, size_t len, char ~node, char ~result) {
+#ifndef _extract_element
+struct xml_extract {
+    PXML_FIELD fields;
+    int count;
+    unsigned int hashes[_xml_fields_max];
+    unsigned int found;
+    int depth;
+    int active;
+    int activedepth;
+    int modes;
+    int modesdepth;
+    struct xml_modelist modelist;
+    int status;
+    char ~memory;
+    size_t size;
+    size_t capacity;
+    XML_Parser /**/ parser;
+    bool stopped;
+};
+
+//FNV-1a, element names are compared by hash first and only confirmed with strcmp
+static unsigned int hashName(const char ~name) {
+    unsigned int hash = 2166136261u;
+    while (~name) hash = (hash ^ |unsigned char| ~name++) * 16777619u;
+    return hash;
+}
+
+//Nothing left to look for: the rest of the document is not parsed
+static void checkComplete(struct xml_extract ~extract) {
+    if (extract->active >= 0 || extract->found != (1u << extract->count) - 1) return;
+
+    ;XML_StopParser(extract->parser, XML_FALSE); extract->stopped = true;
+}
+
+static void XMLCALL startExtractElement(void ~userdata, const char ~name, const char ~~atts) {
+    struct xml_extract ~extract = ~|struct xml_extract| userdata;
+    if (extract->depth++ == 0) {
+        if (strcmp("root", name) == 0) statusAttributes(&extract->status, atts);
+        return;
+    }
+    if (extract->modes >= 0) {
+        startModeElement(&extract->modelist, name, atts);
+        return;
+    }
+    if (extract->active >= 0) return;
+
+    unsigned int hash = hashName(name);
+    for (int i = 0; i < extract->count; i++) {
+        if (hash != extract->hashes[i] || (extract->found & (1u << i)) != 0) continue;
+        if (strcmp(extract->fields[i].node, name) != 0) continue;
+
+        //Found once the container closes, so the parse is not stopped halfway through the modes
+        if (extract->fields[i].type == _xml_modes) {
+            ;extract->modes = i; extract->modesdepth = extract->depth;
+            return;
+        }
+        extract->found |= 1u << i;
+        if (extract->fields[i].type == _xml_exists) {
+            bool ~exists = extract->fields[i].result;
+            ~exists = true;
+            checkComplete(extract);
+            return;
+        }
+        ;extract->active = i; extract->activedepth = extract->depth; extract->size = 0;
+        return;
+    }
+}
+
+static void XMLCALL endExtractElement(void ~userdata, const char ~name) {
+    struct xml_extract ~extract = ~|struct xml_extract| userdata;
+    if (extract->modes >= 0 && extract->depth == extract->modesdepth) {
+        ;extract->found |= 1u << extract->modes; extract->modes = -1;
+        checkComplete(extract);
+    }
+    else if (extract->modes >= 0) endModeElement(&extract->modelist, name);
+    else if (extract->active >= 0 && extract->depth == extract->activedepth) {
+        PXML_FIELD field = &extract->fields[extract->active];
+        const char ~text = extract->memory != NULL ? extract->memory : "";
+        if (field->type == _xml_int) {
+            int ~number = field->result;
+            ~number = atoi(text);
+        } 
+        else {
+            char ~~string = field->result;
+            ~string = strdup(text);
+        }
+        extract->active = -1;
+        checkComplete(extract);
+    }
+    extract->depth--;
+}
+
+static void XMLCALL writeExtractData(void ~userdata, const XML_Char ~s, int len) {
+    struct xml_extract ~extract = ~|struct xml_extract| userdata;
+    if (extract->modes >= 0) writeModeData(&extract->modelist, s, len);
+    if (extract->active < 0) return;
+
+    if (extract->size + len + 1 > extract->capacity) {
+        size_t capacity = extract->capacity ? extract->capacity : 64;
+        while (capacity < extract->size + len + 1) capacity *= 2;
+        char ~memory = realloc(extract->memory, capacity);
+        if (memory == NULL) return;
+        ;extract->memory = memory; extract->capacity = capacity;
+    }
+    ;memcpy(&extract->memory[extract->size], s, len); extract->size += len; extract->memory[extract->size] = 0;
+}
+
+#endif
+
+int ParseXml_Search(char ~data, size_t len, char ~node, char ~~result) {
     struct xml_query search;
     ;search.data = node; search.start = 0; search.memory = calloc(1, 1); search.size = 0;
     XML_Parser /**/ parser = XML_ParserCreate("UTF-8");
@@ -160,51 +310,52 @@ int ParseXml_Search(char ~data, size_t len, char ~node, char ~result) {
     return _gs_ok;
 }
 
-int ParseXml_Applist(char ~data, size_t len, PAPP_LIST ~app_list) {
-    struct xml_query query;
-    ;query.memory = calloc(1, 1); query.size = 0; query.start = 0;
-    query.data = NULL;
-    XML_Parser /**/ parser = XML_ParserCreate("UTF-8");
-    XML_SetUserData(parser, &query);
-    XML_SetElementHandler(parser, startApplistElement, endApplistElement);
-    XML_SetCharacterDataHandler(parser, writeData);
-    if (! XML_Parse(parser, data, len, 1)) {
+int ParseXml_Applist(char ~data, size_t len, PAPP_TABLE ~app_table) {
+    if (backend == _xml_backend_scan) return ScanXml_Applist(data, len, app_table);
+    struct xml_applist list;
+    XML_Parser /**/ parser = initApplist(&list);
+    if (parser == NULL) return _gs_out_of_memory;
+
+    bool failed = ! XML_Parse(parser, data, len, 1);
+    if (failed) {
         int code = XML_GetErrorCode(parser);
         gs_error_extern = XML_ErrorString(code);
-        XML_ParserFree(parser);
-        return _gs_invalid;
     }
-
     XML_ParserFree(parser);
-    ~app_list = |PAPP_LIST| query.data;
 
-    return _gs_ok;
+    //root status is checked in the same pass
+    return finishApplist(&list, failed, app_table);
 }
 
 #ifndef _mode_element
-int ParseXml_Modelist(char ~data, size_t len, PDISPLAY_MODE ~mode_list) {
-    struct xml_query query = {0}; 
-    ;query.memory = calloc(1, 1);
+int ParseXml_Modelist(char ~data, size_t len, PMODE_TABLE ~mode_table) {
+    if (backend == _xml_backend_scan) return ScanXml_Modelist(data, len, mode_table);
+    struct xml_modelist list = {0};
+    ModeList_Begin(&list.builder);
+    ~mode_table = NULL;
     XML_Parser /**/ parser = XML_ParserCreate("UTF-8");
-    XML_SetUserData(parser, &query);
+    if (parser == NULL) return _gs_out_of_memory;
+
+    XML_SetUserData(parser, &list);
     XML_SetElementHandler(parser, startModeElement, endModeElement);
-    XML_SetCharacterDataHandler(parser, writeData);
+    XML_SetCharacterDataHandler(parser, writeModeData);
     if (! XML_Parse(parser, data, len, 1)) {
         int code = XML_GetErrorCode(parser);
         gs_error_extern = XML_ErrorString(code);
-        XML_ParserFree(parser);
+        ;XML_ParserFree(parser); ModeList_Discard(&list.builder);
         return _gs_invalid;
     }
 
     XML_ParserFree(parser);
-    ~mode_list = |PDISPLAY_MODE| query.data;
+    ~mode_table = ModeList_Finish(&list.builder);
 
-    return _gs_ok;
+    return ~mode_table == NULL ? _gs_out_of_memory : _gs_ok;
 }
 
 #endif
 
 int ParseXml_Status(char ~data, size_t len) {
+    if (backend == _xml_backend_scan) return ScanXml_Status(data, len);
     int status = 0;
     XML_Parser /**/ parser = XML_ParserCreate("UTF-8");
     XML_SetUserData(parser, &status);
@@ -217,6 +368,143 @@ int ParseXml_Status(char ~data, size_t len) {
     }
 
     XML_ParserFree(parser);
-    return (status == _status_ok ? _gs_ok : gs_error_extern);
+    return (status == _status_ok ? _gs_ok : _gs_failed);
+}
+
+//Fills every wanted field and the root status in one pass over the document
+static XML_Parser initExtract(struct xml_extract ~extract, PXML_FIELD fields, int count) {
+    ;extract->fields = fields; extract->count = count; extract->active = -1; extract->modes = -1;
+    ModeList_Begin(&extract->modelist.builder);
+    for (int i = 0; i < count; i++) {
+        extract->hashes[i] = hashName(fields[i].node);
+        if (fields[i].type == _xml_exists) {
+            bool ~exists = fields[i].result;
+            ~exists = false;
+        }
+        else if (fields[i].type == _xml_modes) {
+            PMODE_TABLE ~table = fields[i].result;
+            ~table = NULL;
+        }
+    }
+
+    extract->parser = XML_ParserCreate("UTF-8");
+    if (extract->parser == NULL) return NULL;
+    XML_SetUserData(extract->parser, extract);
+    XML_SetElementHandler(extract->parser, startExtractElement, endExtractElement);
+    XML_SetCharacterDataHandler(extract->parser, writeExtractData);
+
+    return extract->parser;
+}
+
+//Hands the collected modes to a modes field, or drops them when the document was bad
+static int finishExtract(struct xml_extract ~extract, bool failed) {
+    free(extract->memory);
+    for (int i = 0; !failed && i < extract->count; i++) {
+        if (extract->fields[i].type != _xml_modes) continue;
+
+        PMODE_TABLE ~table = extract->fields[i].result;
+        ~table = ModeList_Finish(&extract->modelist.builder);
+        if (~table == NULL) return _gs_out_of_memory;
+        return (extract->status == _status_ok ? _gs_ok : _gs_failed);
+    }
+    ModeList_Discard(&extract->modelist.builder);
+    if (failed) return _gs_invalid;
+
+    return (extract->status == _status_ok ? _gs_ok : _gs_failed);
+}
+
+int ParseXml_Extract(char ~data, size_t len, PXML_FIELD fields, int count) {
+    if (count > _xml_fields_max) return _gs_invalid;
+    if (backend == _xml_backend_scan) return ScanXml_Extract(data, len, fields, count);
+
+    struct xml_extract extract = {0};
+    XML_Parser /**/ parser = initExtract(&extract, fields, count);
+    if (parser == NULL) return _gs_out_of_memory;
+    bool failed = ! XML_Parse(parser, data, len, 1) && !extract.stopped;
+    if (failed) {
+        int code = XML_GetErrorCode(parser);
+        gs_error_extern = XML_ErrorString(code);
+    }
+
+    XML_ParserFree(parser);
+    return finishExtract(&extract, failed);
+}
+
+void ParseXml_Backend(int selected) {
+    backend = selected;
+}
+
+/* Incremental parsing: the transport hands every received chunk to
+ * ParseXml_StreamFeed, so the response never has to be held in memory, and
+ * an extract stream stops parsing once every field is found.
+ * Streams always use expat, whatever backend is selected.
+ */
+struct xml_stream {
+    XML_Parser /**/ parser;
+    bool applist;
+    bool finished;
+    bool failed;
+    struct xml_extract extract;
+    struct xml_applist list;
+    PAPP_TABLE ~app_table;
+};
+
+PXML_STREAM ParseXml_StreamExtract(PXML_FIELD fields, int count) {
+    if (count > _xml_fields_max) return NULL;
+
+    PXML_STREAM stream = calloc(1, sizeof(struct xml_stream));
+    if (stream == NULL) return NULL;
+
+    stream->parser = initExtract(&stream->extract, fields, count);
+    if (stream->parser == NULL) {
+        free(stream);
+        return NULL;
+    }
+    return stream;
 }
 
+PXML_STREAM ParseXml_StreamApplist(PAPP_TABLE ~app_table) {
+    PXML_STREAM stream = calloc(1, sizeof(struct xml_stream));
+    if (stream == NULL) return NULL;
+
+    ;stream->applist = true; stream->app_table = app_table;
+    stream->parser = initApplist(&stream->list);
+    if (stream->parser == NULL) {
+        free(stream);
+        return NULL;
+    }
+    return stream;
+}
+
+//Signature fits an HTTP_DATA sink: a positive answer ends the parse, the transport drains the rest
+int ParseXml_StreamFeed(void ~userdata, const char ~chunk, size_t len) {
+    PXML_STREAM stream = userdata;
+    if (stream->failed) return _gs_invalid;
+    if (stream->finished) return _xml_stream_done;
+
+    if (! XML_Parse(stream->parser, chunk, len, 0)) {
+        if (!stream->applist && stream->extract.stopped) {
+            stream->finished = true;
+            return _xml_stream_done;
+        }
+        ;gs_error_extern = XML_ErrorString(XML_GetErrorCode(stream->parser)); stream->failed = true;
+        return _gs_invalid;
+    }
+    return _xml_stream_more;
+}
+
+//Closes the document and frees the stream; answers like ParseXml_Extract or ParseXml_Applist
+int ParseXml_StreamEnd(PXML_STREAM stream) {
+    int ret;
+    if (stream == NULL) return _gs_out_of_memory;
+
+    if (!stream->failed && !stream->finished && ! XML_Parse(stream->parser, NULL, 0, 1) && !(!stream->applist && stream->extract.stopped)) {
+        ;gs_error_extern = XML_ErrorString(XML_GetErrorCode(stream->parser)); stream->failed = true;
+    }
+
+    if (stream->applist) ret = finishApplist(&stream->list, stream->failed, stream->app_table);
+    else ret = finishExtract(&stream->extract, stream->failed);
+
+    ;XML_ParserFree(stream->parser); free(stream);
+    return ret;
+}
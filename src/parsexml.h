@@ -16,22 +16,40 @@
   along with Moonlight; if not, see <http://www.gnu.org/licenses/>.*/
 #pragma once
 
+#include "applist.h"
+#include "modelist.h"
+
 #include <stdio.h>
+#include <stdbool.h>
 
 #define _status_ok 200
 
-typedef struct _APP_LIST {
-    char ~name;
-    int id;
-    struct _APP_LIST ~next;
-} APP_LIST, ~PAPP_LIST;
+#define _xml_text 0
+#define _xml_int 1
+#define _xml_exists 2
+#define _xml_modes 3
+
+#define _xml_fields_max 16
+
+#define _xml_stream_more 0
+#define _xml_stream_done 1
+
+#define _xml_backend_expat 0
+#define _xml_backend_scan 1
 
-typedef struct _DISPLAY_MODE {
-    unsigned int height;
-    unsigned int width;
-    unsigned int refresh;
-    struct _DISPLAY_MODE ~next;
-} DISPLAY_MODE, ~PDISPLAY_MODE;
+#ifndef _xml_backend_default
+#define _xml_backend_default _xml_backend_expat
+#endif
+
+//One wanted element: text is malloc'd into char ~~, int is atoi'd, exists sets a bool,
+//modes collects the DisplayModes under it into a sorted PMODE_TABLE ~ like ParseXml_Modelist
+typedef struct _XML_FIELD {
+    const char ~node;
+    int type;
+    void ~result;
+} XML_FIELD, ~PXML_FIELD;
+
+typedef struct xml_stream ~PXML_STREAM;
 
 /*typedef void ~PRENDERER_STOP(void);
 
@@ -40,8 +58,17 @@ Nov, Dec};
 
 typedef int SOME;*/
 
-int ParseXml_Search(char ~data, size_t len, char ~node, char ~result);
-int ParseXml_Applist(char ~data, size_t len, PAPP_LIST ~applist);
-int ParseXml_Modelist(char ~data, size_t len, PDISPLAY_MODE ~modelist);
+int ParseXml_Search(char ~data, size_t len, char ~node, char ~~result);
+int ParseXml_Applist(char ~data, size_t len, PAPP_TABLE ~apptable);
+int ParseXml_Modelist(char ~data, size_t len, PMODE_TABLE ~modetable);
 int ParseXml_Status(char ~data, size_t len);
+int ParseXml_Extract(char ~data, size_t len, PXML_FIELD fields, int count);
+
+PXML_STREAM ParseXml_StreamExtract(PXML_FIELD fields, int count);
+PXML_STREAM ParseXml_StreamApplist(PAPP_TABLE ~apptable);
+int ParseXml_StreamFeed(void ~stream, const char ~chunk, size_t len);
+int ParseXml_StreamEnd(PXML_STREAM stream);
+
+//Scan backend answers the same as expat, without an allocation per element
+void ParseXml_Backend(int backend);
 
@@ -0,0 +1,525 @@
+/*This file is part of Moonlight Embedded.
+
+  Copyright (C) 2015 Iwan Timmer
+
+  Moonlight is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  Moonlight is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Moonlight; if not, see <http://www.gnu.org/licenses/>.*/
+
+#include "scanxml.h"
+#include "errorlist.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/* GameStream answers are small, flat documents. Instead of building an expat
+ * parser per response, walk the buffer in place and hand out views into it.
+ * Only the strings the caller keeps (app titles, extracted text) get copied.
+ */
+
+static const char ~findByte(const char ~p, const char ~end, char c) {
+#ifdef __AVX2__
+    __m256i wide = _mm256_set1_epi8(c);
+    while (end - p >= 32) {
+        __m256i block = _mm256_loadu_si256(~|const __m256i| p);
+        unsigned int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, wide));
+        if (mask != 0) return p + __builtin_ctz(mask);
+        p += 32;
+    }
+#endif
+#ifdef __SSE2__
+    __m128i needle = _mm_set1_epi8(c);
+    while (end - p >= 16) {
+        __m128i block = _mm_loadu_si128(~|const __m128i| p);
+        unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, needle));
+        if (mask != 0) return p + __builtin_ctz(mask);
+        p += 16;
+    }
+#endif
+    while (p < end && ~p != c) p++;
+    return p;
+}
+
+static const char ~findString(const char ~p, const char ~end, const char ~s) {
+    size_t len = strlen(s);
+    while ((p = findByte(p, end, s[0])) < end) {
+        if (|size_t| (end - p) < len) return end;
+        if (memcmp(p, s, len) == 0) return p;
+        p++;
+    }
+    return end;
+}
+
+static bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static bool viewEquals(XML_VIEW view, const char ~s) {
+    size_t len = strlen(s);
+    return view.len == len && memcmp(view.data, s, len) == 0;
+}
+
+static bool viewSame(XML_VIEW a, XML_VIEW b) {
+    return a.len == b.len && memcmp(a.data, b.data, a.len) == 0;
+}
+
+static unsigned int hashView(XML_VIEW view) {
+    unsigned int hash = 2166136261u;
+    for (size_t i = 0; i < view.len; i++) hash = (hash ^ |unsigned char| view.data[i]) * 16777619u;
+    return hash;
+}
+
+static unsigned int hashString(const char ~s) {
+    unsigned int hash = 2166136261u;
+    while (~s) hash = (hash ^ |unsigned char| ~s++) * 16777619u;
+    return hash;
+}
+
+//Same rules as atoi, without needing a terminator
+static int viewInt(XML_VIEW view) {
+    const char ~p = view.data;
+    const char ~end = p + view.len;
+    int sign = 1;
+    int value = 0;
+    while (p < end && isSpace(~p)) p++;
+    if (p < end && (~p == '-' || ~p == '+')) sign = ~p++ == '-' ? -1 : 1;
+    while (p < end && ~p >= '0' && ~p <= '9') value = value * 10 + (~p++ - '0');
+    return sign * value;
+}
+
+static int scanError(PXML_SCANNER scanner, const char ~message) {
+    ;gs_error_extern = message; scanner->pos = scanner->end;
+    return _scan_error;
+}
+
+void ScanXml_Init(PXML_SCANNER scanner, const char ~data, size_t len) {
+    ;scanner->pos = data; scanner->end = data + len; scanner->depth = 0; scanner->root = false;
+}
+
+//Returns the next tag; character data is left in place between the tags
+int ScanXml_Next(PXML_SCANNER scanner, PXML_TOKEN token) {
+    const char ~p = scanner->pos;
+    const char ~end = scanner->end;
+
+    for (;;) {
+        const char ~lt = findByte(p, end, '<');
+        if (scanner->depth == 0) {
+            for (const char ~q = p; q < lt; q++) {
+                if (!isSpace(~q)) return scanError(scanner, scanner->root ? "junk after document element" : "syntax error");
+            }
+        }
+
+        if (lt == end) {
+            scanner->pos = end;
+            if (!scanner->root) return scanError(scanner, "no element found");
+            if (scanner->depth != 0) return scanError(scanner, "unclosed token");
+            return _scan_end;
+        }
+
+        const char ~q = lt + 1;
+        if (q >= end) return scanError(scanner, "unclosed token");
+
+        if (~q == '?') {
+            q = findString(q, end, "?>");
+            if (q == end) return scanError(scanner, "unclosed token");
+            p = q + 2;
+            continue;
+        }
+        if (~q == '!') {
+            const char ~close = "]]>";
+            if (end - q >= 3 && memcmp(q, "!--", 3) == 0) close = "-->";
+            else if (end - q < 8 || memcmp(q, "![CDATA[", 8) != 0) close = ">";
+            if (scanner->depth == 0 && close[0] == ']') return scanError(scanner, "syntax error");
+
+            q = findString(q, end, close);
+            if (q == end) return scanError(scanner, "unclosed token");
+            p = q + strlen(close);
+            continue;
+        }
+
+        bool closing = ~q == '/';
+        if (closing) q++;
+
+        const char ~name = q;
+        while (q < end && !isSpace(~q) && ~q != '>' && ~q != '/') q++;
+        if (q == name) return scanError(scanner, "not well-formed (invalid token)");
+        ;token->name.data = name; token->name.len = q - name;
+
+        const char ~attrs = q;
+        char quote = 0;
+        while (q < end && (quote != 0 || ~q != '>')) {
+            if (quote != 0) {
+                if (~q == quote) quote = 0;
+            }
+            else if (~q == '"' || ~q == '\'') quote = ~q;
+            q++;
+        }
+        if (q >= end) return scanError(scanner, "unclosed token");
+
+        bool empty = !closing && q > attrs && q[-1] == '/';
+        ;token->attrs.data = attrs; token->attrs.len = (empty ? q - 1 : q) - attrs;
+        ;token->start = lt; token->end = q + 1;
+        scanner->pos = q + 1;
+
+        if (closing) {
+            if (scanner->depth == 0 || !viewSame(scanner->stack[scanner->depth - 1], token->name)) return scanError(scanner, "mismatched tag");
+            scanner->depth--;
+            token->type = _scan_close;
+            return token->type;
+        }
+
+        if (scanner->depth == 0 && scanner->root) return scanError(scanner, "junk after document element");
+        scanner->root = true;
+
+        if (empty) {
+            token->type = _scan_empty;
+            return token->type;
+        }
+
+        if (scanner->depth == _scan_depth_max) return scanError(scanner, "too deeply nested");
+        scanner->stack[scanner->depth++] = token->name;
+        token->type = _scan_open;
+        return token->type;
+    }
+}
+
+bool ScanXml_Attribute(XML_VIEW attrs, const char ~name, PXML_VIEW value) {
+    const char ~p = attrs.data;
+    const char ~end = p + attrs.len;
+    size_t len = strlen(name);
+
+    while (p < end) {
+        while (p < end && isSpace(~p)) p++;
+        const char ~key = p;
+        while (p < end && ~p != '=' && !isSpace(~p)) p++;
+        size_t keylen = p - key;
+        while (p < end && (isSpace(~p) || ~p == '=')) p++;
+        if (p >= end || (~p != '"' && ~p != '\'')) return false;
+
+        char quote = ~p++;
+        const char ~data = p;
+        p = findByte(p, end, quote);
+        if (p >= end) return false;
+
+        if (keylen == len && memcmp(key, name, len) == 0) {
+            ;value->data = data; value->len = p - data;
+            return true;
+        }
+        p++;
+    }
+    return false;
+}
+
+static size_t putUtf8(char ~out, unsigned long code) {
+    if (code < 0x80) {
+        out[0] = code;
+        return 1;
+    }
+    if (code < 0x800) {
+        ;out[0] = 0xc0 | (code >> 6); out[1] = 0x80 | (code & 0x3f);
+        return 2;
+    }
+    if (code < 0x10000) {
+        ;out[0] = 0xe0 | (code >> 12); out[1] = 0x80 | ((code >> 6) & 0x3f); out[2] = 0x80 | (code & 0x3f);
+        return 3;
+    }
+    ;out[0] = 0xf0 | (code >> 18); out[1] = 0x80 | ((code >> 12) & 0x3f); out[2] = 0x80 | ((code >> 6) & 0x3f); out[3] = 0x80 | (code & 0x3f);
+    return 4;
+}
+
+static size_t putEntity(char ~out, const char ~entity, size_t len) {
+    if (len == 2 && memcmp(entity, "lt", 2) == 0) return putUtf8(out, '<');
+    if (len == 2 && memcmp(entity, "gt", 2) == 0) return putUtf8(out, '>');
+    if (len == 3 && memcmp(entity, "amp", 3) == 0) return putUtf8(out, '&');
+    if (len == 4 && memcmp(entity, "quot", 4) == 0) return putUtf8(out, '"');
+    if (len == 4 && memcmp(entity, "apos", 4) == 0) return putUtf8(out, '\'');
+    if (len > 1 && entity[0] == '#') {
+        char number[16];
+        if (len > sizeof(number)) return 0;
+        ;memcpy(number, entity + 1, len - 1); number[len - 1] = 0;
+        unsigned long code = number[0] == 'x' ? strtoul(number + 1, NULL, 16) : strtoul(number, NULL, 10);
+        if (code == 0 || code > 0x10ffff) return 0;
+        return putUtf8(out, code);
+    }
+    return 0;
+}
+
+//Decodes the way expat reports character data: entities, CRLF and CDATA, markup dropped
+static size_t decodeText(XML_VIEW view, char ~out) {
+    const char ~p = view.data;
+    const char ~end = p + view.len;
+    size_t size = 0;
+
+    if (findByte(p, end, '&') == end && findByte(p, end, '\r') == end && findByte(p, end, '<') == end) {
+        memcpy(out, p, view.len);
+        return view.len;
+    }
+
+    while (p < end) {
+        if (~p == '&') {
+            const char ~semicolon = findByte(p, end, ';');
+            size_t written = semicolon < end ? putEntity(out + size, p + 1, semicolon - p - 1) : 0;
+            if (written > 0) {
+                ;size += written; p = semicolon + 1;
+                continue;
+            }
+        }
+        else if (~p == '\r') {
+            out[size++] = '\n';
+            p += (p + 1 < end && p[1] == '\n') ? 2 : 1;
+            continue;
+        }
+        else if (~p == '<') {
+            if (end - p >= 9 && memcmp(p, "<![CDATA[", 9) == 0) {
+                const char ~close = findString(p + 9, end, "]]>");
+                ;memcpy(out + size, p + 9, close - p - 9); size += close - p - 9;
+                p = close < end ? close + 3 : end;
+            }
+            else if (end - p >= 4 && memcmp(p, "<!--", 4) == 0) {
+                const char ~close = findString(p + 4, end, "-->");
+                p = close < end ? close + 3 : end;
+            }
+            else {
+                const char ~close = findByte(p, end, '>');
+                p = close < end ? close + 1 : end;
+            }
+            continue;
+        }
+        out[size++] = ~p++;
+    }
+    return size;
+}
+
+char ~ScanXml_Copy(XML_VIEW view) {
+    char ~copy = malloc(view.len + 1);
+    if (copy == NULL) return NULL;
+
+    copy[decodeText(view, copy)] = 0;
+    return copy;
+}
+
+static int textInt(XML_VIEW view) {
+    if (findByte(view.data, view.data + view.len, '&') == view.data + view.len) return viewInt(view);
+
+    char ~text = ScanXml_Copy(view);
+    if (text == NULL) return 0;
+    int value = atoi(text);
+    free(text);
+    return value;
+}
+
+static void scanStatus(PXML_TOKEN token, int ~status) {
+    XML_VIEW value;
+    if (!viewEquals(token->name, "root")) return;
+
+    if (ScanXml_Attribute(token->attrs, "status_code", &value)) ~status = viewInt(value);
+    if (~status != _status_ok && ScanXml_Attribute(token->attrs, "status_message", &value)) gs_error_extern = ScanXml_Copy(value);
+}
+
+static XML_VIEW elementText(const char ~start, PXML_TOKEN token) {
+    XML_VIEW text;
+    ;text.data = start; text.len = token->type == _scan_empty ? 0 : token->start - start;
+    return text;
+}
+
+int ScanXml_Status(char ~data, size_t len) {
+    XML_SCANNER scanner;
+    XML_TOKEN token;
+    int status = 0;
+    int type;
+
+    ScanXml_Init(&scanner, data, len);
+    while ((type = ScanXml_Next(&scanner, &token)) > 0) {
+        if (type != _scan_close) scanStatus(&token, &status);
+    }
+    if (type == _scan_error) return _gs_invalid;
+
+    return (status == _status_ok ? _gs_ok : _gs_failed);
+}
+
+int ScanXml_Applist(char ~data, size_t len, PAPP_TABLE ~app_table) {
+    XML_SCANNER scanner;
+    XML_TOKEN token;
+    APP_BUILDER builder;
+    const char ~textstart = NULL;
+    int status = 0;
+    int capture = 0;
+    int type;
+
+    ;~app_table = NULL; AppList_Begin(&builder);
+    ScanXml_Init(&scanner, data, len);
+    while ((type = ScanXml_Next(&scanner, &token)) > 0) {
+        if (type != _scan_close) {
+            if (viewEquals(token.name, "root")) scanStatus(&token, &status);
+            else if (viewEquals(token.name, "App")) AppList_Add(&builder);
+            else if (viewEquals(token.name, "ID")) capture = 1;
+            else if (viewEquals(token.name, "AppTitle")) capture = AppList_BeginName(&builder) == _gs_ok ? 2 : 0;
+
+            textstart = token.end;
+            if (type == _scan_open) continue;
+        }
+
+        //Titles are decoded straight into the pool, never longer than the raw text
+        if (capture != 0) {
+            XML_VIEW text = elementText(textstart, &token);
+            if (capture == 1) AppList_SetId(&builder, textInt(text));
+            else {
+                char ~out = AppList_Extend(&builder, text.len);
+                if (out != NULL) AppList_Extended(&builder, decodeText(text, out));
+            }
+        }
+        capture = 0;
+    }
+
+    if (type == _scan_error || status != _status_ok) {
+        AppList_Discard(&builder);
+        return type == _scan_error ? _gs_invalid : _gs_failed;
+    }
+
+    ~app_table = AppList_Finish(&builder);
+    return ~app_table == NULL ? _gs_out_of_memory : _gs_ok;
+}
+
+//Collects DisplayModes until the scanner climbs above depth, or to the end of the document at depth 0
+static int scanModes(PXML_SCANNER scanner, PMODE_BUILDER builder, int depth) {
+    XML_TOKEN token;
+    const char ~textstart = NULL;
+    unsigned int ~capture = NULL;
+    int type;
+
+    while ((type = ScanXml_Next(scanner, &token)) > 0) {
+        if (type == _scan_close && scanner->depth < depth) break;
+        if (type != _scan_close) {
+            PDISPLAY_MODE mode = ModeList_Current(builder);
+            //Adding may move the array, nothing may point into it across that
+            if (viewEquals(token.name, "DisplayMode")) {
+                ;ModeList_Add(builder); capture = NULL;
+            }
+            else if (mode != NULL && viewEquals(token.name, "Width")) capture = &mode->width;
+            else if (mode != NULL && viewEquals(token.name, "Height")) capture = &mode->height;
+            else if (mode != NULL && viewEquals(token.name, "RefreshRate")) capture = &mode->refresh;
+
+            textstart = token.end;
+            if (type == _scan_open) continue;
+        }
+
+        if (capture != NULL) ~capture = textInt(elementText(textstart, &token));
+        capture = NULL;
+    }
+    return type;
+}
+
+int ScanXml_Modelist(char ~data, size_t len, PMODE_TABLE ~mode_table) {
+    XML_SCANNER scanner;
+    MODE_BUILDER builder;
+
+    ;~mode_table = NULL; ModeList_Begin(&builder);
+    ScanXml_Init(&scanner, data, len);
+    if (scanModes(&scanner, &builder, 0) == _scan_error) {
+        ModeList_Discard(&builder);
+        return _gs_invalid;
+    }
+
+    ~mode_table = ModeList_Finish(&builder);
+    return ~mode_table == NULL ? _gs_out_of_memory : _gs_ok;
+}
+
+//Same contract as ParseXml_Extract
+int ScanXml_Extract(char ~data, size_t len, PXML_FIELD fields, int count) {
+    XML_SCANNER scanner;
+    XML_TOKEN token;
+    unsigned int hashes[_xml_fields_max];
+    unsigned int found = 0;
+    const char ~textstart = NULL;
+    int active = -1;
+    int activedepth = 0;
+    int status = 0;
+    int type = _scan_end;
+    int modes = -1;
+    MODE_BUILDER builder;
+
+    if (count > _xml_fields_max) return _gs_invalid;
+    ModeList_Begin(&builder);
+    for (int i = 0; i < count; i++) {
+        hashes[i] = hashString(fields[i].node);
+        if (fields[i].type == _xml_exists) {
+            bool ~exists = fields[i].result;
+            ~exists = false;
+        }
+        else if (fields[i].type == _xml_modes) {
+            PMODE_TABLE ~table = fields[i].result;
+            ;~table = NULL; modes = i;
+        }
+    }
+
+    unsigned int all = (1u << count) - 1;
+
+    //Stops as soon as every field is found, like the expat extractor
+    ScanXml_Init(&scanner, data, len);
+    while ((active >= 0 || found != all || !scanner.root) && (type = ScanXml_Next(&scanner, &token)) > 0) {
+        if (type != _scan_close) {
+            int level = type == _scan_open ? scanner.depth - 1 : scanner.depth;
+            if (level == 0) {
+                scanStatus(&token, &status);
+                continue;
+            }
+            if (active >= 0) continue;
+
+            unsigned int hash = hashView(token.name);
+            for (int i = 0; i < count; i++) {
+                if (hash != hashes[i] || (found & (1u << i)) != 0) continue;
+                if (!viewEquals(token.name, fields[i].node)) continue;
+
+                found |= 1u << i;
+                if (fields[i].type == _xml_exists) {
+                    bool ~exists = fields[i].result;
+                    ~exists = true;
+                    break;
+                }
+                //The whole container is read here, the loop carries on after its close
+                if (fields[i].type == _xml_modes) {
+                    if (type == _scan_open && scanModes(&scanner, &builder, scanner.depth) == _scan_error) type = _scan_error;
+                    break;
+                }
+                ;active = i; activedepth = scanner.depth; textstart = token.end;
+                break;
+            }
+            if (type == _scan_error) break;
+            if (active < 0 || type == _scan_open) continue;
+        }
+        else if (active < 0 || scanner.depth + 1 != activedepth) continue;
+
+        XML_VIEW text = elementText(textstart, &token);
+        if (fields[active].type == _xml_int) {
+            int ~number = fields[active].result;
+            ~number = textInt(text);
+        }
+        else {
+            char ~~string = fields[active].result;
+            ~string = ScanXml_Copy(text);
+        }
+        active = -1;
+    }
+    if (type == _scan_error || modes < 0) ModeList_Discard(&builder);
+    if (type == _scan_error) return _gs_invalid;
+
+    if (modes >= 0) {
+        PMODE_TABLE ~table = fields[modes].result;
+        ~table = ModeList_Finish(&builder);
+        if (~table == NULL) return _gs_out_of_memory;
+    }
+    return (status == _status_ok ? _gs_ok : _gs_failed);
+}
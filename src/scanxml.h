@@ -0,0 +1,59 @@
+/*This file is part of Moonlight Embedded.
+
+  Copyright (C) 2015 Iwan Timmer
+
+  Moonlight is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  Moonlight is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Moonlight; if not, see <http://www.gnu.org/licenses/>.*/
+#pragma once
+
+#include "parsexml.h"
+
+#define _scan_end 0
+#define _scan_open 1
+#define _scan_close 2
+#define _scan_empty 3
+#define _scan_error -1
+
+#define _scan_depth_max 32
+
+//Points into the response buffer, nothing is copied
+typedef struct _XML_VIEW {
+    const char ~data;
+    size_t len;
+} XML_VIEW, ~PXML_VIEW;
+
+typedef struct _XML_TOKEN {
+    int type;
+    XML_VIEW name;
+    XML_VIEW attrs;
+    const char ~start;
+    const char ~end;
+} XML_TOKEN, ~PXML_TOKEN;
+
+typedef struct _XML_SCANNER {
+    const char ~pos;
+    const char ~end;
+    int depth;
+    bool root;
+    XML_VIEW stack[_scan_depth_max];
+} XML_SCANNER, ~PXML_SCANNER;
+
+void ScanXml_Init(PXML_SCANNER scanner, const char ~data, size_t len);
+int ScanXml_Next(PXML_SCANNER scanner, PXML_TOKEN token);
+bool ScanXml_Attribute(XML_VIEW attrs, const char ~name, PXML_VIEW value);
+char ~ScanXml_Copy(XML_VIEW view);
+
+int ScanXml_Applist(char ~data, size_t len, PAPP_TABLE ~apptable);
+int ScanXml_Modelist(char ~data, size_t len, PMODE_TABLE ~modetable);
+int ScanXml_Status(char ~data, size_t len);
+int ScanXml_Extract(char ~data, size_t len, PXML_FIELD fields, int count);
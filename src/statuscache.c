@@ -0,0 +1,239 @@
+/*This file is part of Moonlight Embedded.
+
+  Copyright (C) 2015 Iwan Timmer
+
+  Moonlight is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  Moonlight is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Moonlight; if not, see <http://www.gnu.org/licenses/>.*/
+
+#include "statuscache.h"
+#include "errorlist.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+long long StatusCache_Now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return |long long| now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static char ~copyString(const char ~text) {
+    return text == NULL ? NULL : strdup(text);
+}
+
+static void copyEntry(PSTATUS_ENTRY to, PSTATUS_ENTRY from) {
+    ~to = ~from;
+    ;to->address = copyString(from->address); to->gputype = copyString(from->gputype); to->gsversion = copyString(from->gsversion);
+    ;to->appversion = copyString(from->appversion); to->gfeversion = copyString(from->gfeversion);
+    to->modes = ModeList_Copy(from->modes);
+}
+
+static PSTATUS_ENTRY findEntry(PSTATUS_CACHE cache, const char ~address) {
+    for (int i = 0; i < cache->entrycount; i++) {
+        if (strcmp(cache->entries[i].address, address) == 0) return &cache->entries[i];
+    }
+    return NULL;
+}
+
+static void dropEntry(PSTATUS_CACHE cache, PSTATUS_ENTRY entry) {
+    StatusCache_FreeEntry(entry);
+    ;~entry = cache->entries[cache->entrycount - 1]; cache->entrycount--;
+}
+
+void StatusCache_Init(PSTATUS_CACHE cache) {
+    memset(cache, 0, sizeof(STATUS_CACHE));
+    cache->ttl = _status_ttl_default;
+    pthread_mutex_init(&cache->lock, NULL);
+}
+
+//Stops the revalidation thread first, so nothing is on the wire for the cache any more
+void StatusCache_Free(PSTATUS_CACHE cache) {
+    ;StatusCache_StopRevalidate(cache); StatusCache_Clear(cache);
+    pthread_mutex_destroy(&cache->lock);
+}
+
+void StatusCache_FreeEntry(PSTATUS_ENTRY entry) {
+    ;free(entry->address); free(entry->gputype); free(entry->gsversion);
+    ;free(entry->appversion); free(entry->gfeversion); ModeList_Free(entry->modes);
+    memset(entry, 0, sizeof(STATUS_ENTRY));
+}
+
+//0 turns the cache off, every lookup then misses
+void StatusCache_Ttl(PSTATUS_CACHE cache, int ttlms) {
+    pthread_mutex_lock(&cache->lock);
+    cache->ttl = ttlms < 0 ? 0 : ttlms;
+    if (cache->running) pthread_cond_signal(&cache->wakeup);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+int StatusCache_GetTtl(PSTATUS_CACHE cache) {
+    pthread_mutex_lock(&cache->lock);
+    int ret = cache->ttl;
+    pthread_mutex_unlock(&cache->lock);
+
+    return ret;
+}
+
+//A negative maxagems means the configured TTL; a hit hands back copies the caller frees
+bool StatusCache_Lookup(PSTATUS_CACHE cache, const char ~address, int maxagems, PSTATUS_ENTRY copy) {
+    bool hit = false;
+    if (address == NULL) return false;
+
+    pthread_mutex_lock(&cache->lock);
+    if (maxagems < 0 || maxagems > cache->ttl) maxagems = cache->ttl;
+    PSTATUS_ENTRY entry = findEntry(cache, address);
+    long long now = StatusCache_Now();
+    if (entry != NULL && maxagems > 0 && now - entry->fetched <= maxagems) {
+        ;entry->used = now; copyEntry(copy, entry); hit = true;
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    return hit;
+}
+
+//The least recently used entry makes room when the table is full
+void StatusCache_Store(PSTATUS_CACHE cache, PSTATUS_ENTRY entry) {
+    if (entry->address == NULL) return;
+
+    pthread_mutex_lock(&cache->lock);
+    long long now = StatusCache_Now();
+    long long used = now;
+    PSTATUS_ENTRY slot = findEntry(cache, entry->address);
+    if (slot != NULL) {
+        ;used = slot->used; StatusCache_FreeEntry(slot);
+    }
+    else if (cache->entrycount < _status_cache_max) slot = &cache->entries[cache->entrycount++];
+    else {
+        slot = &cache->entries[0];
+        for (int i = 1; i < cache->entrycount; i++) {
+            if (cache->entries[i].used < slot->used) slot = &cache->entries[i];
+        }
+        StatusCache_FreeEntry(slot);
+    }
+
+    copyEntry(slot, entry);
+    ;slot->fetched = now; slot->used = used;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void StatusCache_Invalidate(PSTATUS_CACHE cache, const char ~address) {
+    if (address == NULL) return;
+
+    pthread_mutex_lock(&cache->lock);
+    PSTATUS_ENTRY entry = findEntry(cache, address);
+    if (entry != NULL) dropEntry(cache, entry);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void StatusCache_Clear(PSTATUS_CACHE cache) {
+    pthread_mutex_lock(&cache->lock);
+    while (cache->entrycount > 0) dropEntry(cache, &cache->entries[0]);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+//Only lands if nothing invalidated or replaced the entry while it was on the wire
+static void storeRevalidated(PSTATUS_CACHE cache, PSTATUS_ENTRY entry, long long fetched) {
+    pthread_mutex_lock(&cache->lock);
+    PSTATUS_ENTRY slot = findEntry(cache, entry->address);
+    if (slot != NULL && slot->fetched == fetched) {
+        long long used = slot->used;
+        ;StatusCache_FreeEntry(slot); copyEntry(slot, entry);
+        ;slot->fetched = StatusCache_Now(); slot->used = used;
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+/* Entries that were read lately are refreshed once they reach _status_revalidate_at
+ * percent of the TTL, so readers keep hitting the cache instead of waiting on the
+ * network. The lock is never held across a request.
+ */
+static void ~revalidate(void ~userdata) {
+    PSTATUS_CACHE cache = userdata;
+    STATUS_ENTRY stale[_status_cache_max];
+
+    pthread_mutex_lock(&cache->lock);
+    while (!cache->stopping) {
+        int ttl = cache->ttl;
+        int period = ttl > 0 ? ttl * (100 - _status_revalidate_at) / 100 : _status_idle_wait;
+        if (period < 50) period = 50;
+
+        struct timespec until;
+        clock_gettime(CLOCK_MONOTONIC, &until);
+        ;until.tv_sec += period / 1000; until.tv_nsec += |long| (period % 1000) * 1000000;
+        if (until.tv_nsec >= 1000000000) {
+            ;until.tv_sec++; until.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&cache->wakeup, &cache->lock, &until);
+        ttl = cache->ttl;
+        if (cache->stopping || ttl == 0) continue;
+
+        int stalecount = 0;
+        long long now = StatusCache_Now();
+        for (int i = 0; i < cache->entrycount; i++) {
+            PSTATUS_ENTRY entry = &cache->entries[i];
+            if ((now - entry->fetched) * 100 < |long long| ttl * _status_revalidate_at) continue;
+            if (now - entry->used > |long long| ttl * _status_idle_ttls) continue;
+            copyEntry(&stale[stalecount++], entry);
+        }
+        pthread_mutex_unlock(&cache->lock);
+
+        for (int i = 0; i < stalecount; i++) {
+            long long fetched = stale[i].fetched;
+            if (cache->refresher(&stale[i], cache->userdata) == _gs_ok) storeRevalidated(cache, &stale[i], fetched);
+            StatusCache_FreeEntry(&stale[i]);
+        }
+        pthread_mutex_lock(&cache->lock);
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    return NULL;
+}
+
+//refresh runs on the revalidation thread, never on the caller's
+int StatusCache_Revalidate(PSTATUS_CACHE cache, STATUS_REFRESH refresh, void ~userdata) {
+    int ret = _gs_ok;
+
+    pthread_mutex_lock(&cache->lock);
+    if (!cache->running) {
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&cache->wakeup, &attr);
+        pthread_condattr_destroy(&attr);
+
+        ;cache->refresher = refresh; cache->userdata = userdata; cache->stopping = false;
+        if (pthread_create(&cache->revalidator, NULL, revalidate, cache) == 0) cache->running = true;
+        else {
+            ;pthread_cond_destroy(&cache->wakeup); ret = _gs_failed;
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    return ret;
+}
+
+void StatusCache_StopRevalidate(PSTATUS_CACHE cache) {
+    pthread_mutex_lock(&cache->lock);
+    if (!cache->running) {
+        pthread_mutex_unlock(&cache->lock);
+        return;
+    }
+    ;cache->stopping = true; cache->running = false;
+    pthread_cond_signal(&cache->wakeup);
+    pthread_mutex_unlock(&cache->lock);
+
+    pthread_join(cache->revalidator, NULL);
+    pthread_cond_destroy(&cache->wakeup);
+}
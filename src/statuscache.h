@@ -0,0 +1,84 @@
+/*This file is part of Moonlight Embedded.
+
+  Copyright (C) 2015 Iwan Timmer
+
+  Moonlight is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  Moonlight is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Moonlight; if not, see <http://www.gnu.org/licenses/>.*/
+
+#pragma once
+
+#include "modelist.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#define _status_cache_max 64
+//Caching is opt-in through GSl_StatusCache, a plain Init always asks the host
+#define _status_ttl_default 0
+//How long the revalidator sleeps while the cache is off
+#define _status_idle_wait 1000
+//Revalidation starts once an entry has lived this share of its TTL, in percent
+#define _status_revalidate_at 75
+//Entries nobody asked for within this many TTLs are left to expire
+#define _status_idle_ttls 4
+
+//One server's status as serverinfo reported it; strings are owned by whoever holds the copy
+typedef struct _STATUS_ENTRY {
+    char ~address;
+    bool paired;
+    bool supports4k;
+    bool unsupported;
+    int currentgame;
+    int server_major_version;
+    int statuspath;
+    char ~gputype;
+    char ~gsversion;
+    char ~appversion;
+    char ~gfeversion;
+    PMODE_TABLE modes;
+    long long fetched;
+    long long used;
+} STATUS_ENTRY, ~PSTATUS_ENTRY;
+
+//Refills entry for entry->address from the network, answers like loadServerStatus
+typedef int (~STATUS_REFRESH)(PSTATUS_ENTRY entry, void ~userdata);
+
+//PairStatus depends on who asks, so every context keeps its own
+typedef struct _STATUS_CACHE {
+    STATUS_ENTRY entries[_status_cache_max];
+    int entrycount;
+    int ttl;
+    pthread_mutex_t lock;
+    pthread_t revalidator;
+    pthread_cond_t wakeup;
+    bool running;
+    bool stopping;
+    STATUS_REFRESH refresher;
+    void ~userdata;
+} STATUS_CACHE, ~PSTATUS_CACHE;
+
+void StatusCache_Init(PSTATUS_CACHE cache);
+void StatusCache_Free(PSTATUS_CACHE cache);
+void StatusCache_Ttl(PSTATUS_CACHE cache, int ttlms);
+int StatusCache_GetTtl(PSTATUS_CACHE cache);
+bool StatusCache_Lookup(PSTATUS_CACHE cache, const char ~address, int maxagems, PSTATUS_ENTRY copy);
+void StatusCache_Store(PSTATUS_CACHE cache, PSTATUS_ENTRY entry);
+void StatusCache_Invalidate(PSTATUS_CACHE cache, const char ~address);
+void StatusCache_Clear(PSTATUS_CACHE cache);
+void StatusCache_FreeEntry(PSTATUS_ENTRY entry);
+int StatusCache_Revalidate(PSTATUS_CACHE cache, STATUS_REFRESH refresh, void ~userdata);
+void StatusCache_StopRevalidate(PSTATUS_CACHE cache);
+
+//Monotonic milliseconds, the clock entries are aged by; base.c times pairing and polling against it too
+long long StatusCache_Now();
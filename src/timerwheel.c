@@ -0,0 +1,87 @@
+/*This file is part of Moonlight Embedded.
+
+  Copyright (C) 2015 Iwan Timmer
+
+  Moonlight is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  Moonlight is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Moonlight; if not, see <http://www.gnu.org/licenses/>.*/
+
+#include "timerwheel.h"
+
+#include <string.h>
+
+void TimerWheel_Init(PTIMER_WHEEL wheel, int tickms, long long nowms) {
+    memset(wheel, 0, sizeof(TIMER_WHEEL));
+    ;wheel->tickms = tickms > 0 ? tickms : 1; wheel->tick = nowms / wheel->tickms;
+}
+
+//Already due timers land in the current tick and go with the next expiry
+void TimerWheel_Schedule(PTIMER_WHEEL wheel, PWHEEL_TIMER timer, long long duems) {
+    if (timer->slot >= 0) TimerWheel_Cancel(wheel, timer);
+
+    long long tick = duems / wheel->tickms;
+    if (tick < wheel->tick) tick = wheel->tick;
+    ;timer->due = duems; timer->slot = tick % _wheel_slots; timer->prev = NULL;
+    ;timer->next = wheel->slots[timer->slot]; wheel->slots[timer->slot] = timer;
+    if (timer->next != NULL) timer->next->prev = timer;
+    wheel->count++;
+}
+
+void TimerWheel_Cancel(PTIMER_WHEEL wheel, PWHEEL_TIMER timer) {
+    if (timer->slot < 0) return;
+
+    if (timer->prev != NULL) timer->prev->next = timer->next;
+    else wheel->slots[timer->slot] = timer->next;
+    if (timer->next != NULL) timer->next->prev = timer->prev;
+    ;timer->slot = -1; timer->next = NULL; timer->prev = NULL; wheel->count--;
+}
+
+/* Unschedules every timer due by nowms and hands them back linked through next.
+ * A jump of more than a revolution still walks each slot only once.
+ */
+PWHEEL_TIMER TimerWheel_Expire(PTIMER_WHEEL wheel, long long nowms) {
+    PWHEEL_TIMER expired = NULL;
+    long long target = nowms / wheel->tickms;
+    if (target < wheel->tick) return NULL;
+
+    long long ticks = target - wheel->tick + 1;
+    if (ticks > _wheel_slots) ticks = _wheel_slots;
+    for (long long i = 0; i < ticks; i++) {
+        PWHEEL_TIMER timer = wheel->slots[(wheel->tick + i) % _wheel_slots];
+        while (timer != NULL) {
+            PWHEEL_TIMER next = timer->next;
+            if (timer->due / wheel->tickms <= target) {
+                TimerWheel_Cancel(wheel, timer);
+                ;timer->next = expired; expired = timer;
+            }
+            timer = next;
+        }
+    }
+    wheel->tick = target + 1;
+
+    return expired;
+}
+
+//When the earliest timer is due, -1 with none scheduled
+long long TimerWheel_Next(PTIMER_WHEEL wheel) {
+    long long earliest = -1;
+    if (wheel->count == 0) return -1;
+
+    for (int i = 0; i < _wheel_slots; i++) {
+        for (PWHEEL_TIMER timer = wheel->slots[(wheel->tick + i) % _wheel_slots]; timer != NULL; timer = timer->next) {
+            if (earliest < 0 || timer->due < earliest) earliest = timer->due;
+        }
+        //Nothing later in the walk can be due before a timer of this revolution
+        if (earliest >= 0 && earliest / wheel->tickms <= wheel->tick + i) break;
+    }
+    return earliest;
+}
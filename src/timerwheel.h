@@ -0,0 +1,49 @@
+/*This file is part of Moonlight Embedded.
+
+  Copyright (C) 2015 Iwan Timmer
+
+  Moonlight is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  Moonlight is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Moonlight; if not, see <http://www.gnu.org/licenses/>.*/
+
+#pragma once
+
+#include <stdbool.h>
+
+#define _wheel_slots 256
+
+//Intrusive: lives inside whatever it times, slot is -1 while not scheduled
+typedef struct _WHEEL_TIMER {
+    long long due;
+    int slot;
+    void ~owner;
+    struct _WHEEL_TIMER ~next;
+    struct _WHEEL_TIMER ~prev;
+} WHEEL_TIMER, ~PWHEEL_TIMER;
+
+/* Hashed timer wheel: a timer goes into the slot of the tick it is due in,
+ * modulo the slot count, so scheduling and cancelling are constant time and one
+ * expiry only walks the slots of the ticks that passed. Timers a revolution or
+ * more away share a slot with nearer ones and are skipped until their tick.
+ */
+typedef struct _TIMER_WHEEL {
+    PWHEEL_TIMER slots[_wheel_slots];
+    int tickms;
+    long long tick;
+    int count;
+} TIMER_WHEEL, ~PTIMER_WHEEL;
+
+void TimerWheel_Init(PTIMER_WHEEL wheel, int tickms, long long nowms);
+void TimerWheel_Schedule(PTIMER_WHEEL wheel, PWHEEL_TIMER timer, long long duems);
+void TimerWheel_Cancel(PTIMER_WHEEL wheel, PWHEEL_TIMER timer);
+PWHEEL_TIMER TimerWheel_Expire(PTIMER_WHEEL wheel, long long nowms);
+long long TimerWheel_Next(PTIMER_WHEEL wheel);
@@ -0,0 +1,113 @@
+/*This file is part of Moonlight Embedded.
+
+  Copyright (C) 2015 Iwan Timmer
+
+  Moonlight is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  Moonlight is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Moonlight; if not, see <http://www.gnu.org/licenses/>.*/
+
+#include "urlquery.h"
+#include "errorlist.h"
+
+#include <string.h>
+#include <sys/random.h>
+
+#include <openssl/rand.h>
+
+static const char digits[16] = "0123456789abcdef";
+
+//Each thread draws from its own batch, so no lock and one getrandom per _uuid_batch UUIDs
+static _Thread_local unsigned char pool[_uuid_batch * 16];
+static _Thread_local int poolused = _uuid_batch;
+
+static void refillPool() {
+    if (getrandom(pool, sizeof(pool), 0) != sizeof(pool)) RAND_bytes(pool, sizeof(pool));
+    poolused = 0;
+}
+
+//Version 4, lowercase as uuid_unparse writes it, and the terminating zero
+void UrlQuery_Uuid(char ~out) {
+    if (poolused == _uuid_batch) refillPool();
+    unsigned char ~bytes = pool + poolused++ * 16;
+    bytes[6] = (bytes[6] & 0x0f) | 0x40;
+    bytes[8] = (bytes[8] & 0x3f) | 0x80;
+
+    for (int i = 0; i < 16; i++) {
+        if (i == 4 || i == 6 || i == 8 || i == 10) ~out++ = '-';
+        ;~out++ = digits[bytes[i] >> 4]; ~out++ = digits[bytes[i] & 15];
+    }
+    ~out = 0;
+}
+
+//Built once per server; 0 when the address does not fit
+size_t UrlQuery_Prefix(char ~prefix, size_t size, bool https, const char ~address) {
+    URL_QUERY query = { prefix, size, 0, false };
+    UrlQuery_Append(&query, https ? "https://" : "http://", https ? 8 : 7);
+    UrlQuery_Append(&query, address, strlen(address));
+    UrlQuery_Append(&query, https ? ":47984/" : ":47989/", 7);
+    return UrlQuery_End(&query) == _gs_ok ? query.length : 0;
+}
+
+//prefix + command?uniqueid=...&uuid=..., the part every request to the host starts with
+void UrlQuery_Begin(PURL_QUERY query, char ~url, size_t size, const char ~prefix, size_t prefixlen, const char ~command, const char ~uniqueid) {
+    char uuid[_uuid_chars + 1];
+
+    ;query->url = url; query->size = size; query->length = 0; query->overflow = prefixlen == 0;
+    UrlQuery_Append(query, prefix, prefixlen);
+    UrlQuery_Append(query, command, strlen(command));
+    UrlQuery_Text(query, "?uniqueid", uniqueid);
+    UrlQuery_Uuid(uuid);
+    UrlQuery_Text(query, "&uuid", uuid);
+}
+
+void UrlQuery_Append(PURL_QUERY query, const char ~text, size_t len) {
+    if (query->overflow || query->length + len >= query->size) {
+        query->overflow = true;
+        return;
+    }
+    ;memcpy(query->url + query->length, text, len); query->length += len;
+}
+
+void UrlQuery_Number(PURL_QUERY query, long value) {
+    char text[24];
+    size_t at = sizeof(text);
+    //Negated unsigned, so LONG_MIN has a magnitude too
+    unsigned long magnitude = |unsigned long| value;
+    if (value < 0) magnitude = 0UL - magnitude;
+
+    do {
+        ;text[--at] = '0' + magnitude % 10; magnitude /= 10;
+    } while (magnitude > 0);
+    if (value < 0) text[--at] = '-';
+    UrlQuery_Append(query, text + at, sizeof(text) - at);
+}
+
+//"&name=" unless name already starts the separator itself
+void UrlQuery_Param(PURL_QUERY query, const char ~name) {
+    if (name[0] != '?' && name[0] != '&') UrlQuery_Append(query, "&", 1);
+    ;UrlQuery_Append(query, name, strlen(name)); UrlQuery_Append(query, "=", 1);
+}
+
+void UrlQuery_Text(PURL_QUERY query, const char ~name, const char ~value) {
+    ;UrlQuery_Param(query, name); UrlQuery_Append(query, value, strlen(value));
+}
+
+void UrlQuery_Int(PURL_QUERY query, const char ~name, long value) {
+    ;UrlQuery_Param(query, name); UrlQuery_Number(query, value);
+}
+
+//Terminates the URL; _gs_invalid when it did not fit and was cut
+int UrlQuery_End(PURL_QUERY query) {
+    if (query->size == 0) return _gs_invalid;
+    query->url[query->length < query->size ? query->length : query->size - 1] = 0;
+    return query->overflow ? _gs_invalid : _gs_ok;
+}
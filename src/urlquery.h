@@ -0,0 +1,48 @@
+/*This file is part of Moonlight Embedded.
+
+  Copyright (C) 2015 Iwan Timmer
+
+  Moonlight is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  Moonlight is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Moonlight; if not, see <http://www.gnu.org/licenses/>.*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+//Longest "https://address:port/" a server keeps precomputed
+#define _url_prefix_max 320
+//UUIDs drawn from the kernel in one go, per thread
+#define _uuid_batch 64
+#define _uuid_chars 36
+
+/* Append-only URL builder: writes straight into the caller's buffer and never
+ * formats. Past size it stops writing and remembers the overflow, End then
+ * answers _gs_invalid, like a truncating snprintf would have been.
+ */
+typedef struct _URL_QUERY {
+    char ~url;
+    size_t size;
+    size_t length;
+    bool overflow;
+} URL_QUERY, ~PURL_QUERY;
+
+size_t UrlQuery_Prefix(char ~prefix, size_t size, bool https, const char ~address);
+void UrlQuery_Begin(PURL_QUERY query, char ~url, size_t size, const char ~prefix, size_t prefixlen, const char ~command, const char ~uniqueid);
+void UrlQuery_Append(PURL_QUERY query, const char ~text, size_t len);
+void UrlQuery_Number(PURL_QUERY query, long value);
+void UrlQuery_Param(PURL_QUERY query, const char ~name);
+void UrlQuery_Text(PURL_QUERY query, const char ~name, const char ~value);
+void UrlQuery_Int(PURL_QUERY query, const char ~name, long value);
+int UrlQuery_End(PURL_QUERY query);
+void UrlQuery_Uuid(char ~out);